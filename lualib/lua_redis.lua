@@ -1217,6 +1217,14 @@ local function add_redis_script(script, redis_params)
 
   -- Register on load function
   rspamd_config:add_on_load(function(cfg, ev_base, worker)
+    -- Only the first worker of each type uploads scripts: SCRIPT LOAD is
+    -- idempotent and the NOSCRIPT fallback in exec_redis_script reuploads
+    -- on demand, so there is no need for every process to thunder the
+    -- upstreams with the same uploads after each restart
+    if worker:get_index() ~= 0 then
+      return
+    end
+
     local mult = 0.0
     rspamd_config:add_periodic(ev_base, 0.0, function()
       if not new_script.sha then
@@ -1315,6 +1323,11 @@ local function exec_redis_script(id, params, callback, keys, args)
     -- Delayed until scripts are loaded
     if not params.task then
       table.insert(script.waitq, do_call)
+
+      if (script.in_flight or 0) == 0 and not script.sha then
+        -- Lazy upload for workers that skip preloading
+        load_script_taskless(script, rspamd_config, params.ev_base)
+      end
     else
       -- TODO: fix taskfull requests
       table.insert(script.waitq, function()
@@ -26,11 +26,6 @@ local fun = require "fun"
 local lupa = require "lupa"
 
 local split_grammar = {}
-local spaces_split_grammar
-local space = lpeg.S' \t\n\v\f\r'
-local nospace = 1 - space
-local ptrim = space^0 * lpeg.C((space^0 * nospace^1)^0)
-local match = lpeg.match
 
 lupa.configure('{%', '%}', '{=', '=}', '{#', '#}', {
   keep_trailing_newline = true,
@@ -43,31 +38,19 @@ lupa.filters.pbkdf = function(s)
 end
 
 local function rspamd_str_split(s, sep)
-  local gr
-  if not sep then
-    if not spaces_split_grammar then
-      local _sep = space
-      local elem = lpeg.C((1 - _sep)^0)
-      local p = lpeg.Ct(elem * (_sep * elem)^0)
-      spaces_split_grammar = p
-    end
+  -- Plain character set separators are handled by the C companion; the
+  -- lpeg grammar remains for callers passing lpeg objects as separators
+  if not sep or type(sep) == 'string' then
+    return rspamd_util.str_split(s, sep)
+  end
 
-    gr = spaces_split_grammar
-  else
-    gr = split_grammar[sep]
+  local gr = split_grammar[sep]
 
-    if not gr then
-      local _sep
-      if type(sep) == 'string' then
-        _sep = lpeg.S(sep) -- Assume set
-      else
-        _sep = sep -- Assume lpeg object
-      end
-      local elem = lpeg.C((1 - _sep)^0)
-      local p = lpeg.Ct(elem * (_sep * elem)^0)
-      gr = p
-      split_grammar[sep] = gr
-    end
+  if not gr then
+    local elem = lpeg.C((1 - sep)^0)
+    local p = lpeg.Ct(elem * (sep * elem)^0)
+    gr = p
+    split_grammar[sep] = gr
   end
 
   return gr:match(s)
@@ -85,7 +68,7 @@ exports.rspamd_str_split = rspamd_str_split
 exports.str_split = rspamd_str_split
 
 local function rspamd_str_trim(s)
-  return match(ptrim, s)
+  return rspamd_util.str_trim(s)
 end
 exports.rspamd_str_trim = rspamd_str_trim
 --[[[
@@ -104,11 +87,7 @@ exports.str_trim = rspamd_str_trim
 -- @return {number} rounded number
 --]]
 
--- Robert Jay Gould http://lua-users.org/wiki/SimpleRound
-exports.round = function(num, numDecimalPlaces)
-  local mult = 10^(numDecimalPlaces or 0)
-  return math.floor(num * mult) / mult
-end
+exports.round = rspamd_util.round
 
 --[[[
 -- @function lua_util.template(text, replacements)
@@ -298,16 +277,7 @@ end
 -- @param {table} table table of tables
 -- @return {table} flattened table
 --]]
-exports.flatten = function(t)
-  local res = {}
-  for _,e in fun.iter(t) do
-    for _,v in fun.iter(e) do
-      res[#res + 1] = v
-    end
-  end
-
-  return res
-end
+exports.flatten = rspamd_util.flatten
 
 --[[[
 -- @function lua_util.spairs(table)
@@ -402,23 +372,7 @@ exports.check_experimental = check_experimental
 -- local h = lua_util.list_to_hash({"a", "b"})
 -- -- h contains {a = true, b = true}
 --]]
-local function list_to_hash(list)
-  if type(list) == 'table' then
-    if list[1] then
-      local h = {}
-      for _, e in ipairs(list) do
-        h[e] = true
-      end
-      return h
-    else
-      return list
-    end
-  elseif type(list) == 'string' then
-    local h = {}
-    h[list] = true
-    return h
-  end
-end
+local list_to_hash = rspamd_util.list_to_hash
 
 exports.list_to_hash = list_to_hash
 
@@ -903,20 +857,7 @@ end
 -- }
 -- Performs deep copy of the table. Including metatables
 --]]
-local function deepcopy(orig)
-  local orig_type = type(orig)
-  local copy
-  if orig_type == 'table' then
-    copy = {}
-    for orig_key, orig_value in next, orig, nil do
-      copy[deepcopy(orig_key)] = deepcopy(orig_value)
-    end
-    setmetatable(copy, deepcopy(getmetatable(orig)))
-  else -- number, string, boolean, etc
-    copy = orig
-  end
-  return copy
-end
+local deepcopy = rspamd_util.deepcopy
 
 exports.deepcopy = deepcopy
 
@@ -924,19 +865,7 @@ exports.deepcopy = deepcopy
 -- @function lua_util.shallowcopy(tbl)
 -- Performs shallow (and fast) copy of a table or another Lua type
 --]]
-exports.shallowcopy = function(orig)
-  local orig_type = type(orig)
-  local copy
-  if orig_type == 'table' then
-    copy = {}
-    for orig_key, orig_value in pairs(orig) do
-      copy[orig_key] = orig_value
-    end
-  else
-    copy = orig
-  end
-  return copy
-end
+exports.shallowcopy = rspamd_util.shallowcopy
 
 -- Debugging support
 local unconditional_debug = false
@@ -1137,22 +1066,18 @@ end
 -- @return array of keys
 --]]]
 exports.keys = function(gen, param, state)
-  local keys = {}
-  local i = 1
-
   if param then
+    local keys = {}
+    local i = 1
     for k,_ in fun.iter(gen, param, state) do
       rawset(keys, i, k)
       i = i + 1
     end
-  else
-    for k,_ in pairs(gen) do
-      rawset(keys, i, k)
-      i = i + 1
-    end
+
+    return keys
   end
 
-  return keys
+  return rspamd_util.keys(gen)
 end
 
 ---[[[
@@ -1162,22 +1087,18 @@ end
 -- @return array of values
 --]]]
 exports.values = function(gen, param, state)
-  local values = {}
-  local i = 1
-
   if param then
+    local values = {}
+    local i = 1
     for _,v in fun.iter(gen, param, state) do
       rawset(values, i, v)
       i = i + 1
     end
-  else
-    for _,v in pairs(gen) do
-      rawset(values, i, v)
-      i = i + 1
-    end
+
+    return values
   end
 
-  return values
+  return rspamd_util.values(gen)
 end
 
 ---[[[
@@ -1266,33 +1187,6 @@ exports.table_digest = table_digest
 -- @param {string|number} v
 -- @return {boolean} v converted to boolean
 --]]]
-exports.toboolean = function(v)
-  local true_t = {
-    ['1'] = true,
-    ['true'] = true,
-    ['TRUE'] = true,
-    ['True'] = true,
-  };
-  local false_t = {
-    ['0'] = false,
-    ['false'] = false,
-    ['FALSE'] = false,
-    ['False'] = false,
-  };
-
-  if type(v) == 'string' then
-    if true_t[v] == true then
-      return true;
-    elseif false_t[v] == false then
-      return false;
-    else
-      return false, string.format( 'cannot convert %q to boolean', v);
-    end
-  elseif type(v) == 'number' then
-    return (not (v == 0))
-  else
-    return false, string.format( 'cannot convert %q to boolean', v);
-  end
-end
+exports.toboolean = rspamd_util.toboolean
 
 return exports
@@ -0,0 +1,145 @@
+--[[
+Copyright (c) 2019, Vsevolod Stakhov <vsevolod@highsecure.ru>
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+]]--
+
+local argparse = require "argparse"
+local rspamd_task = require "rspamd_task"
+local rspamd_util = require "rspamd_util"
+local rspamd_logger = require "rspamd_logger"
+
+local parser = argparse()
+    :name "rspamadm bench"
+    :description "Benchmark message processing over a corpus (in process, no network)"
+    :help_description_margin(30)
+
+parser:option "-c --config"
+      :description "Path to config file"
+      :argname("<cfg>")
+      :default(rspamd_paths["CONFDIR"] .. "/" .. "rspamd.conf")
+parser:argument "path"
+      :description "Files or directories with messages"
+      :argname "<path>"
+      :args "+"
+parser:option "-n --repeat"
+      :description "Process the corpus this many times"
+      :argname("<times>")
+      :convert(tonumber)
+      :default(1)
+
+local function load_config(opts)
+  local _r,err = rspamd_config:load_ucl(opts.config)
+
+  if not _r then
+    rspamd_logger.errx('cannot parse %s: %s', opts.config, err)
+    os.exit(1)
+  end
+
+  _r,err = rspamd_config:parse_rcl({'logging', 'worker'})
+  if not _r then
+    rspamd_logger.errx('cannot process %s: %s', opts.config, err)
+    os.exit(1)
+  end
+end
+
+local function collect_files(paths)
+  local files = {}
+
+  for _,p in ipairs(paths) do
+    -- Directories expand to their files, plain files are used as is
+    local dir_files = rspamd_util.glob(p .. '/*')
+
+    if dir_files and #dir_files > 0 then
+      for _,f in ipairs(dir_files) do
+        table.insert(files, f)
+      end
+    else
+      table.insert(files, p)
+    end
+  end
+
+  return files
+end
+
+local function percentile(sorted, p)
+  local idx = math.max(1, math.floor(#sorted * p + 0.5))
+  return sorted[math.min(idx, #sorted)]
+end
+
+local function handler(args)
+  local opts = parser:parse(args)
+  load_config(opts)
+
+  local files = collect_files(opts.path)
+
+  if #files == 0 then
+    parser:error('no files to process')
+  end
+
+  local timings = {}
+  local total_bytes = 0
+  local failed = 0
+  local t_start = rspamd_util.get_ticks()
+
+  for _ = 1,opts['repeat'] do
+    for _,fname in ipairs(files) do
+      local t1 = rspamd_util.get_ticks()
+      local res,task = rspamd_task.load_from_file(fname, rspamd_config)
+
+      if res then
+        if task:process_message() then
+          total_bytes = total_bytes + task:get_size()
+        else
+          failed = failed + 1
+        end
+
+        local t2 = rspamd_util.get_ticks()
+        table.insert(timings, (t2 - t1) * 1000.0)
+        task:destroy()
+      else
+        failed = failed + 1
+      end
+    end
+  end
+
+  local elapsed = rspamd_util.get_ticks() - t_start
+
+  if #timings == 0 then
+    parser:error('no messages processed')
+  end
+
+  table.sort(timings)
+
+  local sum = 0
+  for _,t in ipairs(timings) do sum = sum + t end
+
+  rspamd_logger.messagex('processed %s messages (%s failed) in %.2f seconds',
+      #timings, failed, elapsed)
+  rspamd_logger.messagex('throughput: %.1f msg/sec, %.2f MB/sec',
+      #timings / elapsed, total_bytes / elapsed / (1024 * 1024))
+  rspamd_logger.messagex('parse latency (ms): mean %.3f, p50 %.3f, p90 %.3f, ' ..
+      'p99 %.3f, max %.3f',
+      sum / #timings,
+      percentile(timings, 0.5),
+      percentile(timings, 0.9),
+      percentile(timings, 0.99),
+      timings[#timings])
+end
+
+return {
+  name = 'bench',
+  aliases = {'benchmark'},
+  handler = handler,
+  description = parser._description
+}
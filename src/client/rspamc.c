@@ -70,6 +70,7 @@ static GPatternSpec **exclude_compiled = NULL;
 static struct rspamd_http_context *http_ctx;
 
 static gint retcode = EXIT_SUCCESS;
+static gint pending_requests = 0;
 
 #define ADD_CLIENT_HEADER(o, n, v) do { \
     struct rspamd_http_client_header *nh; \
@@ -1535,6 +1536,7 @@ rspamc_client_cb (struct rspamd_client_connection *conn,
 	struct rspamc_command *cmd;
 	FILE *out = stdout;
 	gdouble finish = rspamd_get_ticks (FALSE), diff;
+	pending_requests --;
 
 	cmd = cbdata->cmd;
 
@@ -1718,11 +1720,14 @@ rspamc_process_input (struct ev_loop *ev_base, struct rspamc_command *cmd,
 		}
 
 		if (cmd->need_input) {
-			rspamd_client_command (conn, cmd->path, attrs, in, rspamc_client_cb,
-				cbdata, compressed, dictionary, cbdata->filename, &err);
+			if (rspamd_client_command (conn, cmd->path, attrs, in,
+					rspamc_client_cb,
+					cbdata, compressed, dictionary, cbdata->filename, &err)) {
+				pending_requests ++;
+			}
 		}
 		else {
-			rspamd_client_command (conn,
+			if (rspamd_client_command (conn,
 					cmd->path,
 					attrs,
 					NULL,
@@ -1731,7 +1736,9 @@ rspamc_process_input (struct ev_loop *ev_base, struct rspamc_command *cmd,
 					compressed,
 					dictionary,
 					cbdata->filename,
-					&err);
+					&err)) {
+				pending_requests ++;
+			}
 		}
 	}
 	else {
@@ -1782,7 +1789,7 @@ rspamc_process_dir (struct ev_loop *ev_base, struct rspamc_command *cmd,
 	DIR *d;
 	GPatternSpec **ex;
 	struct dirent *pentry;
-	gint cur_req = 0, r;
+	gint r;
 	gchar fpath[PATH_MAX];
 	FILE *in;
 	struct stat st;
@@ -1863,13 +1870,15 @@ rspamc_process_dir (struct ev_loop *ev_base, struct rspamc_command *cmd,
 				}
 
 				rspamc_process_input (ev_base, cmd, in, fpath, attrs);
-				cur_req++;
 				fclose (in);
 
-				if (cur_req >= max_requests) {
-					cur_req = 0;
-					/* Wait for completion */
-					ev_loop (ev_base, 0);
+				while (pending_requests >= max_requests) {
+					/*
+					 * Keep the requests window full: draining whole
+					 * batches serializes throughput on the slowest
+					 * reply of each batch
+					 */
+					ev_loop (ev_base, EVRUN_ONCE);
 				}
 			}
 		}
@@ -1897,7 +1906,7 @@ rspamc_kwattr_free (gpointer p)
 gint
 main (gint argc, gchar **argv, gchar **env)
 {
-	gint i, start_argc, cur_req = 0, res, ret, npatterns;
+	gint i, start_argc, res, ret, npatterns;
 	GQueue *kwattrs;
 	GList *cur;
 	GPid cld;
@@ -2032,7 +2041,6 @@ main (gint argc, gchar **argv, gchar **env)
 				if (S_ISDIR (st.st_mode)) {
 					/* Directories are processed with a separate limit */
 					rspamc_process_dir (event_loop, cmd, argv[i], kwattrs);
-					cur_req = 0;
 				}
 				else {
 					in = fopen (argv[i], "r");
@@ -2041,13 +2049,12 @@ main (gint argc, gchar **argv, gchar **env)
 						exit (EXIT_FAILURE);
 					}
 					rspamc_process_input (event_loop, cmd, in, argv[i], kwattrs);
-					cur_req++;
 					fclose (in);
 				}
-				if (cur_req >= max_requests) {
-					cur_req = 0;
-					/* Wait for completion */
-					ev_loop (event_loop, 0);
+
+				while (pending_requests >= max_requests) {
+					/* Keep the requests window full */
+					ev_loop (event_loop, EVRUN_ONCE);
 				}
 			}
 		}
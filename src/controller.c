@@ -17,6 +17,7 @@
 #include "libserver/dynamic_cfg.h"
 #include "libserver/cfg_file_private.h"
 #include "libutil/rrd.h"
+#include "libutil/sqlite_utils.h"
 #include "libutil/map.h"
 #include "libutil/map_helpers.h"
 #include "libutil/map_private.h"
@@ -65,6 +66,10 @@
 #define PATH_NEIGHBOURS "/neighbours"
 #define PATH_PLUGINS "/plugins"
 #define PATH_PING "/ping"
+#define PATH_ALLOC_STATS "/allocstats"
+#define PATH_RESCAN_START "/rescanstart"
+#define PATH_RESCAN_STATUS "/rescanstatus"
+#define PATH_PROM_METRICS "/metrics"
 
 #define msg_err_session(...) rspamd_default_log_function(G_LOG_LEVEL_CRITICAL, \
         session->pool->tag.tagname, session->pool->tag.uid, \
@@ -106,6 +111,8 @@ INIT_LOG_MODULE(controller)
 #define COLOR_TOTAL "#9440ED"
 
 const static ev_tstamp rrd_update_time = 1.0;
+/* Flush the batched rrd datapoints this often (in update ticks) */
+const static guint rrd_flush_ticks = 30;
 const static guint64 rspamd_controller_ctx_magic = 0xf72697805e6941faULL;
 
 extern void fuzzy_stat_command (struct rspamd_task *task);
@@ -179,6 +186,8 @@ struct rspamd_controller_worker_ctx {
 
 	ev_timer rrd_event;
 	struct rspamd_rrd_file *rrd;
+	guint rrd_ticks_pending;
+	struct rspamd_rescan_job *rescan_job;
 	ev_timer save_stats_event;
 	struct rspamd_lang_detector *lang_det;
 	gdouble task_timeout;
@@ -721,12 +730,12 @@ rspamd_controller_handle_auth (struct rspamd_http_connection_entry *conn_ent,
 
 	obj = ucl_object_typed_new (UCL_OBJECT);
 	st = session->ctx->srv->stat;
-	data[0] = st->actions_stat[METRIC_ACTION_NOACTION];
-	data[1] = st->actions_stat[METRIC_ACTION_ADD_HEADER] +
-		st->actions_stat[METRIC_ACTION_REWRITE_SUBJECT];
-	data[2] = st->actions_stat[METRIC_ACTION_GREYLIST];
-	data[3] = st->actions_stat[METRIC_ACTION_REJECT];
-	data[4] = st->actions_stat[METRIC_ACTION_SOFT_REJECT];
+	data[0] = rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_NOACTION]);
+	data[1] = rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_ADD_HEADER]) +
+		rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
+	data[2] = rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_GREYLIST]);
+	data[3] = rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_REJECT]);
+	data[4] = rspamd_striped_counter_read (&st->actions_stat[METRIC_ACTION_SOFT_REJECT]);
 
 	/* Get uptime */
 	uptime = ev_time () - session->ctx->start_time;
@@ -748,7 +757,8 @@ rspamd_controller_handle_auth (struct rspamd_http_connection_entry *conn_ent,
 	ucl_object_insert_key (obj,	   ucl_object_fromint (
 			data[4]),			   "soft_reject",   0, false);
 	ucl_object_insert_key (obj,	   ucl_object_fromint (
-			st->messages_scanned), "scanned",  0, false);
+			rspamd_striped_counter_read (&st->messages_scanned)),
+			"scanned",  0, false);
 	ucl_object_insert_key (obj,	   ucl_object_fromint (
 			st->messages_learned), "learned",  0, false);
 	ucl_object_insert_key (obj, ucl_object_frombool (!session->is_enable),
@@ -1132,15 +1142,21 @@ rspamd_controller_handle_pie_chart (
 	}
 
 	top = ucl_object_typed_new (UCL_ARRAY);
-	total = ctx->srv->stat->messages_scanned;
+	total = rspamd_striped_counter_read (&ctx->srv->stat->messages_scanned);
 	if (total != 0) {
 
-		data[0] = ctx->srv->stat->actions_stat[METRIC_ACTION_NOACTION];
-		data[1] = ctx->srv->stat->actions_stat[METRIC_ACTION_SOFT_REJECT];
-		data[2] = (ctx->srv->stat->actions_stat[METRIC_ACTION_ADD_HEADER] +
-			ctx->srv->stat->actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
-		data[3] = ctx->srv->stat->actions_stat[METRIC_ACTION_GREYLIST];
-		data[4] = ctx->srv->stat->actions_stat[METRIC_ACTION_REJECT];
+		data[0] = rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_NOACTION]);
+		data[1] = rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_SOFT_REJECT]);
+		data[2] = rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_ADD_HEADER]) +
+				rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
+		data[3] = rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_GREYLIST]);
+		data[4] = rspamd_striped_counter_read (
+				&ctx->srv->stat->actions_stat[METRIC_ACTION_REJECT]);
 	}
 	else {
 		memset (data, 0, sizeof (data));
@@ -1284,6 +1300,10 @@ rspamd_controller_handle_graph (
 		return 0;
 	}
 
+	/* Make the batched datapoints visible to the query */
+	rspamd_rrd_flush_deferred (ctx->rrd, NULL);
+	ctx->rrd_ticks_pending = 0;
+
 	rrd_result = rspamd_rrd_query (ctx->rrd, rra_num);
 
 	if (rrd_result == NULL) {
@@ -1384,8 +1404,11 @@ rspamd_controller_handle_legacy_history (
 			row_num = 0;
 		}
 		row = &copied_rows[row_num];
-		/* Get only completed rows */
-		if (row->completed) {
+		/* Get only rows that were stable when the snapshot was taken:
+		 * the sequence must be even, nonzero and unchanged since then */
+		if (ROLL_HISTORY_ROW_IS_COMPLETED (row) &&
+			g_atomic_int_get (&ctx->srv->history->rows[row_num].seq) ==
+					row->seq) {
 			rspamd_localtime (row->timestamp, &tm);
 			strftime (timebuf, sizeof (timebuf) - 1, "%Y-%m-%d %H:%M:%S", &tm);
 			obj = ucl_object_typed_new (UCL_OBJECT);
@@ -1648,6 +1671,587 @@ rspamd_controller_handle_errors (struct rspamd_http_connection_entry *conn_ent,
 	return 0;
 }
 
+/*
+ * Quarantine rescan engine: /rescanstart lists the messages of a
+ * directory, scans them through the ordinary task pipeline at bounded
+ * concurrency and checkpoints every result into a sqlite journal, so an
+ * interrupted rescan resumes where it stopped; /rescanstatus reports the
+ * aggregate progress and score statistics of the current job
+ */
+
+enum rspamd_rescan_stmt_idx {
+	RESCAN_STMT_CHECK = 0,
+	RESCAN_STMT_INSERT,
+	RESCAN_STMT_MAX,
+};
+
+static struct rspamd_sqlite3_prstmt rescan_journal_stmts[] = {
+	[RESCAN_STMT_CHECK] = {
+		.idx = RESCAN_STMT_CHECK,
+		.sql = "SELECT action FROM rescan WHERE path = ?1;",
+		.args = "T",
+		.stmt = NULL,
+		.result = SQLITE_ROW,
+		.ret = "",
+		.flags = 0,
+	},
+	[RESCAN_STMT_INSERT] = {
+		.idx = RESCAN_STMT_INSERT,
+		.sql = "INSERT OR REPLACE INTO rescan (path, score, action) "
+				"VALUES (?1, ?2, ?3);",
+		.args = "TTT",
+		.stmt = NULL,
+		.result = SQLITE_DONE,
+		.ret = "",
+		.flags = 0,
+	},
+};
+
+static const gchar rescan_journal_create_sql[] =
+		"CREATE TABLE IF NOT EXISTS rescan ("
+		"path TEXT PRIMARY KEY, score TEXT, action TEXT);";
+
+struct rspamd_rescan_job {
+	struct rspamd_controller_worker_ctx *ctx;
+	GPtrArray *files;
+	guint next;
+	guint inflight;
+	guint concurrency;
+	guint processed;
+	guint skipped;
+	guint errors;
+	gdouble score_sum;
+	guint actions[METRIC_ACTION_MAX];
+	gdouble started;
+	gboolean finished;
+	gboolean pumping;
+	sqlite3 *journal;
+	GArray *journal_stmts;
+	rspamd_mempool_t *pool;
+};
+
+struct rspamd_rescan_task_cbdata {
+	struct rspamd_rescan_job *job;
+	gchar *path;
+	gchar *data;
+};
+
+static void rspamd_controller_rescan_pump (struct rspamd_rescan_job *job);
+
+static void
+rspamd_controller_rescan_job_free (struct rspamd_rescan_job *job)
+{
+	guint i;
+
+	if (job->journal) {
+		if (job->journal_stmts) {
+			rspamd_sqlite3_close_prstmt (job->journal, job->journal_stmts);
+		}
+
+		sqlite3_close (job->journal);
+	}
+
+	if (job->files) {
+		for (i = 0; i < job->files->len; i ++) {
+			g_free (g_ptr_array_index (job->files, i));
+		}
+
+		g_ptr_array_free (job->files, TRUE);
+	}
+
+	rspamd_mempool_delete (job->pool);
+	g_free (job);
+}
+
+static gboolean
+rspamd_controller_rescan_fin_task (void *ud)
+{
+	struct rspamd_task *task = ud;
+	struct rspamd_rescan_task_cbdata *cbd = task->fin_arg;
+	struct rspamd_rescan_job *job = cbd->job;
+
+	if (task->err == NULL && !RSPAMD_TASK_IS_PROCESSED (task)) {
+		if (rspamd_task_process (task, RSPAMD_TASK_PROCESS_ALL) &&
+				!RSPAMD_TASK_IS_PROCESSED (task)) {
+			/* One more iteration */
+			return FALSE;
+		}
+	}
+
+	job->inflight --;
+	job->processed ++;
+
+	if (task->err != NULL || task->result == NULL) {
+		job->errors ++;
+		msg_info_task ("rescan of %s failed: %e", cbd->path, task->err);
+	}
+	else {
+		struct rspamd_action *action = rspamd_check_action_metric (task);
+		gchar scorebuf[32];
+
+		job->score_sum += task->result->score;
+
+		if (action->action_type < METRIC_ACTION_MAX) {
+			job->actions[action->action_type] ++;
+		}
+
+		rspamd_snprintf (scorebuf, sizeof (scorebuf), "%.2f",
+				task->result->score);
+		rspamd_sqlite3_run_prstmt (job->pool, job->journal,
+				job->journal_stmts, RESCAN_STMT_INSERT,
+				cbd->path, scorebuf, action->name);
+	}
+
+	g_free (cbd->path);
+	g_free (cbd->data);
+	g_free (cbd);
+
+	/*
+	 * The rescan engine owns its tasks: destroy the session here, which
+	 * frees the task (and its pool) through the session finalizer, just
+	 * like the http scan path does when its connection closes. The task
+	 * must not be touched past this point
+	 */
+	rspamd_session_destroy (task->s);
+
+	rspamd_controller_rescan_pump (job);
+
+	return TRUE;
+}
+
+static void
+rspamd_controller_rescan_start_one (struct rspamd_rescan_job *job,
+		const gchar *path)
+{
+	struct rspamd_controller_worker_ctx *ctx = job->ctx;
+	struct rspamd_rescan_task_cbdata *cbd;
+	struct rspamd_task *task;
+	gchar *data;
+	gsize len;
+	GError *err = NULL;
+
+	if (!g_file_get_contents (path, &data, &len, &err)) {
+		msg_info ("cannot read %s for rescan: %e", path, err);
+		g_error_free (err);
+		job->processed ++;
+		job->errors ++;
+
+		return;
+	}
+
+	cbd = g_malloc0 (sizeof (*cbd));
+	cbd->job = job;
+	cbd->path = g_strdup (path);
+	cbd->data = data;
+
+	task = rspamd_task_new (ctx->worker, ctx->cfg, NULL, ctx->lang_det,
+			ctx->event_loop);
+	task->resolver = ctx->resolver;
+	task->s = rspamd_session_create (task->task_pool,
+			rspamd_controller_rescan_fin_task,
+			NULL,
+			(event_finalizer_t)rspamd_task_free,
+			task);
+	task->fin_arg = cbd;
+	task->flags |= RSPAMD_TASK_FLAG_MIME;
+
+	job->inflight ++;
+
+	if (!rspamd_task_load_message (task, NULL, data, len)) {
+		/* Fin callback accounts for the failure */
+		rspamd_session_pending (task->s);
+
+		return;
+	}
+
+	rspamd_task_process (task, RSPAMD_TASK_PROCESS_ALL);
+	rspamd_session_pending (task->s);
+}
+
+static void
+rspamd_controller_rescan_pump (struct rspamd_rescan_job *job)
+{
+	const gchar *path;
+
+	if (job->pumping) {
+		/* Synchronously completed tasks re-enter from their fin callback;
+		 * the outer loop picks the next message up itself */
+		return;
+	}
+
+	job->pumping = TRUE;
+
+	while (!job->finished && job->inflight < job->concurrency &&
+			job->next < job->files->len) {
+		path = g_ptr_array_index (job->files, job->next);
+		job->next ++;
+
+		/* Resume: skip messages checkpointed by a previous run */
+		if (rspamd_sqlite3_run_prstmt (job->pool, job->journal,
+				job->journal_stmts, RESCAN_STMT_CHECK, path) == SQLITE_OK) {
+			job->skipped ++;
+			continue;
+		}
+
+		rspamd_controller_rescan_start_one (job, path);
+	}
+
+	job->pumping = FALSE;
+
+	if (!job->finished && job->inflight == 0 &&
+			job->next >= job->files->len) {
+		job->finished = TRUE;
+		msg_info ("rescan finished: %ud messages processed, %ud skipped, "
+				"%ud errors, average score %.2f in %.1f seconds",
+				job->processed, job->skipped, job->errors,
+				job->processed > job->errors ?
+						job->score_sum / (job->processed - job->errors) : 0.0,
+				ev_time () - job->started);
+	}
+}
+
+/*
+ * Rescan start command handler:
+ * request: /rescanstart
+ * headers: Password
+ * input: json {"directory": "/path", "concurrency": 8, "journal": "/path.db"}
+ * reply: json {"success":true,"total":N} or error
+ */
+static int
+rspamd_controller_handle_rescan_start (
+	struct rspamd_http_connection_entry *conn_ent,
+	struct rspamd_http_message *msg)
+{
+	struct rspamd_controller_session *session = conn_ent->ud;
+	struct rspamd_controller_worker_ctx *ctx = session->ctx;
+	struct rspamd_rescan_job *job;
+	struct ucl_parser *parser;
+	ucl_object_t *obj;
+	const ucl_object_t *elt;
+	const gchar *dir, *journal_path = NULL, *fname;
+	gchar journal_buf[PATH_MAX];
+	GError *err = NULL;
+	GDir *d;
+
+	if (!rspamd_controller_check_password (conn_ent, session, msg, TRUE)) {
+		return 0;
+	}
+
+	if (ctx->rescan_job != NULL && !ctx->rescan_job->finished) {
+		rspamd_controller_send_error (conn_ent, 409,
+				"rescan is already running");
+		return 0;
+	}
+
+	if (rspamd_http_message_get_body (msg, NULL) == NULL) {
+		rspamd_controller_send_error (conn_ent, 400,
+				"Empty body is not permitted");
+		return 0;
+	}
+
+	parser = ucl_parser_new (UCL_PARSER_DEFAULT);
+
+	if (!ucl_parser_add_chunk (parser, msg->body_buf.begin,
+			msg->body_buf.len)) {
+		rspamd_controller_send_error (conn_ent, 400, "cannot parse request: %s",
+				ucl_parser_get_error (parser));
+		ucl_parser_free (parser);
+		return 0;
+	}
+
+	obj = ucl_parser_get_object (parser);
+	ucl_parser_free (parser);
+
+	elt = ucl_object_lookup (obj, "directory");
+	dir = elt ? ucl_object_tostring (elt) : NULL;
+
+	if (dir == NULL) {
+		rspamd_controller_send_error (conn_ent, 400, "no directory specified");
+		ucl_object_unref (obj);
+		return 0;
+	}
+
+	d = g_dir_open (dir, 0, &err);
+
+	if (d == NULL) {
+		rspamd_controller_send_error (conn_ent, 400, "cannot open %s: %s",
+				dir, err->message);
+		g_error_free (err);
+		ucl_object_unref (obj);
+		return 0;
+	}
+
+	if (ctx->rescan_job != NULL) {
+		rspamd_controller_rescan_job_free (ctx->rescan_job);
+		ctx->rescan_job = NULL;
+	}
+
+	job = g_malloc0 (sizeof (*job));
+	job->ctx = ctx;
+	job->pool = rspamd_mempool_new (rspamd_mempool_suggest_size (),
+			"rescan");
+	job->concurrency = 8;
+	job->started = ev_time ();
+	job->files = g_ptr_array_new ();
+
+	elt = ucl_object_lookup (obj, "concurrency");
+
+	if (elt != NULL) {
+		job->concurrency = CLAMP (ucl_object_toint (elt), 1, 128);
+	}
+
+	elt = ucl_object_lookup (obj, "journal");
+
+	if (elt != NULL) {
+		journal_path = ucl_object_tostring (elt);
+	}
+
+	if (journal_path == NULL) {
+		rspamd_snprintf (journal_buf, sizeof (journal_buf),
+				"%s%c%s", dir, G_DIR_SEPARATOR, "rescan-journal.sqlite");
+		journal_path = journal_buf;
+	}
+
+	job->journal = rspamd_sqlite3_open_or_create (job->pool, journal_path,
+			rescan_journal_create_sql, 0, &err);
+
+	if (job->journal == NULL) {
+		rspamd_controller_send_error (conn_ent, 500,
+				"cannot open journal: %s", err ? err->message : "unknown");
+
+		if (err) {
+			g_error_free (err);
+		}
+
+		g_dir_close (d);
+		ucl_object_unref (obj);
+		rspamd_controller_rescan_job_free (job);
+		return 0;
+	}
+
+	job->journal_stmts = rspamd_sqlite3_init_prstmt (job->journal,
+			rescan_journal_stmts, RESCAN_STMT_MAX, &err);
+
+	if (job->journal_stmts == NULL) {
+		rspamd_controller_send_error (conn_ent, 500,
+				"cannot init journal: %s", err ? err->message : "unknown");
+
+		if (err) {
+			g_error_free (err);
+		}
+
+		g_dir_close (d);
+		ucl_object_unref (obj);
+		rspamd_controller_rescan_job_free (job);
+		return 0;
+	}
+
+	while ((fname = g_dir_read_name (d)) != NULL) {
+		gchar *full = g_build_filename (dir, fname, NULL);
+
+		if (g_file_test (full, G_FILE_TEST_IS_REGULAR) &&
+				!g_str_has_suffix (fname, ".sqlite")) {
+			g_ptr_array_add (job->files, full);
+		}
+		else {
+			g_free (full);
+		}
+	}
+
+	g_dir_close (d);
+	ucl_object_unref (obj);
+
+	ctx->rescan_job = job;
+	msg_info ("started rescan of %s: %ud messages, concurrency %ud",
+			dir, job->files->len, job->concurrency);
+	rspamd_controller_rescan_pump (job);
+
+	rspamd_controller_send_string (conn_ent, "{\"success\":true}");
+
+	return 0;
+}
+
+/*
+ * Rescan status command handler:
+ * request: /rescanstatus
+ * headers: Password
+ * reply: json with progress and aggregate score statistics
+ */
+static int
+rspamd_controller_handle_rescan_status (
+	struct rspamd_http_connection_entry *conn_ent,
+	struct rspamd_http_message *msg)
+{
+	struct rspamd_controller_session *session = conn_ent->ud;
+	struct rspamd_controller_worker_ctx *ctx = session->ctx;
+	struct rspamd_rescan_job *job = ctx->rescan_job;
+	ucl_object_t *top, *acts;
+	guint i;
+
+	if (!rspamd_controller_check_password (conn_ent, session, msg, FALSE)) {
+		return 0;
+	}
+
+	if (job == NULL) {
+		rspamd_controller_send_error (conn_ent, 404, "no rescan started");
+		return 0;
+	}
+
+	top = ucl_object_typed_new (UCL_OBJECT);
+	ucl_object_insert_key (top, ucl_object_frombool (!job->finished),
+			"running", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromint (job->files->len),
+			"total", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromint (job->processed),
+			"processed", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromint (job->skipped),
+			"skipped", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromint (job->errors),
+			"errors", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromint (job->inflight),
+			"inflight", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromdouble (
+			job->processed > job->errors ?
+					job->score_sum / (job->processed - job->errors) : 0.0),
+			"avg_score", 0, false);
+	ucl_object_insert_key (top, ucl_object_fromdouble (
+			ev_time () - job->started), "elapsed", 0, false);
+
+	acts = ucl_object_typed_new (UCL_OBJECT);
+
+	for (i = METRIC_ACTION_REJECT; i < METRIC_ACTION_MAX; i ++) {
+		if (job->actions[i] > 0) {
+			ucl_object_insert_key (acts, ucl_object_fromint (job->actions[i]),
+					rspamd_action_to_str (i), 0, false);
+		}
+	}
+
+	ucl_object_insert_key (top, acts, "actions", 0, false);
+	rspamd_controller_send_ucl (conn_ent, top);
+	ucl_object_unref (top);
+
+	return 0;
+}
+
+/*
+ * Prometheus metrics command handler:
+ * request: /metrics
+ * headers: Password
+ * reply: text exposition of the stage latency histograms and scan counters
+ */
+static int
+rspamd_controller_handle_prom_metrics (
+	struct rspamd_http_connection_entry *conn_ent,
+	struct rspamd_http_message *msg)
+{
+	struct rspamd_controller_session *session = conn_ent->ud;
+	struct rspamd_stat *st;
+	struct rspamd_http_message *rep;
+	rspamd_fstring_t *out;
+	guint64 cumulative;
+	guint i, b;
+
+	if (!rspamd_controller_check_password (conn_ent, session, msg, FALSE)) {
+		return 0;
+	}
+
+	st = session->ctx->srv->stat;
+	out = rspamd_fstring_sized_new (8192);
+
+	rspamd_printf_fstring (&out,
+			"# HELP rspamd_scanned_total messages scanned\n"
+			"# TYPE rspamd_scanned_total counter\n"
+			"rspamd_scanned_total %uL\n",
+			rspamd_striped_counter_read (&st->messages_scanned));
+
+	rspamd_printf_fstring (&out,
+			"# HELP rspamd_scan_stage_seconds scan wall time per stage\n"
+			"# TYPE rspamd_scan_stage_seconds histogram\n");
+
+	for (i = 0; i < RSPAMD_STAGE_HIST_STAGES; i ++) {
+		const struct rspamd_stage_histogram *hist = &st->stage_hist[i];
+
+		cumulative = 0;
+
+		for (b = 0; b < RSPAMD_STAGE_HIST_BUCKETS; b ++) {
+			cumulative += hist->buckets[b];
+
+			if (b < RSPAMD_STAGE_HIST_BUCKETS - 1) {
+				rspamd_printf_fstring (&out,
+						"rspamd_scan_stage_seconds_bucket{stage=\"%s\","
+						"le=\"%.3f\"} %uL\n",
+						rspamd_stage_wm_names[i],
+						rspamd_stage_hist_bounds[b],
+						cumulative);
+			}
+			else {
+				rspamd_printf_fstring (&out,
+						"rspamd_scan_stage_seconds_bucket{stage=\"%s\","
+						"le=\"+Inf\"} %uL\n",
+						rspamd_stage_wm_names[i],
+						cumulative);
+			}
+		}
+
+		rspamd_printf_fstring (&out,
+				"rspamd_scan_stage_seconds_sum{stage=\"%s\"} %.6f\n"
+				"rspamd_scan_stage_seconds_count{stage=\"%s\"} %uL\n",
+				rspamd_stage_wm_names[i],
+				(gdouble)hist->sum_usec / 1e6,
+				rspamd_stage_wm_names[i],
+				hist->count);
+	}
+
+	rep = rspamd_http_new_message (HTTP_RESPONSE);
+	rep->date = time (NULL);
+	rep->code = 200;
+	rep->status = rspamd_fstring_new_init ("OK", 2);
+	rspamd_http_message_set_body_from_fstring_steal (rep, out);
+	rspamd_http_connection_reset (conn_ent->conn);
+	rspamd_http_router_insert_headers (conn_ent->rt, rep);
+	rspamd_http_connection_write_message (conn_ent->conn,
+			rep,
+			NULL,
+			"text/plain; version=0.0.4",
+			conn_ent,
+			conn_ent->rt->timeout);
+	conn_ent->is_reply = TRUE;
+
+	return 0;
+}
+
+/*
+ * Allocator stats command handler:
+ * request: /allocstats
+ * headers: Password
+ * reply: json with per subsystem jemalloc arena counters
+ */
+static int
+rspamd_controller_handle_alloc_stats (struct rspamd_http_connection_entry *conn_ent,
+	struct rspamd_http_message *msg)
+{
+	struct rspamd_controller_session *session = conn_ent->ud;
+	ucl_object_t *top;
+
+	if (!rspamd_controller_check_password (conn_ent, session, msg, TRUE)) {
+		return 0;
+	}
+
+	top = (ucl_object_t *)rspamd_mempool_get_arena_stats ();
+
+	if (top == NULL) {
+		rspamd_controller_send_error (conn_ent, 404,
+				"no jemalloc integration compiled in");
+
+		return 0;
+	}
+
+	rspamd_controller_send_ucl (conn_ent, top);
+	ucl_object_unref (top);
+
+	return 0;
+}
+
 /*
  * Neighbours command handler:
  * request: /neighbours
@@ -2619,29 +3223,29 @@ rspamd_controller_handle_stat_common (
 	ucl_object_insert_key (top, ucl_object_frombool (!session->is_enable),
 			"read_only", 0, false);
 	ucl_object_insert_key (top, ucl_object_fromint (
-			stat->messages_scanned), "scanned", 0, false);
+			rspamd_striped_counter_read (&stat->messages_scanned)),
+			"scanned", 0, false);
 	ucl_object_insert_key (top, ucl_object_fromint (
 			stat->messages_learned), "learned", 0, false);
 
-	if (stat->messages_scanned > 0) {
+	if (rspamd_striped_counter_read (&stat->messages_scanned) > 0) {
+		guint64 cnt;
+
 		sub = ucl_object_typed_new (UCL_OBJECT);
 		for (i = METRIC_ACTION_REJECT; i <= METRIC_ACTION_NOACTION; i++) {
+			cnt = rspamd_striped_counter_read (&stat->actions_stat[i]);
 			ucl_object_insert_key (sub,
-				ucl_object_fromint (stat->actions_stat[i]),
+				ucl_object_fromint (cnt),
 				rspamd_action_to_str (i), 0, false);
 			if (i < METRIC_ACTION_GREYLIST) {
-				spam += stat->actions_stat[i];
+				spam += cnt;
 			}
 			else {
-				ham += stat->actions_stat[i];
+				ham += cnt;
 			}
 			if (do_reset) {
-#ifndef HAVE_ATOMIC_BUILTINS
-				session->ctx->worker->srv->stat->actions_stat[i] = 0;
-#else
-				__atomic_store_n(&session->ctx->worker->srv->stat->actions_stat[i],
-						0, __ATOMIC_RELEASE);
-#endif
+				rspamd_striped_counter_reset (
+						&session->ctx->worker->srv->stat->actions_stat[i]);
 			}
 		}
 		ucl_object_insert_key (top, sub, "actions", 0, false);
@@ -2657,6 +3261,20 @@ rspamd_controller_handle_stat_common (
 		ucl_object_fromint (stat->control_connections_count),
 		"control_connections", 0, false);
 
+	ucl_object_insert_key (top,
+		ucl_object_fromint (stat->dns_cache_hits), "dns_cache_hits", 0, false);
+	ucl_object_insert_key (top,
+		ucl_object_fromint (stat->dns_cache_misses), "dns_cache_misses", 0,
+		false);
+	ucl_object_insert_key (top,
+		ucl_object_fromint (stat->spf_cache_hits), "spf_cache_hits", 0, false);
+	ucl_object_insert_key (top,
+		ucl_object_fromint (stat->spf_cache_misses), "spf_cache_misses", 0,
+		false);
+	ucl_object_insert_key (top,
+		ucl_object_fromint (stat->dns_requests_coalesced),
+		"dns_requests_coalesced", 0, false);
+
 	ucl_object_insert_key (top,
 		ucl_object_fromint (mem_st.pools_allocated), "pools_allocated", 0,
 		false);
@@ -2678,9 +3296,15 @@ rspamd_controller_handle_stat_common (
 			mem_st.oversized_chunks), "chunks_oversized", 0, false);
 	ucl_object_insert_key (top,
 			ucl_object_fromint (mem_st.fragmented_size), "fragmented", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.chunks_cached), "chunks_cached", 0,
+			false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.chunks_reused), "chunks_reused", 0,
+			false);
 
 	if (do_reset) {
-		session->ctx->srv->stat->messages_scanned = 0;
+		rspamd_striped_counter_reset (&session->ctx->srv->stat->messages_scanned);
 		session->ctx->srv->stat->messages_learned = 0;
 		session->ctx->srv->stat->connections_count = 0;
 		session->ctx->srv->stat->control_connections_count = 0;
@@ -3061,7 +3685,14 @@ rspamd_controller_finish_handler (struct rspamd_http_connection_entry *conn_ent)
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 
+	/* The counter page is shared between all workers */
+#ifndef HAVE_ATOMIC_BUILTINS
 	session->ctx->worker->srv->stat->control_connections_count++;
+#else
+	__atomic_add_fetch (
+			&session->ctx->worker->srv->stat->control_connections_count, 1,
+			__ATOMIC_RELAXED);
+#endif
 
 	if (session->task != NULL) {
 		rspamd_session_destroy (session->task->s);
@@ -3131,16 +3762,31 @@ rspamd_controller_rrd_update (EV_P_ ev_timer *w, int revents)
 	stat = ctx->srv->stat;
 
 	for (i = METRIC_ACTION_REJECT; i < METRIC_ACTION_MAX; i ++) {
-		points[i] = stat->actions_stat[i];
+		points[i] = rspamd_striped_counter_read (&stat->actions_stat[i]);
 	}
 
 	ar.data = (gchar *)points;
 	ar.len = sizeof (points);
 
-	if (!rspamd_rrd_add_record (ctx->rrd, &ar, rspamd_get_calendar_ticks (),
-			&err)) {
-		msg_err_ctx ("cannot update rrd file: %e", err);
+	/*
+	 * Batch the datapoint in memory: the mmapped file is touched and
+	 * synced once per flush window instead of every tick, so stat ticks
+	 * do no file i/o on the event loop
+	 */
+	if (!rspamd_rrd_add_record_deferred (ctx->rrd, &ar,
+			rspamd_get_calendar_ticks (), &err)) {
+		msg_err_ctx ("cannot defer rrd update: %e", err);
 		g_error_free (err);
+		err = NULL;
+	}
+
+	if (++ ctx->rrd_ticks_pending >= rrd_flush_ticks) {
+		if (!rspamd_rrd_flush_deferred (ctx->rrd, &err)) {
+			msg_err_ctx ("cannot update rrd file: %e", err);
+			g_error_free (err);
+		}
+
+		ctx->rrd_ticks_pending = 0;
 	}
 
 	/* Plan new event */
@@ -3183,7 +3829,8 @@ rspamd_controller_load_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 	elt = ucl_object_lookup (obj, "scanned");
 
 	if (elt != NULL && ucl_object_type (elt) == UCL_INT) {
-		stat_copy.messages_scanned = ucl_object_toint (elt);
+		rspamd_striped_counter_set (&stat_copy.messages_scanned,
+				ucl_object_toint (elt));
 	}
 
 	elt = ucl_object_lookup (obj, "learned");
@@ -3199,7 +3846,8 @@ rspamd_controller_load_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 			subelt = ucl_object_lookup (elt, rspamd_action_to_str (i));
 
 			if (subelt && ucl_object_type (subelt) == UCL_INT) {
-				stat_copy.actions_stat[i] = ucl_object_toint (subelt);
+				rspamd_striped_counter_set (&stat_copy.actions_stat[i],
+						ucl_object_toint (subelt));
 			}
 		}
 	}
@@ -3250,15 +3898,17 @@ rspamd_controller_store_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 
 	top = ucl_object_typed_new (UCL_OBJECT);
 	ucl_object_insert_key (top, ucl_object_fromint (
-			stat->messages_scanned), "scanned", 0, false);
+			rspamd_striped_counter_read (&stat->messages_scanned)),
+			"scanned", 0, false);
 	ucl_object_insert_key (top, ucl_object_fromint (
 			stat->messages_learned), "learned", 0, false);
 
-	if (stat->messages_scanned > 0) {
+	if (rspamd_striped_counter_read (&stat->messages_scanned) > 0) {
 		sub = ucl_object_typed_new (UCL_OBJECT);
 		for (i = METRIC_ACTION_REJECT; i <= METRIC_ACTION_NOACTION; i++) {
 			ucl_object_insert_key (sub,
-					ucl_object_fromint (stat->actions_stat[i]),
+					ucl_object_fromint (
+							rspamd_striped_counter_read (&stat->actions_stat[i])),
 					rspamd_action_to_str (i), 0, false);
 		}
 		ucl_object_insert_key (top, sub, "actions", 0, false);
@@ -3852,6 +4502,18 @@ start_controller_worker (struct rspamd_worker *worker)
 	rspamd_http_router_add_path (ctx->http,
 			PATH_PING,
 			rspamd_controller_handle_ping);
+	rspamd_http_router_add_path (ctx->http,
+			PATH_ALLOC_STATS,
+			rspamd_controller_handle_alloc_stats);
+	rspamd_http_router_add_path (ctx->http,
+			PATH_RESCAN_START,
+			rspamd_controller_handle_rescan_start);
+	rspamd_http_router_add_path (ctx->http,
+			PATH_RESCAN_STATUS,
+			rspamd_controller_handle_rescan_status);
+	rspamd_http_router_add_path (ctx->http,
+			PATH_PROM_METRICS,
+			rspamd_controller_handle_prom_metrics);
 	rspamd_controller_register_plugins_paths (ctx);
 
 #if 0
@@ -3891,6 +4553,7 @@ start_controller_worker (struct rspamd_worker *worker)
 	ctx->resolver = rspamd_dns_resolver_init (worker->srv->logger,
 			ctx->event_loop,
 			worker->srv->cfg);
+	rspamd_dns_resolver_attach_stat (ctx->resolver, worker->srv->stat);
 
 	rspamd_upstreams_library_config (worker->srv->cfg, worker->srv->cfg->ups_ctx,
 			ctx->event_loop, ctx->resolver->r);
@@ -35,6 +35,7 @@
 #include "libcryptobox/keypair.h"
 #include "libserver/rspamd_control.h"
 #include "libutil/hash.h"
+#include "khash.h"
 #include "libutil/map_private.h"
 #include "contrib/uthash/utlist.h"
 #include "unix-std.h"
@@ -91,6 +92,9 @@ worker_t fuzzy_worker = {
 		RSPAMD_WORKER_VER           /* Version info */
 };
 
+/* Digest hash -> index in updates_pending for the current sync window */
+KHASH_MAP_INIT_INT64 (fuzzy_update_dedup, guint32);
+
 struct fuzzy_global_stat {
 	guint64 fuzzy_hashes;
 	/**< number of fuzzy hashes stored					*/
@@ -164,6 +168,8 @@ struct rspamd_fuzzy_storage_ctx {
 	rspamd_lru_hash_t *ratelimit_buckets;
 	struct rspamd_fuzzy_backend *backend;
 	GArray *updates_pending;
+	khash_t (fuzzy_update_dedup) *updates_dedup;
+	guint64 updates_combined;
 	guint updates_failed;
 	guint updates_maxfail;
 	/* Used to send data between workers */
@@ -491,6 +497,61 @@ rspamd_fuzzy_updates_cb (gboolean success,
 	g_free (cbdata);
 }
 
+/*
+ * Appends an update to the pending queue; identical ADD commands (same
+ * digest, flag and shingle-ness) within one sync window are combined into
+ * a single write with a summed value, so a campaign hammering one digest
+ * costs one backend write per window instead of one per learn
+ */
+static void
+rspamd_fuzzy_updates_append (struct rspamd_fuzzy_storage_ctx *ctx,
+		struct fuzzy_peer_cmd *up_cmd)
+{
+	if (up_cmd->cmd.normal.cmd == FUZZY_WRITE && ctx->updates_dedup != NULL) {
+		struct fuzzy_peer_cmd *pending;
+		guint64 h;
+		khiter_t k;
+		gint r;
+
+		h = rspamd_cryptobox_fast_hash (up_cmd->cmd.normal.digest,
+				sizeof (up_cmd->cmd.normal.digest),
+				((guint64)up_cmd->cmd.normal.flag << 1) | !!up_cmd->is_shingle);
+		k = kh_get (fuzzy_update_dedup, ctx->updates_dedup, h);
+
+		if (k != kh_end (ctx->updates_dedup)) {
+			guint32 idx = kh_value (ctx->updates_dedup, k);
+
+			if (idx < ctx->updates_pending->len) {
+				pending = &g_array_index (ctx->updates_pending,
+						struct fuzzy_peer_cmd, idx);
+
+				/* Verify the full identity to be collision proof */
+				if (pending->cmd.normal.cmd == FUZZY_WRITE &&
+						pending->is_shingle == up_cmd->is_shingle &&
+						pending->cmd.normal.flag == up_cmd->cmd.normal.flag &&
+						memcmp (pending->cmd.normal.digest,
+								up_cmd->cmd.normal.digest,
+								sizeof (pending->cmd.normal.digest)) == 0 &&
+						(!up_cmd->is_shingle ||
+								memcmp (&pending->cmd.shingle.sgl,
+										&up_cmd->cmd.shingle.sgl,
+										sizeof (pending->cmd.shingle.sgl)) == 0)) {
+					pending->cmd.normal.value += up_cmd->cmd.normal.value;
+					ctx->updates_combined ++;
+
+					return;
+				}
+			}
+		}
+		else {
+			k = kh_put (fuzzy_update_dedup, ctx->updates_dedup, h, &r);
+			kh_value (ctx->updates_dedup, k) = ctx->updates_pending->len;
+		}
+	}
+
+	g_array_append_val (ctx->updates_pending, *up_cmd);
+}
+
 static void
 rspamd_fuzzy_process_updates_queue (struct rspamd_fuzzy_storage_ctx *ctx,
 		const gchar *source, gboolean forced)
@@ -505,6 +566,11 @@ rspamd_fuzzy_process_updates_queue (struct rspamd_fuzzy_storage_ctx *ctx,
 		ctx->updates_pending = g_array_sized_new (FALSE, FALSE,
 				sizeof (struct fuzzy_peer_cmd),
 				MAX (cbdata->updates_pending->len, 1024));
+
+		if (ctx->updates_dedup != NULL) {
+			/* Indices refer to the swapped out array */
+			kh_clear (fuzzy_update_dedup, ctx->updates_dedup);
+		}
 		cbdata->source = g_strdup (source);
 		rspamd_fuzzy_backend_process_updates (ctx->backend,
 				cbdata->updates_pending,
@@ -762,7 +828,7 @@ rspamd_fuzzy_check_callback (struct rspamd_fuzzy_reply *result, void *ud)
 						sizeof (up_cmd.cmd.shingle.sgl));
 			}
 
-			g_array_append_val (session->ctx->updates_pending, up_cmd);
+			rspamd_fuzzy_updates_append (session->ctx, &up_cmd);
 		}
 		else {
 			/* We need to send request to the peer */
@@ -911,7 +977,7 @@ rspamd_fuzzy_process_command (struct fuzzy_session *session)
 						(gpointer)&up_cmd.cmd.shingle :
 						(gpointer)&up_cmd.cmd.normal;
 				memcpy (ptr, cmd, up_len);
-				g_array_append_val (session->ctx->updates_pending, up_cmd);
+				rspamd_fuzzy_updates_append (session->ctx, &up_cmd);
 			}
 			else {
 				/* We need to send request to the peer */
@@ -1158,13 +1224,101 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 	struct fuzzy_session *session;
 	rspamd_inet_addr_t *addr;
 	gssize r;
-	guint8 buf[512];
 	guint64 *nerrors;
+#ifdef HAVE_RECVMMSG
+#define FUZZY_RECV_BATCH 64
+	static struct mmsghdr msgvec[FUZZY_RECV_BATCH];
+	static guint8 bufs[FUZZY_RECV_BATCH][512];
+	static struct sockaddr_storage peers[FUZZY_RECV_BATCH];
+	static struct iovec iovs[FUZZY_RECV_BATCH];
+	gint nmsg, i;
+#else
+	guint8 buf[512];
+#endif
 
 	/* Got some data */
 	if (revents == EV_READ) {
 
 		for (;;) {
+#ifdef HAVE_RECVMMSG
+			/*
+			 * Batch mode: pull up to FUZZY_RECV_BATCH datagrams with one
+			 * syscall and process the commands in a tight loop; commands
+			 * are timestamped per batch which is enough for ratelimits
+			 */
+			for (i = 0; i < FUZZY_RECV_BATCH; i ++) {
+				iovs[i].iov_base = bufs[i];
+				iovs[i].iov_len = sizeof (bufs[i]);
+				memset (&msgvec[i].msg_hdr, 0, sizeof (msgvec[i].msg_hdr));
+				msgvec[i].msg_hdr.msg_iov = &iovs[i];
+				msgvec[i].msg_hdr.msg_iovlen = 1;
+				msgvec[i].msg_hdr.msg_name = &peers[i];
+				msgvec[i].msg_hdr.msg_namelen = sizeof (peers[i]);
+			}
+
+			nmsg = recvmmsg (w->fd, msgvec, FUZZY_RECV_BATCH, 0, NULL);
+
+			if (nmsg == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return;
+				}
+
+				msg_err ("got error while reading from socket: %d, %s",
+						errno,
+						strerror (errno));
+				return;
+			}
+
+			for (i = 0; i < nmsg; i ++) {
+				worker->nconns++;
+				r = msgvec[i].msg_len;
+				addr = rspamd_inet_address_from_sa (
+						(struct sockaddr *)&peers[i],
+						msgvec[i].msg_hdr.msg_namelen);
+
+				session = g_malloc0 (sizeof (*session));
+				REF_INIT_RETAIN (session, fuzzy_session_destroy);
+				session->worker = worker;
+				session->fd = w->fd;
+				session->ctx = worker->ctx;
+				session->time = (guint64) time (NULL);
+				session->addr = addr;
+
+				if (rspamd_fuzzy_cmd_from_wire (bufs[i], r, session)) {
+					/* Check shingles count sanity */
+					rspamd_fuzzy_process_command (session);
+				}
+				else {
+					/* Discard input */
+					session->ctx->stat.invalid_requests ++;
+					msg_debug ("invalid fuzzy command of size %z received", r);
+
+					nerrors = rspamd_lru_hash_lookup (session->ctx->errors_ips,
+							addr, -1);
+
+					if (nerrors == NULL) {
+						nerrors = g_malloc (sizeof (*nerrors));
+						*nerrors = 1;
+						rspamd_lru_hash_insert (session->ctx->errors_ips,
+								rspamd_inet_address_copy (addr),
+								nerrors, -1, -1);
+					}
+					else {
+						*nerrors = *nerrors + 1;
+					}
+				}
+
+				REF_RELEASE (session);
+			}
+
+			if (nmsg < FUZZY_RECV_BATCH) {
+				/* The socket is drained */
+				return;
+			}
+#else
 			worker->nconns++;
 
 			r = rspamd_inet_address_recvfrom (w->fd,
@@ -1221,6 +1375,7 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 			}
 
 			REF_RELEASE (session);
+#endif
 		}
 	}
 }
@@ -1388,6 +1543,11 @@ rspamd_fuzzy_stat_to_ucl (struct rspamd_fuzzy_storage_ctx *ctx, gboolean ip_stat
 			"fuzzy_expired",
 			0,
 			false);
+	ucl_object_insert_key (obj,
+			ucl_object_fromint (ctx->updates_combined),
+			"updates_combined",
+			0,
+			false);
 	ucl_object_insert_key (obj,
 			ucl_object_fromint (ctx->stat.invalid_requests),
 			"invalid_requests",
@@ -1822,7 +1982,7 @@ rspamd_fuzzy_peer_io (EV_P_ ev_io *w, int revents)
 			break;
 		}
 		else {
-			g_array_append_val (ctx->updates_pending, cmd);
+			rspamd_fuzzy_updates_append (ctx, &cmd);
 		}
 	}
 }
@@ -1932,6 +2092,7 @@ start_fuzzy (struct rspamd_worker *worker)
 	if (worker->index == 0) {
 		ctx->updates_pending = g_array_sized_new (FALSE, FALSE,
 				sizeof (struct fuzzy_peer_cmd), 1024);
+		ctx->updates_dedup = kh_init (fuzzy_update_dedup);
 		rspamd_fuzzy_backend_start_update (ctx->backend, ctx->sync_timeout,
 				rspamd_fuzzy_storage_periodic_callback, ctx);
 	}
@@ -2028,6 +2189,10 @@ start_fuzzy (struct rspamd_worker *worker)
 
 	if (worker->index == 0) {
 		g_array_free (ctx->updates_pending, TRUE);
+
+		if (ctx->updates_dedup != NULL) {
+			kh_destroy (fuzzy_update_dedup, ctx->updates_dedup);
+		}
 	}
 
 	if (ctx->keypair_cache) {
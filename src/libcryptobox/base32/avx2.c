@@ -0,0 +1,179 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "base32.h"
+
+gssize base32_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+gssize hex_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#ifndef __SSE2__
+#define __SSE2__
+#endif
+#ifndef __SSE__
+#define __SSE__
+#endif
+#ifndef __SSE4_2__
+#define __SSE4_2__
+#endif
+#ifndef __SSE4_1__
+#define __SSE4_1__
+#endif
+#ifndef __SSEE3__
+#define __SSEE3__
+#endif
+#ifndef __AVX__
+#define __AVX__
+#endif
+#ifndef __AVX2__
+#define __AVX2__
+#endif
+#include <immintrin.h>
+
+/*
+ * Same bit extraction scheme as the sse42 kernel (see the comment there),
+ * doubled up: the two 128 bit lanes process two 5 byte groups each, so one
+ * iteration consumes 20 input bytes and emits 32 symbols
+ */
+
+#define B32_SHUF_GROUP(base) \
+	(base) + 0, (base) + 1, (base) + 0, (base) + 1, \
+	(base) + 1, (base) + 2, (base) + 1, (base) + 2, \
+	(base) + 2, (base) + 3, (base) + 3, (base) + 4, \
+	(base) + 3, (base) + 4, (base) + 4, (base) + 5
+
+#define B32_MULHI_CONST 8192, 256, 2048, 64, 512, 4096, 128, 1024
+
+static inline __m256i
+b32_enc_translate_avx2 (__m256i idx) __attribute__((__target__("avx2")));
+
+static inline __m256i
+b32_enc_translate_avx2 (__m256i idx)
+{
+	const __m256i tbl_lo = _mm256_setr_epi8 (
+			'y', 'b', 'n', 'd', 'r', 'f', 'g', '8',
+			'e', 'j', 'k', 'm', 'c', 'p', 'q', 'x',
+			'y', 'b', 'n', 'd', 'r', 'f', 'g', '8',
+			'e', 'j', 'k', 'm', 'c', 'p', 'q', 'x');
+	const __m256i tbl_hi = _mm256_setr_epi8 (
+			'o', 't', '1', 'u', 'w', 'i', 's', 'z',
+			'a', '3', '4', '5', 'h', '7', '6', '9',
+			'o', 't', '1', 'u', 'w', 'i', 's', 'z',
+			'a', '3', '4', '5', 'h', '7', '6', '9');
+	__m256i hi_mask = _mm256_cmpgt_epi8 (idx, _mm256_set1_epi8 (15));
+
+	return _mm256_blendv_epi8 (_mm256_shuffle_epi8 (tbl_lo, idx),
+			_mm256_shuffle_epi8 (tbl_hi, idx),
+			hi_mask);
+}
+
+gssize
+base32_encode_avx2 (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gchar *o = out;
+	gssize r;
+
+	if (outlen < (inlen * 8 + 4) / 5) {
+		return -1;
+	}
+
+	while (inlen >= 32) {
+		const __m256i shuf = _mm256_setr_epi8 (B32_SHUF_GROUP (0),
+				B32_SHUF_GROUP (0));
+		const __m256i mult = _mm256_setr_epi16 (B32_MULHI_CONST,
+				B32_MULHI_CONST);
+		const __m256i lo5 = _mm256_set1_epi16 (0x1F);
+		/* Lanes hold 5 byte groups (a, b) and (c, d) respectively */
+		__m256i vab = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+				_mm_loadu_si128 ((__m128i *)in)),
+				_mm_loadu_si128 ((__m128i *)(in + 5)), 1);
+		__m256i vcd = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+				_mm_loadu_si128 ((__m128i *)(in + 10))),
+				_mm_loadu_si128 ((__m128i *)(in + 15)), 1);
+		__m256i idx;
+
+		vab = _mm256_shuffle_epi8 (vab, shuf);
+		vab = _mm256_mullo_epi16 (vab, _mm256_set1_epi16 (8));
+		vab = _mm256_and_si256 (_mm256_mulhi_epu16 (vab, mult), lo5);
+
+		vcd = _mm256_shuffle_epi8 (vcd, shuf);
+		vcd = _mm256_mullo_epi16 (vcd, _mm256_set1_epi16 (8));
+		vcd = _mm256_and_si256 (_mm256_mulhi_epu16 (vcd, mult), lo5);
+
+		/* In lane pack gives (a, c | b, d), permute restores the order */
+		idx = _mm256_packus_epi16 (vab, vcd);
+		idx = _mm256_permute4x64_epi64 (idx, 0xD8);
+
+		_mm256_storeu_si256 ((__m256i *)o, b32_enc_translate_avx2 (idx));
+
+		in += 20;
+		inlen -= 20;
+		o += 32;
+	}
+
+	r = base32_encode_ref (in, inlen, o, outlen - (o - out));
+	g_assert (r >= 0);
+
+	return (o - out) + r;
+}
+
+gssize
+hex_encode_avx2 (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	const __m256i hexmap = _mm256_setr_epi8 (
+			'0', '1', '2', '3', '4', '5', '6', '7',
+			'8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+			'0', '1', '2', '3', '4', '5', '6', '7',
+			'8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m256i lo4 = _mm256_set1_epi8 (0x0F);
+	gchar *o = out;
+	gssize r;
+
+	if (outlen < inlen * 2) {
+		return -1;
+	}
+
+	while (inlen >= 32) {
+		/* Reorder quads first so the in lane unpacks emit sequential output */
+		__m256i str = _mm256_permute4x64_epi64 (
+				_mm256_loadu_si256 ((__m256i *)in), 0xD8);
+		__m256i hn = _mm256_shuffle_epi8 (hexmap,
+				_mm256_and_si256 (_mm256_srli_epi16 (str, 4), lo4));
+		__m256i ln = _mm256_shuffle_epi8 (hexmap,
+				_mm256_and_si256 (str, lo4));
+
+		_mm256_storeu_si256 ((__m256i *)o, _mm256_unpacklo_epi8 (hn, ln));
+		_mm256_storeu_si256 ((__m256i *)(o + 32), _mm256_unpackhi_epi8 (hn, ln));
+
+		in += 32;
+		inlen -= 32;
+		o += 64;
+	}
+
+	r = hex_encode_ref (in, inlen, o, outlen - (o - out));
+	g_assert (r >= 0);
+
+	return (o - out) + r;
+}
+
+#pragma GCC pop_options
+#endif
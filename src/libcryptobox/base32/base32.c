@@ -0,0 +1,106 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "base32.h"
+#include "platform_config.h"
+
+extern unsigned long cpu_config;
+
+typedef struct base32_impl {
+	unsigned long cpu_flags;
+	const char *desc;
+
+	gssize (*encode) (const guchar *in, gsize inlen,
+			gchar *out, gsize outlen);
+	gssize (*encode_hex) (const guchar *in, gsize inlen,
+			gchar *out, gsize outlen);
+} base32_impl_t;
+
+#define BASE32_DECLARE(ext) \
+    gssize base32_encode_##ext(const guchar *in, gsize inlen, gchar *out, gsize outlen); \
+    gssize hex_encode_##ext(const guchar *in, gsize inlen, gchar *out, gsize outlen);
+#define BASE32_IMPL(cpuflags, desc, ext) \
+    {(cpuflags), desc, base32_encode_##ext, hex_encode_##ext}
+
+BASE32_DECLARE(ref);
+#define BASE32_REF BASE32_IMPL(0, "ref", ref)
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_SSE42)
+gssize base32_encode_sse42 (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("sse4.2")));
+gssize hex_encode_sse42 (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("sse4.2")));
+
+BASE32_DECLARE(sse42);
+#  define BASE32_SSE42 BASE32_IMPL(CPUID_SSE42, "sse42", sse42)
+# endif
+#endif
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_AVX2)
+gssize base32_encode_avx2 (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("avx2")));
+gssize hex_encode_avx2 (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("avx2")));
+
+BASE32_DECLARE(avx2);
+#  define BASE32_AVX2 BASE32_IMPL(CPUID_AVX2, "avx2", avx2)
+# endif
+#endif
+
+static const base32_impl_t base32_list[] = {
+		BASE32_REF,
+#ifdef BASE32_AVX2
+		BASE32_AVX2,
+#endif
+#ifdef BASE32_SSE42
+		BASE32_SSE42,
+#endif
+};
+
+static const base32_impl_t *base32_opt = &base32_list[0];
+
+const char *
+base32_load (void)
+{
+	guint i;
+
+	if (cpu_config != 0) {
+		for (i = 0; i < G_N_ELEMENTS (base32_list); i++) {
+			if (base32_list[i].cpu_flags & cpu_config) {
+				base32_opt = &base32_list[i];
+				break;
+			}
+		}
+	}
+
+	return base32_opt->desc;
+}
+
+gssize
+base32_encode (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	return base32_opt->encode (in, inlen, out, outlen);
+}
+
+gssize
+hex_encode (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	return base32_opt->encode_hex (in, inlen, out, outlen);
+}
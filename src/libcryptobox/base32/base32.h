@@ -0,0 +1,44 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SRC_LIBCRYPTOBOX_BASE32_BASE32_H_
+#define SRC_LIBCRYPTOBOX_BASE32_BASE32_H_
+
+#include "config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+const char *base32_load (void);
+
+/**
+ * Encode a buffer in the zbase32 alphabet (lsb first bit order, as used by
+ * fuzzy digests) with the runtime selected implementation
+ * @return number of symbols written or -1 if `outlen` is not enough
+ */
+gssize base32_encode (const guchar *in, gsize inlen, gchar *out, gsize outlen);
+
+/**
+ * Encode a buffer as lowercase hex using the runtime selected implementation
+ * @return number of symbols written or -1 if `outlen` is not enough
+ */
+gssize hex_encode (const guchar *in, gsize inlen, gchar *out, gsize outlen);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* SRC_LIBCRYPTOBOX_BASE32_BASE32_H_ */
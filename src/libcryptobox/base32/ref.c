@@ -0,0 +1,88 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "base32.h"
+
+static const char b32_enc[] = "ybndrfg8ejkmcpqxot1uwisza345h769";
+static const char hex_enc[] = "0123456789abcdef";
+
+gssize
+base32_encode_ref (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gchar *o = out;
+	guint64 x;
+	gsize i;
+
+	if (outlen < (inlen * 8 + 4) / 5) {
+		return -1;
+	}
+
+	/*
+	 * The encoding is plain lsb first extraction of 5 bit groups from a
+	 * little endian bit stream, so a full 40 bit block is just 8 shifted
+	 * lookups without the data dependent state machine of the old encoder
+	 */
+	while (inlen >= 5) {
+		x = (guint64)in[0] | ((guint64)in[1] << 8) |
+				((guint64)in[2] << 16) | ((guint64)in[3] << 24) |
+				((guint64)in[4] << 32);
+		o[0] = b32_enc[x & 0x1F];
+		o[1] = b32_enc[(x >> 5) & 0x1F];
+		o[2] = b32_enc[(x >> 10) & 0x1F];
+		o[3] = b32_enc[(x >> 15) & 0x1F];
+		o[4] = b32_enc[(x >> 20) & 0x1F];
+		o[5] = b32_enc[(x >> 25) & 0x1F];
+		o[6] = b32_enc[(x >> 30) & 0x1F];
+		o[7] = b32_enc[(x >> 35) & 0x1F];
+		in += 5;
+		inlen -= 5;
+		o += 8;
+	}
+
+	/* Tail of 1 - 4 bytes: 8 * inlen bits make ceil(8 * inlen / 5) symbols */
+	if (inlen > 0) {
+		x = 0;
+
+		for (i = 0; i < inlen; i++) {
+			x |= (guint64)in[i] << (8 * i);
+		}
+
+		for (i = 0; i < inlen * 8; i += 5) {
+			*o++ = b32_enc[(x >> i) & 0x1F];
+		}
+	}
+
+	return o - out;
+}
+
+gssize
+hex_encode_ref (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gsize i;
+
+	if (outlen < inlen * 2) {
+		return -1;
+	}
+
+	for (i = 0; i < inlen; i++) {
+		out[i * 2] = hex_enc[(in[i] >> 4) & 0xF];
+		out[i * 2 + 1] = hex_enc[in[i] & 0xF];
+	}
+
+	return inlen * 2;
+}
@@ -0,0 +1,162 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "base32.h"
+
+gssize base32_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+gssize hex_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#ifndef __SSE2__
+#define __SSE2__
+#endif
+#ifndef __SSE__
+#define __SSE__
+#endif
+#ifndef __SSE4_2__
+#define __SSE4_2__
+#endif
+#ifndef __SSE4_1__
+#define __SSE4_1__
+#endif
+#ifndef __SSEE3__
+#define __SSEE3__
+#endif
+#include <xmmintrin.h>
+#include <nmmintrin.h>
+
+/*
+ * Every output symbol k of a 40 bit block covers bits [5k, 5k + 5) of the
+ * little endian bit stream, hence it lives entirely in the two input bytes
+ * starting at floor(5k / 8). The kernel shuffles those byte pairs into the
+ * eight 16 bit lanes of a vector, shifts every lane right by (5k mod 8) via
+ * the mullo/mulhi trick (a left shift by 3 first makes all the effective
+ * shifts strictly positive) and maps the resulting 5 bit indices through
+ * the zbase32 alphabet with a pair of nibble shuffles
+ */
+
+/* Byte pairs (floor(5k / 8), floor(5k / 8) + 1) for k = 0 .. 7 */
+#define B32_SHUF_GROUP(base) \
+	(base) + 0, (base) + 1, (base) + 0, (base) + 1, \
+	(base) + 1, (base) + 2, (base) + 1, (base) + 2, \
+	(base) + 2, (base) + 3, (base) + 3, (base) + 4, \
+	(base) + 3, (base) + 4, (base) + 4, (base) + 5
+
+/* 1 << (13 - (5k mod 8)) for k = 0 .. 7 */
+#define B32_MULHI_CONST 8192, 256, 2048, 64, 512, 4096, 128, 1024
+
+static inline __m128i
+b32_enc_translate (__m128i idx) __attribute__((__target__("sse4.2")));
+
+static inline __m128i
+b32_enc_translate (__m128i idx)
+{
+	const __m128i tbl_lo = _mm_setr_epi8 ('y', 'b', 'n', 'd', 'r', 'f', 'g',
+			'8', 'e', 'j', 'k', 'm', 'c', 'p', 'q', 'x');
+	const __m128i tbl_hi = _mm_setr_epi8 ('o', 't', '1', 'u', 'w', 'i', 's',
+			'z', 'a', '3', '4', '5', 'h', '7', '6', '9');
+	__m128i hi_mask = _mm_cmpgt_epi8 (idx, _mm_set1_epi8 (15));
+
+	return _mm_blendv_epi8 (_mm_shuffle_epi8 (tbl_lo, idx),
+			_mm_shuffle_epi8 (tbl_hi, idx),
+			hi_mask);
+}
+
+gssize
+base32_encode_sse42 (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gchar *o = out;
+	gssize r;
+
+	if (outlen < (inlen * 8 + 4) / 5) {
+		return -1;
+	}
+
+	/*
+	 * Each iteration consumes 10 input bytes and emits 16 symbols; a whole
+	 * 16 byte vector is loaded, so keep 16 bytes of readable input
+	 */
+	while (inlen >= 16) {
+		const __m128i shuf_a = _mm_setr_epi8 (B32_SHUF_GROUP (0));
+		const __m128i shuf_b = _mm_setr_epi8 (B32_SHUF_GROUP (5));
+		const __m128i mult = _mm_setr_epi16 (B32_MULHI_CONST);
+		const __m128i lo5 = _mm_set1_epi16 (0x1F);
+		__m128i str = _mm_loadu_si128 ((__m128i *)in);
+		__m128i va, vb, idx;
+
+		va = _mm_shuffle_epi8 (str, shuf_a);
+		va = _mm_mullo_epi16 (va, _mm_set1_epi16 (8));
+		va = _mm_and_si128 (_mm_mulhi_epu16 (va, mult), lo5);
+
+		vb = _mm_shuffle_epi8 (str, shuf_b);
+		vb = _mm_mullo_epi16 (vb, _mm_set1_epi16 (8));
+		vb = _mm_and_si128 (_mm_mulhi_epu16 (vb, mult), lo5);
+
+		idx = _mm_packus_epi16 (va, vb);
+		_mm_storeu_si128 ((__m128i *)o, b32_enc_translate (idx));
+
+		in += 10;
+		inlen -= 10;
+		o += 16;
+	}
+
+	r = base32_encode_ref (in, inlen, o, outlen - (o - out));
+	g_assert (r >= 0);
+
+	return (o - out) + r;
+}
+
+gssize
+hex_encode_sse42 (const guchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	const __m128i hexmap = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6',
+			'7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i lo4 = _mm_set1_epi8 (0x0F);
+	gchar *o = out;
+	gssize r;
+
+	if (outlen < inlen * 2) {
+		return -1;
+	}
+
+	while (inlen >= 16) {
+		__m128i str = _mm_loadu_si128 ((__m128i *)in);
+		__m128i hn = _mm_shuffle_epi8 (hexmap,
+				_mm_and_si128 (_mm_srli_epi16 (str, 4), lo4));
+		__m128i ln = _mm_shuffle_epi8 (hexmap, _mm_and_si128 (str, lo4));
+
+		_mm_storeu_si128 ((__m128i *)o, _mm_unpacklo_epi8 (hn, ln));
+		_mm_storeu_si128 ((__m128i *)(o + 16), _mm_unpackhi_epi8 (hn, ln));
+
+		in += 16;
+		inlen -= 16;
+		o += 32;
+	}
+
+	r = hex_encode_ref (in, inlen, o, outlen - (o - out));
+	g_assert (r >= 0);
+
+	return (o - out) + r;
+}
+
+#pragma GCC pop_options
+#endif
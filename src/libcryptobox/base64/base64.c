@@ -112,6 +112,86 @@ base64_load (void)
 	return base64_opt->desc;
 }
 
+/*
+ * Decodes base64 input interleaved with garbage (normally CRLF folding of
+ * MIME parts): clean quad-aligned runs are fed to the optimized kernel
+ * and only the quads straddling line breaks go through the reference
+ * decoder, so large attachments are decoded in a single pass with SIMD.
+ * Trailing '=' padding is treated as a span terminator: decoding a final
+ * partial quad without padding yields exactly the same bytes.
+ */
+static gboolean
+rspamd_cryptobox_base64_decode_fused (const gchar *in, gsize inlen,
+		guchar *out, gsize *outlen)
+{
+	const guchar *p = (const guchar *)in, *end = p + inlen;
+	guchar *o = out;
+	gsize avail = *outlen, span, n, outspan;
+	gchar pend[4];
+	guint pend_len = 0;
+	gboolean ret = TRUE;
+
+	while (p < end && ret) {
+		if (base64_table_dec[*p] >= 254) {
+			p ++;
+			continue;
+		}
+
+		/* Get the length of the next clean span */
+		span = 1;
+		while (p + span < end && base64_table_dec[p[span]] < 254) {
+			span ++;
+		}
+
+		if (pend_len > 0) {
+			/* Complete the quad straddling the previous line break */
+			while (pend_len < 4 && span > 0) {
+				pend[pend_len ++] = *p ++;
+				span --;
+			}
+
+			if (pend_len == 4 || p == end) {
+				outspan = avail;
+				ret = base64_ref->decode (pend, pend_len, o, &outspan);
+				o += outspan;
+				avail -= outspan;
+				pend_len = 0;
+			}
+
+			if (!ret || span == 0) {
+				continue;
+			}
+		}
+
+		n = span - (span % 4);
+
+		if (n > 0) {
+			outspan = avail;
+			ret = base64_opt->decode ((const gchar *)p, n, o, &outspan);
+			o += outspan;
+			avail -= outspan;
+			p += n;
+			span -= n;
+		}
+
+		/* Stash the unaligned remainder for the next span */
+		while (span > 0) {
+			pend[pend_len ++] = *p ++;
+			span --;
+		}
+	}
+
+	if (ret && pend_len > 0) {
+		outspan = avail;
+		ret = base64_ref->decode (pend, pend_len, o, &outspan);
+		o += outspan;
+	}
+
+	*outlen = o - out;
+
+	return ret;
+}
+
 gboolean
 rspamd_cryptobox_base64_decode (const gchar *in, gsize inlen,
 		guchar *out, gsize *outlen)
@@ -127,8 +207,13 @@ rspamd_cryptobox_base64_decode (const gchar *in, gsize inlen,
 			return base64_opt->decode (in, inlen, out, outlen);
 		}
 		else {
-			/* Garbage found */
-			return base64_ref->decode (in, inlen, out, outlen);
+			/*
+			 * Garbage found (usually CRLF folding of MIME parts): feed
+			 * the clean runs to the optimized kernel instead of falling
+			 * back to the naive version for the whole input
+			 */
+			return rspamd_cryptobox_base64_decode_fused (in, inlen,
+					out, outlen);
 		}
 	}
 	else {
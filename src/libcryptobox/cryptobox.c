@@ -25,6 +25,8 @@
 #include "chacha20/chacha.h"
 #include "catena/catena.h"
 #include "base64/base64.h"
+#include "base32/base32.h"
+#include "qp/qp.h"
 #include "ottery.h"
 #include "printf.h"
 #include "xxhash.h"
@@ -300,6 +302,8 @@ rspamd_cryptobox_init (void)
 
 	ctx->chacha20_impl = chacha_load ();
 	ctx->base64_impl = base64_load ();
+	ctx->base32_impl = base32_load ();
+	ctx->qp_impl = qp_load ();
 #if defined(HAVE_USABLE_OPENSSL) && (OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER))
 	/* Needed for old openssl api, not sure about LibreSSL */
 	ERR_load_EC_strings ();
@@ -1065,6 +1069,32 @@ rspamd_cryptobox_encryptv_nm_inplace (struct rspamd_cryptobox_segment *segments,
 			break;
 		}
 
+		if (remain == sizeof (outbuf) && cur->len >= sizeof (outbuf)) {
+			/*
+			 * The staging buffer is empty, so the stream is block aligned:
+			 * encrypt the aligned part of a large segment (e.g. a reply
+			 * body) in place instead of copying it twice through the
+			 * staging buffer
+			 */
+			gsize n = cur->len - (cur->len % CHACHA_BLOCKBYTES);
+
+			rspamd_cryptobox_encrypt_update (enc_ctx, cur->data, n,
+					cur->data, NULL, mode);
+			rspamd_cryptobox_auth_update (auth_ctx, cur->data, n, mode);
+
+			if (n == cur->len) {
+				cur ++;
+			}
+			else {
+				cur->data += n;
+				cur->len -= n;
+			}
+
+			start_seg = cur;
+			seg_offset = 0;
+			continue;
+		}
+
 		if (cur->len <= remain) {
 			memcpy (out, cur->data, cur->len);
 			remain -= cur->len;
@@ -1485,6 +1515,46 @@ void rspamd_cryptobox_hash (guchar *out,
 			data, len, key, keylen);
 }
 
+void
+rspamd_cryptobox_multi_hash_init (struct rspamd_cryptobox_multi_hash *mh)
+{
+	mh->nconsumers = 0;
+}
+
+gboolean
+rspamd_cryptobox_multi_hash_add (struct rspamd_cryptobox_multi_hash *mh,
+		rspamd_cryptobox_hash_consumer_fn update, void *ud)
+{
+	if (mh->nconsumers >= RSPAMD_CRYPTOBOX_MAX_HASH_CONSUMERS) {
+		return FALSE;
+	}
+
+	mh->consumers[mh->nconsumers].update = update;
+	mh->consumers[mh->nconsumers].ud = ud;
+	mh->nconsumers ++;
+
+	return TRUE;
+}
+
+void
+rspamd_cryptobox_multi_hash_update (struct rspamd_cryptobox_multi_hash *mh,
+		const guchar *data, gsize len)
+{
+	gsize clen;
+	guint i;
+
+	while (len > 0) {
+		clen = MIN (len, RSPAMD_CRYPTOBOX_HASH_CHUNK);
+
+		for (i = 0; i < mh->nconsumers; i ++) {
+			mh->consumers[i].update (mh->consumers[i].ud, data, clen);
+		}
+
+		data += clen;
+		len -= clen;
+	}
+}
+
 G_STATIC_ASSERT (sizeof (t1ha_context_t) <=
 		sizeof (((rspamd_cryptobox_fast_hash_state_t *)NULL)->opaque));
 G_STATIC_ASSERT (sizeof (XXH64_state_t) <=
@@ -17,6 +17,7 @@
 #define CRYPTOBOX_H_
 
 #include "config.h"
+#include "contrib/t1ha/t1ha.h"
 
 #include <sodium.h>
 
@@ -76,6 +77,8 @@ struct rspamd_cryptobox_library_ctx {
 	gchar *cpu_extensions;
 	const gchar *chacha20_impl;
 	const gchar *base64_impl;
+	const gchar *base32_impl;
+	const gchar *qp_impl;
 	unsigned long cpu_config;
 };
 
@@ -343,6 +346,45 @@ void rspamd_cryptobox_hash (guchar *out,
 							const guchar *key,
 							gsize keylen);
 
+/*
+ * Multi hash pipeline: several hash states are updated from a single pass
+ * over the input, streamed in cache sized chunks, so computing e.g. sha1
+ * and sha256 over the same message costs one memory traversal and not one
+ * per digest
+ */
+#define RSPAMD_CRYPTOBOX_HASH_CHUNK (128UL * 1024)
+#define RSPAMD_CRYPTOBOX_MAX_HASH_CONSUMERS 8
+
+typedef void (*rspamd_cryptobox_hash_consumer_fn) (void *ud,
+		const guchar *data, gsize len);
+
+struct rspamd_cryptobox_multi_hash {
+	struct {
+		rspamd_cryptobox_hash_consumer_fn update;
+		void *ud;
+	} consumers[RSPAMD_CRYPTOBOX_MAX_HASH_CONSUMERS];
+	guint nconsumers;
+};
+
+/**
+ * Init an empty multi hash pipeline
+ */
+void rspamd_cryptobox_multi_hash_init (struct rspamd_cryptobox_multi_hash *mh);
+
+/**
+ * Register a hash consumer; returns FALSE if all consumer slots are taken
+ */
+gboolean rspamd_cryptobox_multi_hash_add (struct rspamd_cryptobox_multi_hash *mh,
+		rspamd_cryptobox_hash_consumer_fn update, void *ud);
+
+/**
+ * Stream a buffer through all registered consumers in chunks of
+ * RSPAMD_CRYPTOBOX_HASH_CHUNK bytes, keeping every chunk cache warm for
+ * all the hash states that consume it
+ */
+void rspamd_cryptobox_multi_hash_update (struct rspamd_cryptobox_multi_hash *mh,
+		const guchar *data, gsize len);
+
 enum rspamd_cryptobox_fast_hash_type {
 	RSPAMD_CRYPTOBOX_XXHASH64 = 0,
 	RSPAMD_CRYPTOBOX_XXHASH32,
@@ -392,6 +434,23 @@ guint64 rspamd_cryptobox_fast_hash_final (rspamd_cryptobox_fast_hash_state_t *st
 guint64 rspamd_cryptobox_fast_hash (const void *data,
 									gsize len, guint64 seed);
 
+/**
+ * Fast path for short keys (hash table keys, statistics tokens and so on):
+ * the t1ha2 short input code is called directly avoiding the length-generic
+ * out of line dispatch. Produces exactly the same values as
+ * rspamd_cryptobox_fast_hash.
+ */
+static inline guint64
+rspamd_cryptobox_fast_hash_short (const void *data,
+		gsize len, guint64 seed)
+{
+	if (G_LIKELY (len <= 64)) {
+		return t1ha2_atonce (data, len, seed);
+	}
+
+	return rspamd_cryptobox_fast_hash (data, len, seed);
+}
+
 /**
  * Platform independent version
  */
@@ -24,10 +24,104 @@ struct rspamd_keypair_elt {
 	guchar pair[rspamd_cryptobox_HASHBYTES * 2];
 };
 
+/*
+ * Bucketed shared table of precomputed nm keys: entries are guarded with
+ * a per-bucket seqlock (odd while a writer is inside), so readers from
+ * other workers either get a consistent pair/nm combination or skip
+ */
+struct rspamd_keypair_shared_elt {
+	guint32 seq;
+	guchar pair[rspamd_cryptobox_HASHBYTES * 2];
+	guchar nm[rspamd_cryptobox_MAX_NMBYTES];
+};
+
 struct rspamd_keypair_cache {
 	rspamd_lru_hash_t *hash;
+	struct rspamd_keypair_shared_elt *shared;
+	guint shared_nelts;
 };
 
+gsize
+rspamd_keypair_cache_shared_size (guint nelts)
+{
+	return sizeof (struct rspamd_keypair_shared_elt) * nelts;
+}
+
+void
+rspamd_keypair_cache_set_shared (struct rspamd_keypair_cache *c,
+		gpointer tbl, guint nelts)
+{
+	if (c) {
+		c->shared = tbl;
+		c->shared_nelts = nelts;
+	}
+}
+
+static struct rspamd_keypair_shared_elt *
+rspamd_keypair_cache_shared_bucket (struct rspamd_keypair_cache *c,
+		const guchar *pair)
+{
+	guint64 h;
+
+	h = rspamd_cryptobox_fast_hash (pair, rspamd_cryptobox_HASHBYTES * 2,
+			rspamd_hash_seed ());
+
+	return &c->shared[h % c->shared_nelts];
+}
+
+static gboolean
+rspamd_keypair_cache_shared_get (struct rspamd_keypair_cache *c,
+		const guchar *pair, guchar *nm)
+{
+	struct rspamd_keypair_shared_elt *elt;
+	guint32 seq;
+
+	elt = rspamd_keypair_cache_shared_bucket (c, pair);
+	seq = g_atomic_int_get (&elt->seq);
+
+	if (seq == 0 || (seq & 1)) {
+		return FALSE;
+	}
+
+	if (memcmp (elt->pair, pair, sizeof (elt->pair)) != 0) {
+		return FALSE;
+	}
+
+	memcpy (nm, elt->nm, rspamd_cryptobox_MAX_NMBYTES);
+
+	/* Recheck the sequence to detect a concurrent overwrite */
+	return g_atomic_int_get (&elt->seq) == seq;
+}
+
+static void
+rspamd_keypair_cache_shared_put (struct rspamd_keypair_cache *c,
+		const guchar *pair, const guchar *nm)
+{
+	struct rspamd_keypair_shared_elt *elt;
+
+	guint32 seq;
+
+	elt = rspamd_keypair_cache_shared_bucket (c, pair);
+
+	/*
+	 * Writers must exclude each other, not only readers: claim the slot
+	 * by moving seq from even to odd with a CAS, so two workers cannot
+	 * interleave their pair/nm copies and publish a mismatched pair. On
+	 * contention the publish is simply skipped - the cache is advisory
+	 */
+	seq = g_atomic_int_get (&elt->seq);
+
+	if ((seq & 1) ||
+			!g_atomic_int_compare_and_exchange ((gint *)&elt->seq,
+					seq, seq + 1)) {
+		return;
+	}
+
+	memcpy (elt->pair, pair, sizeof (elt->pair));
+	memcpy (elt->nm, nm, rspamd_cryptobox_MAX_NMBYTES);
+	g_atomic_int_inc ((gint *)&elt->seq);
+}
+
 static void
 rspamd_keypair_destroy (gpointer ptr)
 {
@@ -94,6 +188,8 @@ rspamd_keypair_cache_process (struct rspamd_keypair_cache *c,
 	}
 
 	if (new == NULL) {
+		gboolean from_shared = FALSE;
+
 		new = g_malloc0 (sizeof (*new));
 
 		if (posix_memalign ((void **)&new->nm, 32, sizeof (*new->nm)) != 0) {
@@ -107,21 +203,36 @@ rspamd_keypair_cache_process (struct rspamd_keypair_cache *c,
 				rspamd_cryptobox_HASHBYTES);
 		memcpy (&new->nm->sk_id, lk->id, sizeof (guint64));
 
-		if (rk->alg == RSPAMD_CRYPTOBOX_MODE_25519) {
-			struct rspamd_cryptobox_pubkey_25519 *rk_25519 =
-					RSPAMD_CRYPTOBOX_PUBKEY_25519(rk);
-			struct rspamd_cryptobox_keypair_25519 *sk_25519 =
-					RSPAMD_CRYPTOBOX_KEYPAIR_25519(lk);
-
-			rspamd_cryptobox_nm (new->nm->nm, rk_25519->pk, sk_25519->sk, rk->alg);
+		if (c->shared &&
+			rspamd_keypair_cache_shared_get (c, new->pair, new->nm->nm)) {
+			/* Another worker has already derived this secret */
+			from_shared = TRUE;
 		}
-		else {
-			struct rspamd_cryptobox_pubkey_nist *rk_nist =
-					RSPAMD_CRYPTOBOX_PUBKEY_NIST(rk);
-			struct rspamd_cryptobox_keypair_nist *sk_nist =
-					RSPAMD_CRYPTOBOX_KEYPAIR_NIST(lk);
 
-			rspamd_cryptobox_nm (new->nm->nm, rk_nist->pk, sk_nist->sk, rk->alg);
+		if (!from_shared) {
+			if (rk->alg == RSPAMD_CRYPTOBOX_MODE_25519) {
+				struct rspamd_cryptobox_pubkey_25519 *rk_25519 =
+						RSPAMD_CRYPTOBOX_PUBKEY_25519(rk);
+				struct rspamd_cryptobox_keypair_25519 *sk_25519 =
+						RSPAMD_CRYPTOBOX_KEYPAIR_25519(lk);
+
+				rspamd_cryptobox_nm (new->nm->nm, rk_25519->pk, sk_25519->sk,
+						rk->alg);
+			}
+			else {
+				struct rspamd_cryptobox_pubkey_nist *rk_nist =
+						RSPAMD_CRYPTOBOX_PUBKEY_NIST(rk);
+				struct rspamd_cryptobox_keypair_nist *sk_nist =
+						RSPAMD_CRYPTOBOX_KEYPAIR_NIST(lk);
+
+				rspamd_cryptobox_nm (new->nm->nm, rk_nist->pk, sk_nist->sk,
+						rk->alg);
+			}
+
+			if (c->shared) {
+				/* Publish the secret for the sibling workers */
+				rspamd_keypair_cache_shared_put (c, new->pair, new->nm->nm);
+			}
 		}
 
 		rspamd_lru_hash_insert (c->hash, new, new, time (NULL), -1);
@@ -137,6 +248,11 @@ void
 rspamd_keypair_cache_destroy (struct rspamd_keypair_cache *c)
 {
 	if (c != NULL) {
+		guint64 hits = 0, misses = 0;
+
+		rspamd_lru_hash_counters (c->hash, &hits, &misses);
+		msg_debug ("keypairs cache: %uL hits, %uL misses (ecdh computed)",
+				hits, misses);
 		rspamd_lru_hash_destroy (c->hash);
 		g_free (c);
 	}
@@ -33,6 +33,22 @@ struct rspamd_keypair_cache;
  */
 struct rspamd_keypair_cache *rspamd_keypair_cache_new (guint max_items);
 
+/**
+ * Returns the size in bytes of a shared keypairs table with `nelts` buckets,
+ * to be allocated from a shared memory pool before forking
+ */
+gsize rspamd_keypair_cache_shared_size (guint nelts);
+
+/**
+ * Attaches a shared (between workers) table of precomputed nm keys to the
+ * cache: ECDH results computed by any worker then become visible to all
+ * @param c cache object
+ * @param tbl shared memory of rspamd_keypair_cache_shared_size (nelts) bytes
+ * @param nelts number of buckets
+ */
+void rspamd_keypair_cache_set_shared (struct rspamd_keypair_cache *c,
+		gpointer tbl, guint nelts);
+
 
 /**
  * Process local and remote keypair setting beforenm value as appropriate
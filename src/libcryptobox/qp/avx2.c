@@ -0,0 +1,156 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#ifndef __SSE2__
+#define __SSE2__
+#endif
+#ifndef __SSE__
+#define __SSE__
+#endif
+#ifndef __AVX__
+#define __AVX__
+#endif
+#ifndef __AVX2__
+#define __AVX2__
+#endif
+#include <immintrin.h>
+
+gssize qp_decode_avx2 (const gchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("avx2")));
+
+gssize
+qp_decode_avx2 (const gchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gchar *o, *end, c;
+	const gchar *p;
+	guchar ret;
+	gssize remain, run;
+	guint mask;
+	const __m256i eq = _mm256_set1_epi8 ('=');
+	__m256i block;
+
+	p = in;
+	o = out;
+	end = out + outlen;
+	remain = inlen;
+
+	while (remain > 0 && o < end) {
+		if (*p == '=') {
+			remain --;
+
+			if (remain == 0) {
+				/* Last '=' character, bugon */
+				if (end - o > 0) {
+					*o++ = *p;
+				}
+				else {
+					/* Buffer overflow */
+					return (-1);
+				}
+
+				break;
+			}
+
+			p ++;
+			/* Decode character after '=' */
+			c = *p++;
+			remain --;
+			ret = 0;
+
+			if      (c >= '0' && c <= '9') { ret = c - '0'; }
+			else if (c >= 'A' && c <= 'F') { ret = c - 'A' + 10; }
+			else if (c >= 'a' && c <= 'f') { ret = c - 'a' + 10; }
+			else if (c == '\r' || c == '\n') {
+				/* Soft line break */
+				while (remain > 0 && (*p == '\r' || *p == '\n')) {
+					remain --;
+					p ++;
+				}
+
+				continue;
+			}
+			else {
+				/* Hack, hack, hack, treat =<garbadge> as =<garbadge> */
+				if (remain > 0) {
+					*o++ = *(p - 1);
+				}
+
+				continue;
+			}
+
+			if (remain > 0) {
+				c = *p++;
+				ret *= 16;
+
+				if      (c >= '0' && c <= '9') { ret += c - '0'; }
+				else if (c >= 'A' && c <= 'F') { ret += c - 'A' + 10; }
+				else if (c >= 'a' && c <= 'f') { ret += c - 'a' + 10; }
+
+				if (end - o > 0) {
+					*o++ = (gchar)ret;
+				}
+				else {
+					return (-1);
+				}
+
+				remain --;
+			}
+		}
+		else {
+			if (end - o < remain) {
+				/* Buffer overflow */
+				return (-1);
+			}
+
+			/* Scan for the next '=' using SIMD, bulk-copy the clean run */
+			run = 0;
+
+			while (run + 32 <= remain) {
+				block = _mm256_loadu_si256 ((const __m256i *)(p + run));
+				mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (block, eq));
+
+				if (mask != 0) {
+					run += __builtin_ctz (mask);
+					goto copy;
+				}
+
+				run += 32;
+			}
+
+			while (run < remain && p[run] != '=') {
+				run ++;
+			}
+
+copy:
+			memcpy (o, p, run);
+			o += run;
+			p += run;
+			remain -= run;
+			/* Either all input is copied or *p == '=' here */
+		}
+	}
+
+	return (o - out);
+}
+
+#pragma GCC pop_options
+#endif
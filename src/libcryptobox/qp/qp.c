@@ -0,0 +1,93 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "qp.h"
+#include "platform_config.h"
+
+extern unsigned long cpu_config;
+
+typedef struct qp_impl {
+	unsigned long cpu_flags;
+	const char *desc;
+
+	gssize (*decode) (const gchar *in, gsize inlen,
+			gchar *out, gsize outlen);
+} qp_impl_t;
+
+#define QP_DECLARE(ext) \
+    gssize qp_decode_##ext(const gchar *in, gsize inlen, gchar *out, gsize outlen);
+#define QP_IMPL(cpuflags, desc, ext) \
+    {(cpuflags), desc, qp_decode_##ext}
+
+QP_DECLARE(ref);
+#define QP_REF QP_IMPL(0, "ref", ref)
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_SSE2)
+gssize qp_decode_sse2 (const gchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("sse2")));
+
+QP_DECLARE(sse2);
+#  define QP_SSE2 QP_IMPL(CPUID_SSE2, "sse2", sse2)
+# endif
+#endif
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_AVX2)
+gssize qp_decode_avx2 (const gchar *in, gsize inlen,
+		gchar *out, gsize outlen) __attribute__((__target__("avx2")));
+
+QP_DECLARE(avx2);
+#  define QP_AVX2 QP_IMPL(CPUID_AVX2, "avx2", avx2)
+# endif
+#endif
+
+static const qp_impl_t qp_list[] = {
+		QP_REF,
+#ifdef QP_AVX2
+		QP_AVX2,
+#endif
+#ifdef QP_SSE2
+		QP_SSE2,
+#endif
+};
+
+static const qp_impl_t *qp_opt = &qp_list[0];
+
+const char *
+qp_load (void)
+{
+	guint i;
+
+	if (cpu_config != 0) {
+		for (i = 0; i < G_N_ELEMENTS (qp_list); i++) {
+			if (qp_list[i].cpu_flags & cpu_config) {
+				qp_opt = &qp_list[i];
+				break;
+			}
+		}
+	}
+
+	return qp_opt->desc;
+}
+
+gssize
+qp_decode (const gchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	return qp_opt->decode (in, inlen, out, outlen);
+}
@@ -0,0 +1,140 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "libutil/util.h"
+
+gssize
+qp_decode_ref (const gchar *in, gsize inlen, gchar *out, gsize outlen)
+{
+	gchar *o, *end, *pos, c;
+	const gchar *p;
+	guchar ret;
+	gssize remain, processed;
+
+	p = in;
+	o = out;
+	end = out + outlen;
+	remain = inlen;
+
+	while (remain > 0 && o < end) {
+		if (*p == '=') {
+			remain --;
+
+			if (remain == 0) {
+				/* Last '=' character, bugon */
+				if (end - o > 0) {
+					*o++ = *p;
+				}
+				else {
+					/* Buffer overflow */
+					return (-1);
+				}
+
+				break;
+			}
+
+			p ++;
+decode:
+			/* Decode character after '=' */
+			c = *p++;
+			remain --;
+			ret = 0;
+
+			if      (c >= '0' && c <= '9') { ret = c - '0'; }
+			else if (c >= 'A' && c <= 'F') { ret = c - 'A' + 10; }
+			else if (c >= 'a' && c <= 'f') { ret = c - 'a' + 10; }
+			else if (c == '\r' || c == '\n') {
+				/* Soft line break */
+				while (remain > 0 && (*p == '\r' || *p == '\n')) {
+					remain --;
+					p ++;
+				}
+
+				continue;
+			}
+			else {
+				/* Hack, hack, hack, treat =<garbadge> as =<garbadge> */
+				if (remain > 0) {
+					*o++ = *(p - 1);
+				}
+
+				continue;
+			}
+
+			if (remain > 0) {
+				c = *p++;
+				ret *= 16;
+
+				if      (c >= '0' && c <= '9') { ret += c - '0'; }
+				else if (c >= 'A' && c <= 'F') { ret += c - 'A' + 10; }
+				else if (c >= 'a' && c <= 'f') { ret += c - 'a' + 10; }
+
+				if (end - o > 0) {
+					*o++ = (gchar)ret;
+				}
+				else {
+					return (-1);
+				}
+
+				remain --;
+			}
+		}
+		else {
+			if (end - o >= remain) {
+				if ((pos = memccpy (o, p, '=', remain)) == NULL) {
+					/* All copied */
+					o += remain;
+					break;
+				}
+				else {
+					processed = pos - o;
+					remain -= processed;
+					p += processed;
+
+					if (remain > 0) {
+						o = pos - 1;
+						/*
+						 * Skip comparison and jump inside decode branch,
+						 * as we know that we have found match
+						 */
+						goto decode;
+					}
+					else {
+						/* Last '=' character, bugon */
+						o = pos;
+
+						if (end - o > 0) {
+							*o = '=';
+						}
+						else {
+							/* Buffer overflow */
+							return (-1);
+						}
+
+						break;
+					}
+				}
+			}
+			else {
+				/* Buffer overflow */
+				return (-1);
+			}
+		}
+	}
+
+	return (o - out);
+}
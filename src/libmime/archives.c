@@ -134,7 +134,8 @@ rspamd_archive_process_zip (struct rspamd_task *task,
 		struct rspamd_mime_part *part)
 {
 	const guchar *p, *start, *end, *eocd = NULL, *cd;
-	const guint32 eocd_magic = 0x06054b50, cd_basic_len = 46;
+	/* EOCD magic is 0x06054b50 in LE, compared bytewise below */
+	const guint32 cd_basic_len = 46;
 	const guchar cd_magic[] = {0x50, 0x4b, 0x01, 0x02};
 	const guint max_processed = 1024;
 	guint32 cd_offset, cd_size, comp_size, uncomp_size, processed = 0;
@@ -154,16 +155,12 @@ rspamd_archive_process_zip (struct rspamd_task *task,
 	p -= 21;
 
 	while (p > start + sizeof (guint32)) {
-		guint32 t;
-
 		if (processed > max_processed) {
 			break;
 		}
 
-		/* XXX: not an efficient approach */
-		memcpy (&t, p, sizeof (t));
-
-		if (GUINT32_FROM_LE (t) == eocd_magic) {
+		/* Compare the magic bytewise to avoid a memcpy per position */
+		if (p[0] == 0x50 && p[1] == 0x4b && p[2] == 0x05 && p[3] == 0x06) {
 			eocd = p;
 			break;
 		}
@@ -686,6 +686,16 @@ rspamd_content_type_parse (const gchar *in,
 			}
 		}
 
+		/*
+		 * Dispatch over the first character to avoid comparing every
+		 * type against the whole list; the flags then make all the
+		 * downstream checks pure integer comparisons
+		 */
+		switch (res->type.len > 0 ?
+				g_ascii_tolower (res->type.begin[0]) : '\0') {
+		case 'm':
+		case 't':
+
 		RSPAMD_FTOK_ASSIGN (&srch, "multipart");
 
 		if (rspamd_ftok_casecmp (&res->type, &srch) == 0) {
@@ -721,6 +731,12 @@ rspamd_content_type_parse (const gchar *in,
 				}
 			}
 		}
+
+			break;
+		default:
+			/* Not multipart, text or message */
+			break;
+		}
 	}
 	else {
 		msg_warn_pool ("cannot parse content type: %*s", (gint)len, cpy);
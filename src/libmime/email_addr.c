@@ -96,7 +96,9 @@ rspamd_email_address_free (struct rspamd_email_address *addr)
 			g_free ((void *) addr->user);
 		}
 
-		g_free (addr);
+		if (!(addr->flags & RSPAMD_EMAIL_ADDR_POOL_ALLOCATED)) {
+			g_free (addr);
+		}
 	}
 }
 
@@ -109,10 +111,19 @@ rspamd_email_address_add (rspamd_mempool_t *pool,
 	struct rspamd_email_address *elt;
 	guint nlen;
 
-	elt = g_malloc0 (sizeof (*elt));
+	/*
+	 * Mime address lists die with the task pool: allocating elements
+	 * there turns 500-recipient headers from 500 mallocs into pool
+	 * bumps, with only the unquoted strings heap allocated
+	 */
+	elt = rspamd_mempool_alloc0 (pool, sizeof (*elt));
+	elt->flags |= RSPAMD_EMAIL_ADDR_POOL_ALLOCATED;
 
 	if (addr != NULL) {
+		guint tmp_flags = elt->flags;
+
 		memcpy (elt, addr, sizeof (*addr));
+		elt->flags |= tmp_flags;
 	}
 	else {
 		elt->addr = "";
@@ -39,6 +39,7 @@ enum rspamd_email_address_flags {
 	RSPAMD_EMAIL_ADDR_HAS_8BIT = (1 << 8),
 	RSPAMD_EMAIL_ADDR_ALIASED = (1 << 9),
 	RSPAMD_EMAIL_ADDR_ORIGINAL = (1 << 10),
+	RSPAMD_EMAIL_ADDR_POOL_ALLOCATED = (1 << 11),
 };
 
 /*
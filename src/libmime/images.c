@@ -356,6 +356,7 @@ rspamd_image_dct_block (gint pixels[8][8], gdouble *out)
 struct rspamd_image_cache_entry {
 	guchar digest[64];
 	guchar dct[RSPAMD_DCT_LEN / NBBY];
+	gboolean failed; /* the image could not be decoded */
 };
 
 static void
@@ -399,6 +400,11 @@ rspamd_image_check_hash (struct rspamd_task *task, struct rspamd_image *img)
 			task->tv.tv_sec);
 
 	if (found) {
+		if (found->failed) {
+			/* Negative cache: no reason to decode this image again */
+			return TRUE;
+		}
+
 		/* We need to decompress */
 		img->dct = g_malloc (RSPAMD_DCT_LEN / NBBY);
 		rspamd_mempool_add_destructor (task->task_pool, g_free,
@@ -478,16 +484,33 @@ rspamd_image_normalize (struct rspamd_task *task, struct rspamd_image *img)
 	}
 
 	if (src == NULL) {
+		struct rspamd_image_cache_entry *failed_entry;
+
 		msg_info_task ("cannot load image of type %s from %T",
 				rspamd_image_type_str (img->type), img->filename);
+
+		/* Campaigns reuse broken images, cache the failure as well */
+		failed_entry = g_malloc0 (sizeof (*failed_entry));
+		failed_entry->failed = TRUE;
+		memcpy (failed_entry->digest, img->parent->digest,
+				sizeof (failed_entry->digest));
+		rspamd_lru_hash_insert (images_hash, failed_entry->digest,
+				failed_entry, task->tv.tv_sec, 0);
 	}
 	else {
 		gdImageSetInterpolationMethod (src, GD_BILINEAR_FIXED);
 
 		dst = gdImageScale (src, RSPAMD_NORMALIZED_DIM, RSPAMD_NORMALIZED_DIM);
-		gdImageGrayScale (dst);
 		gdImageDestroy (src);
 
+		if (dst == NULL) {
+			msg_info_task ("cannot scale image of type %s from %T",
+					rspamd_image_type_str (img->type), img->filename);
+			return;
+		}
+
+		gdImageGrayScale (dst);
+
 		img->is_normalized = TRUE;
 		dct = g_malloc0 (sizeof (gdouble) * RSPAMD_DCT_LEN);
 		img->dct = g_malloc0 (RSPAMD_DCT_LEN / NBBY);
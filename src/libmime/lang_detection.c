@@ -23,6 +23,9 @@
 #include "libstemmer.h"
 
 #include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unicode/utf8.h>
 #include <unicode/utf16.h>
 #include <unicode/ucnv.h>
@@ -345,6 +348,96 @@ rspamd_language_detector_cmp_ngramm (gconstpointer a, gconstpointer b)
 	return (gint)e2->freq - (gint)e1->freq;
 }
 
+static guint
+rspamd_language_detector_process_stop_words (struct rspamd_config *cfg,
+		struct rspamd_lang_detector *d,
+		struct rspamd_language_elt *nelt,
+		enum rspamd_language_category cat,
+		const ucl_object_t *stop_words)
+{
+	const ucl_object_t *specific_stop_words, *w;
+	ucl_object_iter_t it = NULL;
+	guint nstop = 0;
+
+	specific_stop_words = ucl_object_lookup (stop_words, nelt->name);
+
+	if (specific_stop_words) {
+		struct sb_stemmer *stem = NULL;
+		guint start, stop;
+
+		stem = sb_stemmer_new (nelt->name, "UTF_8");
+		start = rspamd_multipattern_get_npatterns (d->stop_words[cat].mp);
+
+		while ((w = ucl_object_iterate (specific_stop_words, &it, true)) != NULL) {
+			gsize wlen;
+			const char *word = ucl_object_tolstring (w, &wlen);
+			const char *saved;
+
+#ifdef WITH_HYPERSCAN
+			rspamd_multipattern_add_pattern_len (d->stop_words[cat].mp,
+					word, wlen,
+					RSPAMD_MULTIPATTERN_ICASE|RSPAMD_MULTIPATTERN_UTF8
+					|RSPAMD_MULTIPATTERN_RE);
+#else
+			rspamd_multipattern_add_pattern_len (d->stop_words[cat].mp,
+					word, wlen,
+					RSPAMD_MULTIPATTERN_ICASE|RSPAMD_MULTIPATTERN_UTF8);
+#endif
+			nelt->stop_words ++;
+			nstop ++;
+
+			/* Also lemmatise and store normalised */
+			if (stem) {
+				const char *nw = sb_stemmer_stem (stem, word, wlen);
+
+
+				if (nw) {
+					saved = nw;
+					wlen = strlen (nw);
+				}
+				else {
+					saved = word;
+				}
+			}
+			else {
+				saved = word;
+			}
+
+			if (saved) {
+				gint rc;
+				rspamd_ftok_t *tok;
+				gchar *dst;
+
+				tok = rspamd_mempool_alloc (cfg->cfg_pool,
+						sizeof (*tok) + wlen + 1);
+				dst = ((gchar *)tok) + sizeof (*tok);
+				rspamd_strlcpy (dst, saved, wlen + 1);
+				tok->begin = dst;
+				tok->len = wlen;
+
+				kh_put (rspamd_stopwords_hash, d->stop_words_norm,
+						tok, &rc);
+			}
+		}
+
+		if (stem) {
+			sb_stemmer_delete (stem);
+		}
+
+		stop = rspamd_multipattern_get_npatterns (d->stop_words[cat].mp);
+
+		struct rspamd_stop_word_range r;
+
+		r.start = start;
+		r.stop = stop;
+		r.elt = nelt;
+
+		g_array_append_val (d->stop_words[cat].ranges, r);
+	}
+
+	return nstop;
+}
+
 static void
 rspamd_language_detector_read_file (struct rspamd_config *cfg,
 		struct rspamd_lang_detector *d,
@@ -441,86 +534,8 @@ rspamd_language_detector_read_file (struct rspamd_config *cfg,
 	}
 
 	if (stop_words) {
-		const ucl_object_t *specific_stop_words;
-
-		specific_stop_words = ucl_object_lookup (stop_words, nelt->name);
-
-		if (specific_stop_words) {
-			struct sb_stemmer *stem = NULL;
-			it = NULL;
-			const ucl_object_t *w;
-			guint start, stop;
-
-			stem = sb_stemmer_new (nelt->name, "UTF_8");
-			start = rspamd_multipattern_get_npatterns (d->stop_words[cat].mp);
-
-			while ((w = ucl_object_iterate (specific_stop_words, &it, true)) != NULL) {
-				gsize wlen;
-				const char *word = ucl_object_tolstring (w, &wlen);
-				const char *saved;
-
-#ifdef WITH_HYPERSCAN
-				rspamd_multipattern_add_pattern_len (d->stop_words[cat].mp,
-						word, wlen,
-						RSPAMD_MULTIPATTERN_ICASE|RSPAMD_MULTIPATTERN_UTF8
-						|RSPAMD_MULTIPATTERN_RE);
-#else
-				rspamd_multipattern_add_pattern_len (d->stop_words[cat].mp,
-						word, wlen,
-						RSPAMD_MULTIPATTERN_ICASE|RSPAMD_MULTIPATTERN_UTF8);
-#endif
-				nelt->stop_words ++;
-				nstop ++;
-
-				/* Also lemmatise and store normalised */
-				if (stem) {
-					const char *nw = sb_stemmer_stem (stem, word, wlen);
-
-
-					if (nw) {
-						saved = nw;
-						wlen = strlen (nw);
-					}
-					else {
-						saved = word;
-					}
-				}
-				else {
-					saved = word;
-				}
-
-				if (saved) {
-					gint rc;
-					rspamd_ftok_t *tok;
-					gchar *dst;
-
-					tok = rspamd_mempool_alloc (cfg->cfg_pool,
-							sizeof (*tok) + wlen + 1);
-					dst = ((gchar *)tok) + sizeof (*tok);
-					rspamd_strlcpy (dst, saved, wlen + 1);
-					tok->begin = dst;
-					tok->len = wlen;
-
-					kh_put (rspamd_stopwords_hash, d->stop_words_norm,
-							tok, &rc);
-				}
-			}
-
-			if (stem) {
-				sb_stemmer_delete (stem);
-			}
-
-			stop = rspamd_multipattern_get_npatterns (d->stop_words[cat].mp);
-
-			struct rspamd_stop_word_range r;
-
-			r.start = start;
-			r.stop = stop;
-			r.elt = nelt;
-
-			g_array_append_val (d->stop_words[cat].ranges, r);
-			it = NULL;
-		}
+		nstop = rspamd_language_detector_process_stop_words (cfg, d, nelt,
+				cat, stop_words);
 	}
 
 	nelt->category = cat;
@@ -734,6 +749,323 @@ rspamd_language_detector_process_chain (struct rspamd_config *cfg,
 	}
 }
 
+/*
+ * Compiled profiles cache: a flat binary blob with all languages and
+ * post-processed trigram chains. It is mmapped read-only on load, so the
+ * trigram keys, utf strings and probabilities are physically shared
+ * between workers and no json parsing is needed on startup.
+ */
+static const guchar rspamd_langdet_cache_magic[8] = {'r', 's', 'l', 'd', 'c', 'a', 1, 0};
+
+struct rspamd_langdet_cache_header {
+	guchar magic[8];
+	guint64 cksum;
+	guint32 nlangs;
+	guint32 ncats;
+};
+
+struct rspamd_langdet_cache_lang {
+	gchar name[16];
+	guint32 flags;
+	guint32 category;
+	guint32 trigramms_words;
+	guint32 unused;
+	gdouble mean;
+	gdouble std;
+};
+
+struct rspamd_langdet_cache_trigram {
+	UChar32 s[3];
+	guint32 nlangs;
+	gdouble mean;
+	gdouble std;
+	gchar utf[16];
+};
+
+struct rspamd_langdet_cache_prob {
+	guint32 lang_idx;
+	guint32 unused;
+	gdouble prob;
+};
+
+static guint64
+rspamd_language_detector_cache_cksum (GPtrArray *profile_files)
+{
+	rspamd_cryptobox_fast_hash_state_t st;
+	struct stat stbuf;
+	const gchar *path;
+	guint i;
+
+	rspamd_cryptobox_fast_hash_init (&st, rspamd_hash_seed ());
+
+	PTR_ARRAY_FOREACH (profile_files, i, path) {
+		rspamd_cryptobox_fast_hash_update (&st, path, strlen (path));
+
+		if (stat (path, &stbuf) == 0) {
+			rspamd_cryptobox_fast_hash_update (&st, &stbuf.st_size,
+					sizeof (stbuf.st_size));
+			rspamd_cryptobox_fast_hash_update (&st, &stbuf.st_mtime,
+					sizeof (stbuf.st_mtime));
+		}
+	}
+
+	return rspamd_cryptobox_fast_hash_final (&st);
+}
+
+static gboolean
+rspamd_language_detector_load_cache (struct rspamd_config *cfg,
+		struct rspamd_lang_detector *d,
+		const gchar *path,
+		guint64 cksum,
+		const ucl_object_t *stop_words)
+{
+	const struct rspamd_langdet_cache_header *hdr;
+	const struct rspamd_langdet_cache_lang *clang;
+	const struct rspamd_langdet_cache_trigram *ctri;
+	const struct rspamd_langdet_cache_prob *cprob;
+	struct rspamd_language_elt *nelt;
+	struct rspamd_ngramm_chain chain;
+	struct rspamd_ngramm_elt *elt;
+	struct stat st;
+	const guchar *map, *p, *end;
+	guint64 ntri;
+	guint32 i, j, k;
+	khiter_t kit;
+	gint rc, fd;
+
+	fd = open (path, O_RDONLY);
+
+	if (fd == -1) {
+		msg_info_config ("cannot open language profiles cache %s: %s",
+				path, strerror (errno));
+		return FALSE;
+	}
+
+	if (fstat (fd, &st) == -1 || st.st_size < (goffset)sizeof (*hdr)) {
+		close (fd);
+		return FALSE;
+	}
+
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (map == MAP_FAILED) {
+		msg_info_config ("cannot mmap language profiles cache %s: %s",
+				path, strerror (errno));
+		return FALSE;
+	}
+
+	hdr = (const struct rspamd_langdet_cache_header *)map;
+	end = map + st.st_size;
+
+	if (memcmp (hdr->magic, rspamd_langdet_cache_magic,
+			sizeof (rspamd_langdet_cache_magic)) != 0 ||
+		hdr->cksum != cksum ||
+		hdr->ncats != RSPAMD_LANGUAGE_MAX) {
+		msg_info_config ("stale language profiles cache %s, ignore it", path);
+		munmap ((gpointer)map, st.st_size);
+		return FALSE;
+	}
+
+	p = map + sizeof (*hdr);
+
+	if (p + hdr->nlangs * sizeof (*clang) > end) {
+		goto err;
+	}
+
+	for (i = 0; i < hdr->nlangs; i ++) {
+		clang = (const struct rspamd_langdet_cache_lang *)p;
+		p += sizeof (*clang);
+
+		if (clang->category >= RSPAMD_LANGUAGE_MAX ||
+			memchr (clang->name, '\0', sizeof (clang->name)) == NULL) {
+			goto err;
+		}
+
+		nelt = rspamd_mempool_alloc0 (cfg->cfg_pool, sizeof (*nelt));
+		nelt->name = (const gchar *)clang->name;
+		nelt->flags = clang->flags;
+		nelt->category = clang->category;
+		nelt->trigramms_words = clang->trigramms_words;
+		nelt->mean = clang->mean;
+		nelt->std = clang->std;
+		g_ptr_array_add (d->languages, nelt);
+	}
+
+	for (i = 0; i < RSPAMD_LANGUAGE_MAX; i ++) {
+		if (p + sizeof (ntri) > end) {
+			goto err;
+		}
+
+		memcpy (&ntri, p, sizeof (ntri));
+		p += sizeof (ntri);
+
+		for (j = 0; j < ntri; j ++) {
+			ctri = (const struct rspamd_langdet_cache_trigram *)p;
+			p += sizeof (*ctri);
+
+			if (p > end || p + ctri->nlangs * sizeof (*cprob) > end ||
+				memchr (ctri->utf, '\0', sizeof (ctri->utf)) == NULL) {
+				goto err;
+			}
+
+			memset (&chain, 0, sizeof (chain));
+			chain.mean = ctri->mean;
+			chain.std = ctri->std;
+			/* Points into the mapped blob */
+			chain.utf = (gchar *)ctri->utf;
+			chain.languages = g_ptr_array_sized_new (ctri->nlangs);
+			rspamd_mempool_add_destructor (cfg->cfg_pool,
+					rspamd_ptr_array_free_hard, chain.languages);
+
+			for (k = 0; k < ctri->nlangs; k ++) {
+				cprob = (const struct rspamd_langdet_cache_prob *)p;
+				p += sizeof (*cprob);
+
+				if (cprob->lang_idx >= d->languages->len) {
+					goto err;
+				}
+
+				elt = rspamd_mempool_alloc (cfg->cfg_pool, sizeof (*elt));
+				elt->elt = g_ptr_array_index (d->languages, cprob->lang_idx);
+				elt->prob = cprob->prob;
+				g_ptr_array_add (chain.languages, elt);
+			}
+
+			kit = kh_put (rspamd_trigram_hash, d->trigramms[i], ctri->s, &rc);
+			kh_value (d->trigramms[i], kit) = chain;
+		}
+	}
+
+	/* Stop words always come from the ucl file, it is cheap to parse */
+	if (stop_words) {
+		PTR_ARRAY_FOREACH (d->languages, i, nelt) {
+			rspamd_language_detector_process_stop_words (cfg, d, nelt,
+					nelt->category, stop_words);
+		}
+	}
+
+	/* The mapping is kept for the whole lifetime of the detector */
+	msg_info_config ("loaded %d languages from compiled cache %s",
+			(gint)d->languages->len, path);
+
+	return TRUE;
+
+err:
+	msg_warn_config ("truncated language profiles cache %s, ignore it", path);
+	munmap ((gpointer)map, st.st_size);
+	/* Partially filled tables are rebuilt from scratch by the caller */
+	for (i = 0; i < RSPAMD_LANGUAGE_MAX; i ++) {
+		kh_clear (rspamd_trigram_hash, d->trigramms[i]);
+	}
+
+	g_ptr_array_set_size (d->languages, 0);
+
+	return FALSE;
+}
+
+static void
+rspamd_language_detector_save_cache (struct rspamd_config *cfg,
+		struct rspamd_lang_detector *d,
+		const gchar *path,
+		guint64 cksum)
+{
+	struct rspamd_langdet_cache_header hdr;
+	struct rspamd_langdet_cache_lang clang;
+	struct rspamd_langdet_cache_trigram ctri;
+	struct rspamd_langdet_cache_prob cprob;
+	struct rspamd_language_elt *nelt;
+	struct rspamd_ngramm_chain schain;
+	struct rspamd_ngramm_elt *elt;
+	const UChar32 *trikey;
+	gchar npath[PATH_MAX];
+	guint64 ntri;
+	guint i, j;
+	FILE *f;
+
+	rspamd_snprintf (npath, sizeof (npath), "%s.new", path);
+	f = fopen (npath, "wx");
+
+	if (f == NULL) {
+		if (errno != EEXIST) {
+			msg_warn_config ("cannot save language profiles cache %s: %s",
+					npath, strerror (errno));
+		}
+
+		return;
+	}
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, rspamd_langdet_cache_magic,
+			sizeof (rspamd_langdet_cache_magic));
+	hdr.cksum = cksum;
+	hdr.nlangs = d->languages->len;
+	hdr.ncats = RSPAMD_LANGUAGE_MAX;
+	fwrite (&hdr, sizeof (hdr), 1, f);
+
+	PTR_ARRAY_FOREACH (d->languages, i, nelt) {
+		memset (&clang, 0, sizeof (clang));
+		rspamd_strlcpy (clang.name, nelt->name, sizeof (clang.name));
+		clang.flags = nelt->flags;
+		clang.category = nelt->category;
+		clang.trigramms_words = nelt->trigramms_words;
+		clang.mean = nelt->mean;
+		clang.std = nelt->std;
+		fwrite (&clang, sizeof (clang), 1, f);
+	}
+
+	for (i = 0; i < RSPAMD_LANGUAGE_MAX; i ++) {
+		ntri = kh_size (d->trigramms[i]);
+		fwrite (&ntri, sizeof (ntri), 1, f);
+
+		kh_foreach (d->trigramms[i], trikey, schain, {
+			memset (&ctri, 0, sizeof (ctri));
+			memcpy (ctri.s, trikey, sizeof (ctri.s));
+			ctri.nlangs = schain.languages->len;
+			ctri.mean = schain.mean;
+			ctri.std = schain.std;
+			rspamd_strlcpy (ctri.utf, schain.utf, sizeof (ctri.utf));
+			fwrite (&ctri, sizeof (ctri), 1, f);
+
+			PTR_ARRAY_FOREACH (schain.languages, j, elt) {
+				memset (&cprob, 0, sizeof (cprob));
+
+				for (cprob.lang_idx = 0;
+					 cprob.lang_idx < d->languages->len;
+					 cprob.lang_idx ++) {
+					if (g_ptr_array_index (d->languages, cprob.lang_idx) ==
+							elt->elt) {
+						break;
+					}
+				}
+
+				cprob.prob = elt->prob;
+				fwrite (&cprob, sizeof (cprob), 1, f);
+			}
+		});
+	}
+
+	if (fflush (f) != 0 || ferror (f)) {
+		msg_warn_config ("cannot write language profiles cache %s: %s",
+				npath, strerror (errno));
+		fclose (f);
+		(void)unlink (npath);
+
+		return;
+	}
+
+	fclose (f);
+
+	if (rename (npath, path) == -1) {
+		msg_warn_config ("cannot rename %s -> %s: %s", npath, path,
+				strerror (errno));
+		(void)unlink (npath);
+	}
+	else {
+		msg_info_config ("saved compiled language profiles cache to %s", path);
+	}
+}
+
 static void
 rspamd_language_detector_dtor (struct rspamd_lang_detector *d)
 {
@@ -758,15 +1090,19 @@ rspamd_language_detector_init (struct rspamd_config *cfg)
 	const ucl_object_t *section, *elt, *languages_enable = NULL,
 			*languages_disable = NULL;
 	const gchar *languages_path = default_languages_path;
+	const gchar *cache_path = NULL;
 	glob_t gl;
 	size_t i, short_text_limit = default_short_text_limit, total = 0;
 	UErrorCode uc_err = U_ZERO_ERROR;
 	GString *languages_pattern;
+	GPtrArray *profile_files;
 	struct rspamd_ngramm_chain *chain, schain;
 	gchar *fname;
 	struct rspamd_lang_detector *ret = NULL;
 	struct ucl_parser *parser;
 	ucl_object_t *stop_words;
+	guint64 cksum = 0;
+	gboolean cache_loaded = FALSE;
 
 	section = ucl_object_lookup (cfg->rcl_obj, "lang_detection");
 
@@ -777,6 +1113,12 @@ rspamd_language_detector_init (struct rspamd_config *cfg)
 			languages_path = ucl_object_tostring (elt);
 		}
 
+		elt = ucl_object_lookup (section, "cache_file");
+
+		if (elt) {
+			cache_path = ucl_object_tostring (elt);
+		}
+
 		elt = ucl_object_lookup (section, "short_text_limit");
 
 		if (elt) {
@@ -836,14 +1178,17 @@ rspamd_language_detector_init (struct rspamd_config *cfg)
 
 	g_assert (uc_err == U_ZERO_ERROR);
 
+	/* Filter the profiles to read, so the cache checksum covers the
+	 * actual set of files selected by languages_enable/languages_disable */
+	profile_files = g_ptr_array_sized_new (gl.gl_pathc);
+
 	for (i = 0; i < gl.gl_pathc; i ++) {
 		fname = g_path_get_basename (gl.gl_pathv[i]);
 
 		if (!rspamd_ucl_array_find_str (fname, languages_disable) ||
 				(languages_enable == NULL ||
 						rspamd_ucl_array_find_str (fname, languages_enable))) {
-			rspamd_language_detector_read_file (cfg, ret, gl.gl_pathv[i],
-					stop_words);
+			g_ptr_array_add (profile_files, gl.gl_pathv[i]);
 		}
 		else {
 			msg_info_config ("skip language file %s: disabled", fname);
@@ -852,13 +1197,31 @@ rspamd_language_detector_init (struct rspamd_config *cfg)
 		g_free (fname);
 	}
 
+	if (cache_path) {
+		cksum = rspamd_language_detector_cache_cksum (profile_files);
+		cache_loaded = rspamd_language_detector_load_cache (cfg, ret,
+				cache_path, cksum, stop_words);
+	}
+
+	if (!cache_loaded) {
+		PTR_ARRAY_FOREACH (profile_files, i, fname) {
+			rspamd_language_detector_read_file (cfg, ret, fname,
+					stop_words);
+		}
+	}
+
+	g_ptr_array_free (profile_files, TRUE);
+
 	for (i = 0; i < RSPAMD_LANGUAGE_MAX; i ++) {
 		GError *err = NULL;
 
-		kh_foreach_value (ret->trigramms[i], schain, {
-			chain = &schain;
-			rspamd_language_detector_process_chain (cfg, chain);
-		});
+		if (!cache_loaded) {
+			/* Cached chains are stored post-processed */
+			kh_foreach_value (ret->trigramms[i], schain, {
+				chain = &schain;
+				rspamd_language_detector_process_chain (cfg, chain);
+			});
+		}
 
 		if (!rspamd_multipattern_compile (ret->stop_words[i].mp, &err)) {
 			msg_err_config ("cannot compile stop words for %z language group: %e",
@@ -869,6 +1232,10 @@ rspamd_language_detector_init (struct rspamd_config *cfg)
 		total += kh_size (ret->trigramms[i]);
 	}
 
+	if (cache_path && !cache_loaded) {
+		rspamd_language_detector_save_cache (cfg, ret, cache_path, cksum);
+	}
+
 	msg_info_config ("loaded %d languages, "
 			"%d trigramms",
 			(gint)ret->languages->len,
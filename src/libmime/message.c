@@ -1436,7 +1436,9 @@ rspamd_message_process (struct rspamd_task *task)
 			lua_settop (L, func_pos);
 		}
 
-		rspamd_message_process_text_part_maybe (task, part);
+		if (!RSPAMD_TASK_IS_HEADERS_ONLY (task)) {
+			rspamd_message_process_text_part_maybe (task, part);
+		}
 	}
 
 	if (func_pos != -1) {
@@ -611,21 +611,39 @@ rspamd_mime_text_part_maybe_convert (struct rspamd_task *task,
 		text_part->flags |= RSPAMD_MIME_TEXT_PART_FLAG_8BIT;
 	}
 
-	/* Allocate copy storage */
-	part_content = g_byte_array_sized_new (text_part->parsed.len);
-	memcpy (part_content->data, text_part->parsed.begin, text_part->parsed.len);
-	part_content->len = text_part->parsed.len;
-	rspamd_mempool_add_destructor (task->task_pool,
-			(rspamd_mempool_destruct_t)g_byte_array_unref, part_content);
-
 	if (rspamd_str_has_8bit (text_part->parsed.begin, text_part->parsed.len)) {
 		text_part->flags |= RSPAMD_MIME_TEXT_PART_FLAG_8BIT_ENCODED;
 	}
 
 	if (!(text_part->flags & RSPAMD_MIME_TEXT_PART_FLAG_8BIT_ENCODED)) {
 		need_charset_heuristic = FALSE;
+
+		if (!(task->cfg && task->cfg->raw_mode) &&
+				part->ct->charset.len == 0) {
+			/*
+			 * Pure 7bit content with no declared charset is already valid
+			 * utf8: alias the parsed data instead of copying it, as no
+			 * in-place conversion can happen on this path
+			 */
+			SET_PART_UTF (text_part);
+			part_content = rspamd_mempool_alloc0 (task->task_pool,
+					sizeof (*part_content));
+			part_content->data = (guint8 *)text_part->parsed.begin;
+			part_content->len = text_part->parsed.len;
+			text_part->utf_raw_content = part_content;
+			text_part->real_charset = UTF8_CHARSET;
+
+			return;
+		}
 	}
 
+	/* Allocate copy storage */
+	part_content = g_byte_array_sized_new (text_part->parsed.len);
+	memcpy (part_content->data, text_part->parsed.begin, text_part->parsed.len);
+	part_content->len = text_part->parsed.len;
+	rspamd_mempool_add_destructor (task->task_pool,
+			(rspamd_mempool_destruct_t)g_byte_array_unref, part_content);
+
 	if (task->cfg && task->cfg->raw_mode) {
 		SET_PART_RAW (text_part);
 		text_part->utf_raw_content = part_content;
@@ -105,6 +105,7 @@ struct rspamd_regexp_atom {
 		const gchar *header;                        /**< header name for header regexps						*/
 		const gchar *selector;                      /**< selector name for lua selector regexp				*/
 	} extra;
+	gsize extra_len;                                /**< length of the extra data, precomputed at parse		*/
 	gboolean is_test;                               /**< true if this expression must be tested				*/
 	gboolean is_strong;                             /**< true if headers search must be case sensitive		*/
 	gboolean is_multiple;                           /**< true if we need to match all inclusions of atom	*/
@@ -459,6 +460,7 @@ rspamd_mime_expr_parse_regexp_atom (rspamd_mempool_t * pool, const gchar *line,
 		if (extra) {
 			/* Assume header regexp */
 			result->extra.header = extra;
+			result->extra_len = strlen (extra);
 			result->type = RSPAMD_RE_HEADER;
 		}
 		else {
@@ -476,6 +478,7 @@ rspamd_mime_expr_parse_regexp_atom (rspamd_mempool_t * pool, const gchar *line,
 		}
 		else {
 			result->extra.header = extra;
+			result->extra_len = strlen (extra);
 		}
 	}
 
@@ -486,6 +489,7 @@ rspamd_mime_expr_parse_regexp_atom (rspamd_mempool_t * pool, const gchar *line,
 		}
 		else {
 			result->extra.selector = extra;
+			result->extra_len = strlen (extra);
 		}
 	}
 
@@ -970,7 +974,7 @@ rspamd_mime_expr_process_regexp (struct rspamd_regexp_atom *re,
 				re->regexp,
 				re->type,
 				re->extra.header,
-				strlen (re->extra.header),
+				re->extra_len,
 				re->is_strong);
 	}
 	else if (re->type == RSPAMD_RE_SELECTOR) {
@@ -978,7 +982,7 @@ rspamd_mime_expr_process_regexp (struct rspamd_regexp_atom *re,
 				re->regexp,
 				re->type,
 				re->extra.selector,
-				strlen (re->extra.selector),
+				re->extra_len,
 				re->is_strong);
 	}
 	else {
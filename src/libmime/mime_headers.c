@@ -30,6 +30,15 @@ KHASH_INIT (rspamd_mime_headers_htb, gchar *,
 struct rspamd_mime_headers_table {
 	khash_t(rspamd_mime_headers_htb) htb;
 	ref_entry_t ref;
+	/*
+	 * One slot lookup memo: rules query the very same header names over
+	 * and over using stable (static or lua interned) string pointers, so
+	 * a pointer identity check plus a plain comparison with the stored
+	 * copy skips the case-insensitive hashing and probing
+	 */
+	const gchar *last_query_ptr;
+	struct rspamd_mime_header *last_res;
+	gchar last_query_buf[64];
 };
 
 #define RSPAMD_INET_ADDRESS_PARSE_RECEIVED \
@@ -152,15 +161,19 @@ rspamd_mime_header_check_special (struct rspamd_task *task,
 
 static void
 rspamd_mime_header_add (struct rspamd_task *task,
-						khash_t(rspamd_mime_headers_htb) *target,
+						struct rspamd_mime_headers_table *target_tbl,
 						struct rspamd_mime_header **order_ptr,
 						struct rspamd_mime_header *rh,
 						gboolean check_special)
 {
 	khiter_t k;
+	khash_t(rspamd_mime_headers_htb) *target = &target_tbl->htb;
 	struct rspamd_mime_header *ex;
 	int res;
 
+	/* Invalidate the lookup memo */
+	target_tbl->last_query_ptr = NULL;
+
 	k = kh_put (rspamd_mime_headers_htb, target, rh->name, &res);
 
 	if (res == 0) {
@@ -401,7 +414,7 @@ rspamd_mime_headers_process (struct rspamd_task *task,
 			/* We also validate utf8 and replace all non-valid utf8 chars */
 			rspamd_mime_charset_utf_enforce (nh->decoded, strlen (nh->decoded));
 			nh->order = norder ++;
-			rspamd_mime_header_add (task, &target->htb, order_ptr, nh, check_newlines);
+			rspamd_mime_header_add (task, target, order_ptr, nh, check_newlines);
 			nh = NULL;
 			state = 0;
 			break;
@@ -411,7 +424,7 @@ rspamd_mime_headers_process (struct rspamd_task *task,
 			nh->decoded = "";
 			nh->raw_len = p - nh->raw_value;
 			nh->order = norder ++;
-			rspamd_mime_header_add (task, &target->htb, order_ptr, nh, check_newlines);
+			rspamd_mime_header_add (task, target, order_ptr, nh, check_newlines);
 			nh = NULL;
 			state = 0;
 			break;
@@ -1157,10 +1170,10 @@ rspamd_smtp_received_spill (struct rspamd_task *task,
 
 	len = end - p;
 
-	/* Ignore all received but those started from from part */
-	if (len <= 4 || (lc_map[p[0]] != 'f' &&
-					 lc_map[p[1]] != 'r' &&
-					 lc_map[p[2]] != 'o' &&
+	/* Ignore all received but those started from the "from" part */
+	if (len <= 4 || (lc_map[p[0]] != 'f' ||
+					 lc_map[p[1]] != 'r' ||
+					 lc_map[p[2]] != 'o' ||
 					 lc_map[p[3]] != 'm')) {
 		return NULL;
 	}
@@ -1625,15 +1638,30 @@ rspamd_message_get_header_from_hash (struct rspamd_mime_headers_table *headers,
 {
 	khiter_t k;
 	khash_t(rspamd_mime_headers_htb) *htb = &headers->htb;
+	struct rspamd_mime_header *res;
 
 	if (htb) {
+		if (field == headers->last_query_ptr &&
+			strcmp (field, headers->last_query_buf) == 0) {
+			/* The same name as the previous lookup */
+			return headers->last_res;
+		}
+
 		k = kh_get (rspamd_mime_headers_htb, htb, (gchar *) field);
+		res = (k == kh_end (htb)) ? NULL : kh_value (htb, k);
 
-		if (k == kh_end (htb)) {
-			return NULL;
+		if (rspamd_strlcpy (headers->last_query_buf, field,
+				sizeof (headers->last_query_buf)) <
+				sizeof (headers->last_query_buf) - 1) {
+			headers->last_query_ptr = field;
+			headers->last_res = res;
+		}
+		else {
+			/* Too long to memoize */
+			headers->last_query_ptr = NULL;
 		}
 
-		return kh_value (htb, k);
+		return res;
 	}
 
 	return NULL;
@@ -33,6 +33,8 @@ struct rspamd_mime_parser_lib_ctx {
 struct rspamd_mime_parser_lib_ctx *lib_ctx = NULL;
 
 static const guint max_nested = 64;
+/* Hard limit of mime parts for a message, protects from wide part bombs */
+static const guint max_parts = 1024;
 static const guint max_key_usages = 10000;
 
 #define msg_debug_mime(...)  rspamd_conditional_debug_fast (NULL, task->from_addr, \
@@ -457,20 +459,13 @@ rspamd_mime_parse_normal_part (struct rspamd_task *task,
 			}
 		}
 
-		if (IS_CT_TEXT (part->ct)) {
-			/* Need to copy text as we have couple of in-place change functions */
-			parsed = rspamd_fstring_sized_new (part->raw_data.len);
-			parsed->len = part->raw_data.len;
-			memcpy (parsed->str, part->raw_data.begin, parsed->len);
-			part->parsed_data.begin = parsed->str;
-			part->parsed_data.len = parsed->len;
-			rspamd_mempool_add_destructor (task->task_pool,
-					(rspamd_mempool_destruct_t)rspamd_fstring_free, parsed);
-		}
-		else {
-			part->parsed_data.begin = part->raw_data.begin;
-			part->parsed_data.len = part->raw_data.len;
-		}
+		/*
+		 * Zero-copy mode: point into the raw input (usually mmapped for
+		 * file scans). All in-place conversion functions work on their
+		 * own copy of the content, so a view is enough here.
+		 */
+		part->parsed_data.begin = part->raw_data.begin;
+		part->parsed_data.len = part->raw_data.len;
 		break;
 	case RSPAMD_CTE_QP:
 		parsed = rspamd_fstring_sized_new (part->raw_data.len);
@@ -495,16 +490,20 @@ rspamd_mime_parse_normal_part (struct rspamd_task *task,
 					(rspamd_mempool_destruct_t)rspamd_fstring_free, parsed);
 		}
 		break;
-	case RSPAMD_CTE_B64:
-		parsed = rspamd_fstring_sized_new (part->raw_data.len / 4 * 3 + 12);
+	case RSPAMD_CTE_B64: {
+		/* Decode from the raw input into a single pool allocation */
+		gchar *b64_buf;
+		gsize b64_len;
+
+		b64_len = part->raw_data.len / 4 * 3 + 12;
+		b64_buf = rspamd_mempool_alloc (task->task_pool, b64_len);
 		rspamd_cryptobox_base64_decode (part->raw_data.begin,
 				part->raw_data.len,
-				parsed->str, &parsed->len);
-		part->parsed_data.begin = parsed->str;
-		part->parsed_data.len = parsed->len;
-		rspamd_mempool_add_destructor (task->task_pool,
-				(rspamd_mempool_destruct_t)rspamd_fstring_free, parsed);
+				(guchar *)b64_buf, &b64_len);
+		part->parsed_data.begin = b64_buf;
+		part->parsed_data.len = b64_len;
 		break;
+	}
 	default:
 		g_assert_not_reached ();
 	}
@@ -544,6 +543,18 @@ rspamd_mime_process_multipart_node (struct rspamd_task *task,
 	goffset hdr_pos, body_pos;
 	enum rspamd_mime_parse_error ret = RSPAMD_MIME_PARSE_FATAL;
 
+	if (MESSAGE_FIELD (task, parts)->len >= max_parts) {
+		/*
+		 * The nesting depth check does not protect from wide bombs with
+		 * thousands of sibling parts, so the total parts count is capped
+		 * as well; everything parsed so far is retained for scanning
+		 */
+		g_set_error (err, RSPAMD_MIME_QUARK, E2BIG,
+				"Too many mime parts: %d", MESSAGE_FIELD (task, parts)->len);
+
+		return RSPAMD_MIME_PARSE_NESTING;
+	}
+
 
 	str.str = (gchar *)start;
 	str.len = end - start;
@@ -72,7 +72,12 @@ rspamd_create_metric_result (struct rspamd_task *task)
 	kh_resize (rspamd_symbols_group_hash, metric_res->sym_groups, 4);
 
 	if (symbols_count.mean > 4) {
-		kh_resize (rspamd_symbols_hash, metric_res->symbols, symbols_count.mean);
+		/*
+		 * Account for the load factor of the table (0.77), so a task with
+		 * the average number of symbols does not rehash mid-scan
+		 */
+		kh_resize (rspamd_symbols_hash, metric_res->symbols,
+				symbols_count.mean * 1.3 + 1);
 	}
 	else {
 		kh_resize (rspamd_symbols_hash, metric_res->symbols, 4);
@@ -95,6 +100,8 @@ rspamd_create_metric_result (struct rspamd_task *task)
 		}
 
 		metric_res->nactions = i;
+		/* The limits inherit the ascending threshold sort of cfg->actions */
+		metric_res->actions_order_valid = TRUE;
 	}
 
 	rspamd_mempool_add_destructor (task->task_pool,
@@ -104,13 +111,6 @@ rspamd_create_metric_result (struct rspamd_task *task)
 	return metric_res;
 }
 
-static inline int
-rspamd_pr_sort (const struct rspamd_passthrough_result *pra,
-				const struct rspamd_passthrough_result *prb)
-{
-	return prb->priority - pra->priority;
-}
-
 void
 rspamd_add_passthrough_result (struct rspamd_task *task,
 									struct rspamd_action *action,
@@ -133,8 +133,27 @@ rspamd_add_passthrough_result (struct rspamd_task *task,
 	pr->target_score = target_score;
 	pr->flags = flags;
 
-	DL_APPEND (metric_res->passthrough_result, pr);
-	DL_SORT (metric_res->passthrough_result, rspamd_pr_sort);
+	/*
+	 * Insert into the priority ordered position directly: the list is
+	 * a few elements at most, so this beats re-sorting it on every
+	 * insertion and keeps equal priorities in the insertion order
+	 */
+	{
+		struct rspamd_passthrough_result *cur = NULL;
+
+		DL_FOREACH (metric_res->passthrough_result, cur) {
+			if (pr->priority > cur->priority) {
+				break;
+			}
+		}
+
+		if (cur) {
+			DL_PREPEND_ELEM (metric_res->passthrough_result, cur, pr);
+		}
+		else {
+			DL_APPEND (metric_res->passthrough_result, pr);
+		}
+	}
 
 	if (!isnan (target_score)) {
 
@@ -208,7 +227,31 @@ insert_metric_result (struct rspamd_task *task,
 	msg_debug_metric ("want to insert symbol %s, initial weight %.2f",
 			symbol, weight);
 
-	sdef = g_hash_table_lookup (task->cfg->symbols, symbol);
+	/*
+	 * The common case is a symbol inserting itself from its own callback:
+	 * the executing cache item already carries its metric definition, so
+	 * the per-insert hash lookup can be skipped entirely
+	 */
+	sdef = NULL;
+
+	{
+		struct rspamd_symcache_item *cur_item =
+				rspamd_symcache_get_cur_item (task);
+
+		if (cur_item != NULL) {
+			struct rspamd_symbol *cur_sdef =
+					rspamd_symcache_item_sdef (cur_item);
+
+			if (cur_sdef != NULL && strcmp (cur_sdef->name, symbol) == 0) {
+				sdef = cur_sdef;
+			}
+		}
+	}
+
+	if (sdef == NULL) {
+		sdef = g_hash_table_lookup (task->cfg->symbols, symbol);
+	}
+
 	if (sdef == NULL) {
 		if (flags & RSPAMD_SYMBOL_INSERT_ENFORCE) {
 			final_score = 1.0 * weight; /* Enforce static weight to 1.0 */
@@ -391,7 +434,17 @@ insert_metric_result (struct rspamd_task *task,
 	}
 	else {
 		/* New result */
-		sym_cpy = rspamd_mempool_strdup (task->task_pool, symbol);
+		if (sdef != NULL && sdef->name != NULL) {
+			/*
+			 * Registered symbols use the interned config name: no copy
+			 * and the key survives the task anyway as the task holds a
+			 * reference on its config
+			 */
+			sym_cpy = sdef->name;
+		}
+		else {
+			sym_cpy = rspamd_mempool_strdup (task->task_pool, symbol);
+		}
 		k = kh_put (rspamd_symbols_hash, metric_res->symbols,
 				sym_cpy, &ret);
 		g_assert (ret > 0);
@@ -504,7 +557,8 @@ rspamd_task_insert_result_full (struct rspamd_task *task,
 
 	/* Process cache item */
 	if (s && task->cfg->cache && s->sym) {
-		rspamd_symcache_inc_frequency (task->cfg->cache, s->sym->cache_item);
+		rspamd_symcache_inc_frequency (task->cfg->cache, s->sym->cache_item,
+				task);
 	}
 
 	return s;
@@ -642,6 +696,15 @@ rspamd_check_action_metric (struct rspamd_task *task)
 		if (mres->score >= sc && sc > max_score) {
 			selected_action = action_lim->action;
 			max_score = sc;
+
+			/*
+			 * The limits are walked from the highest threshold down, so
+			 * the first match is the final one unless some limit has been
+			 * overridden out of order by settings
+			 */
+			if (mres->actions_order_valid && noaction != NULL) {
+				break;
+			}
 		}
 	}
 
@@ -82,6 +82,7 @@ struct rspamd_scan_result {
 	struct kh_rspamd_symbols_group_hash_s *sym_groups; /**< groups of symbols						*/
 	struct rspamd_action_result *actions_limits;
 	guint nactions;
+	gboolean actions_order_valid;                    /**< limits still follow the config sort	*/
 };
 
 /**
@@ -135,7 +135,8 @@ rspamd_session_create (rspamd_mempool_t * pool,
 	s->events = kh_init (rspamd_events_hash);
 
 	if (events_count.mean > 4) {
-		kh_resize (rspamd_events_hash, s->events, events_count.mean);
+		/* Count in the load factor to avoid mid-scan rehashing */
+		kh_resize (rspamd_events_hash, s->events, events_count.mean * 1.3 + 1);
 	}
 	else {
 		kh_resize (rspamd_events_hash, s->events, 4);
@@ -220,6 +220,7 @@ struct rspamd_worker_conf {
 	GQuark type;                                    /**< type of worker										*/
 	struct rspamd_worker_bind_conf *bind_conf;      /**< bind configuration									*/
 	gint16 count;                                   /**< number of workers									*/
+	gint pin_cpu_base;                              /**< pin workers to cpus starting from this one, -1 = off	*/
 	GList *listen_socks;                            /**< listening sockets descriptors						*/
 	guint64 rlimit_nofile;                          /**< max files limit									*/
 	guint64 rlimit_maxcore;                         /**< maximum core file size								*/
@@ -363,6 +364,20 @@ struct rspamd_config {
 	gboolean allow_raw_input;                       /**< scan messages with invalid mime					*/
 	gboolean disable_hyperscan;                     /**< disable hyperscan usage							*/
 	gboolean vectorized_hyperscan;                  /**< use vectorized hyperscan matching					*/
+	guint re_memo_cache_size;                       /**< entries in the regexps memoization cache			*/
+	gdouble re_time_budget;                         /**< cumulative pcre time allowed per task (seconds)	*/
+	gboolean symcache_conditional_skip;             /**< skip symbols that never fire in a task's segment	*/
+	gdouble verdict_memo_ttl;                       /**< replay verdicts of byte identical messages (seconds)	*/
+	gdouble io_collect_interval;                    /**< event loop io collection interval (syscall batching)	*/
+	gdouble profile_probability;                    /**< probability to profile a random task				*/
+	gdouble redis_pool_timeout;                     /**< idle timeout of pooled redis connections			*/
+	guint soft_shutdown_time;                       /**< seconds to wait for tasks completion on shutdown	*/
+	gboolean stat_sketch_memo;                      /**< reuse verdicts of near identical token sets		*/
+	gchar *stat_export_file;                        /**< path prefix of the features export log (opt-in)	*/
+	gsize stat_export_size;                         /**< rotate the features export log above this size		*/
+	guint redis_pool_max_conns;                     /**< watermark of pooled redis connections per upstream	*/
+	gpointer shared_keypairs_table;                 /**< shared table of precomputed nm keys				*/
+	guint shared_keypairs_nelts;                    /**< number of buckets in the shared keypairs table		*/
 	gboolean enable_shutdown_workaround;            /**< enable workaround for legacy SA clients (exim)		*/
 	gboolean ignore_received;                       /**< Ignore data from the first received header			*/
 	gboolean enable_sessions_cache;                 /**< Enable session cache for debug						*/
@@ -388,6 +403,7 @@ struct rspamd_config {
 	gint log_level;                                 /**< log level trigger									*/
 	gchar *log_file;                                /**< path to logfile in case of file logging			*/
 	gboolean log_buffered;                          /**< whether logging is buffered						*/
+	guint log_debug_sample;                         /**< emit only every Nth debug line (0/1 = all)			*/
 	gboolean log_silent_workers;                    /**< silence info messages from workers					*/
 	guint32 log_buf_size;                           /**< length of log buffer								*/
 	const ucl_object_t *debug_ip_map;               /**< turn on debugging for specified ip addresses       */
@@ -1726,6 +1726,14 @@ rspamd_rcl_config_init (struct rspamd_config *cfg, GHashTable *skip_sections)
 				G_STRUCT_OFFSET (struct rspamd_config, debug_modules),
 				RSPAMD_CL_FLAG_STRING_LIST_HASH,
 				"Enable debugging for the specified modules");
+		rspamd_rcl_add_default_handler (sub,
+				"debug_sample",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_config, log_debug_sample),
+				RSPAMD_CL_FLAG_UINT,
+				"Emit only every Nth debug line, so debug_modules can stay "
+				"enabled in production at a bounded logging rate "
+				"(0 or 1 to log everything)");
 		rspamd_rcl_add_default_handler (sub,
 				"log_format",
 				rspamd_rcl_parse_struct_string,
@@ -2032,6 +2040,97 @@ rspamd_rcl_config_init (struct rspamd_config *cfg, GHashTable *skip_sections)
 				G_STRUCT_OFFSET (struct rspamd_config, vectorized_hyperscan),
 				0,
 				"Use hyperscan in vectorized mode (experimental)");
+		rspamd_rcl_add_default_handler (sub,
+				"soft_shutdown_time",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_config, soft_shutdown_time),
+				RSPAMD_CL_FLAG_UINT,
+				"Time in seconds to wait for all in-flight tasks to finish "
+				"on graceful shutdown/reload before killing workers "
+				"(default: 10)");
+		rspamd_rcl_add_default_handler (sub,
+				"redis_pool_timeout",
+				rspamd_rcl_parse_struct_time,
+				G_STRUCT_OFFSET (struct rspamd_config, redis_pool_timeout),
+				RSPAMD_CL_FLAG_TIME_FLOAT,
+				"Idle timeout of pooled redis connections, default: 10s");
+		rspamd_rcl_add_default_handler (sub,
+				"redis_pool_max_conns",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_config, redis_pool_max_conns),
+				RSPAMD_CL_FLAG_UINT,
+				"Soft limit of pooled redis connections per upstream: above "
+				"it idle connections are pruned aggressively, default: 100");
+		rspamd_rcl_add_default_handler (sub,
+				"profile_probability",
+				rspamd_rcl_parse_struct_double,
+				G_STRUCT_OFFSET (struct rspamd_config, profile_probability),
+				0,
+				"Profile a random share of tasks (0..1) adding per symbol "
+				"timings to their replies, default: 0");
+		rspamd_rcl_add_default_handler (sub,
+				"io_collect_interval",
+				rspamd_rcl_parse_struct_time,
+				G_STRUCT_OFFSET (struct rspamd_config, io_collect_interval),
+				RSPAMD_CL_FLAG_TIME_FLOAT,
+				"Let the event loop sleep this long collecting io events to "
+				"batch syscalls under high load (increases latency, default: 0)");
+		rspamd_rcl_add_default_handler (sub,
+				"re_memo_cache_size",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_config, re_memo_cache_size),
+				RSPAMD_CL_FLAG_UINT,
+				"Size of the per-worker regexps results memoization cache "
+				"(0 to disable). The cache key is a keyed 64 bit hash "
+				"of the content: collisions cannot be searched for "
+				"offline, but a blind collision within one process "
+				"lifetime would replay a wrong match count");
+		rspamd_rcl_add_default_handler (sub,
+				"verdict_memo_ttl",
+				rspamd_rcl_parse_struct_time,
+				G_STRUCT_OFFSET (struct rspamd_config, verdict_memo_ttl),
+				RSPAMD_CL_FLAG_TIME_FLOAT,
+				"Replay full scan results for byte identical messages with "
+				"the same envelope seen within this many seconds "
+				"(0 to disable, default: 0)");
+		rspamd_rcl_add_default_handler (sub,
+				"symcache_conditional_skip",
+				rspamd_rcl_parse_struct_boolean,
+				G_STRUCT_OFFSET (struct rspamd_config, symcache_conditional_skip),
+				0,
+				"Probabilistically skip symbols that never fire for a task's "
+				"segment (settings/size class), re-probing a small sample "
+				"(default: false)");
+		rspamd_rcl_add_default_handler (sub,
+				"re_time_budget",
+				rspamd_rcl_parse_struct_time,
+				G_STRUCT_OFFSET (struct rspamd_config, re_time_budget),
+				RSPAMD_CL_FLAG_TIME_FLOAT,
+				"Cumulative pcre execution time allowed per task; when "
+				"exhausted, only literal regexps are matched for the rest "
+				"of the task (0 to disable, default: 0)");
+		rspamd_rcl_add_default_handler (sub,
+				"stat_sketch_memo",
+				rspamd_rcl_parse_struct_boolean,
+				G_STRUCT_OFFSET (struct rspamd_config, stat_sketch_memo),
+				0,
+				"Reuse recent classification verdicts for near identical "
+				"token sets (bulk campaign mail), default: false");
+		rspamd_rcl_add_default_handler (sub,
+				"stat_export_file",
+				rspamd_rcl_parse_struct_string,
+				G_STRUCT_OFFSET (struct rspamd_config, stat_export_file),
+				RSPAMD_CL_FLAG_STRING_PATH,
+				"Path prefix of the per-worker binary log with classification "
+				"features (token hashes, scores) for external ML training; "
+				"unset (default) disables the export");
+		rspamd_rcl_add_default_handler (sub,
+				"stat_export_size",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_config, stat_export_size),
+				RSPAMD_CL_FLAG_INT_SIZE,
+				"Rotate the features export log above this size, "
+				"default: 100MB");
 		rspamd_rcl_add_default_handler (sub,
 				"cores_dir",
 				rspamd_rcl_parse_struct_string,
@@ -2377,6 +2476,13 @@ rspamd_rcl_config_init (struct rspamd_config *cfg, GHashTable *skip_sections)
 				G_STRUCT_OFFSET (struct rspamd_worker_conf, enabled),
 				0,
 				"Enable or disable a worker (true by default)");
+		rspamd_rcl_add_default_handler (sub,
+				"pin_cpu_base",
+				rspamd_rcl_parse_struct_integer,
+				G_STRUCT_OFFSET (struct rspamd_worker_conf, pin_cpu_base),
+				RSPAMD_CL_FLAG_INT_32,
+				"Pin worker number N to cpu (pin_cpu_base + N), aligning "
+				"workers with NIC RSS queues (-1 to disable, default)");
 	}
 
 	if (!(skip_sections && g_hash_table_lookup (skip_sections, "modules"))) {
@@ -3848,6 +3954,8 @@ rspamd_config_read (struct rspamd_config *cfg,
 		return FALSE;
 	}
 
+	gdouble parse_start = rspamd_get_ticks (FALSE);
+
 	if (!rspamd_config_parse_ucl (cfg, filename, vars, NULL, NULL, skip_jinja, &err)) {
 		msg_err_config_forced ("failed to load config: %e", err);
 		g_error_free (err);
@@ -3855,6 +3963,9 @@ rspamd_config_read (struct rspamd_config *cfg,
 		return FALSE;
 	}
 
+	msg_info_config ("parsed configuration from %s in %.3f seconds",
+			filename, rspamd_get_ticks (FALSE) - parse_start);
+
 	top = rspamd_rcl_config_init (cfg, NULL);
 	/* Add new paths if defined in options */
 	rspamd_lua_set_path (cfg->lua_state, cfg->rcl_obj, vars);
@@ -16,6 +16,7 @@
 #include "config.h"
 
 #include "cfg_file.h"
+#include "libcryptobox/keypairs_cache.h"
 #include "rspamd.h"
 #include "cfg_file_private.h"
 #include "scan_result.h"
@@ -780,6 +781,30 @@ rspamd_config_post_load (struct rspamd_config *cfg,
 	rspamd_regexp_library_init (cfg);
 	rspamd_multipattern_library_init (cfg->hs_cache_dir);
 
+	/*
+	 * Allocated before forking, so ECDH secrets computed by one worker
+	 * become visible to all of them
+	 */
+	if (cfg->shared_keypairs_table == NULL) {
+		cfg->shared_keypairs_nelts = 1024;
+		cfg->shared_keypairs_table = rspamd_mempool_alloc0_shared (
+				cfg->cfg_pool,
+				rspamd_keypair_cache_shared_size (cfg->shared_keypairs_nelts));
+	}
+
+	/* Shared sliding window ratelimit counters, also pre-fork */
+	rspamd_shm_ratelimit_init (rspamd_mempool_alloc0_shared (cfg->cfg_pool,
+			rspamd_shm_ratelimit_size ()));
+
+	/* Shared state of monitored resources (dead RBL discovery) */
+	rspamd_monitored_attach_shm (rspamd_mempool_alloc0_shared (cfg->cfg_pool,
+			rspamd_monitored_shm_size ()));
+
+	/* Shared cache of redirector resolutions, also pre-fork */
+	rspamd_url_redirector_cache_init (rspamd_mempool_alloc0_shared (
+			cfg->cfg_pool,
+			rspamd_url_redirector_cache_size ()));
+
 #ifdef WITH_HYPERSCAN
 	if (!cfg->disable_hyperscan) {
 		if (!(cfg->libs_ctx->crypto_ctx->cpu_config & CPUID_SSSE3)) {
@@ -1105,6 +1130,7 @@ rspamd_config_new_worker (struct rspamd_config *cfg,
 		c = g_malloc0 (sizeof (struct rspamd_worker_conf));
 		c->params = g_hash_table_new (rspamd_str_hash, rspamd_str_equal);
 		c->active_workers = g_queue_new ();
+		c->pin_cpu_base = -1;
 #ifdef HAVE_SC_NPROCESSORS_ONLN
 		c->count = MIN (DEFAULT_MAX_WORKERS,
 				MAX (1, sysconf (_SC_NPROCESSORS_ONLN) - 2));
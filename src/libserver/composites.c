@@ -392,7 +392,7 @@ rspamd_composite_expr_process (void *ud,
 	if (isset (cd->checked, cd->composite->id * 2)) {
 		/* We have already checked this composite, so just return its value */
 		if (isset (cd->checked, cd->composite->id * 2 + 1)) {
-			ms = rspamd_task_find_symbol_result (cd->task, sym);
+			ms = rspamd_task_find_symbol_result (cd->task, cd->composite->sym);
 		}
 
 		if (ms) {
@@ -21,6 +21,11 @@
 #include "utlist.h"
 #include "unix-std.h"
 #include "mempool_vars_internal.h"
+#include "libutil/hash.h"
+
+#ifdef __x86_64__
+#include <emmintrin.h>
+#endif
 
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
@@ -111,6 +116,7 @@ struct rspamd_dkim_common_ctx {
 	GHashTable *htable; /* header -> count mapping */
 	EVP_MD_CTX *headers_hash;
 	EVP_MD_CTX *body_hash;
+	gboolean body_hashed; /* body_hash was fed by the precompute pipeline */
 	enum rspamd_dkim_type type;
 	guint idx;
 };
@@ -1598,6 +1604,7 @@ rspamd_get_dkim_key (rspamd_dkim_context_t *ctx,
 
 static gboolean
 rspamd_dkim_relaxed_body_step (struct rspamd_dkim_common_ctx *ctx, EVP_MD_CTX *ck,
+		GByteArray *cache,
 		const gchar **start, guint size,
 		guint *remain)
 {
@@ -1661,6 +1668,11 @@ rspamd_dkim_relaxed_body_step (struct rspamd_dkim_common_ctx *ctx, EVP_MD_CTX *c
 	if (*remain > 0) {
 		size_t cklen = MIN(t - buf, *remain + added);
 		EVP_DigestUpdate (ck, buf, cklen);
+
+		if (cache) {
+			g_byte_array_append (cache, buf, cklen);
+		}
+
 		*remain = *remain - (cklen - added);
 #if 0
 		msg_debug_dkim ("update signature with buffer (%ud size, %ud remain, %ud added): %*s",
@@ -1677,7 +1689,7 @@ rspamd_dkim_relaxed_body_step (struct rspamd_dkim_common_ctx *ctx, EVP_MD_CTX *c
 
 static gboolean
 rspamd_dkim_simple_body_step (struct rspamd_dkim_common_ctx *ctx,
-		EVP_MD_CTX *ck, const gchar **start, guint size,
+		EVP_MD_CTX *ck, GByteArray *cache, const gchar **start, guint size,
 		guint *remain)
 {
 	const gchar *h;
@@ -1715,6 +1727,11 @@ rspamd_dkim_simple_body_step (struct rspamd_dkim_common_ctx *ctx,
 	if (*remain > 0) {
 		size_t cklen = MIN(t - buf, *remain + added);
 		EVP_DigestUpdate (ck, buf, cklen);
+
+		if (cache) {
+			g_byte_array_append (cache, buf, cklen);
+		}
+
 		*remain = *remain - (cklen - added);
 		msg_debug_dkim ("update signature with body buffer "
 				"(%ud size, %ud remain, %ud added)",
@@ -1893,15 +1910,61 @@ end:
 	return p;
 }
 
+/*
+ * Looks up (or creates) the per-task cache of the canonical body stream
+ * keyed by canon type and body length limit: messages signed multiple
+ * times redo identical canonicalization work otherwise
+ */
+static GByteArray *
+rspamd_dkim_canon_stream_cached (struct rspamd_dkim_common_ctx *ctx,
+		struct rspamd_task *task,
+		gsize blen,
+		gboolean *found)
+{
+	gchar typebuf[64];
+	GByteArray *res;
+
+	rspamd_snprintf (typebuf, sizeof (typebuf),
+			RSPAMD_MEMPOOL_DKIM_CANON_CACHE "%s_%z",
+			ctx->body_canon_type == DKIM_CANON_RELAXED ? "1" : "0",
+			ctx->len);
+
+	res = rspamd_mempool_get_variable (task->task_pool, typebuf);
+
+	if (res) {
+		*found = TRUE;
+	}
+	else {
+		*found = FALSE;
+
+		if (blen == 0) {
+			/* Lookup merely, do not create an empty stream */
+			return NULL;
+		}
+
+		res = g_byte_array_sized_new (blen);
+		rspamd_mempool_add_destructor (task->task_pool,
+				(rspamd_mempool_destruct_t)g_byte_array_unref, res);
+		rspamd_mempool_set_variable (task->task_pool,
+				rspamd_mempool_strdup (task->task_pool, typebuf), res, NULL);
+	}
+
+	return res;
+}
+
 static gboolean
 rspamd_dkim_canonize_body (struct rspamd_dkim_common_ctx *ctx,
+	struct rspamd_task *task,
 	const gchar *start,
 	const gchar *end,
 	gboolean sign)
 {
 	const gchar *p;
 	guint remain = ctx->len ? ctx->len : (guint)(end - start);
-	gboolean need_crlf = FALSE;
+	gboolean need_crlf = FALSE, cached = FALSE;
+	GByteArray *canon_stream = NULL;
+	/* Chunk size for the cached stream replay, keeps the data in L2 */
+	const gsize replay_chunk = 128 * 1024;
 
 	if (start == NULL) {
 		/* Empty body */
@@ -1928,28 +1991,51 @@ rspamd_dkim_canonize_body (struct rspamd_dkim_common_ctx *ctx,
 			}
 		}
 		else {
+			if (task) {
+				canon_stream = rspamd_dkim_canon_stream_cached (ctx, task,
+						end - start, &cached);
+			}
+
+			if (cached) {
+				/* Feed the hash with the canonical stream produced by
+				 * some previous signature with the same canon settings */
+				gsize off, rem = canon_stream->len;
+
+				for (off = 0; off < canon_stream->len; off += replay_chunk) {
+					EVP_DigestUpdate (ctx->body_hash,
+							canon_stream->data + off,
+							MIN (replay_chunk, rem));
+					rem -= MIN (replay_chunk, rem);
+				}
+
+				msg_debug_dkim ("reused cached canonical body stream "
+						"of %ud bytes", (guint)canon_stream->len);
+
+				return TRUE;
+			}
+
 			if (ctx->body_canon_type == DKIM_CANON_SIMPLE) {
 				/* Simple canonization */
 				while (rspamd_dkim_simple_body_step (ctx, ctx->body_hash,
-						&start, end - start, &remain));
+						canon_stream, &start, end - start, &remain));
 
 				if (need_crlf) {
 					start = "\r\n";
 					end = start + 2;
 					remain = 2;
 					rspamd_dkim_simple_body_step (ctx, ctx->body_hash,
-							&start, end - start, &remain);
+							canon_stream, &start, end - start, &remain);
 				}
 			}
 			else {
 				while (rspamd_dkim_relaxed_body_step (ctx, ctx->body_hash,
-						&start, end - start, &remain)) ;
+						canon_stream, &start, end - start, &remain)) ;
 				if (need_crlf) {
 					start = "\r\n";
 					end = start + 2;
 					remain = 2;
 					rspamd_dkim_relaxed_body_step (ctx, ctx->body_hash,
-							&start, end - start, &remain);
+							canon_stream, &start, end - start, &remain);
 				}
 			}
 		}
@@ -2055,11 +2141,40 @@ rspamd_dkim_canonize_header_relaxed_str (const gchar *hname,
 	gchar *t;
 	const guchar *h;
 	gboolean got_sp;
+#ifdef __x86_64__
+	gsize hlen;
+	const guchar *hend;
+#endif
 
 	/* Name part */
 	t = out;
 	h = hname;
 
+#ifdef __x86_64__
+	/*
+	 * Vectorized lowercase: ascii uppercase letters are the only bytes
+	 * relaxed canonicalization changes in header names. SSE2 is the
+	 * baseline on this architecture, so no dispatch is needed
+	 */
+	hlen = strlen (hname);
+
+	if (hlen < outlen) {
+		while (hlen >= 16) {
+			__m128i in = _mm_loadu_si128 ((const __m128i *)h);
+			__m128i upper = _mm_and_si128 (
+					_mm_cmpgt_epi8 (in, _mm_set1_epi8 ('A' - 1)),
+					_mm_cmplt_epi8 (in, _mm_set1_epi8 ('Z' + 1)));
+
+			_mm_storeu_si128 ((__m128i *)t,
+					_mm_or_si128 (in,
+							_mm_and_si128 (upper, _mm_set1_epi8 (0x20))));
+			h += 16;
+			t += 16;
+			hlen -= 16;
+		}
+	}
+#endif
+
 	while (*h && t - out < outlen) {
 		*t++ = lc_map[*h++];
 	}
@@ -2078,8 +2193,35 @@ rspamd_dkim_canonize_header_relaxed_str (const gchar *hname,
 	}
 
 	got_sp = FALSE;
+#ifdef __x86_64__
+	hend = (const guchar *)hvalue + strlen (hvalue);
+#endif
 
 	while (*h && (t - out < outlen))  {
+#ifdef __x86_64__
+		/*
+		 * Whitespace run detection over 16 byte blocks: blocks without
+		 * any whitespace (the vast majority of header value bytes) are
+		 * copied vector wise, blocks containing runs take the byte path
+		 */
+		if (hend - h >= 16 && (gsize)(t - out) + 16 <= outlen) {
+			__m128i in = _mm_loadu_si128 ((const __m128i *)h);
+			__m128i ws = _mm_or_si128 (
+					_mm_cmpeq_epi8 (in, _mm_set1_epi8 (' ')),
+					_mm_and_si128 (
+							_mm_cmpgt_epi8 (in, _mm_set1_epi8 (0x08)),
+							_mm_cmplt_epi8 (in, _mm_set1_epi8 (0x0E))));
+
+			if (_mm_movemask_epi8 (ws) == 0) {
+				_mm_storeu_si128 ((__m128i *)t, in);
+				h += 16;
+				t += 16;
+				got_sp = FALSE;
+				continue;
+			}
+		}
+#endif
+
 		if (g_ascii_isspace (*h)) {
 			if (got_sp) {
 				h++;
@@ -2326,6 +2468,113 @@ rspamd_dkim_check_bh_cached (struct rspamd_dkim_common_ctx *ctx,
 	return res;
 }
 
+static void
+rspamd_dkim_body_hash_consumer (void *ud, const guchar *data, gsize len)
+{
+	EVP_DigestUpdate ((EVP_MD_CTX *)ud, data, len);
+}
+
+void
+rspamd_dkim_precompute_body_hashes (struct rspamd_task *task, GPtrArray *ctxs)
+{
+	rspamd_dkim_context_t *ctx, *first = NULL;
+	struct rspamd_dkim_cached_hash *bh;
+	struct rspamd_cryptobox_multi_hash mh;
+	const gchar *body_start, *body_end;
+	GByteArray *canon_stream;
+	gboolean found = FALSE;
+	gsize dlen;
+	guint i;
+
+	if (ctxs == NULL || ctxs->len < 2 || task->msg.len == 0 ||
+			task->message == NULL) {
+		return;
+	}
+
+	body_end = task->msg.begin + task->msg.len;
+	body_start = MESSAGE_FIELD (task, raw_headers_content).body_start;
+
+	if (!body_start) {
+		return;
+	}
+
+	rspamd_cryptobox_multi_hash_init (&mh);
+
+	/*
+	 * The body hash depends on the signature parameters merely, not on the
+	 * key, so all pending signatures can be hashed here in one go: the
+	 * first one canonizes the body (caching the canonical stream), and the
+	 * rest consume that stream simultaneously chunk by chunk instead of
+	 * replaying it once per signature later
+	 */
+	for (i = 0; i < ctxs->len; i ++) {
+		ctx = g_ptr_array_index (ctxs, i);
+
+		if (ctx->common.type == RSPAMD_DKIM_ARC_SEAL ||
+				ctx->common.body_hashed) {
+			continue;
+		}
+
+		dlen = EVP_MD_CTX_size (ctx->common.body_hash);
+		bh = rspamd_dkim_check_bh_cached (&ctx->common, task, dlen, FALSE);
+
+		if (bh->digest_normal) {
+			continue;
+		}
+
+		if (first == NULL) {
+			if (!rspamd_dkim_canonize_body (&ctx->common, task, body_start,
+					body_end, FALSE)) {
+				return;
+			}
+
+			ctx->common.body_hashed = TRUE;
+			first = ctx;
+			continue;
+		}
+
+		/* Only signatures with the same canon settings share the stream */
+		if (ctx->common.body_canon_type != first->common.body_canon_type ||
+				ctx->common.len != first->common.len) {
+			continue;
+		}
+
+		if (!rspamd_cryptobox_multi_hash_add (&mh,
+				rspamd_dkim_body_hash_consumer, ctx->common.body_hash)) {
+			break;
+		}
+
+		ctx->common.body_hashed = TRUE;
+	}
+
+	if (mh.nconsumers == 0) {
+		return;
+	}
+
+	canon_stream = rspamd_dkim_canon_stream_cached (&first->common, task,
+			0, &found);
+
+	if (!found) {
+		/* Canonization did not produce a stream (e.g. empty body), so
+		 * the joined signatures must fall back to the lazy path */
+		for (i = 0; i < ctxs->len; i ++) {
+			ctx = g_ptr_array_index (ctxs, i);
+
+			if (ctx != first) {
+				ctx->common.body_hashed = FALSE;
+			}
+		}
+
+		return;
+	}
+
+	rspamd_cryptobox_multi_hash_update (&mh, canon_stream->data,
+			canon_stream->len);
+
+	msg_debug_dkim_taskless ("computed %d body hashes in a single pass "
+			"over %ud bytes", mh.nconsumers + 1, (guint)canon_stream->len);
+}
+
 /**
  * Check task for dkim context using dkim key
  * @param ctx dkim verify context
@@ -2333,6 +2582,23 @@ rspamd_dkim_check_bh_cached (struct rspamd_dkim_common_ctx *ctx,
  * @param task task to check
  * @return
  */
+static guint
+rspamd_dkim_vkey_hash (gconstpointer p)
+{
+	guint h;
+
+	/* The key is a blake2 digest, any slice of it is well distributed */
+	memcpy (&h, p, sizeof (h));
+
+	return h;
+}
+
+static gboolean
+rspamd_dkim_vkey_equal (gconstpointer a, gconstpointer b)
+{
+	return memcmp (a, b, rspamd_cryptobox_HASHBYTES) == 0;
+}
+
 struct rspamd_dkim_check_result *
 rspamd_dkim_check (rspamd_dkim_context_t *ctx,
 	rspamd_dkim_key_t *key,
@@ -2375,10 +2641,10 @@ rspamd_dkim_check (rspamd_dkim_context_t *ctx,
 		cached_bh = rspamd_dkim_check_bh_cached (&ctx->common, task,
 				dlen, FALSE);
 
-		if (!cached_bh->digest_normal) {
+		if (!cached_bh->digest_normal && !ctx->common.body_hashed) {
 			/* Start canonization of body part */
-			if (!rspamd_dkim_canonize_body (&ctx->common, body_start, body_end,
-					FALSE)) {
+			if (!rspamd_dkim_canonize_body (&ctx->common, task, body_start,
+					body_end, FALSE)) {
 				res->rcode = DKIM_RECORD_ERROR;
 				return res;
 			}
@@ -2548,31 +2814,84 @@ rspamd_dkim_check (rspamd_dkim_context_t *ctx,
 		nid = NID_sha1;
 	}
 
-	switch (key->type) {
-	case RSPAMD_DKIM_KEY_RSA:
-		if (RSA_verify (nid, raw_digest, dlen, ctx->b, ctx->blen,
-				key->key.key_rsa) != 1) {
-			msg_debug_dkim ("rsa verify failed");
+	/*
+	 * Memoize asymmetric verification results: duplicate messages (MX
+	 * mirroring, user forwarding) re-verify bit identical signatures over
+	 * identical digests, and each RSA verify blocks the loop for up to a
+	 * millisecond. The memo caches a security decision, so the key must
+	 * be collision resistant against adversarial inputs: it is the full
+	 * blake2 digest of the signature, the header hash and the key
+	 * material, keyed with a random per process secret, so offline
+	 * collision search is not possible.
+	 */
+	static rspamd_lru_hash_t *verify_cache = NULL;
+	static guchar vkey_secret[rspamd_cryptobox_HASHBYTES];
+	rspamd_cryptobox_hash_state_t vst;
+	guchar vkey[rspamd_cryptobox_HASHBYTES];
+	guchar vtype;
+	gpointer vres;
+
+	if (verify_cache == NULL) {
+		verify_cache = rspamd_lru_hash_new_full (1024, g_free, NULL,
+				rspamd_dkim_vkey_hash, rspamd_dkim_vkey_equal);
+		ottery_rand_bytes (vkey_secret, sizeof (vkey_secret));
+	}
+
+	vtype = (guchar)key->type;
+	rspamd_cryptobox_hash_init (&vst, vkey_secret, sizeof (vkey_secret));
+	rspamd_cryptobox_hash_update (&vst, &vtype, sizeof (vtype));
+	rspamd_cryptobox_hash_update (&vst, ctx->b, ctx->blen);
+	rspamd_cryptobox_hash_update (&vst, raw_digest, dlen);
+	rspamd_cryptobox_hash_update (&vst, key->keydata, key->keylen);
+	rspamd_cryptobox_hash_final (&vst, vkey);
+
+	vres = rspamd_lru_hash_lookup (verify_cache, vkey, 0);
+
+	if (vres != NULL) {
+		if (GPOINTER_TO_INT (vres) != 1) {
+			msg_debug_dkim ("signature verify failed (cached)");
 			res->rcode = DKIM_REJECT;
-			res->fail_reason = "rsa verify failed";
+			res->fail_reason = "signature verify failed";
 		}
-		break;
-	case RSPAMD_DKIM_KEY_ECDSA:
-		if (ECDSA_verify (nid, raw_digest, dlen, ctx->b, ctx->blen,
-				key->key.key_ecdsa) != 1) {
-			msg_debug_dkim ("ecdsa verify failed");
-			res->rcode = DKIM_REJECT;
-			res->fail_reason = "ecdsa verify failed";
-		}
-		break;
-	case RSPAMD_DKIM_KEY_EDDSA:
-		if (!rspamd_cryptobox_verify (ctx->b, ctx->blen, raw_digest, dlen,
-				key->key.key_eddsa, RSPAMD_CRYPTOBOX_MODE_25519)) {
-			msg_debug_dkim ("eddsa verify failed");
-			res->rcode = DKIM_REJECT;
-			res->fail_reason = "eddsa verify failed";
+	}
+	else {
+		gboolean verified = TRUE;
+
+		switch (key->type) {
+		case RSPAMD_DKIM_KEY_RSA:
+			if (RSA_verify (nid, raw_digest, dlen, ctx->b, ctx->blen,
+					key->key.key_rsa) != 1) {
+				msg_debug_dkim ("rsa verify failed");
+				res->rcode = DKIM_REJECT;
+				res->fail_reason = "rsa verify failed";
+				verified = FALSE;
+			}
+			break;
+		case RSPAMD_DKIM_KEY_ECDSA:
+			if (ECDSA_verify (nid, raw_digest, dlen, ctx->b, ctx->blen,
+					key->key.key_ecdsa) != 1) {
+				msg_debug_dkim ("ecdsa verify failed");
+				res->rcode = DKIM_REJECT;
+				res->fail_reason = "ecdsa verify failed";
+				verified = FALSE;
+			}
+			break;
+		case RSPAMD_DKIM_KEY_EDDSA:
+			if (!rspamd_cryptobox_verify (ctx->b, ctx->blen, raw_digest, dlen,
+					key->key.key_eddsa, RSPAMD_CRYPTOBOX_MODE_25519)) {
+				msg_debug_dkim ("eddsa verify failed");
+				res->rcode = DKIM_REJECT;
+				res->fail_reason = "eddsa verify failed";
+				verified = FALSE;
+			}
+			break;
 		}
-		break;
+
+		guchar *vkey_copy = g_malloc (sizeof (vkey));
+
+		memcpy (vkey_copy, vkey, sizeof (vkey));
+		rspamd_lru_hash_insert (verify_cache, vkey_copy,
+				GINT_TO_POINTER (verified ? 1 : 2), 0, 0);
 	}
 
 
@@ -2622,6 +2941,20 @@ rspamd_dkim_key_ref (rspamd_dkim_key_t *k)
 	return k;
 }
 
+const guchar *
+rspamd_dkim_key_get_raw (rspamd_dkim_key_t *k, gsize *len)
+{
+	*len = k->decoded_len;
+
+	return k->keydata;
+}
+
+enum rspamd_dkim_key_type
+rspamd_dkim_key_type (rspamd_dkim_key_t *k)
+{
+	return k->type;
+}
+
 void
 rspamd_dkim_key_unref (rspamd_dkim_key_t *k)
 {
@@ -2973,8 +3306,8 @@ rspamd_dkim_sign (struct rspamd_task *task, const gchar *selector,
 
 		if (!cached_bh->digest_normal) {
 			/* Start canonization of body part */
-			if (!rspamd_dkim_canonize_body (&ctx->common, body_start, body_end,
-					TRUE)) {
+			if (!rspamd_dkim_canonize_body (&ctx->common, task, body_start,
+					body_end, TRUE)) {
 				return NULL;
 			}
 		}
@@ -222,6 +222,16 @@ gboolean rspamd_get_dkim_key (rspamd_dkim_context_t *ctx,
  * @param task task to check
  * @return
  */
+/**
+ * Precomputes body hashes for a set of parsed signatures in a single pass:
+ * the canonical body stream is produced once and all pending hash states
+ * consume it chunk by chunk instead of one replay per signature
+ * @param task task to check
+ * @param ctxs array of rspamd_dkim_context_t
+ */
+void rspamd_dkim_precompute_body_hashes (struct rspamd_task *task,
+	GPtrArray *ctxs);
+
 struct rspamd_dkim_check_result *rspamd_dkim_check (rspamd_dkim_context_t *ctx,
 													rspamd_dkim_key_t *key,
 													struct rspamd_task *task);
@@ -242,6 +252,18 @@ GString *rspamd_dkim_sign (struct rspamd_task *task,
 
 rspamd_dkim_key_t *rspamd_dkim_key_ref (rspamd_dkim_key_t *k);
 
+/**
+ * Returns the decoded key material of the key (for cache serialization)
+ * @param k key
+ * @param len decoded length output
+ */
+const guchar *rspamd_dkim_key_get_raw (rspamd_dkim_key_t *k, gsize *len);
+
+/**
+ * Returns the type of the key
+ */
+enum rspamd_dkim_key_type rspamd_dkim_key_type (rspamd_dkim_key_t *k);
+
 void rspamd_dkim_key_unref (rspamd_dkim_key_t *k);
 
 rspamd_dkim_sign_key_t *rspamd_dkim_sign_key_ref (rspamd_dkim_sign_key_t *k);
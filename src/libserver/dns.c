@@ -26,6 +26,25 @@
 
 static const gchar *M = "rspamd dns";
 
+/*
+ * In-process DNS answers cache: both positive and negative entries are
+ * stored, lifetime is driven by the reply TTLs. Consulted before librdns
+ * as repeated RBL queries dominate the scan latency.
+ */
+#define DNS_CACHE_SIZE 4096
+/* Lifetime of negative replies that carry no TTL */
+static const guint dns_cache_negative_ttl = 60;
+/* Upper bound for the positive TTL to limit staleness */
+static const guint dns_cache_max_ttl = 3600;
+
+struct rspamd_dns_cache_entry {
+	struct rdns_reply_entry *entries;
+	enum dns_rcode code;
+	ref_entry_t ref;
+};
+
+static void rspamd_dns_fin_cb (gpointer arg);
+
 static struct rdns_upstream_elt* rspamd_dns_select_upstream (const char *name,
 		size_t len, void *ups_data);
 static struct rdns_upstream_elt* rspamd_dns_select_upstream_retransmit (
@@ -46,6 +65,14 @@ static struct rdns_upstream_context rspamd_ups_ctx = {
 		.data = NULL
 };
 
+/* Extra callbacks piggybacked on an identical in-flight request */
+struct rspamd_dns_extra_cb {
+	dns_callback_type cb;
+	gpointer ud;
+	struct rspamd_symcache_item *item;
+	struct rspamd_dns_extra_cb *next;
+};
+
 struct rspamd_dns_request_ud {
 	struct rspamd_async_session *session;
 	dns_callback_type cb;
@@ -53,42 +80,261 @@ struct rspamd_dns_request_ud {
 	rspamd_mempool_t *pool;
 	struct rspamd_task *task;
 	struct rspamd_symcache_item *item;
+	struct rspamd_dns_resolver *resolver;
 	struct rdns_request *req;
 	struct rdns_reply *reply;
+	struct rspamd_dns_extra_cb *extra_cbs;
+	GHashTable *dedup_tbl;
+	const gchar *dedup_key;
+	/* Used to deliver cached replies asynchronously */
+	struct rspamd_dns_cache_entry *cached_entry;
+	struct rdns_request_name cached_name;
+	struct rdns_request cached_req;
+	ev_timer cached_ev;
 };
 
+static void
+rspamd_dns_cache_entry_dtor (struct rspamd_dns_cache_entry *entry)
+{
+	struct rdns_reply_entry *elt, *tmp;
+
+	DL_FOREACH_SAFE (entry->entries, elt, tmp) {
+		switch (elt->type) {
+		case RDNS_REQUEST_PTR:
+			g_free (elt->content.ptr.name);
+			break;
+		case RDNS_REQUEST_NS:
+			g_free (elt->content.ns.name);
+			break;
+		case RDNS_REQUEST_MX:
+			g_free (elt->content.mx.name);
+			break;
+		case RDNS_REQUEST_TXT:
+		case RDNS_REQUEST_SPF:
+			g_free (elt->content.txt.data);
+			break;
+		case RDNS_REQUEST_SRV:
+			g_free (elt->content.srv.target);
+			break;
+		case RDNS_REQUEST_SOA:
+			g_free (elt->content.soa.mname);
+			g_free (elt->content.soa.admin);
+			break;
+		case RDNS_REQUEST_TLSA:
+			g_free (elt->content.tlsa.data);
+			break;
+		default:
+			break;
+		}
+
+		g_free (elt);
+	}
+
+	g_free (entry);
+}
+
+static void
+rspamd_dns_cache_entry_unref (gpointer p)
+{
+	struct rspamd_dns_cache_entry *entry = p;
+
+	REF_RELEASE (entry);
+}
+
+static void
+rspamd_dns_cache_key (gchar *buf, gsize buflen,
+		enum rdns_request_type type, const gchar *name)
+{
+	rspamd_snprintf (buf, buflen, "%d:%s", (gint)type, name);
+}
+
+static void
+rspamd_dns_cache_store (struct rspamd_dns_resolver *resolver,
+		enum rdns_request_type type,
+		const gchar *name,
+		struct rdns_reply *reply)
+{
+	struct rspamd_dns_cache_entry *entry;
+	struct rdns_reply_entry *elt, *celt;
+	gchar keybuf[512];
+	guint ttl = 0;
+
+	if (reply->code == RDNS_RC_NOERROR) {
+		if (reply->entries == NULL) {
+			return;
+		}
+
+		ttl = dns_cache_max_ttl;
+
+		DL_FOREACH (reply->entries, elt) {
+			if (elt->ttl > 0 && (guint)elt->ttl < ttl) {
+				ttl = elt->ttl;
+			}
+		}
+	}
+	else if (reply->code == RDNS_RC_NXDOMAIN ||
+			 reply->code == RDNS_RC_NOREC) {
+		/* Negative caching */
+		ttl = dns_cache_negative_ttl;
+	}
+	else {
+		/* Transient errors are not cached */
+		return;
+	}
+
+	if (ttl == 0) {
+		return;
+	}
+
+	entry = g_malloc0 (sizeof (*entry));
+	entry->code = reply->code;
+	REF_INIT_RETAIN (entry, rspamd_dns_cache_entry_dtor);
+
+	DL_FOREACH (reply->entries, elt) {
+		celt = g_malloc0 (sizeof (*celt));
+		memcpy (&celt->content, &elt->content, sizeof (celt->content));
+		celt->type = elt->type;
+		celt->ttl = elt->ttl;
+
+		switch (elt->type) {
+		case RDNS_REQUEST_PTR:
+			celt->content.ptr.name = g_strdup (elt->content.ptr.name);
+			break;
+		case RDNS_REQUEST_NS:
+			celt->content.ns.name = g_strdup (elt->content.ns.name);
+			break;
+		case RDNS_REQUEST_MX:
+			celt->content.mx.name = g_strdup (elt->content.mx.name);
+			break;
+		case RDNS_REQUEST_TXT:
+		case RDNS_REQUEST_SPF:
+			celt->content.txt.data = g_strdup (elt->content.txt.data);
+			break;
+		case RDNS_REQUEST_SRV:
+			celt->content.srv.target = g_strdup (elt->content.srv.target);
+			break;
+		case RDNS_REQUEST_SOA:
+			celt->content.soa.mname = g_strdup (elt->content.soa.mname);
+			celt->content.soa.admin = g_strdup (elt->content.soa.admin);
+			break;
+		case RDNS_REQUEST_TLSA:
+			celt->content.tlsa.data = g_memdup (elt->content.tlsa.data,
+					elt->content.tlsa.datalen);
+			break;
+		default:
+			break;
+		}
+
+		DL_APPEND (entry->entries, celt);
+	}
+
+	rspamd_dns_cache_key (keybuf, sizeof (keybuf), type, name);
+	rspamd_lru_hash_insert (resolver->cache, g_strdup (keybuf), entry,
+			time (NULL), ttl);
+}
+
+static void
+rspamd_dns_cached_timer_cb (EV_P_ ev_timer *w, int revents)
+{
+	struct rspamd_dns_request_ud *reqdata =
+			(struct rspamd_dns_request_ud *)w->data;
+
+	ev_timer_stop (EV_A_ w);
+
+	if (reqdata->session) {
+		rspamd_session_remove_event (reqdata->session, rspamd_dns_fin_cb,
+				reqdata);
+	}
+	else {
+		rspamd_dns_fin_cb (reqdata);
+	}
+}
+
 static void
 rspamd_dns_fin_cb (gpointer arg)
 {
 	struct rspamd_dns_request_ud *reqdata = (struct rspamd_dns_request_ud *)arg;
+	struct rspamd_dns_extra_cb *ecb;
+	struct rdns_reply fake_reply, *reply_ptr;
+
+	/*
+	 * The session finalizer can run before the cached delivery timer has
+	 * fired (e.g. synchronous task teardown); stop it before reqdata is
+	 * freed, otherwise libev fires on freed memory. Stopping an inactive
+	 * timer is a no-op, so this is safe for the uncached path as well
+	 */
+	ev_timer_stop (reqdata->resolver->event_loop, &reqdata->cached_ev);
+
+	if (reqdata->dedup_tbl) {
+		/* No more piggybacking on this request */
+		g_hash_table_remove (reqdata->dedup_tbl, reqdata->dedup_key);
+		reqdata->dedup_tbl = NULL;
+	}
 
 	if (reqdata->item) {
 		rspamd_symcache_set_cur_item (reqdata->task, reqdata->item);
 	}
 
-	if (reqdata->reply) {
-		reqdata->cb (reqdata->reply, reqdata->ud);
+	if (reqdata->cached_entry) {
+		/* Deliver a reply from the cache */
+		memset (&fake_reply, 0, sizeof (fake_reply));
+		fake_reply.code = reqdata->cached_entry->code;
+		fake_reply.entries = reqdata->cached_entry->entries;
+		fake_reply.request = &reqdata->cached_req;
+		fake_reply.resolver = reqdata->resolver->r;
+		fake_reply.requested_name = reqdata->cached_name.name;
+
+		reply_ptr = &fake_reply;
+	}
+	else if (reqdata->reply) {
+		reply_ptr = reqdata->reply;
 	}
 	else {
-		struct rdns_reply fake_reply;
-
 		memset (&fake_reply, 0, sizeof (fake_reply));
 		fake_reply.code = RDNS_RC_TIMEOUT;
 		fake_reply.request = reqdata->req;
 		fake_reply.resolver = reqdata->req->resolver;
 		fake_reply.requested_name = reqdata->req->requested_names[0].name;
 
-		reqdata->cb (&fake_reply, reqdata->ud);
+		reply_ptr = &fake_reply;
 	}
 
-	rdns_request_release (reqdata->req);
+	reqdata->cb (reply_ptr, reqdata->ud);
+
+	/* Fan the very same reply out to the piggybacked requests */
+	LL_FOREACH (reqdata->extra_cbs, ecb) {
+		if (ecb->item) {
+			rspamd_symcache_set_cur_item (reqdata->task, ecb->item);
+		}
+
+		ecb->cb (reply_ptr, ecb->ud);
+	}
+
+	if (reqdata->cached_entry) {
+		REF_RELEASE (reqdata->cached_entry);
+	}
+
+	if (reqdata->req) {
+		rdns_request_release (reqdata->req);
+	}
 
 	if (reqdata->item) {
 		rspamd_symcache_item_async_dec_check (reqdata->task,
 				reqdata->item, M);
 	}
 
+	LL_FOREACH (reqdata->extra_cbs, ecb) {
+		if (ecb->item) {
+			rspamd_symcache_item_async_dec_check (reqdata->task,
+					ecb->item, M);
+		}
+	}
+
 	if (reqdata->pool == NULL) {
+		if (reqdata->cached_entry) {
+			g_free (reqdata->cached_name.name);
+		}
+
 		g_free (reqdata);
 	}
 }
@@ -100,6 +346,14 @@ rspamd_dns_callback (struct rdns_reply *reply, gpointer ud)
 
 	reqdata->reply = reply;
 
+	if (reqdata->resolver && reqdata->resolver->cache &&
+		reply->request && reply->request->qcount > 0) {
+		rspamd_dns_cache_store (reqdata->resolver,
+				reply->request->requested_names[0].type,
+				reply->request->requested_names[0].name,
+				reply);
+	}
+
 	if (reqdata->session) {
 		/*
 		 * Ref event to avoid double unref by
@@ -117,6 +371,15 @@ rspamd_dns_callback (struct rdns_reply *reply, gpointer ud)
 	}
 }
 
+void
+rspamd_dns_resolver_attach_stat (struct rspamd_dns_resolver *resolver,
+		struct rspamd_stat *st)
+{
+	if (resolver) {
+		resolver->stat = st;
+	}
+}
+
 struct rspamd_dns_request_ud *
 rspamd_dns_resolver_request (struct rspamd_dns_resolver *resolver,
 							 struct rspamd_async_session *session,
@@ -151,6 +414,62 @@ rspamd_dns_resolver_request (struct rspamd_dns_resolver *resolver,
 	reqdata->session = session;
 	reqdata->cb = cb;
 	reqdata->ud = ud;
+	reqdata->resolver = resolver;
+
+	if (resolver->cache) {
+		struct rspamd_dns_cache_entry *entry;
+		gchar keybuf[512];
+
+		rspamd_dns_cache_key (keybuf, sizeof (keybuf), type, name);
+		entry = rspamd_lru_hash_lookup (resolver->cache, keybuf, time (NULL));
+
+		if (entry) {
+			/*
+			 * Cache hit: deliver the stored reply via a zero timer to
+			 * keep the asynchronous contract for the caller
+			 */
+			if (resolver->stat) {
+				__atomic_add_fetch (&resolver->stat->dns_cache_hits, 1,
+						__ATOMIC_RELAXED);
+			}
+
+			REF_RETAIN (entry);
+			reqdata->cached_entry = entry;
+
+			if (pool) {
+				reqdata->cached_name.name = rspamd_mempool_strdup (pool, name);
+			}
+			else {
+				reqdata->cached_name.name = g_strdup (name);
+				/* Freed with the fake request name below */
+			}
+
+			reqdata->cached_name.type = type;
+			reqdata->cached_name.len = strlen (name);
+			reqdata->cached_req.resolver = resolver->r;
+			reqdata->cached_req.type = type;
+			reqdata->cached_req.requested_names = &reqdata->cached_name;
+			reqdata->cached_req.qcount = 1;
+
+			if (session) {
+				rspamd_session_add_event (session,
+						(event_finalizer_t) rspamd_dns_fin_cb,
+						reqdata,
+						M);
+			}
+
+			reqdata->cached_ev.data = reqdata;
+			ev_timer_init (&reqdata->cached_ev, rspamd_dns_cached_timer_cb,
+					0.0, 0.0);
+			ev_timer_start (resolver->event_loop, &reqdata->cached_ev);
+
+			return reqdata;
+		}
+		else if (resolver->stat) {
+			__atomic_add_fetch (&resolver->stat->dns_cache_misses, 1,
+					__ATOMIC_RELAXED);
+		}
+	}
 
 	req = rdns_make_request_full (resolver->r, rspamd_dns_callback, reqdata,
 			resolver->request_timeout, resolver->max_retransmits, 1, name,
@@ -191,6 +510,53 @@ make_dns_request_task_common (struct rspamd_task *task,
 		return FALSE;
 	}
 
+	/*
+	 * Deduplicate identical requests within the task: several symbols
+	 * frequently resolve the same name (e.g. hop PTR records), so
+	 * piggyback additional callbacks on the in-flight request instead of
+	 * querying again
+	 */
+	GHashTable *dedup_tbl;
+	gchar *dedup_key;
+
+	dedup_tbl = rspamd_mempool_get_variable (task->task_pool, "dns_dedup");
+
+	if (dedup_tbl == NULL) {
+		dedup_tbl = g_hash_table_new (rspamd_strcase_hash,
+				rspamd_strcase_equal);
+		rspamd_mempool_set_variable (task->task_pool, "dns_dedup", dedup_tbl,
+				(rspamd_mempool_destruct_t)g_hash_table_unref);
+	}
+
+	dedup_key = rspamd_mempool_alloc (task->task_pool,
+			strlen (name) + sizeof ("255:"));
+	rspamd_snprintf (dedup_key, strlen (name) + sizeof ("255:"), "%d:%s",
+			(gint)type, name);
+
+	reqdata = g_hash_table_lookup (dedup_tbl, dedup_key);
+
+	if (reqdata != NULL) {
+		struct rspamd_dns_extra_cb *ecb;
+
+		ecb = rspamd_mempool_alloc0 (task->task_pool, sizeof (*ecb));
+		ecb->cb = cb;
+		ecb->ud = ud;
+		ecb->item = rspamd_symcache_get_cur_item (task);
+		LL_PREPEND (reqdata->extra_cbs, ecb);
+
+		if (ecb->item) {
+			rspamd_symcache_item_async_inc (task, ecb->item, M);
+		}
+
+		if (task->worker && task->worker->srv) {
+			__atomic_add_fetch (
+					&task->worker->srv->stat->dns_requests_coalesced, 1,
+					__ATOMIC_RELAXED);
+		}
+
+		return TRUE;
+	}
+
 	reqdata = rspamd_dns_resolver_request (task->resolver, task->s, task->task_pool, cb, ud,
 			type, name);
 
@@ -199,6 +565,9 @@ make_dns_request_task_common (struct rspamd_task *task,
 
 		reqdata->task = task;
 		reqdata->item = rspamd_symcache_get_cur_item (task);
+		reqdata->dedup_tbl = dedup_tbl;
+		reqdata->dedup_key = dedup_key;
+		g_hash_table_insert (dedup_tbl, dedup_key, reqdata);
 
 		if (reqdata->item) {
 			/* We are inside some session */
@@ -555,6 +924,8 @@ rspamd_dns_resolver_init (rspamd_logger_t *logger,
 
 	dns_resolver = g_malloc0 (sizeof (struct rspamd_dns_resolver));
 	dns_resolver->event_loop = ev_base;
+	dns_resolver->cache = rspamd_lru_hash_new (DNS_CACHE_SIZE, g_free,
+			rspamd_dns_cache_entry_unref);
 	if (cfg != NULL) {
 		dns_resolver->request_timeout = cfg->dns_timeout;
 		dns_resolver->max_retransmits = cfg->dns_retransmits;
@@ -22,6 +22,7 @@
 #include "async_session.h"
 #include "logger.h"
 #include "rdns.h"
+#include "libutil/hash.h"
 #include "upstream.h"
 
 #ifdef  __cplusplus
@@ -31,17 +32,29 @@ extern "C" {
 struct rspamd_config;
 struct rspamd_task;
 
+struct rspamd_stat;
+
 struct rspamd_dns_resolver {
 	struct rdns_resolver *r;
 	struct ev_loop *event_loop;
 	struct upstream_list *ups;
 	struct rspamd_config *cfg;
+	rspamd_lru_hash_t *cache;           /**< ttl driven answers cache			*/
+	struct rspamd_stat *stat;           /**< for cache hit/miss counters		*/
 	gdouble request_timeout;
 	guint max_retransmits;
 };
 
 /* Rspamd DNS API */
 
+struct rspamd_dns_resolver;
+
+/**
+ * Attaches the shared server stat to account dns cache hits and misses
+ */
+void rspamd_dns_resolver_attach_stat (struct rspamd_dns_resolver *resolver,
+									  struct rspamd_stat *st);
+
 /**
  * Init DNS resolver, params are obtained from a config file or system file /etc/resolv.conf
  */
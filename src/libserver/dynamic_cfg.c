@@ -213,9 +213,15 @@ json_config_fin_cb (struct map_cb_data *data, void **target)
 		return;
 	}
 
-	ucl_object_unref (jb->cfg->current_dynamic_conf);
+	/* Versioned swap: the new object fully replaces the previous one */
+	if (jb->cfg->current_dynamic_conf) {
+		ucl_object_unref (jb->cfg->current_dynamic_conf);
+	}
+
 	apply_dynamic_conf (top, jb->cfg);
 	jb->cfg->current_dynamic_conf = top;
+	msg_info ("applied dynamic configuration in-place: %d entries",
+			(gint)ucl_array_size (top));
 
 	if (target) {
 		*target = data->cur_data;
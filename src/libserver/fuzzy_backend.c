@@ -20,6 +20,7 @@
 #include "fuzzy_backend_redis.h"
 #include "cfg_file.h"
 #include "fuzzy_wire.h"
+#include "libutil/hash.h"
 
 #define DEFAULT_EXPIRE 172800L
 
@@ -111,8 +112,23 @@ struct rspamd_fuzzy_backend {
 	const struct rspamd_fuzzy_backend_subr *subr;
 	void *subr_ud;
 	ev_timer periodic_event;
+	/*
+	 * In-memory read cache for exact digest checks in front of sqlite:
+	 * the backend serializes on a single connection, so repeated checks
+	 * of the same digests should not touch it at all
+	 */
+	rspamd_lru_hash_t *check_cache;
+	guint64 cache_hits;
+	guint64 cache_misses;
 };
 
+#define FUZZY_BACKEND_CACHE_SIZE 65536
+/* Fallback lifetime of cached replies when no sync interval is set */
+#define FUZZY_BACKEND_CACHE_TTL 60
+
+static guint rspamd_fuzzy_digest_hash (gconstpointer key);
+static gboolean rspamd_fuzzy_digest_equal (gconstpointer v, gconstpointer v2);
+
 static GQuark
 rspamd_fuzzy_backend_quark (void)
 {
@@ -134,8 +150,22 @@ rspamd_fuzzy_backend_init_sqlite (struct rspamd_fuzzy_backend *bk,
 		return NULL;
 	}
 
-	return rspamd_fuzzy_backend_sqlite_open (ucl_object_tostring (elt),
+	struct rspamd_fuzzy_backend_sqlite *sq;
+
+	sq = rspamd_fuzzy_backend_sqlite_open (ucl_object_tostring (elt),
 			FALSE, err);
+
+	if (sq != NULL) {
+		elt = ucl_object_lookup_any (obj, "replication_journal",
+				"journal", NULL);
+
+		if (elt != NULL && ucl_object_type (elt) == UCL_STRING) {
+			rspamd_fuzzy_backend_sqlite_enable_journal (sq,
+					ucl_object_tostring (elt));
+		}
+	}
+
+	return sq;
 }
 
 static void
@@ -145,10 +175,37 @@ rspamd_fuzzy_backend_check_sqlite (struct rspamd_fuzzy_backend *bk,
 		void *subr_ud)
 {
 	struct rspamd_fuzzy_backend_sqlite *sq = subr_ud;
-	struct rspamd_fuzzy_reply rep;
+	struct rspamd_fuzzy_reply rep, *cached;
+
+	if (bk->check_cache && cmd->shingles_count == 0) {
+		cached = rspamd_lru_hash_lookup (bk->check_cache, cmd->digest,
+				time (NULL));
+
+		if (cached != NULL) {
+			bk->cache_hits ++;
+
+			if (cb) {
+				cb (cached, ud);
+			}
+
+			return;
+		}
+
+		bk->cache_misses ++;
+	}
 
 	rep = rspamd_fuzzy_backend_sqlite_check (sq, cmd, bk->expire);
 
+	if (bk->check_cache && cmd->shingles_count == 0) {
+		/* Both positive and missing replies are cached */
+		cached = g_malloc (sizeof (*cached));
+		memcpy (cached, &rep, sizeof (rep));
+		rspamd_lru_hash_insert (bk->check_cache,
+				g_memdup (cmd->digest, sizeof (cmd->digest)),
+				cached, time (NULL),
+				bk->sync > 0 ? (guint)bk->sync : FUZZY_BACKEND_CACHE_TTL);
+	}
+
 	if (cb) {
 		cb (&rep, ud);
 	}
@@ -312,6 +369,12 @@ rspamd_fuzzy_backend_create (struct ev_loop *ev_base,
 	bk->type = type;
 	bk->subr = &fuzzy_subrs[type];
 
+	if (type == RSPAMD_FUZZY_BACKEND_SQLITE) {
+		bk->check_cache = rspamd_lru_hash_new_full (FUZZY_BACKEND_CACHE_SIZE,
+				g_free, g_free,
+				rspamd_fuzzy_digest_hash, rspamd_fuzzy_digest_equal);
+	}
+
 	if ((bk->subr_ud = bk->subr->init (bk, config, cfg, err)) == NULL) {
 		g_free (bk);
 
@@ -441,6 +504,26 @@ rspamd_fuzzy_backend_process_updates (struct rspamd_fuzzy_backend *bk,
 
 	if (updates) {
 		rspamd_fuzzy_backend_deduplicate_queue (updates);
+
+		if (bk->check_cache) {
+			/* Invalidate cached replies of the updated digests */
+			struct fuzzy_peer_cmd *io_cmd;
+			guint i;
+
+			for (i = 0; i < updates->len; i ++) {
+				io_cmd = &g_array_index (updates, struct fuzzy_peer_cmd, i);
+
+				if (io_cmd->is_shingle) {
+					rspamd_lru_hash_remove (bk->check_cache,
+							io_cmd->cmd.shingle.basic.digest);
+				}
+				else {
+					rspamd_lru_hash_remove (bk->check_cache,
+							io_cmd->cmd.normal.digest);
+				}
+			}
+		}
+
 		bk->subr->update (bk, updates, src, cb, ud, bk->subr_ud);
 	}
 	else if (cb) {
@@ -553,6 +636,12 @@ rspamd_fuzzy_backend_close (struct rspamd_fuzzy_backend *bk)
 
 	bk->subr->close (bk, bk->subr_ud);
 
+	if (bk->check_cache) {
+		msg_info ("fuzzy backend check cache: %uL hits, %uL misses",
+				bk->cache_hits, bk->cache_misses);
+		rspamd_lru_hash_destroy (bk->check_cache);
+	}
+
 	g_free (bk);
 }
 
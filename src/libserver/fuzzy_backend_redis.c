@@ -58,6 +58,7 @@ struct rspamd_fuzzy_backend_redis {
 	struct rspamd_redis_pool *pool;
 	gdouble timeout;
 	gint conf_ref;
+	gboolean sharded; /* shard by digest over the servers list */
 	ref_entry_t ref;
 };
 
@@ -213,6 +214,16 @@ rspamd_fuzzy_backend_init_redis (struct rspamd_fuzzy_backend *bk,
 		return NULL;
 	}
 
+	elt = ucl_object_lookup (obj, "sharded");
+	if (elt != NULL && ucl_object_type (elt) == UCL_BOOLEAN) {
+		/*
+		 * Client side sharding: keys are distributed over the servers
+		 * list by a consistent hash of the digest; servers then hold
+		 * disjoint parts of the fuzzy database
+		 */
+		backend->sharded = ucl_object_toboolean (elt);
+	}
+
 	elt = ucl_object_lookup (obj, "prefix");
 	if (elt == NULL || ucl_object_type (elt) != UCL_STRING) {
 		backend->redis_object = REDIS_DEFAULT_OBJECT;
@@ -637,10 +648,19 @@ rspamd_fuzzy_backend_check_redis (struct rspamd_fuzzy_backend *bk,
 	g_string_free (key, FALSE); /* Do not free underlying array */
 
 	ups = rspamd_redis_get_servers (backend, "read_servers");
-	up = rspamd_upstream_get (ups,
-			RSPAMD_UPSTREAM_ROUND_ROBIN,
-			NULL,
-			0);
+
+	if (backend->sharded) {
+		up = rspamd_upstream_get (ups,
+				RSPAMD_UPSTREAM_HASHED,
+				session->cmd->digest,
+				sizeof (session->cmd->digest));
+	}
+	else {
+		up = rspamd_upstream_get (ups,
+				RSPAMD_UPSTREAM_ROUND_ROBIN,
+				NULL,
+				0);
+	}
 
 	session->up = up;
 	addr = rspamd_upstream_addr_next (up);
@@ -28,9 +28,56 @@ struct rspamd_fuzzy_backend_sqlite {
 	gchar id[MEMPOOL_UID_LEN];
 	gsize count;
 	gsize expired;
+	gint journal_fd;
+	guint64 journal_seq;
 	rspamd_mempool_t *pool;
 };
 
+/*
+ * Sequenced replication journal record: appended on every accepted add
+ * or delete, so replicas can tail the journal instead of copying the
+ * whole database file
+ */
+struct rspamd_fuzzy_sqlite_journal_rec {
+	guchar magic[4];
+	guint32 op;
+	guint64 seq;
+	guint64 ts;
+	gint32 value;
+	guint32 flag;
+	guchar digest[rspamd_cryptobox_HASHBYTES];
+};
+
+static const guchar fuzzy_journal_magic[4] = {'r', 'f', 'j', 1};
+
+static void
+rspamd_fuzzy_backend_sqlite_journal_append (
+		struct rspamd_fuzzy_backend_sqlite *backend,
+		guint32 op,
+		const struct rspamd_fuzzy_cmd *cmd)
+{
+	struct rspamd_fuzzy_sqlite_journal_rec rec;
+
+	if (backend->journal_fd == -1) {
+		return;
+	}
+
+	memset (&rec, 0, sizeof (rec));
+	memcpy (rec.magic, fuzzy_journal_magic, sizeof (rec.magic));
+	rec.op = op;
+	rec.seq = ++backend->journal_seq;
+	rec.ts = (guint64)time (NULL);
+	rec.value = cmd->value;
+	rec.flag = cmd->flag;
+	memcpy (rec.digest, cmd->digest, sizeof (rec.digest));
+
+	/* Write behind: no fsync per record, the journal is best-effort */
+	if (write (backend->journal_fd, &rec, sizeof (rec)) == -1) {
+		msg_warn_fuzzy_backend ("cannot append replication journal: %s",
+				strerror (errno));
+	}
+}
+
 static const gdouble sql_sleep_time = 0.1;
 static const guint max_retries = 10;
 
@@ -429,6 +476,7 @@ rspamd_fuzzy_backend_sqlite_open_db (const gchar *path, GError **err)
 	g_assert (path != NULL);
 
 	bk = g_malloc0 (sizeof (*bk));
+	bk->journal_fd = -1;
 	bk->path = g_strdup (path);
 	bk->expired = 0;
 	bk->pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "fuzzy_backend");
@@ -475,6 +523,7 @@ rspamd_fuzzy_backend_sqlite_open (const gchar *path,
 		return NULL;
 	}
 
+
 	if (rspamd_fuzzy_backend_sqlite_run_stmt (backend, FALSE, RSPAMD_FUZZY_BACKEND_COUNT)
 			== SQLITE_OK) {
 		backend->count = sqlite3_column_int64 (
@@ -486,6 +535,37 @@ rspamd_fuzzy_backend_sqlite_open (const gchar *path,
 	return backend;
 }
 
+gboolean
+rspamd_fuzzy_backend_sqlite_enable_journal (
+		struct rspamd_fuzzy_backend_sqlite *backend,
+		const gchar *path)
+{
+	struct stat st;
+
+	if (backend == NULL || path == NULL) {
+		return FALSE;
+	}
+
+	backend->journal_fd = open (path, O_WRONLY | O_APPEND | O_CREAT, 00644);
+
+	if (backend->journal_fd == -1) {
+		msg_warn_fuzzy_backend ("cannot open replication journal %s: %s",
+				path, strerror (errno));
+		return FALSE;
+	}
+
+	/* Continue the sequence from the journal tail */
+	if (fstat (backend->journal_fd, &st) != -1) {
+		backend->journal_seq = st.st_size /
+				sizeof (struct rspamd_fuzzy_sqlite_journal_rec);
+	}
+
+	msg_info_fuzzy_backend ("opened replication journal %s, sequence %uL",
+			path, backend->journal_seq);
+
+	return TRUE;
+}
+
 static gint
 rspamd_fuzzy_backend_sqlite_int64_cmp (const void *a, const void *b)
 {
@@ -757,6 +837,10 @@ rspamd_fuzzy_backend_sqlite_add (struct rspamd_fuzzy_backend_sqlite *backend,
 				RSPAMD_FUZZY_BACKEND_INSERT);
 	}
 
+	if (rc == SQLITE_OK) {
+		rspamd_fuzzy_backend_sqlite_journal_append (backend, FUZZY_WRITE, cmd);
+	}
+
 	return (rc == SQLITE_OK);
 }
 
@@ -841,6 +925,10 @@ rspamd_fuzzy_backend_sqlite_del (struct rspamd_fuzzy_backend_sqlite *backend,
 		rspamd_fuzzy_backend_sqlite_cleanup_stmt (backend, RSPAMD_FUZZY_BACKEND_CHECK);
 	}
 
+	if (rc == SQLITE_OK) {
+		rspamd_fuzzy_backend_sqlite_journal_append (backend, FUZZY_DEL, cmd);
+	}
+
 	return (rc == SQLITE_OK);
 }
 
@@ -1001,6 +1089,10 @@ rspamd_fuzzy_backend_sqlite_close (struct rspamd_fuzzy_backend_sqlite *backend)
 			sqlite3_close (backend->db);
 		}
 
+		if (backend->journal_fd != -1) {
+			close (backend->journal_fd);
+		}
+
 		if (backend->path != NULL) {
 			g_free (backend->path);
 		}
@@ -58,6 +58,15 @@ gboolean rspamd_fuzzy_backend_sqlite_prepare_update (struct rspamd_fuzzy_backend
  * @param cmd
  * @return
  */
+/**
+ * Enables the sequenced binary replication journal: every accepted add or
+ * delete is appended there, so replicas can tail the journal instead of
+ * copying the database file
+ */
+gboolean rspamd_fuzzy_backend_sqlite_enable_journal (
+		struct rspamd_fuzzy_backend_sqlite *backend,
+		const gchar *path);
+
 gboolean rspamd_fuzzy_backend_sqlite_add (struct rspamd_fuzzy_backend_sqlite *backend,
 										  const struct rspamd_fuzzy_cmd *cmd);
 
@@ -356,6 +356,11 @@ rspamd_html_decode_entitles_inplace (gchar *s, gsize len)
 		l = len;
 	}
 
+	/* Lazy path: the vast majority of blocks have no entities at all */
+	if (memchr (s, '&', l) == NULL) {
+		return l;
+	}
+
 	end = s + l;
 
 	while (h - s < l) {
@@ -1012,10 +1017,22 @@ rspamd_html_parse_tag_content (rspamd_mempool_t *pool,
 
 				s = rspamd_mempool_alloc (pool, tag->name.len + 1);
 				memcpy (s, tag->name.start, tag->name.len);
-				tag->name.len = rspamd_html_decode_entitles_inplace (s,
-						tag->name.len);
 				tag->name.start = s;
-				tag->name.len = rspamd_str_lc_utf8 (s, tag->name.len);
+
+				/*
+				 * Fast path: plain ascii names without entities need
+				 * neither entity decoding nor utf8 aware lowercasing
+				 */
+				if (G_LIKELY (!rspamd_str_has_8bit (s, tag->name.len) &&
+						memchr (s, '&', tag->name.len) == NULL)) {
+					rspamd_str_lc (s, tag->name.len);
+				}
+				else {
+					tag->name.len = rspamd_html_decode_entitles_inplace (s,
+							tag->name.len);
+					tag->name.len = rspamd_str_lc_utf8 (s, tag->name.len);
+				}
+
 				s[tag->name.len] = '\0';
 
 				k = kh_get (tag_by_name, html_tag_by_name, s);
@@ -30,7 +30,9 @@
 #define RSPAMD_MEMPOOL_MILTER_REPLY "milter_reply"
 #define RSPAMD_MEMPOOL_DKIM_SIGNATURE "dkim-signature"
 #define RSPAMD_MEMPOOL_DMARC_CHECKS "dmarc_checks"
+#define RSPAMD_MEMPOOL_AUTH_RESULTS "auth_results"
 #define RSPAMD_MEMPOOL_DKIM_BH_CACHE "dkim_bh_cache"
+#define RSPAMD_MEMPOOL_DKIM_CANON_CACHE "dkim_canon_cache"
 #define RSPAMD_MEMPOOL_DKIM_CHECK_RESULTS "dkim_results"
 #define RSPAMD_MEMPOOL_DKIM_SIGN_KEY "dkim_key"
 #define RSPAMD_MEMPOOL_DKIM_SIGN_SELECTOR "dkim_selector"
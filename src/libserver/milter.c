@@ -16,6 +16,7 @@
 
 #include "config.h"
 #include "milter.h"
+#include "libserver/re_cache.h"
 #include "milter_internal.h"
 #include "email_addr.h"
 #include "addr.h"
@@ -117,6 +118,23 @@ rspamd_milter_session_reset (struct rspamd_milter_session *session,
 			msg_debug_milter ("cleanup message on abort");
 		}
 
+		if (session->body_stream) {
+			/* The message is being restarted, the stream is stale */
+			rspamd_re_cache_stream_free (session->body_stream);
+			session->body_stream = NULL;
+		}
+
+		if (priv->body_chunks) {
+			rspamd_fstring_t *chunk;
+
+			PTR_ARRAY_FOREACH (priv->body_chunks, i, chunk) {
+				rspamd_fstring_free (chunk);
+			}
+
+			g_ptr_array_set_size (priv->body_chunks, 0);
+			priv->body_chunks_len = 0;
+		}
+
 		if (session->rcpts) {
 			PTR_ARRAY_FOREACH (session->rcpts, i, cur) {
 				rspamd_email_address_free (cur);
@@ -165,9 +183,13 @@ rspamd_milter_session_reset (struct rspamd_milter_session *session,
 
 	if (how & RSPAMD_MILTER_RESET_MACRO) {
 		if (session->macros) {
+			/*
+			 * Keep the table allocated for the next message on this
+			 * connection: macro sets arrive for every message and
+			 * destroy/create churn of the table dominates this path
+			 */
 			msg_debug_milter ("cleanup macros");
-			g_hash_table_unref (session->macros);
-			session->macros = NULL;
+			g_hash_table_remove_all (session->macros);
 		}
 	}
 }
@@ -188,10 +210,24 @@ rspamd_milter_session_dtor (struct rspamd_milter_session *session)
 			rspamd_fstring_free (priv->parser.buf);
 		}
 
+		if (priv->body_chunks) {
+			/* Chunks themselves are freed by the reset above */
+			g_ptr_array_free (priv->body_chunks, TRUE);
+		}
+
 		if (session->message) {
 			rspamd_fstring_free (session->message);
 		}
 
+		if (session->body_stream) {
+			rspamd_re_cache_stream_free (session->body_stream);
+		}
+
+		if (session->macros) {
+			/* Reset merely clears the table, it is freed only here */
+			g_hash_table_unref (session->macros);
+		}
+
 		if (session->helo) {
 			rspamd_fstring_free (session->helo);
 		}
@@ -274,6 +310,51 @@ rspamd_milter_plan_io (struct rspamd_milter_session *session,
 	(var) = ntohs (var); \
 } while (0)
 
+static struct rspamd_re_cache *milter_re_cache = NULL;
+
+void
+rspamd_milter_set_re_cache (struct rspamd_re_cache *cache)
+{
+	milter_re_cache = cache;
+}
+
+/*
+ * Coalesces the accumulated body chunks into the session message with a
+ * single resize: appending each chunk directly would pay realloc and
+ * copying costs on every body command
+ */
+static void
+rspamd_milter_flush_body_chunks (struct rspamd_milter_session *session,
+		struct rspamd_milter_private *priv)
+{
+	rspamd_fstring_t *chunk;
+	guint i;
+
+	if (priv->body_chunks == NULL || priv->body_chunks->len == 0) {
+		return;
+	}
+
+	if (!session->message) {
+		session->message = rspamd_fstring_sized_new (
+				MAX (priv->body_chunks_len, RSPAMD_MILTER_MESSAGE_CHUNK));
+	}
+	else if (session->message->allocated <
+			session->message->len + priv->body_chunks_len) {
+		session->message = rspamd_fstring_grow (session->message,
+				session->message->len + priv->body_chunks_len);
+	}
+
+	PTR_ARRAY_FOREACH (priv->body_chunks, i, chunk) {
+		memcpy (session->message->str + session->message->len,
+				chunk->str, chunk->len);
+		session->message->len += chunk->len;
+		rspamd_fstring_free (chunk);
+	}
+
+	g_ptr_array_set_size (priv->body_chunks, 0);
+	priv->body_chunks_len = 0;
+}
+
 static gboolean
 rspamd_milter_process_command (struct rspamd_milter_session *session,
 		struct rspamd_milter_private *priv)
@@ -295,14 +376,44 @@ rspamd_milter_process_command (struct rspamd_milter_session *session,
 		rspamd_milter_session_reset (session, RSPAMD_MILTER_RESET_ABORT);
 		break;
 	case RSPAMD_MILTER_CMD_BODY:
-		if (!session->message) {
-			session->message = rspamd_fstring_sized_new (
-					RSPAMD_MILTER_MESSAGE_CHUNK);
-		}
-
 		msg_debug_milter ("got body chunk: %d bytes", (int)cmdlen);
-		session->message = rspamd_fstring_append (session->message,
-				pos, cmdlen);
+
+		if (priv->body_chunks == NULL) {
+			priv->body_chunks = g_ptr_array_sized_new (16);
+		}
+
+		g_ptr_array_add (priv->body_chunks,
+				rspamd_fstring_new_init (pos, cmdlen));
+		priv->body_chunks_len += cmdlen;
+
+		if (milter_re_cache != NULL) {
+			if (session->body_stream == NULL &&
+					priv->body_chunks->len == 1) {
+				/*
+				 * First body chunk: open the stream and replay the
+				 * serialized headers, so the stream sees exactly the
+				 * bytes of the final message
+				 */
+				session->body_stream = rspamd_re_cache_stream_new (
+						milter_re_cache);
+
+				if (session->body_stream != NULL &&
+						session->message != NULL &&
+						!rspamd_re_cache_stream_feed (session->body_stream,
+								session->message->str,
+								session->message->len)) {
+					rspamd_re_cache_stream_free (session->body_stream);
+					session->body_stream = NULL;
+				}
+			}
+
+			if (session->body_stream != NULL &&
+					!rspamd_re_cache_stream_feed (session->body_stream,
+							pos, cmdlen)) {
+				rspamd_re_cache_stream_free (session->body_stream);
+				session->body_stream = NULL;
+			}
+		}
 		break;
 	case RSPAMD_MILTER_CMD_CONNECT:
 		msg_debug_milter ("got connect command");
@@ -505,6 +616,7 @@ rspamd_milter_process_command (struct rspamd_milter_session *session,
 		break;
 	case RSPAMD_MILTER_CMD_BODYEOB:
 		msg_debug_milter ("got eob command");
+		rspamd_milter_flush_body_chunks (session, priv);
 		REF_RETAIN (session);
 		priv->fin_cb (priv->fd, session, priv->ud);
 		REF_RELEASE (session);
@@ -1003,32 +1115,33 @@ rspamd_milter_handle_session (struct rspamd_milter_session *session,
 			}
 		}
 		else {
-			DL_FOREACH_SAFE (priv->out_chain, obuf, obuf_tmp) {
-				to_write = obuf->buf->len - obuf->pos;
+			/*
+			 * Flush the whole output chain with one writev: replies are
+			 * queued per action (8+ header frames per message), so per
+			 * frame write syscalls dominated the milter write path
+			 */
+			struct iovec iov[32];
+			guint niov = 0;
 
-				g_assert (to_write > 0);
+			DL_FOREACH (priv->out_chain, obuf) {
+				iov[niov].iov_base = obuf->buf->str + obuf->pos;
+				iov[niov].iov_len = obuf->buf->len - obuf->pos;
 
-				r = write (priv->fd, obuf->buf->str + obuf->pos, to_write);
+				if (++niov >= G_N_ELEMENTS (iov)) {
+					break;
+				}
+			}
 
-				if (r == -1) {
-					if (errno == EAGAIN || errno == EINTR) {
-						rspamd_milter_plan_io (session, priv, EV_WRITE);
-					}
-					else {
-						/* Fatal IO error */
-						err = g_error_new (rspamd_milter_quark (), errno,
-								"IO write error: %s", strerror (errno));
-						REF_RETAIN (session);
-						priv->err_cb (priv->fd, session, priv->ud, err);
-						REF_RELEASE (session);
-						g_error_free (err);
+			r = writev (priv->fd, iov, niov);
 
-						return FALSE;
-					}
+			if (r == -1) {
+				if (errno == EAGAIN || errno == EINTR) {
+					rspamd_milter_plan_io (session, priv, EV_WRITE);
 				}
-				else if (r == 0) {
-					err = g_error_new (rspamd_milter_quark (), ECONNRESET,
-							"Unexpected EOF");
+				else {
+					/* Fatal IO error */
+					err = g_error_new (rspamd_milter_quark (), errno,
+							"IO write error: %s", strerror (errno));
 					REF_RETAIN (session);
 					priv->err_cb (priv->fd, session, priv->ud, err);
 					REF_RELEASE (session);
@@ -1036,25 +1149,47 @@ rspamd_milter_handle_session (struct rspamd_milter_session *session,
 
 					return FALSE;
 				}
-				else {
-					if (r == to_write) {
-						/* We have done with this buf */
+			}
+			else if (r == 0) {
+				err = g_error_new (rspamd_milter_quark (), ECONNRESET,
+						"Unexpected EOF");
+				REF_RETAIN (session);
+				priv->err_cb (priv->fd, session, priv->ud, err);
+				REF_RELEASE (session);
+				g_error_free (err);
+
+				return FALSE;
+			}
+			else {
+				/* Consume the written bytes along the chain */
+				DL_FOREACH_SAFE (priv->out_chain, obuf, obuf_tmp) {
+					to_write = obuf->buf->len - obuf->pos;
+
+					if (r >= to_write) {
+						r -= to_write;
 						DL_DELETE (priv->out_chain, obuf);
 						rspamd_milter_obuf_free (obuf);
 					}
 					else {
-						/* We need to plan another write */
+						/* Partial write, plan another write cycle */
 						obuf->pos += r;
 						rspamd_milter_plan_io (session, priv, EV_WRITE);
 
 						return TRUE;
 					}
 				}
-			}
 
-			/* Here we have written everything, so we can plan reading */
-			priv->state = RSPAMD_MILTER_READ_MORE;
-			rspamd_milter_plan_io (session, priv, EV_READ);
+				if (priv->out_chain) {
+					/* More than the iovec window was queued */
+					rspamd_milter_plan_io (session, priv, EV_WRITE);
+
+					return TRUE;
+				}
+
+				/* Here we have written everything, so we can plan reading */
+				priv->state = RSPAMD_MILTER_READ_MORE;
+				rspamd_milter_plan_io (session, priv, EV_READ);
+			}
 		}
 		break;
 	case RSPAMD_MILTER_WANNA_DIE:
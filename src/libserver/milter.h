@@ -61,6 +61,9 @@ struct rspamd_milter_context {
 	gboolean quarantine_on_reject;
 };
 
+struct rspamd_re_stream;
+struct rspamd_re_cache;
+
 struct rspamd_milter_session {
 	GHashTable *macros;
 	rspamd_inet_addr_t *addr;
@@ -69,6 +72,7 @@ struct rspamd_milter_session {
 	rspamd_fstring_t *helo;
 	rspamd_fstring_t *hostname;
 	rspamd_fstring_t *message;
+	struct rspamd_re_stream *body_stream;	/**< streamed regexp prefilter	*/
 	void *priv;
 	ref_entry_t ref;
 };
@@ -181,6 +185,13 @@ void rspamd_milter_init_library (const struct rspamd_milter_context *ctx);
 rspamd_mempool_t *rspamd_milter_get_session_pool (
 		struct rspamd_milter_session *session);
 
+/**
+ * Enables streamed regexp prefiltering: with a cache set, body chunks are
+ * fed into a hyperscan stream while the message is still being received,
+ * so the prefilter results are ready at end of body
+ */
+void rspamd_milter_set_re_cache (struct rspamd_re_cache *cache);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -68,6 +68,9 @@ struct rspamd_milter_private {
 	struct rspamd_milter_outbuf *out_chain;
 	struct ev_loop *event_loop;
 	rspamd_mempool_t *pool;
+	/* Body chunks accumulated until eob, coalesced in a single pass */
+	GPtrArray *body_chunks;
+	gsize body_chunks_len;
 	khash_t(milter_headers_hash_t) *headers;
 	gint cur_hdr;
 	rspamd_milter_finish fin_cb;
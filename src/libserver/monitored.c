@@ -49,6 +49,34 @@ struct rspamd_monitored_ctx {
 	gboolean initialized;
 };
 
+/*
+ * State shared between all workers: the first worker that detects a dead
+ * resource publishes it, so the siblings stop querying it immediately
+ * instead of each rediscovering the failure after its own timeouts
+ */
+struct rspamd_monitored_shm_elt {
+	guint64 tag_hash;
+	guint state; /* 0 - unclaimed, 1 - alive, 2 - dead */
+	guchar pad[52];
+};
+
+#define RSPAMD_MONITORED_SHM_ELTS 128
+
+static struct rspamd_monitored_shm_elt *monitored_shm = NULL;
+
+gsize
+rspamd_monitored_shm_size (void)
+{
+	return sizeof (struct rspamd_monitored_shm_elt) *
+			RSPAMD_MONITORED_SHM_ELTS;
+}
+
+void
+rspamd_monitored_attach_shm (gpointer p)
+{
+	monitored_shm = p;
+}
+
 struct rspamd_monitored {
 	gchar *url;
 	gdouble monitoring_mult;
@@ -59,6 +87,7 @@ struct rspamd_monitored {
 	guint max_errors;
 	guint cur_errors;
 	gboolean alive;
+	struct rspamd_monitored_shm_elt *shm;
 	enum rspamd_monitored_type type;
 	enum rspamd_monitored_flags flags;
 	struct rspamd_monitored_ctx *ctx;
@@ -90,6 +119,15 @@ struct rspamd_monitored {
 
 INIT_LOG_MODULE(monitored)
 
+static inline void
+rspamd_monitored_publish_shm (struct rspamd_monitored *m)
+{
+	if (m->shm) {
+		__atomic_store_n (&m->shm->state, m->alive ? 1 : 2,
+				__ATOMIC_RELEASE);
+	}
+}
+
 static inline void
 rspamd_monitored_propagate_error (struct rspamd_monitored *m,
 		const gchar *error)
@@ -112,6 +150,7 @@ rspamd_monitored_propagate_error (struct rspamd_monitored *m,
 			msg_notice_mon ("%s on resolving %s, disable object",
 					error, m->url);
 			m->alive = FALSE;
+			rspamd_monitored_publish_shm (m);
 			m->offline_time = rspamd_get_calendar_ticks ();
 			rspamd_monitored_stop (m);
 			m->monitoring_mult = 1.0;
@@ -149,6 +188,7 @@ rspamd_monitored_propagate_success (struct rspamd_monitored *m, gdouble lat)
 		t = rspamd_get_calendar_ticks ();
 		m->total_offline_time += t - m->offline_time;
 		m->alive = TRUE;
+		rspamd_monitored_publish_shm (m);
 		msg_notice_mon ("restoring %s after %.1f seconds of downtime, "
 				"total downtime: %.1f",
 				m->url, t - m->offline_time, m->total_offline_time);
@@ -571,6 +611,29 @@ rspamd_monitored_create_ (struct rspamd_monitored_ctx *ctx,
 
 	g_free (cksum_encoded);
 
+	if (monitored_shm) {
+		/* Claim a shared state slot keyed by the persistent tag */
+		guint64 th = rspamd_cryptobox_fast_hash (m->tag, strlen (m->tag),
+				rspamd_hash_seed ());
+		guint i, idx;
+
+		for (i = 0; i < 8; i ++) {
+			struct rspamd_monitored_shm_elt *elt;
+			guint64 expected = 0;
+
+			idx = (th + i) % RSPAMD_MONITORED_SHM_ELTS;
+			elt = &monitored_shm[idx];
+
+			if (__atomic_load_n (&elt->tag_hash, __ATOMIC_ACQUIRE) == th ||
+				__atomic_compare_exchange_n (&elt->tag_hash, &expected, th,
+						false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				m->shm = elt;
+				rspamd_monitored_publish_shm (m);
+				break;
+			}
+		}
+	}
+
 	g_ptr_array_add (ctx->elts, m);
 
 	if (ctx->event_loop) {
@@ -585,6 +648,12 @@ rspamd_monitored_alive (struct rspamd_monitored *m)
 {
 	g_assert (m != NULL);
 
+	if (m->alive && m->shm &&
+		__atomic_load_n (&m->shm->state, __ATOMIC_ACQUIRE) == 2) {
+		/* Some other worker has found this resource dead */
+		return FALSE;
+	}
+
 	return m->alive;
 }
 
@@ -596,6 +665,7 @@ rspamd_monitored_set_alive (struct rspamd_monitored *m, gboolean alive)
 	g_assert (m != NULL);
 	st = m->alive;
 	m->alive = alive;
+	rspamd_monitored_publish_shm (m);
 
 	return st;
 }
@@ -106,6 +106,17 @@ void rspamd_monitored_get_tag (struct rspamd_monitored *m,
  * @param m monitored object
  * @return TRUE or FALSE
  */
+/**
+ * Size of the shared monitored state region
+ */
+gsize rspamd_monitored_shm_size (void);
+
+/**
+ * Attaches the shared (between workers) monitored state region, allocated
+ * from a shared pool before forking
+ */
+void rspamd_monitored_attach_shm (gpointer p);
+
 gboolean rspamd_monitored_alive (struct rspamd_monitored *m);
 
 /**
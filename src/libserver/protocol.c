@@ -377,12 +377,16 @@ rspamd_protocol_handle_flag (struct rspamd_task *task, const gchar *str,
 	CHECK_TASK_FLAG("no_stat", RSPAMD_TASK_FLAG_NO_STAT);
 	CHECK_TASK_FLAG("ssl", RSPAMD_TASK_FLAG_SSL);
 	CHECK_TASK_FLAG("profile", RSPAMD_TASK_FLAG_PROFILE);
+	/* Trusted relay traffic: scan headers only, no body rules, no stat */
+	CHECK_TASK_FLAG("headers_only", RSPAMD_TASK_FLAG_HEADERS_ONLY|
+			RSPAMD_TASK_FLAG_NO_STAT);
 
 	CHECK_PROTOCOL_FLAG("milter", RSPAMD_TASK_PROTOCOL_FLAG_MILTER);
 	CHECK_PROTOCOL_FLAG("zstd", RSPAMD_TASK_PROTOCOL_FLAG_COMPRESSED);
 	CHECK_PROTOCOL_FLAG("ext_urls", RSPAMD_TASK_PROTOCOL_FLAG_EXT_URLS);
 	CHECK_PROTOCOL_FLAG("body_block", RSPAMD_TASK_PROTOCOL_FLAG_BODY_BLOCK);
 	CHECK_PROTOCOL_FLAG("groups", RSPAMD_TASK_PROTOCOL_FLAG_GROUPS);
+	CHECK_PROTOCOL_FLAG("msgpack", RSPAMD_TASK_PROTOCOL_FLAG_MSGPACK);
 
 	if (!known) {
 		msg_warn_protocol ("unknown flag: %*s", (gint)len, str);
@@ -489,6 +493,20 @@ rspamd_protocol_handle_headers (struct rspamd_task *task,
 					msg_debug_protocol ("read hostname header, value: %s", task->hostname);
 				}
 				break;
+			case 'c':
+			case 'C':
+				IF_HEADER (CONNECTION_HEADER) {
+					msg_debug_protocol ("read connection header, value: %T",
+							hv_tok);
+					srch.begin = "keep-alive";
+					srch.len = 10;
+
+					if (rspamd_ftok_casecmp (hv_tok, &srch) == 0) {
+						task->protocol_flags |=
+								RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE;
+					}
+				}
+				break;
 			case 'f':
 			case 'F':
 				IF_HEADER (FROM_HEADER) {
@@ -1225,6 +1243,8 @@ rspamd_scan_result_ucl (struct rspamd_task *task,
 	if (task->cmd != CMD_CHECK) {
 		/* For checkv2 we insert symbols as a separate object */
 		obj = ucl_object_typed_new (UCL_OBJECT);
+		/* Preallocate the hash for all symbols to avoid rehashing */
+		ucl_object_reserve (obj, kh_size (mres->symbols));
 	}
 
 	kh_foreach_value_ptr (mres->symbols, sym, {
@@ -1598,11 +1618,29 @@ rspamd_protocol_http_reply (struct rspamd_http_message *msg,
 				restat->bytes_scanned);
 	}
 
-	reply = rspamd_fstring_sized_new (1000);
+	/*
+	 * Size the output buffer from an average of the previous replies:
+	 * this keeps the emitter from reallocating and copying the json
+	 * several times for typical multi-kilobyte replies
+	 */
+	static struct rspamd_counter_data reply_size_est;
+
+	reply = rspamd_fstring_sized_new (MAX (1000,
+			(gsize)(reply_size_est.mean * 1.2)));
 
 	if (msg->method < HTTP_SYMBOLS && !RSPAMD_TASK_IS_SPAMC (task)) {
-		msg_debug_protocol ("writing json reply");
-		rspamd_ucl_emit_fstring (top, UCL_EMIT_JSON_COMPACT, &reply);
+		if (task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_MSGPACK) {
+			/*
+			 * Binary reply for our own tiers: skips json escaping on
+			 * emit and text parsing on the consumer side
+			 */
+			msg_debug_protocol ("writing msgpack reply");
+			rspamd_ucl_emit_fstring (top, UCL_EMIT_MSGPACK, &reply);
+		}
+		else {
+			msg_debug_protocol ("writing json reply");
+			rspamd_ucl_emit_fstring (top, UCL_EMIT_JSON_COMPACT, &reply);
+		}
 	}
 	else {
 		if (RSPAMD_TASK_IS_SPAMC (task)) {
@@ -1615,6 +1653,8 @@ rspamd_protocol_http_reply (struct rspamd_http_message *msg,
 		}
 	}
 
+	rspamd_set_counter_ema (&reply_size_est, reply->len, 0.5);
+
 	if (task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_BODY_BLOCK) {
 		/* Check if we need to insert a body block */
 		if (task->flags & RSPAMD_TASK_FLAG_MESSAGE_REWRITE) {
@@ -1747,30 +1787,20 @@ end:
 			if (action->action_type == METRIC_ACTION_SOFT_REJECT &&
 					(task->flags & RSPAMD_TASK_FLAG_GREYLISTED)) {
 				/* Set stat action to greylist to display greylisted messages */
-#ifndef HAVE_ATOMIC_BUILTINS
-				task->worker->srv->stat->actions_stat[METRIC_ACTION_GREYLIST]++;
-#else
-				__atomic_add_fetch (&task->worker->srv->stat->actions_stat[METRIC_ACTION_GREYLIST],
-						1, __ATOMIC_RELEASE);
-#endif
+				rspamd_striped_counter_add (
+						&task->worker->srv->stat->actions_stat[METRIC_ACTION_GREYLIST],
+						task->worker->load_slot, 1);
 			}
 			else if (action->action_type < METRIC_ACTION_MAX) {
-#ifndef HAVE_ATOMIC_BUILTINS
-				task->worker->srv->stat->actions_stat[action->action_type]++;
-#else
-				__atomic_add_fetch (&task->worker->srv->stat->actions_stat[action->action_type],
-						1, __ATOMIC_RELEASE);
-#endif
+				rspamd_striped_counter_add (
+						&task->worker->srv->stat->actions_stat[action->action_type],
+						task->worker->load_slot, 1);
 			}
 		}
 
 		/* Increase counters */
-#ifndef HAVE_ATOMIC_BUILTINS
-		task->worker->srv->stat->messages_scanned++;
-#else
-		__atomic_add_fetch (&task->worker->srv->stat->messages_scanned,
-				1, __ATOMIC_RELEASE);
-#endif
+		rspamd_striped_counter_add (&task->worker->srv->stat->messages_scanned,
+				task->worker->load_slot, 1);
 	}
 }
 
@@ -1997,11 +2027,21 @@ rspamd_protocol_write_reply (struct rspamd_task *task, ev_tstamp timeout)
 	const gchar *ctype = "application/json";
 	rspamd_fstring_t *reply;
 
+	if (task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_MSGPACK) {
+		ctype = "application/msgpack";
+	}
+
 	msg = rspamd_http_new_message (HTTP_RESPONSE);
 
 	if (rspamd_http_connection_is_encrypted (task->http_conn)) {
 		msg_info_protocol ("<%s> writing encrypted reply",
 				MESSAGE_FIELD_CHECK (task, message_id));
+		/* Encrypted replies always close the connection */
+		task->protocol_flags &= ~RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE;
+	}
+
+	if (task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE) {
+		msg->flags |= RSPAMD_HTTP_FLAG_KEEPALIVE;
 	}
 
 	/* Compatibility */
@@ -91,6 +91,7 @@ extern "C" {
 #define RAW_DATA_HEADER "Raw"
 #define COMPRESSION_HEADER "Compression"
 #define MESSAGE_OFFSET_HEADER "Message-Offset"
+#define CONNECTION_HEADER "Connection"
 
 #ifdef  __cplusplus
 }
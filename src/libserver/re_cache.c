@@ -16,6 +16,7 @@
 #include "libmime/message.h"
 #include "re_cache.h"
 #include "cryptobox.h"
+#include "ottery.h"
 #include "ref.h"
 #include "libserver/url.h"
 #include "libserver/task.h"
@@ -74,7 +75,19 @@ INIT_LOG_MODULE(re_cache)
 #ifdef WITH_HYPERSCAN
 #define RSPAMD_HS_MAGIC_LEN (sizeof (rspamd_hs_magic))
 static const guchar rspamd_hs_magic[] = {'r', 's', 'h', 's', 'r', 'e', '1', '1'},
-		rspamd_hs_magic_vector[] = {'r', 's', 'h', 's', 'r', 'v', '1', '1'};
+		rspamd_hs_magic_vector[] = {'r', 's', 'h', 's', 'r', 'v', '1', '1'},
+		rspamd_hs_magic_unser[] = {'r', 's', 'h', 's', 'u', 'd', '1', '1'};
+
+/*
+ * Header of the unserialized database file; the database itself follows the
+ * header and is aligned to 64 bytes
+ */
+struct rspamd_hs_unserialized_header {
+	guchar magic[sizeof (rspamd_hs_magic)];
+	guint64 crc;
+	guint64 len;
+	guchar pad[40];
+};
 #endif
 
 
@@ -82,6 +95,7 @@ struct rspamd_re_class {
 	guint64 id;
 	enum rspamd_re_type type;
 	gboolean has_utf8; /* if there are any utf8 regexps */
+	guint header_scope_id; /* 1 based id in the header scopes map, 0 if none */
 	gpointer type_data;
 	gsize type_len;
 	GHashTable *re;
@@ -94,6 +108,9 @@ struct rspamd_re_class {
 	hs_scratch_t *hs_scratch;
 	gint *hs_ids;
 	guint nhs;
+	/* Set if hs_db points inside a shared read-only mmap region */
+	gpointer hs_db_map;
+	gsize hs_db_map_len;
 #endif
 };
 
@@ -112,19 +129,34 @@ KHASH_INIT (lua_selectors_hash, gchar *, int, 1, kh_str_hash_func, kh_str_hash_e
 
 struct rspamd_re_cache {
 	GHashTable *re_classes;
+	/* Lowercase header name -> 1 based scope id for header scoped classes */
+	GHashTable *header_scopes;
+	guint nheader_scopes;
 
 	GPtrArray *re;
 	khash_t (lua_selectors_hash) *selectors;
+	/* Match results memoization keyed by (re id, content) hash */
+	rspamd_lru_hash_t *memo_cache;
+	guint64 memo_hits;
+	guint64 memo_misses;
 	ref_entry_t ref;
 	guint nre;
 	guint max_re_data;
+	gdouble re_time_budget;
 	gchar hash[rspamd_cryptobox_HASHBYTES + 1];
 	lua_State *L;
 #ifdef WITH_HYPERSCAN
 	gboolean hyperscan_loaded;
 	gboolean disable_hyperscan;
 	gboolean vectorized_hyperscan;
+	gboolean stream_db_failed;
 	hs_platform_info_t plt;
+	/* Stream mode variant of the rawbody class, compiled lazily */
+	hs_database_t *stream_db;
+	hs_scratch_t *stream_scratch; /* shared: the worker is single threaded */
+	struct rspamd_re_class *stream_class;
+	gint *stream_ids;
+	guint nstream_ids;
 #endif
 };
 
@@ -140,12 +172,46 @@ KHASH_INIT (selectors_results_hash, int, struct rspamd_re_selector_result, 1,
 struct rspamd_re_runtime {
 	guchar *checked;
 	guchar *results;
+	guchar *header_scopes_mask; /* scopes present in the task's headers */
 	khash_t (selectors_results_hash) *sel_cache;
 	struct rspamd_re_cache *cache;
 	struct rspamd_re_cache_stat stat;
+	gdouble pcre_elapsed; /* cumulative pcre time spent for this task */
 	gboolean has_hs;
+	gboolean header_scopes_gathered;
+	gboolean budget_exceeded;
+};
+
+/*
+ * The memoized match counts feed symbol decisions, so a predictable key
+ * would let crafted content replay another content's results. The key
+ * therefore carries the regexp id and the total length verbatim and the
+ * content hash is seeded with a random per process secret, so collisions
+ * cannot be searched for offline; the residual risk of a blind t1ha
+ * collision within one process lifetime is documented on the option.
+ */
+struct rspamd_re_cache_memo_key {
+	guint64 h;
+	guint64 re_id;
+	guint64 total_len;
 };
 
+static guint64 re_cache_memo_seed = 0;
+
+static guint
+rspamd_re_cache_memo_hash (gconstpointer p)
+{
+	const struct rspamd_re_cache_memo_key *k = p;
+
+	return (guint)k->h;
+}
+
+static gboolean
+rspamd_re_cache_memo_equal (gconstpointer a, gconstpointer b)
+{
+	return memcmp (a, b, sizeof (struct rspamd_re_cache_memo_key)) == 0;
+}
+
 static GQuark
 rspamd_re_cache_quark (void)
 {
@@ -179,6 +245,23 @@ rspamd_re_cache_destroy (struct rspamd_re_cache *cache)
 	gint sref;
 
 	g_assert (cache != NULL);
+
+	if (cache->header_scopes) {
+		/* Keys are owned by the classes freed below */
+		g_hash_table_unref (cache->header_scopes);
+	}
+
+#ifdef WITH_HYPERSCAN
+	if (cache->stream_db) {
+		if (cache->stream_scratch) {
+			hs_free_scratch (cache->stream_scratch);
+		}
+
+		hs_free_database (cache->stream_db);
+		g_free (cache->stream_ids);
+	}
+#endif
+
 	g_hash_table_iter_init (&it, cache->re_classes);
 
 	while (g_hash_table_iter_next (&it, &k, &v)) {
@@ -192,7 +275,12 @@ rspamd_re_cache_destroy (struct rspamd_re_cache *cache)
 
 #ifdef WITH_HYPERSCAN
 		if (re_class->hs_db) {
-			hs_free_database (re_class->hs_db);
+			if (re_class->hs_db_map) {
+				munmap (re_class->hs_db_map, re_class->hs_db_map_len);
+			}
+			else {
+				hs_free_database (re_class->hs_db);
+			}
 		}
 		if (re_class->hs_scratch) {
 			hs_free_scratch (re_class->hs_scratch);
@@ -204,6 +292,12 @@ rspamd_re_cache_destroy (struct rspamd_re_cache *cache)
 		g_free (re_class);
 	}
 
+	if (cache->memo_cache) {
+		msg_debug_re_cache ("re memo cache: %uL hits, %uL misses",
+				cache->memo_hits, cache->memo_misses);
+		rspamd_lru_hash_destroy (cache->memo_cache);
+	}
+
 	if (cache->L) {
 		kh_foreach (cache->selectors, skey, sref, {
 			luaL_unref (cache->L, LUA_REGISTRYINDEX, sref);
@@ -376,10 +470,54 @@ rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 
 	g_assert (cache != NULL);
 
+	cache->re_time_budget = cfg->re_time_budget;
+
+	if (cfg->re_memo_cache_size > 0 && cache->memo_cache == NULL) {
+		cache->memo_cache = rspamd_lru_hash_new_full (
+				cfg->re_memo_cache_size,
+				g_free, NULL,
+				rspamd_re_cache_memo_hash, rspamd_re_cache_memo_equal);
+		re_cache_memo_seed = ottery_rand_uint64 ();
+	}
+
 	rspamd_cryptobox_hash_init (&st_global, NULL, 0);
 	/* Resort all regexps */
 	g_ptr_array_sort (cache->re, rspamd_re_cache_sort_func);
 
+	/*
+	 * Collect all header scoped class names into a single caseless map,
+	 * so the runtime can derive the set of applicable scopes in one pass
+	 * over the task's header list instead of probing every class
+	 */
+	if (cache->header_scopes == NULL) {
+		cache->header_scopes = g_hash_table_new (rspamd_strcase_hash,
+				rspamd_strcase_equal);
+	}
+
+	g_hash_table_iter_init (&it, cache->re_classes);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		re_class = v;
+
+		if ((re_class->type == RSPAMD_RE_HEADER ||
+				re_class->type == RSPAMD_RE_RAWHEADER) &&
+				re_class->type_data != NULL) {
+			gpointer scope_id;
+
+			scope_id = g_hash_table_lookup (cache->header_scopes,
+					re_class->type_data);
+
+			if (scope_id == NULL) {
+				cache->nheader_scopes ++;
+				scope_id = GUINT_TO_POINTER (cache->nheader_scopes);
+				g_hash_table_insert (cache->header_scopes,
+						re_class->type_data, scope_id);
+			}
+
+			re_class->header_scope_id = GPOINTER_TO_UINT (scope_id);
+		}
+	}
+
 	for (i = 0; i < cache->re->len; i ++) {
 		elt = g_ptr_array_index (cache->re, i);
 		re = elt->re;
@@ -505,11 +643,13 @@ rspamd_re_cache_runtime_new (struct rspamd_re_cache *cache)
 	struct rspamd_re_runtime *rt;
 	g_assert (cache != NULL);
 
-	rt = g_malloc0 (sizeof (*rt) + NBYTES (cache->nre) + cache->nre);
+	rt = g_malloc0 (sizeof (*rt) + NBYTES (cache->nre) + cache->nre +
+			NBYTES (cache->nheader_scopes + 1));
 	rt->cache = cache;
 	REF_RETAIN (cache);
 	rt->checked = ((guchar *)rt) + sizeof (*rt);
 	rt->results = rt->checked + NBYTES (cache->nre);
+	rt->header_scopes_mask = rt->results + cache->nre;
 	rt->stat.regexp_total = cache->nre;
 #ifdef WITH_HYPERSCAN
 	rt->has_hs = cache->hyperscan_loaded;
@@ -536,8 +676,9 @@ rspamd_re_cache_process_pcre (struct rspamd_re_runtime *rt,
 	const gchar *start = NULL, *end = NULL;
 	guint max_hits = rspamd_regexp_get_maxhits (re);
 	guint64 id = rspamd_regexp_get_cache_id (re);
-	gdouble t1, t2, pr;
+	gdouble t1 = 0, t2, pr;
 	const gdouble slow_time = 1e8;
+	gboolean track_budget = rt->cache->re_time_budget > 0;
 
 	if (in == NULL) {
 		return rt->results[id];
@@ -551,13 +692,29 @@ rspamd_re_cache_process_pcre (struct rspamd_re_runtime *rt,
 		len = rt->cache->max_re_data;
 	}
 
+	if (rt->budget_exceeded && !rspamd_regexp_is_literal (re)) {
+		/*
+		 * The task has burnt its cumulative pcre budget: degrade to
+		 * literal-only matching so a pathological pattern turns into
+		 * bounded degradation instead of a watchdog kill
+		 */
+		rt->stat.regexp_checked++;
+
+		return rt->results[id];
+	}
+
 	r = rt->results[id];
 
 	if (max_hits == 0 || r < max_hits) {
-		pr = rspamd_random_double_fast ();
+		if (track_budget) {
+			t1 = rspamd_get_ticks (FALSE);
+		}
+		else {
+			pr = rspamd_random_double_fast ();
 
-		if (pr > 0.9) {
-			t1 = rspamd_get_ticks (TRUE);
+			if (pr > 0.9) {
+				t1 = rspamd_get_ticks (TRUE);
+			}
 		}
 
 		while (rspamd_regexp_search (re,
@@ -585,7 +742,22 @@ rspamd_re_cache_process_pcre (struct rspamd_re_runtime *rt,
 			rt->stat.regexp_matched += r;
 		}
 
-		if (pr > 0.9) {
+		if (track_budget) {
+			t2 = rspamd_get_ticks (FALSE);
+			rt->pcre_elapsed += t2 - t1;
+
+			if (!rt->budget_exceeded &&
+					rt->pcre_elapsed > rt->cache->re_time_budget) {
+				rt->budget_exceeded = TRUE;
+				msg_warn_task ("regexp time budget %.2fs exhausted after "
+						"/%s/ (%.3fs total); degrading to literal-only "
+						"matching for the rest of the task",
+						rt->cache->re_time_budget,
+						rspamd_regexp_get_pattern (re),
+						rt->pcre_elapsed);
+			}
+		}
+		else if (t1 != 0) {
 			t2 = rspamd_get_ticks (TRUE);
 
 			if (t2 - t1 > slow_time) {
@@ -673,6 +845,8 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 {
 
 	guint64 re_id;
+	struct rspamd_re_cache_memo_key memo_key;
+	gboolean has_memo_key = FALSE;
 	guint ret = 0;
 	guint i;
 
@@ -685,6 +859,41 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 		return ret;
 	}
 
+	if (rt->cache->memo_cache) {
+		/*
+		 * Lookup the memoized result for this regexp over this content:
+		 * identical bounce templates and footers repeat constantly
+		 */
+		rspamd_cryptobox_fast_hash_state_t st;
+		gpointer mres;
+
+		memset (&memo_key, 0, sizeof (memo_key));
+		memo_key.re_id = re_id + (is_raw ? 1ULL << 63 : 0);
+		rspamd_cryptobox_fast_hash_init (&st,
+				re_cache_memo_seed ^ memo_key.re_id);
+
+		for (i = 0; i < count; i ++) {
+			rspamd_cryptobox_fast_hash_update (&st, &lens[i], sizeof (lens[i]));
+			rspamd_cryptobox_fast_hash_update (&st, in[i], lens[i]);
+			memo_key.total_len += lens[i];
+		}
+
+		memo_key.h = rspamd_cryptobox_fast_hash_final (&st);
+		has_memo_key = TRUE;
+		mres = rspamd_lru_hash_lookup (rt->cache->memo_cache, &memo_key, 0);
+
+		if (mres != NULL) {
+			rt->cache->memo_hits ++;
+			ret = GPOINTER_TO_UINT (mres) - 1;
+			rt->results[re_id] = ret;
+			setbit (rt->checked, re_id);
+
+			return ret;
+		}
+
+		rt->cache->memo_misses ++;
+	}
+
 #ifndef WITH_HYPERSCAN
 	for (i = 0; i < count; i++) {
 		ret = rspamd_re_cache_process_pcre (rt,
@@ -755,7 +964,7 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 			cbdata.re = re;
 			cbdata.rt = rt;
 			cbdata.lens = lens;
-			cbdata.count = 1;
+			cbdata.count = count;
 			cbdata.task = task;
 
 			if ((hs_scan_vector (re_class->hs_db, (const char **)in, lens, count, 0,
@@ -770,6 +979,15 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 	}
 #endif
 
+	if (rt->cache->memo_cache && has_memo_key) {
+		struct rspamd_re_cache_memo_key *kcopy;
+
+		kcopy = g_malloc (sizeof (*kcopy));
+		memcpy (kcopy, &memo_key, sizeof (*kcopy));
+		rspamd_lru_hash_insert (rt->cache->memo_cache, kcopy,
+				GUINT_TO_POINTER ((guintptr)(rt->results[re_id] + 1)), 0, 0);
+	}
+
 	return ret;
 }
 
@@ -952,24 +1170,21 @@ rspamd_process_words_vector (GArray *words,
 	return cnt;
 }
 
+/*
+ * Fills scvec/lenvec with the headers data starting from index `i`;
+ * returns the new count of filled elements
+ */
 static guint
-rspamd_re_cache_process_headers_list (struct rspamd_task *task,
-									  struct rspamd_re_runtime *rt,
-									  rspamd_regexp_t *re,
-									  struct rspamd_re_class *re_class,
-									  struct rspamd_mime_header *rh,
-									  gboolean is_strong)
+rspamd_re_cache_gather_headers_list (struct rspamd_re_class *re_class,
+									 struct rspamd_mime_header *rh,
+									 gboolean is_strong,
+									 const guchar **scvec,
+									 guint *lenvec,
+									 guint i,
+									 gboolean *raw)
 {
-	const guchar **scvec, *in;
-	gboolean raw = FALSE;
-	guint *lenvec;
+	const guchar *in;
 	struct rspamd_mime_header *cur;
-	guint cnt = 0, i = 0, ret = 0;
-
-	DL_COUNT (rh, cur, cnt);
-
-	scvec = g_malloc (sizeof (*scvec) * cnt);
-	lenvec = g_malloc (sizeof (*lenvec) * cnt);
 
 	DL_FOREACH (rh, cur) {
 
@@ -983,7 +1198,7 @@ rspamd_re_cache_process_headers_list (struct rspamd_task *task,
 			lenvec[i] = strlen (cur->value);
 
 			if (!g_utf8_validate (in, lenvec[i], NULL)) {
-				raw = TRUE;
+				*raw = TRUE;
 			}
 		}
 		else {
@@ -1003,6 +1218,31 @@ rspamd_re_cache_process_headers_list (struct rspamd_task *task,
 		i ++;
 	}
 
+	return i;
+}
+
+static guint
+rspamd_re_cache_process_headers_list (struct rspamd_task *task,
+									  struct rspamd_re_runtime *rt,
+									  rspamd_regexp_t *re,
+									  struct rspamd_re_class *re_class,
+									  struct rspamd_mime_header *rh,
+									  gboolean is_strong)
+{
+	const guchar **scvec;
+	gboolean raw = FALSE;
+	guint *lenvec;
+	struct rspamd_mime_header *cur;
+	guint cnt = 0, i = 0, ret = 0;
+
+	DL_COUNT (rh, cur, cnt);
+
+	scvec = g_malloc (sizeof (*scvec) * cnt);
+	lenvec = g_malloc (sizeof (*lenvec) * cnt);
+
+	i = rspamd_re_cache_gather_headers_list (re_class, rh, is_strong,
+			scvec, lenvec, 0, &raw);
+
 	if (i > 0) {
 		ret = rspamd_re_cache_process_regexp_data (rt, re,
 				task, scvec, lenvec, i, raw);
@@ -1018,6 +1258,50 @@ rspamd_re_cache_process_headers_list (struct rspamd_task *task,
 	return ret;
 }
 
+/*
+ * Walks the ordered header list once and marks every header scope that
+ * is actually present in the message
+ */
+static void
+rspamd_re_cache_gather_header_scopes (struct rspamd_re_runtime *rt,
+		struct rspamd_task *task)
+{
+	struct rspamd_mime_header *cur;
+	gpointer scope_id;
+
+	rt->header_scopes_gathered = TRUE;
+
+	if (task->message == NULL) {
+		return;
+	}
+
+	LL_FOREACH2 (MESSAGE_FIELD (task, headers_order), cur, ord_next) {
+		if (cur->name) {
+			scope_id = g_hash_table_lookup (rt->cache->header_scopes,
+					cur->name);
+
+			if (scope_id != NULL) {
+				setbit (rt->header_scopes_mask, GPOINTER_TO_UINT (scope_id));
+			}
+		}
+	}
+}
+
+static inline gboolean
+rspamd_re_cache_header_scope_present (struct rspamd_re_runtime *rt,
+		struct rspamd_task *task, guint scope_id)
+{
+	if (scope_id == 0) {
+		return TRUE; /* Unknown scope, check the headers hash */
+	}
+
+	if (!rt->header_scopes_gathered) {
+		rspamd_re_cache_gather_header_scopes (rt, task);
+	}
+
+	return isset (rt->header_scopes_mask, scope_id);
+}
+
 /*
  * Calculates the specified regexp for the specified class if it's not calculated
  */
@@ -1049,6 +1333,12 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 	switch (re_class->type) {
 	case RSPAMD_RE_HEADER:
 	case RSPAMD_RE_RAWHEADER:
+		if (!rspamd_re_cache_header_scope_present (rt, task,
+				re_class->header_scope_id)) {
+			/* The scoped header does not exist in this message */
+			break;
+		}
+
 		/* Get list of specified headers */
 		rh = rspamd_message_get_header_array (task,
 				re_class->type_data);
@@ -1068,14 +1358,52 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 				rspamd_regexp_get_pattern (re), ret);
 		break;
 	case RSPAMD_RE_MIMEHEADER:
+		/*
+		 * Gather headers of all mime parts into a single vector, so the
+		 * whole class is scanned in one hyperscan call instead of a call
+		 * per part: scratch setup dominates on small multipart messages
+		 */
+		cnt = 0;
+
 		PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, parts), i, mime_part) {
+			struct rspamd_mime_header *cur;
+			guint nh = 0;
+
 			rh = rspamd_message_get_header_from_hash (mime_part->raw_headers,
 					re_class->type_data);
 
 			if (rh) {
-				ret += rspamd_re_cache_process_headers_list (task, rt, re,
-						re_class, rh, is_strong);
+				DL_COUNT (rh, cur, nh);
+				cnt += nh;
+			}
+		}
+
+		if (cnt > 0) {
+			scvec = g_malloc (sizeof (*scvec) * cnt);
+			lenvec = g_malloc (sizeof (*lenvec) * cnt);
+			cnt = 0;
+			raw = FALSE;
+
+			PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, parts), i, mime_part) {
+				rh = rspamd_message_get_header_from_hash (mime_part->raw_headers,
+						re_class->type_data);
+
+				if (rh) {
+					cnt = rspamd_re_cache_gather_headers_list (re_class, rh,
+							is_strong, scvec, lenvec, cnt, &raw);
+				}
+			}
+
+			if (cnt > 0) {
+				ret = rspamd_re_cache_process_regexp_data (rt, re,
+						task, scvec, lenvec, cnt, raw);
+				msg_debug_re_task ("checking mime header %s regexp: %s -> %d",
+						(const gchar *)re_class->type_data,
+						rspamd_regexp_get_pattern (re), ret);
 			}
+
+			g_free (scvec);
+			g_free (lenvec);
 		}
 		break;
 	case RSPAMD_RE_MIME:
@@ -1390,6 +1718,20 @@ rspamd_re_cache_process (struct rspamd_task *task,
 			return 0;
 		}
 
+		if (RSPAMD_TASK_IS_HEADERS_ONLY (task)) {
+			switch (re_class->type) {
+			case RSPAMD_RE_HEADER:
+			case RSPAMD_RE_RAWHEADER:
+			case RSPAMD_RE_ALLHEADER:
+			case RSPAMD_RE_MIMEHEADER:
+				break;
+			default:
+				/* Body dependent scope, not extracted for this task */
+				setbit (rt->checked, re_id);
+				return 0;
+			}
+		}
+
 		return rspamd_re_cache_exec_re (task, rt, re, re_class,
 				is_strong);
 	}
@@ -1686,11 +2028,15 @@ struct rspamd_re_cache_hs_compile_cbdata {
 	const char *cache_dir;
 	gdouble max_time;
 	gboolean silent;
+	gboolean it_done;
 	guint total;
 	void (*cb)(guint ncompiled, GError *err, void *cbd);
 	void *cbd;
 };
 
+/* Scopes compiled in parallel child processes */
+#define RSPAMD_RE_CACHE_MAX_COMPILE_PAR 16
+
 static void
 rspamd_re_cache_compile_err (EV_P_ ev_timer *w, GError *err,
 		struct rspamd_re_cache_hs_compile_cbdata *cbdata)
@@ -1702,14 +2048,15 @@ rspamd_re_cache_compile_err (EV_P_ ev_timer *w, GError *err,
 	g_error_free (err);
 }
 
-static void
-rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
+static gint
+rspamd_re_cache_compile_class (struct rspamd_re_cache *cache,
+		struct rspamd_re_class *re_class,
+		const gchar *cache_dir,
+		gdouble max_time,
+		GError **err)
 {
-	struct rspamd_re_cache_hs_compile_cbdata *cbdata =
-			(struct rspamd_re_cache_hs_compile_cbdata *)w->data;
 	GHashTableIter cit;
 	gpointer k, v;
-	struct rspamd_re_class *re_class;
 	gchar path[PATH_MAX], npath[PATH_MAX];
 	hs_database_t *test_db;
 	gint fd, i, n, *hs_ids = NULL, pcre_flags, re_flags;
@@ -1723,69 +2070,15 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 	gchar *hs_serialized;
 	gsize serialized_len;
 	struct iovec iov[7];
-	struct rspamd_re_cache *cache;
-	GError *err;
-
-	cache = cbdata->cache;
-
-	if (!g_hash_table_iter_next (&cbdata->it, &k, &v)) {
-		/* All done */
-		ev_timer_stop (EV_A_ w);
-		cbdata->cb (cbdata->total, NULL, cbdata->cbd);
-		g_free (w);
-		g_free (cbdata);
-
-		return;
-	}
-
-	re_class = v;
-	rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cbdata->cache_dir,
-			G_DIR_SEPARATOR, re_class->hash);
-
-	if (rspamd_re_cache_is_valid_hyperscan_file (cache, path, TRUE, TRUE)) {
-
-		fd = open (path, O_RDONLY, 00600);
-
-		/* Read number of regexps */
-		g_assert (fd != -1);
-		lseek (fd, RSPAMD_HS_MAGIC_LEN + sizeof (cache->plt), SEEK_SET);
-		g_assert (read (fd, &n, sizeof (n)) == sizeof (n));
-		close (fd);
-
-		if (re_class->type_len > 0) {
-			if (!cbdata->silent) {
-				msg_info_re_cache (
-						"skip already valid class %s(%*s) to cache %6s, %d regexps",
-						rspamd_re_cache_type_to_string (re_class->type),
-						(gint) re_class->type_len - 1,
-						re_class->type_data,
-						re_class->hash,
-						n);
-			}
-		}
-		else {
-			if (!cbdata->silent) {
-				msg_info_re_cache (
-						"skip already valid class %s to cache %6s, %d regexps",
-						rspamd_re_cache_type_to_string (re_class->type),
-						re_class->hash,
-						n);
-			}
-		}
-
-		ev_timer_again (EV_A_ w);
-		return;
-	}
 
-	rspamd_snprintf (path, sizeof (path), "%s%c%s.hs.new", cbdata->cache_dir,
+	rspamd_snprintf (path, sizeof (path), "%s%c%s.hs.new", cache_dir,
 			G_DIR_SEPARATOR, re_class->hash);
 	fd = open (path, O_CREAT|O_TRUNC|O_EXCL|O_WRONLY, 00600);
 
 	if (fd == -1) {
-		err = g_error_new (rspamd_re_cache_quark (), errno,
+		g_set_error (err, rspamd_re_cache_quark (), errno,
 				"cannot open file %s: %s", path, strerror (errno));
-		rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
-		return;
+		return -1;
 	}
 
 	g_hash_table_iter_init (&cit, re_class->re);
@@ -1849,7 +2142,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 			/* The approximation operation might take a significant
 			 * amount of time, so we need to check if it's finite
 			 */
-			if (rspamd_re_cache_is_finite (cache, re, hs_flags[i], cbdata->max_time)) {
+			if (rspamd_re_cache_is_finite (cache, re, hs_flags[i], max_time)) {
 				hs_flags[i] |= HS_FLAG_PREFILTER;
 				hs_ids[i] = rspamd_regexp_get_cache_id (re);
 				hs_pats[i] = pat;
@@ -1881,6 +2174,9 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 				&test_db,
 				&hs_errors) != HS_SUCCESS) {
 
+			g_set_error (err, rspamd_re_cache_quark (), EINVAL,
+					"cannot create tree of regexp when processing '%s': %s",
+					hs_pats[hs_errors->expression], hs_errors->message);
 
 			g_free (hs_flags);
 			g_free (hs_ids);
@@ -1895,12 +2191,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 			unlink (path);
 			hs_free_compile_error (hs_errors);
 
-			err = g_error_new (rspamd_re_cache_quark (), EINVAL,
-					"cannot create tree of regexp when processing '%s': %s",
-					hs_pats[hs_errors->expression], hs_errors->message);
-			rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
-
-			return;
+			return -1;
 		}
 
 		for (guint j = 0; j < i; j ++) {
@@ -1912,7 +2203,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 
 		if (hs_serialize_database (test_db, &hs_serialized,
 				&serialized_len) != HS_SUCCESS) {
-			err = g_error_new (rspamd_re_cache_quark (),
+			g_set_error (err, rspamd_re_cache_quark (),
 					errno,
 					"cannot serialize tree of regexp for %s",
 					re_class->hash);
@@ -1923,8 +2214,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 			g_free (hs_flags);
 			hs_free_database (test_db);
 
-			rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
-			return;
+			return -1;
 		}
 
 		hs_free_database (test_db);
@@ -1970,7 +2260,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 		iov[6].iov_len = serialized_len;
 
 		if (writev (fd, iov, G_N_ELEMENTS (iov)) == -1) {
-			err = g_error_new (rspamd_re_cache_quark (),
+			g_set_error (err, rspamd_re_cache_quark (),
 					errno,
 					"cannot serialize tree of regexp to %s: %s",
 					path, strerror (errno));
@@ -1980,8 +2270,7 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 			g_free (hs_flags);
 			g_free (hs_serialized);
 
-			rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
-			return;
+			return -1;
 		}
 
 		if (re_class->type_len > 0) {
@@ -2001,42 +2290,196 @@ rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
 					n);
 		}
 
-		cbdata->total += n;
-
 		g_free (hs_serialized);
 		g_free (hs_ids);
 		g_free (hs_flags);
 	}
+	else {
+		g_free (hs_flags);
+		g_free (hs_ids);
+		g_free (hs_pats);
+		g_free (hs_exts);
+	}
 
 	fsync (fd);
 
 	/* Now rename temporary file to the new .hs file */
-	rspamd_snprintf (npath, sizeof (path), "%s%c%s.hs", cbdata->cache_dir,
+	rspamd_snprintf (npath, sizeof (path), "%s%c%s.hs", cache_dir,
 			G_DIR_SEPARATOR, re_class->hash);
 
 	if (rename (path, npath) == -1) {
-		err = g_error_new (rspamd_re_cache_quark (),
+		g_set_error (err, rspamd_re_cache_quark (),
 				errno,
 				"cannot rename %s to %s: %s",
 				path, npath, strerror (errno));
 		unlink (path);
 		close (fd);
 
-		rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
-		return;
+		return -1;
 	}
 
 	close (fd);
-	ev_timer_again (EV_A_ w);
+
+	return n;
 }
 
+static void
+rspamd_re_cache_compile_timer_cb (EV_P_ ev_timer *w, int revents )
+{
+	struct rspamd_re_cache_hs_compile_cbdata *cbdata =
+			(struct rspamd_re_cache_hs_compile_cbdata *)w->data;
+	gpointer k, v;
+	struct rspamd_re_class *re_class;
+	gchar path[PATH_MAX];
+	gint fd, n, res;
+	struct rspamd_re_cache *cache;
+	struct {
+		pid_t pid;
+		struct rspamd_re_class *cls;
+	} children[RSPAMD_RE_CACHE_MAX_COMPILE_PAR];
+	guint nchildren = 0, maxpar = 1, i;
+	pid_t pid;
+	GError *err = NULL;
+
+	cache = cbdata->cache;
+
+#ifdef HAVE_SC_NPROCESSORS_ONLN
+	maxpar = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
 #endif
+	maxpar = MIN (maxpar, RSPAMD_RE_CACHE_MAX_COMPILE_PAR);
 
-gint
-rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
-								   const char *cache_dir,
-								   gdouble max_time,
-								   gboolean silent,
+	/*
+	 * Collect up to maxpar classes that require compilation and compile
+	 * each of them in a separate child process: scopes are independent,
+	 * write their cache files independently, and hyperscan compilation
+	 * scales almost linearly with cores
+	 */
+	while (nchildren < maxpar && !cbdata->it_done) {
+		if (!g_hash_table_iter_next (&cbdata->it, &k, &v)) {
+			cbdata->it_done = TRUE;
+			break;
+		}
+
+		re_class = v;
+		rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cbdata->cache_dir,
+				G_DIR_SEPARATOR, re_class->hash);
+
+		if (rspamd_re_cache_is_valid_hyperscan_file (cache, path, TRUE, TRUE)) {
+			fd = open (path, O_RDONLY, 00600);
+
+			/* Read number of regexps */
+			g_assert (fd != -1);
+			lseek (fd, RSPAMD_HS_MAGIC_LEN + sizeof (cache->plt), SEEK_SET);
+			g_assert (read (fd, &n, sizeof (n)) == sizeof (n));
+			close (fd);
+
+			if (!cbdata->silent) {
+				if (re_class->type_len > 0) {
+					msg_info_re_cache (
+							"skip already valid class %s(%*s) to cache %6s, %d regexps",
+							rspamd_re_cache_type_to_string (re_class->type),
+							(gint) re_class->type_len - 1,
+							re_class->type_data,
+							re_class->hash,
+							n);
+				}
+				else {
+					msg_info_re_cache (
+							"skip already valid class %s to cache %6s, %d regexps",
+							rspamd_re_cache_type_to_string (re_class->type),
+							re_class->hash,
+							n);
+				}
+			}
+
+			continue;
+		}
+
+		pid = fork ();
+
+		if (pid == 0) {
+			/* Child: compile a single scope and quit */
+			res = rspamd_re_cache_compile_class (cache, re_class,
+					cbdata->cache_dir, cbdata->max_time, &err);
+
+			if (res < 0) {
+				msg_err_re_cache ("cannot compile class %s: %e",
+						re_class->hash, err);
+				g_error_free (err);
+				_exit (EXIT_FAILURE);
+			}
+
+			_exit (EXIT_SUCCESS);
+		}
+		else if (pid == -1) {
+			/* Cannot fork more children, compile in place */
+			res = rspamd_re_cache_compile_class (cache, re_class,
+					cbdata->cache_dir, cbdata->max_time, &err);
+
+			if (res < 0) {
+				rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
+				return;
+			}
+
+			cbdata->total += res;
+		}
+		else {
+			children[nchildren].pid = pid;
+			children[nchildren].cls = re_class;
+			nchildren ++;
+		}
+	}
+
+	/* Gather the results */
+	for (i = 0; i < nchildren; i ++) {
+		gint wstatus = 0;
+
+		if (waitpid (children[i].pid, &wstatus, 0) == -1 ||
+			!WIFEXITED (wstatus) || WEXITSTATUS (wstatus) != EXIT_SUCCESS) {
+			err = g_error_new (rspamd_re_cache_quark (), EINVAL,
+					"failed to compile class %s in a child process",
+					children[i].cls->hash);
+			rspamd_re_cache_compile_err (EV_A_ w, err, cbdata);
+
+			return;
+		}
+
+		/* Read the number of compiled regexps from the written file */
+		rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cbdata->cache_dir,
+				G_DIR_SEPARATOR, children[i].cls->hash);
+		fd = open (path, O_RDONLY, 00600);
+
+		if (fd != -1) {
+			if (lseek (fd, RSPAMD_HS_MAGIC_LEN + sizeof (cache->plt),
+					SEEK_SET) != -1 &&
+				read (fd, &n, sizeof (n)) == sizeof (n)) {
+				cbdata->total += n;
+			}
+
+			close (fd);
+		}
+	}
+
+	if (cbdata->it_done && nchildren == 0) {
+		/* All done */
+		ev_timer_stop (EV_A_ w);
+		cbdata->cb (cbdata->total, NULL, cbdata->cbd);
+		g_free (w);
+		g_free (cbdata);
+
+		return;
+	}
+
+	ev_timer_again (EV_A_ w);
+}
+
+#endif
+
+gint
+rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
+								   const char *cache_dir,
+								   gdouble max_time,
+								   gboolean silent,
 								   struct ev_loop *event_loop,
 								   void (*cb)(guint ncompiled, GError *err, void *cbd),
 								   void *cbd)
@@ -2266,6 +2709,125 @@ rspamd_re_cache_is_valid_hyperscan_file (struct rspamd_re_cache *cache,
 }
 
 
+#ifdef WITH_HYPERSCAN
+/*
+ * Maps the unserialized hyperscan database stored next to the serialized
+ * one, deserializing it to disk first if needed. The resulting pages are
+ * read-only and backed by the page cache, so all scanner processes share a
+ * single copy of the database instead of a private heap allocation each.
+ */
+static hs_database_t *
+rspamd_re_cache_load_hyperscan_unser (struct rspamd_re_cache *cache,
+		struct rspamd_re_class *re_class,
+		const gchar *path,
+		guint64 crc,
+		const guchar *ser, gsize ser_len)
+{
+	struct rspamd_hs_unserialized_header hdr, *phdr;
+	gchar upath[PATH_MAX], npath[PATH_MAX];
+	gpointer map;
+	gsize unser_len = 0, total_len;
+	struct stat st;
+	gint fd, ret;
+
+	if (hs_serialized_database_size ((const char *)ser, ser_len,
+			&unser_len) != HS_SUCCESS) {
+		return NULL;
+	}
+
+	total_len = sizeof (hdr) + unser_len;
+	rspamd_snprintf (upath, sizeof (upath), "%s.unser", path);
+	fd = open (upath, O_RDONLY);
+
+	if (fd != -1) {
+		if (fstat (fd, &st) != -1 && st.st_size == (goffset)total_len) {
+			map = mmap (NULL, total_len, PROT_READ, MAP_SHARED, fd, 0);
+			close (fd);
+
+			if (map != MAP_FAILED) {
+				phdr = map;
+
+				if (memcmp (phdr->magic, rspamd_hs_magic_unser,
+						sizeof (rspamd_hs_magic_unser)) == 0 &&
+					phdr->crc == crc && phdr->len == unser_len) {
+					re_class->hs_db_map = map;
+					re_class->hs_db_map_len = total_len;
+					msg_debug_re_cache ("mmapped unserialized database %s",
+							upath);
+
+					return (hs_database_t *)((guchar *)map + sizeof (hdr));
+				}
+
+				/* Stale file, e.g. after hyperscan upgrade */
+				munmap (map, total_len);
+			}
+		}
+		else {
+			close (fd);
+		}
+	}
+
+	/* Missing or stale: deserialize into a new shared file */
+	rspamd_snprintf (npath, sizeof (npath), "%s.new", upath);
+	fd = open (npath, O_CREAT | O_RDWR | O_EXCL, 00644);
+
+	if (fd == -1) {
+		/* Some other process is writing it, fallback to the private mode */
+		return NULL;
+	}
+
+	if (ftruncate (fd, total_len) == -1) {
+		msg_err_re_cache ("cannot extend %s: %s", npath, strerror (errno));
+		close (fd);
+		(void)unlink (npath);
+
+		return NULL;
+	}
+
+	map = mmap (NULL, total_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (map == MAP_FAILED) {
+		msg_err_re_cache ("cannot mmap %s: %s", npath, strerror (errno));
+		(void)unlink (npath);
+
+		return NULL;
+	}
+
+	if ((ret = hs_deserialize_database_at ((const char *)ser, ser_len,
+			(hs_database_t *)((guchar *)map + sizeof (hdr)))) != HS_SUCCESS) {
+		msg_err_re_cache ("cannot deserialize database to %s: %d", npath, ret);
+		munmap (map, total_len);
+		(void)unlink (npath);
+
+		return NULL;
+	}
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, rspamd_hs_magic_unser, sizeof (rspamd_hs_magic_unser));
+	hdr.crc = crc;
+	hdr.len = unser_len;
+	memcpy (map, &hdr, sizeof (hdr));
+	msync (map, total_len, MS_SYNC);
+	(void)mprotect (map, total_len, PROT_READ);
+
+	if (rename (npath, upath) == -1) {
+		msg_err_re_cache ("cannot rename %s -> %s: %s", npath, upath,
+				strerror (errno));
+		munmap (map, total_len);
+		(void)unlink (npath);
+
+		return NULL;
+	}
+
+	re_class->hs_db_map = map;
+	re_class->hs_db_map_len = total_len;
+	msg_info_re_cache ("deserialized shared hyperscan database to %s", upath);
+
+	return (hs_database_t *)((guchar *)map + sizeof (hdr));
+}
+#endif
+
 gboolean
 rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 		const char *cache_dir)
@@ -2281,6 +2843,7 @@ rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 	GHashTableIter it;
 	gpointer k, v;
 	guint8 *map, *p, *end;
+	guint64 crc;
 	struct rspamd_re_class *re_class;
 	struct rspamd_re_cache_elt *elt;
 	struct stat st;
@@ -2333,6 +2896,7 @@ rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 			p += n * sizeof (*hs_ids);
 			hs_flags = g_malloc (n * sizeof (*hs_flags));
 			memcpy (hs_flags, p, n * sizeof (*hs_flags));
+			memcpy (&crc, p + n * sizeof (*hs_ids), sizeof (crc));
 
 			/* Skip crc */
 			p += n * sizeof (*hs_ids) + sizeof (guint64);
@@ -2343,7 +2907,12 @@ rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 			}
 
 			if (re_class->hs_db != NULL) {
-				hs_free_database (re_class->hs_db);
+				if (re_class->hs_db_map != NULL) {
+					munmap (re_class->hs_db_map, re_class->hs_db_map_len);
+				}
+				else {
+					hs_free_database (re_class->hs_db);
+				}
 			}
 
 			if (re_class->hs_ids) {
@@ -2353,8 +2922,18 @@ rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 			re_class->hs_ids = NULL;
 			re_class->hs_scratch = NULL;
 			re_class->hs_db = NULL;
+			re_class->hs_db_map = NULL;
+			re_class->hs_db_map_len = 0;
 
-			if ((ret = hs_deserialize_database (p, end - p, &re_class->hs_db))
+			/*
+			 * Prefer the shared unserialized database: its pages are
+			 * shared between all workers via the page cache
+			 */
+			re_class->hs_db = rspamd_re_cache_load_hyperscan_unser (cache,
+					re_class, path, crc, p, end - p);
+
+			if (re_class->hs_db == NULL &&
+				(ret = hs_deserialize_database (p, end - p, &re_class->hs_db))
 					!= HS_SUCCESS) {
 				msg_err_re_cache ("bad hs database in %s: %d", path, ret);
 				munmap (map, st.st_size);
@@ -2429,3 +3008,313 @@ void rspamd_re_cache_add_selector (struct rspamd_re_cache *cache,
 		kh_value (cache->selectors, k) = ref;
 	}
 }
+
+
+/* Streaming prefilter over the rawbody class (milter chunk feeding) */
+
+struct rspamd_re_stream {
+#ifdef WITH_HYPERSCAN
+	struct rspamd_re_cache *cache;
+	hs_stream_t *hs_stream;
+	hs_scratch_t *scratch;
+	guint *matches; /* indexed by the global regexp id */
+	gsize fed;
+	gboolean valid;
+	gboolean closed;
+#else
+	gint unused;
+#endif
+};
+
+#ifdef WITH_HYPERSCAN
+static gint
+rspamd_re_cache_stream_cb (unsigned int id,
+		unsigned long long from,
+		unsigned long long to,
+		unsigned int flags,
+		void *ud)
+{
+	struct rspamd_re_stream *stream = ud;
+
+	if (id < stream->cache->nre) {
+		stream->matches[id] ++;
+	}
+
+	return 0;
+}
+
+/*
+ * Compiles the stream mode twin of the rawbody class from the very same
+ * pattern set as the loaded block mode database; done once per worker on
+ * the first stream request, since the serialized cache files are block
+ * mode merely
+ */
+static gboolean
+rspamd_re_cache_stream_db_init (struct rspamd_re_cache *cache)
+{
+	struct rspamd_re_class *re_class = NULL, *cur;
+	struct rspamd_re_cache_elt *elt;
+	hs_compile_error_t *hs_errors;
+	GHashTableIter it;
+	gpointer k, v;
+	gchar **pats;
+	guint *flags;
+	gint *ids;
+	guint n = 0, i;
+	gdouble t1;
+
+	if (cache->stream_db != NULL) {
+		return TRUE;
+	}
+
+	if (cache->stream_db_failed || !cache->hyperscan_loaded ||
+			cache->disable_hyperscan || cache->vectorized_hyperscan) {
+		return FALSE;
+	}
+
+	g_hash_table_iter_init (&it, cache->re_classes);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		cur = v;
+
+		if (cur->type == RSPAMD_RE_BODY && cur->hs_db != NULL && cur->nhs > 0) {
+			re_class = cur;
+			break;
+		}
+	}
+
+	if (re_class == NULL) {
+		cache->stream_db_failed = TRUE;
+		return FALSE;
+	}
+
+	t1 = rspamd_get_ticks (FALSE);
+	pats = g_malloc0 (sizeof (*pats) * re_class->nhs);
+	flags = g_malloc0 (sizeof (*flags) * re_class->nhs);
+	ids = g_malloc0 (sizeof (*ids) * re_class->nhs);
+
+	for (i = 0; i < re_class->nhs; i ++) {
+		rspamd_regexp_t *re;
+		guint pcre_flags;
+
+		elt = g_ptr_array_index (cache->re, re_class->hs_ids[i]);
+		re = elt->re;
+		pcre_flags = rspamd_regexp_get_pcre_flags (re);
+
+		pats[n] = rspamd_re_cache_hs_pattern_from_pcre (re);
+		ids[n] = re_class->hs_ids[i];
+		flags[n] = 0;
+
+#ifndef WITH_PCRE2
+		if (pcre_flags & PCRE_FLAG(UTF8)) {
+			flags[n] |= HS_FLAG_UTF8;
+		}
+#else
+		if (pcre_flags & PCRE_FLAG(UTF)) {
+			flags[n] |= HS_FLAG_UTF8;
+		}
+#endif
+		if (pcre_flags & PCRE_FLAG(CASELESS)) {
+			flags[n] |= HS_FLAG_CASELESS;
+		}
+		if (pcre_flags & PCRE_FLAG(MULTILINE)) {
+			flags[n] |= HS_FLAG_MULTILINE;
+		}
+		if (pcre_flags & PCRE_FLAG(DOTALL)) {
+			flags[n] |= HS_FLAG_DOTALL;
+		}
+		if (rspamd_regexp_get_maxhits (re) == 1) {
+			flags[n] |= HS_FLAG_SINGLEMATCH;
+		}
+		if (elt->match_type == RSPAMD_RE_CACHE_HYPERSCAN_PRE) {
+			flags[n] |= HS_FLAG_PREFILTER;
+		}
+
+		n ++;
+	}
+
+	if (hs_compile_multi ((const char **)pats, flags, (unsigned int *)ids, n,
+			HS_MODE_STREAM, &cache->plt, &cache->stream_db,
+			&hs_errors) != HS_SUCCESS) {
+		msg_info_re_cache ("cannot compile stream mode rawbody class: %s; "
+				"streamed prefiltering disabled", hs_errors->message);
+		hs_free_compile_error (hs_errors);
+		cache->stream_db = NULL;
+		cache->stream_db_failed = TRUE;
+	}
+	else if (hs_alloc_scratch (cache->stream_db,
+			&cache->stream_scratch) != HS_SUCCESS) {
+		hs_free_database (cache->stream_db);
+		cache->stream_db = NULL;
+		cache->stream_db_failed = TRUE;
+	}
+	else {
+		cache->stream_class = re_class;
+		cache->stream_ids = g_memdup (ids, n * sizeof (*ids));
+		cache->nstream_ids = n;
+		msg_info_re_cache ("compiled %d stream mode rawbody regexps in %.2f "
+				"seconds", n, rspamd_get_ticks (FALSE) - t1);
+	}
+
+	for (i = 0; i < n; i ++) {
+		g_free (pats[i]);
+	}
+
+	g_free (pats);
+	g_free (flags);
+	g_free (ids);
+
+	return cache->stream_db != NULL;
+}
+#endif
+
+struct rspamd_re_stream *
+rspamd_re_cache_stream_new (struct rspamd_re_cache *cache)
+{
+#ifdef WITH_HYPERSCAN
+	struct rspamd_re_stream *stream;
+
+	if (cache == NULL || !rspamd_re_cache_stream_db_init (cache)) {
+		return NULL;
+	}
+
+	stream = g_malloc0 (sizeof (*stream));
+	stream->cache = cache;
+	stream->matches = g_malloc0 (sizeof (guint) * cache->nre);
+	stream->scratch = cache->stream_scratch;
+	stream->valid = TRUE;
+
+	if (hs_open_stream (cache->stream_db, 0,
+			&stream->hs_stream) != HS_SUCCESS) {
+		rspamd_re_cache_stream_free (stream);
+
+		return NULL;
+	}
+
+	return stream;
+#else
+	return NULL;
+#endif
+}
+
+gboolean
+rspamd_re_cache_stream_feed (struct rspamd_re_stream *stream,
+		const guchar *data, gsize len)
+{
+#ifdef WITH_HYPERSCAN
+	if (stream == NULL || !stream->valid || stream->closed) {
+		return FALSE;
+	}
+
+	if (hs_scan_stream (stream->hs_stream, data, len, 0, stream->scratch,
+			rspamd_re_cache_stream_cb, stream) != HS_SUCCESS) {
+		stream->valid = FALSE;
+
+		return FALSE;
+	}
+
+	stream->fed += len;
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+#ifdef WITH_HYPERSCAN
+static void
+rspamd_re_cache_stream_close (struct rspamd_re_stream *stream)
+{
+	if (!stream->closed && stream->hs_stream != NULL) {
+		/* Deliver possible end anchored matches */
+		hs_close_stream (stream->hs_stream,
+				stream->scratch,
+				stream->valid ? rspamd_re_cache_stream_cb : NULL,
+				stream);
+		stream->hs_stream = NULL;
+		stream->closed = TRUE;
+	}
+}
+#endif
+
+void
+rspamd_re_cache_stream_attach (struct rspamd_task *task,
+		struct rspamd_re_stream *stream)
+{
+#ifdef WITH_HYPERSCAN
+	struct rspamd_re_runtime *rt = task->re_rt;
+	struct rspamd_re_cache *cache;
+	struct rspamd_re_cache_elt *elt;
+	guint i, cnt, maxhits;
+	gint id;
+
+	if (stream == NULL || rt == NULL || !stream->valid) {
+		return;
+	}
+
+	cache = stream->cache;
+
+	if (rt->cache != cache || cache->stream_class == NULL) {
+		return;
+	}
+
+	rspamd_re_cache_stream_close (stream);
+
+	if (stream->fed != task->msg.len) {
+		/* The stream saw different bytes, results cannot be used */
+		msg_debug_re_task ("regexp stream mismatch: %z fed, %z in message",
+				stream->fed, task->msg.len);
+
+		return;
+	}
+
+	for (i = 0; i < cache->nstream_ids; i ++) {
+		id = cache->stream_ids[i];
+
+		if (isset (rt->checked, id)) {
+			continue;
+		}
+
+		elt = g_ptr_array_index (cache->re, id);
+		cnt = stream->matches[id];
+
+		if (cnt == 0) {
+			/* The prefilter is a superset: no match is final */
+			setbit (rt->checked, id);
+			rt->stat.regexp_checked ++;
+		}
+		else if (elt->match_type == RSPAMD_RE_CACHE_HYPERSCAN) {
+			maxhits = rspamd_regexp_get_maxhits (elt->re);
+			rt->results[id] = maxhits > 0 ? MIN (cnt, maxhits) : cnt;
+			rt->stat.regexp_matched += rt->results[id];
+			rt->stat.regexp_checked ++;
+			setbit (rt->checked, id);
+		}
+		else {
+			/* Prefilter hit: confirm with pcre over the loaded message */
+			rspamd_re_cache_process_pcre (rt, elt->re, task,
+					task->msg.begin, task->msg.len, TRUE);
+			setbit (rt->checked, id);
+		}
+	}
+
+	msg_debug_re_task ("attached regexp stream results: %ud regexps resolved "
+			"from %z streamed bytes", cache->nstream_ids, stream->fed);
+#endif
+}
+
+void
+rspamd_re_cache_stream_free (struct rspamd_re_stream *stream)
+{
+#ifdef WITH_HYPERSCAN
+	if (stream == NULL) {
+		return;
+	}
+
+	rspamd_re_cache_stream_close (stream);
+
+	/* The scratch belongs to the cache */
+	g_free (stream->matches);
+	g_free (stream);
+#endif
+}
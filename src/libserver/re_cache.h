@@ -107,6 +107,39 @@ struct rspamd_re_runtime *rspamd_re_cache_runtime_new (struct rspamd_re_cache *c
 const struct rspamd_re_cache_stat *
 rspamd_re_cache_get_stat (struct rspamd_re_runtime *rt);
 
+struct rspamd_re_stream;
+
+/**
+ * Opens a streaming hyperscan prefilter over the rawbody (`full`) regexp
+ * class: chunks of the raw message can be fed while it is still being
+ * received, so the linear prefilter scan overlaps the network transfer.
+ * Returns NULL when hyperscan is not available or the class is empty.
+ */
+struct rspamd_re_stream *rspamd_re_cache_stream_new (
+		struct rspamd_re_cache *cache);
+
+/**
+ * Feeds the next chunk of the raw message into the stream
+ * @return FALSE if the stream has become invalid
+ */
+gboolean rspamd_re_cache_stream_feed (struct rspamd_re_stream *stream,
+		const guchar *data, gsize len);
+
+/**
+ * Transfers the stream results into the task's regexp runtime: regexps
+ * of the streamed class are marked as checked, hyperscan confirmed ones
+ * with their match counts and prefiltered ones after a pcre confirmation
+ * over the loaded message. The stream must have been fed exactly the
+ * task's raw message, otherwise the results are discarded.
+ */
+void rspamd_re_cache_stream_attach (struct rspamd_task *task,
+		struct rspamd_re_stream *stream);
+
+/**
+ * Releases the stream and all pending state
+ */
+void rspamd_re_cache_stream_free (struct rspamd_re_stream *stream);
+
 /**
  * Process regexp runtime and return the result for a specific regexp
  * @param task task object
@@ -325,6 +325,17 @@ rspamd_redis_pool_config (struct rspamd_redis_pool *pool,
 	pool->cfg = cfg;
 	pool->timeout = default_timeout;
 	pool->max_conns = default_max_conns;
+
+	if (cfg) {
+		/* Allow operators to cut the held connections count */
+		if (cfg->redis_pool_timeout > 0) {
+			pool->timeout = cfg->redis_pool_timeout;
+		}
+
+		if (cfg->redis_pool_max_conns > 0) {
+			pool->max_conns = cfg->redis_pool_max_conns;
+		}
+	}
 }
 
 
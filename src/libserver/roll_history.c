@@ -119,7 +119,8 @@ rspamd_roll_history_update (struct roll_history *history,
 
 	if (row_num < history->nrows) {
 		row = &history->rows[row_num];
-		g_atomic_int_set (&row->completed, FALSE);
+		/* Mark the row as being written, lock-free readers then skip it */
+		g_atomic_int_inc (&row->seq);
 	}
 	else {
 		/* Race condition */
@@ -178,7 +179,8 @@ rspamd_roll_history_update (struct roll_history *history,
 
 	row->scan_time = task->time_real_finish - task->task_timestamp;
 	row->len = task->msg.len;
-	g_atomic_int_set (&row->completed, TRUE);
+	/* Publish the row: the sequence becomes even again */
+	g_atomic_int_inc (&row->seq);
 }
 
 /**
@@ -346,7 +348,7 @@ rspamd_roll_history_load (struct roll_history *history, const gchar *filename)
 				row->action = ucl_object_toint (elt);
 			}
 
-			row->completed = TRUE;
+			row->seq = 2;
 		}
 	}
 
@@ -388,7 +390,7 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 	for (i = 0; i < history->nrows; i ++) {
 		row = &history->rows[i];
 
-		if (!row->completed) {
+		if (!ROLL_HISTORY_ROW_IS_COMPLETED (row)) {
 			continue;
 		}
 
@@ -47,9 +47,16 @@ struct roll_history_row {
 	gdouble score;
 	gdouble required_score;
 	gint action;
-	guint completed;
+	/*
+	 * Seqlock: odd while the row is being written, even when it is
+	 * stable and zero for a row that has never been filled
+	 */
+	guint seq;
 };
 
+#define ROLL_HISTORY_ROW_IS_COMPLETED(r) \
+	((g_atomic_int_get (&(r)->seq) & 1) == 0 && (r)->seq != 0)
+
 struct roll_history {
 	struct roll_history_row *rows;
 	gboolean disabled;
@@ -801,6 +801,7 @@ rspamd_control_handle_on_fork (struct rspamd_srv_command *cmd,
 	}
 	else {
 		child = g_malloc0 (sizeof (struct rspamd_worker));
+		child->load_slot = -1;
 		child->srv = srv;
 		child->type = parent->type;
 		child->pid = cmd->cmd.on_fork.cpid;
@@ -67,6 +67,27 @@ INIT_LOG_MODULE(symcache)
 #define CLR_FINISH_BIT(checkpoint, dyn_item) \
 	(dyn_item)->finished = 0
 static const guchar rspamd_symcache_magic[8] = {'r', 's', 'c', 2, 0, 0, 0, 0 };
+/* Per-sample smoothing for the shared execution time EMA */
+static const gdouble symcache_ema_alpha = 0.01;
+
+/*
+ * Versioned on-disk snapshot of the resolved symbols order; stored alongside
+ * the stats dump to let a restarted worker mmap the last sort order and skip
+ * the topological sort entirely
+ */
+static const guchar rspamd_symcache_order_magic[8] = {'r', 's', 'o', 1, 0, 0, 0, 0 };
+
+struct rspamd_symcache_order_header {
+	guchar magic[8];
+	guint64 cksum;
+	guint32 nitems;
+	guchar unused[12];
+};
+
+struct rspamd_symcache_order_elt {
+	guint32 id;
+	guint32 order;
+};
 
 struct rspamd_symcache_header {
 	guchar magic[8];
@@ -97,13 +118,21 @@ struct rspamd_symcache_id_list {
 	};
 };
 
+/* Task segments for conditional skip: size class x authenticated flag */
+#define RSPAMD_SYMCACHE_COND_BUCKETS 6
+/* Executions needed in a segment before a symbol may be skipped there */
+#define RSPAMD_SYMCACHE_COND_MIN_EXEC 1000
+/* Share of skipped executions that still run to re-probe the segment */
+#define RSPAMD_SYMCACHE_REPROBE_PROB 0.01
+
 struct rspamd_symcache_item {
 	/* This block is likely shared */
 	struct item_stat *st;
 
 	guint64 last_count;
-	struct rspamd_counter_data *cd;
 	gchar *symbol;
+	/* Metric definition of this symbol, linked at validation */
+	struct rspamd_symbol *sdef;
 	enum rspamd_symbol_type type;
 
 	/* Callback data */
@@ -142,8 +171,16 @@ struct rspamd_symcache_item {
 
 	/* Container */
 	GPtrArray *container;
+
+	/* Per segment skip decision, recomputed on resort */
+	guint8 cond_skip[RSPAMD_SYMCACHE_COND_BUCKETS];
 };
 
+/*
+ * Stat block lives in shared memory and is updated by all workers, so it is
+ * aligned to the cache line boundary to avoid false sharing between counters
+ * of adjacent symbols
+ */
 struct item_stat {
 	struct rspamd_counter_data time_counter;
 	gdouble avg_time;
@@ -153,7 +190,10 @@ struct item_stat {
 	struct rspamd_counter_data frequency_counter;
 	gdouble avg_frequency;
 	gdouble stddev_frequency;
-};
+	/* Per segment execution/fire counters for conditional skip */
+	guint cond_exec[RSPAMD_SYMCACHE_COND_BUCKETS];
+	guint cond_fired[RSPAMD_SYMCACHE_COND_BUCKETS];
+} RSPAMD_ALIGNED(64);
 
 struct rspamd_symcache {
 	/* Hash table for fast access */
@@ -213,6 +253,8 @@ struct delayed_cache_condition {
 struct cache_savepoint {
 	guint version;
 	guint items_inflight;
+	/* Items before this index in the order are all started */
+	guint started_prefix;
 	gboolean profile;
 	gdouble profile_start;
 
@@ -534,6 +576,179 @@ rspamd_symcache_resort (struct rspamd_symcache *cache)
 	cache->items_by_order = ord;
 }
 
+static gboolean
+rspamd_symcache_load_order (struct rspamd_symcache *cache, const gchar *name)
+{
+	struct rspamd_symcache_order_header *hdr;
+	struct rspamd_symcache_order_elt *elts;
+	struct symcache_order *ord;
+	struct rspamd_symcache_item *item;
+	struct stat st;
+	gchar path[PATH_MAX];
+	gpointer map;
+	guint64 total_hits = 0;
+	guint i;
+	gint fd;
+
+	rspamd_snprintf (path, sizeof (path), "%s.order", name);
+
+	fd = open (path, O_RDONLY);
+
+	if (fd == -1) {
+		msg_info_cache ("cannot open file %s, error %d, %s", path,
+				errno, strerror (errno));
+		return FALSE;
+	}
+
+	if (fstat (fd, &st) == -1 ||
+		st.st_size != (goffset)(sizeof (*hdr) +
+				cache->filters->len * sizeof (*elts))) {
+		close (fd);
+		msg_info_cache ("cannot use order file %s: size mismatch", path);
+
+		return FALSE;
+	}
+
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (map == MAP_FAILED) {
+		msg_info_cache ("cannot mmap file %s, error %d, %s", path,
+				errno, strerror (errno));
+
+		return FALSE;
+	}
+
+	hdr = map;
+
+	if (memcmp (hdr->magic, rspamd_symcache_order_magic,
+			sizeof (rspamd_symcache_order_magic)) != 0 ||
+		hdr->cksum != cache->cksum ||
+		hdr->nitems != cache->filters->len) {
+		msg_info_cache ("cannot use order file %s: stale snapshot", path);
+		munmap (map, st.st_size);
+
+		return FALSE;
+	}
+
+	elts = (struct rspamd_symcache_order_elt *)(hdr + 1);
+	ord = rspamd_symcache_order_new (cache, hdr->nitems);
+
+	for (i = 0; i < hdr->nitems; i ++) {
+		if (elts[i].id >= cache->items_by_id->len || elts[i].order == 0) {
+			goto err;
+		}
+
+		item = g_ptr_array_index (cache->items_by_id, elts[i].id);
+
+		if (!item->is_filter || TSORT_IS_MARKED_PERM (item)) {
+			/* Not a filter or a duplicate entry: the snapshot is broken */
+			goto err;
+		}
+
+		item->order = elts[i].order;
+		TSORT_MARK_PERM (item);
+		total_hits += item->st->total_hits;
+		g_ptr_array_add (ord->d, item);
+	}
+
+	munmap (map, st.st_size);
+	cache->total_hits = total_hits;
+
+	if (cache->items_by_order) {
+		REF_RELEASE (cache->items_by_order);
+	}
+
+	cache->items_by_order = ord;
+	msg_info_cache ("loaded symbols order of %d items from %s",
+			hdr->nitems, path);
+
+	return TRUE;
+
+err:
+	msg_info_cache ("cannot use order file %s: invalid snapshot", path);
+	munmap (map, st.st_size);
+	REF_RELEASE (ord);
+
+	return FALSE;
+}
+
+static gboolean
+rspamd_symcache_save_order (struct rspamd_symcache *cache, const gchar *name)
+{
+	struct rspamd_symcache_order_header hdr;
+	struct rspamd_symcache_order_elt elt;
+	struct rspamd_symcache_item *item;
+	gchar path[PATH_MAX], npath[PATH_MAX];
+	guint i;
+	gint fd;
+
+	if (cache->items_by_order == NULL) {
+		return FALSE;
+	}
+
+	rspamd_snprintf (path, sizeof (path), "%s.order", name);
+	rspamd_snprintf (npath, sizeof (npath), "%s.new", path);
+
+	fd = open (npath, O_CREAT | O_WRONLY | O_EXCL, 00644);
+
+	if (fd == -1) {
+		if (errno == EEXIST) {
+			/* Some other process is already writing data, give up silently */
+			return TRUE;
+		}
+
+		msg_err_cache ("cannot open file %s, error %d, %s", npath,
+				errno, strerror (errno));
+		return FALSE;
+	}
+
+	rspamd_file_lock (fd, FALSE);
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, rspamd_symcache_order_magic,
+			sizeof (rspamd_symcache_order_magic));
+	hdr.cksum = cache->cksum;
+	hdr.nitems = cache->items_by_order->d->len;
+
+	if (write (fd, &hdr, sizeof (hdr)) == -1) {
+		msg_err_cache ("cannot write to file %s, error %d, %s", npath,
+				errno, strerror (errno));
+		goto err;
+	}
+
+	for (i = 0; i < cache->items_by_order->d->len; i ++) {
+		item = g_ptr_array_index (cache->items_by_order->d, i);
+		elt.id = item->id;
+		elt.order = TSORT_UNMASK (item);
+
+		if (write (fd, &elt, sizeof (elt)) == -1) {
+			msg_err_cache ("cannot write to file %s, error %d, %s", npath,
+					errno, strerror (errno));
+			goto err;
+		}
+	}
+
+	rspamd_file_unlock (fd, FALSE);
+	close (fd);
+
+	if (rename (npath, path) == -1) {
+		msg_err_cache ("cannot rename %s -> %s, error %d, %s", npath, path,
+				errno, strerror (errno));
+		(void)unlink (npath);
+
+		return FALSE;
+	}
+
+	return TRUE;
+
+err:
+	rspamd_file_unlock (fd, FALSE);
+	close (fd);
+	(void)unlink (npath);
+
+	return FALSE;
+}
+
 static void
 rspamd_symcache_propagate_dep (struct rspamd_symcache *cache,
 							   struct rspamd_symcache_item *it,
@@ -670,6 +885,7 @@ rspamd_symcache_process_dep (struct rspamd_symcache *cache,
 static void
 rspamd_symcache_post_init (struct rspamd_symcache *cache)
 {
+	gdouble ts = rspamd_get_ticks (FALSE);
 	struct rspamd_symcache_item *it, *vit;
 	struct cache_dependency *dep;
 	struct delayed_cache_dependency *ddep;
@@ -749,7 +965,22 @@ rspamd_symcache_post_init (struct rspamd_symcache *cache)
 	g_ptr_array_sort_with_data (cache->postfilters, postfilters_cmp, cache);
 	g_ptr_array_sort_with_data (cache->idempotent, postfilters_cmp, cache);
 
-	rspamd_symcache_resort (cache);
+	/*
+	 * Try to reuse the order from the saved snapshot and fall back to the
+	 * full topological sort if it is missing or stale. The snapshot is
+	 * revalidated lazily: any runtime modification of the cache triggers
+	 * an ordinary resort that replaces it
+	 */
+	if (cache->cfg->cache_filename == NULL ||
+		!rspamd_symcache_load_order (cache, cache->cfg->cache_filename)) {
+		rspamd_symcache_resort (cache);
+	}
+
+	msg_info_cache ("resolved dependencies and sorted %d symbols in %.3f "
+			"seconds (checksum: %xL)",
+			cache->items_by_id->len,
+			rspamd_get_ticks (FALSE) - ts,
+			cache->cksum);
 }
 
 static gboolean
@@ -1076,16 +1307,13 @@ rspamd_symcache_add_symbol (struct rspamd_symcache *cache,
 
 	item = rspamd_mempool_alloc0 (cache->static_pool,
 			sizeof (struct rspamd_symcache_item));
+	/*
+	 * Counters are shared between all workers and updated lock-free,
+	 * hence the cache-line sized allocation
+	 */
 	item->st = rspamd_mempool_alloc0_shared (cache->static_pool,
 			sizeof (*item->st));
 	item->enabled = TRUE;
-
-	/*
-	 * We do not share cd to skip locking, instead we'll just calculate it on
-	 * save or accumulate
-	 */
-	item->cd = rspamd_mempool_alloc0 (cache->static_pool,
-			sizeof (struct rspamd_counter_data));
 	item->priority = priority;
 	item->type = type;
 
@@ -1254,6 +1482,13 @@ rspamd_symcache_save (struct rspamd_symcache *cache)
 				msg_err_cache ("cannot save cache data to %s: %s",
 						cache->cfg->cache_filename, strerror (errno));
 			}
+
+			/* Also save the current order to speed up the next start */
+			if (!rspamd_symcache_save_order (cache,
+					cache->cfg->cache_filename)) {
+				msg_err_cache ("cannot save cache order to %s.order: %s",
+						cache->cfg->cache_filename, strerror (errno));
+			}
 		}
 	}
 }
@@ -1461,6 +1696,7 @@ rspamd_symcache_metric_validate_cb (gpointer k, gpointer v, gpointer ud)
 	if (item) {
 		item->st->weight = weight;
 		s->cache_item = item;
+		item->sdef = s;
 	}
 }
 
@@ -1529,6 +1765,21 @@ rspamd_symcache_metric_limit (struct rspamd_task *task,
 		return FALSE;
 	}
 
+	if (task->result && task->result->passthrough_result != NULL) {
+		struct rspamd_passthrough_result *pr;
+
+		DL_FOREACH (task->result->passthrough_result, pr) {
+			if (!(pr->flags & RSPAMD_PASSTHROUGH_LEAST)) {
+				/*
+				 * Some prefilter has already asserted the verdict and it
+				 * cannot be overridden by scores, so the remaining
+				 * filters cannot change anything
+				 */
+				return TRUE;
+			}
+		}
+	}
+
 	if (cp->lim == 0.0) {
 		res = task->result;
 
@@ -1544,7 +1795,8 @@ rspamd_symcache_metric_limit (struct rspamd_task *task,
 
 	if (cp->rs) {
 
-		if (cp->rs->score > cp->lim) {
+		/* Actions are selected with score >= threshold, match that here */
+		if (cp->rs->score >= cp->lim) {
 			return TRUE;
 		}
 	}
@@ -1685,6 +1937,23 @@ rspamd_symcache_is_item_allowed (struct rspamd_task *task,
 	return TRUE;
 }
 
+/*
+ * Cheap task features define the segment a task belongs to; fire rates
+ * are tracked per segment, so symbols that never fire for e.g. small
+ * authenticated mail can be skipped just there
+ */
+static inline guint
+rspamd_symcache_task_bucket (struct rspamd_task *task)
+{
+	guint b = task->size_class; /* 0..2 */
+
+	if (task->user != NULL) {
+		b += 3;
+	}
+
+	return b;
+}
+
 static gboolean
 rspamd_symcache_check_symbol (struct rspamd_task *task,
 		struct rspamd_symcache *cache,
@@ -1725,6 +1994,14 @@ rspamd_symcache_check_symbol (struct rspamd_task *task,
 	if (!rspamd_symcache_is_item_allowed (task, item, TRUE)) {
 		check = FALSE;
 	}
+	else if (task->cfg->symcache_conditional_skip && item->is_filter &&
+			item->cond_skip[rspamd_symcache_task_bucket (task)] &&
+			rspamd_random_double_fast () > RSPAMD_SYMCACHE_REPROBE_PROB) {
+		/* The symbol carries no information for this task segment */
+		msg_debug_cache_task ("skip check of %s: no hits in segment %d",
+				item->symbol, rspamd_symcache_task_bucket (task));
+		check = FALSE;
+	}
 	else if (item->specific.normal.condition_cb != -1) {
 		/* We also executes condition callback to check if we need this symbol */
 		L = task->cfg->lua_state;
@@ -1752,8 +2029,13 @@ rspamd_symcache_check_symbol (struct rspamd_task *task,
 	if (check) {
 		msg_debug_cache_task ("execute %s, %d", item->symbol, item->id);
 
+		if (task->cfg->symcache_conditional_skip && item->is_filter) {
+			g_atomic_int_inc (
+					&item->st->cond_exec[rspamd_symcache_task_bucket (task)]);
+		}
+
 		if (checkpoint->profile) {
-			dyn_item->start_msec = (rspamd_get_virtual_ticks () -
+			dyn_item->start_msec = (rspamd_get_ticks_fast () -
 					checkpoint->profile_start) * 1e3;
 		}
 
@@ -1913,7 +2195,11 @@ rspamd_symcache_make_checkpoint (struct rspamd_task *task,
 			(rspamd_random_double_fast () >= (1 - PROFILE_PROBABILITY))) {
 		msg_debug_cache_task ("enable profiling of symbols for task");
 		checkpoint->profile = TRUE;
-		checkpoint->profile_start = rspamd_get_virtual_ticks ();
+		/*
+		 * Wall clock (rdtsc backed when available): profiling taxes every
+		 * executed symbol, so it must not cost a cputime syscall per probe
+		 */
+		checkpoint->profile_start = rspamd_get_ticks_fast ();
 		cache->last_profile = now;
 	}
 
@@ -2124,7 +2410,13 @@ rspamd_symcache_process_symbols (struct rspamd_task *task,
 	case RSPAMD_TASK_STAGE_FILTERS:
 		all_done = TRUE;
 
-		for (i = 0; i < (gint) checkpoint->version; i++) {
+		/*
+		 * This stage is re-entered after every completed async event;
+		 * skipping the contiguous prefix of already started items keeps
+		 * each pass proportional to the pending tail instead of the
+		 * whole symbols order
+		 */
+		for (i = checkpoint->started_prefix; i < (gint) checkpoint->version; i++) {
 			if (RSPAMD_TASK_IS_SKIPPED (task)) {
 				return TRUE;
 			}
@@ -2133,6 +2425,10 @@ rspamd_symcache_process_symbols (struct rspamd_task *task,
 			dyn_item = rspamd_symcache_get_dynamic (checkpoint, item);
 
 			if (item->type & SYMBOL_TYPE_CLASSIFIER) {
+				if (i == (gint) checkpoint->started_prefix) {
+					checkpoint->started_prefix = i + 1;
+				}
+
 				continue;
 			}
 
@@ -2153,6 +2449,11 @@ rspamd_symcache_process_symbols (struct rspamd_task *task,
 						checkpoint);
 			}
 
+			if (i == (gint) checkpoint->started_prefix &&
+				CHECK_START_BIT (checkpoint, dyn_item)) {
+				checkpoint->started_prefix = i + 1;
+			}
+
 			if (!(item->type & SYMBOL_TYPE_FINE)) {
 				if (rspamd_symcache_metric_limit (task, checkpoint)) {
 					msg_info_task ("task has already scored more than %.2f, so do "
@@ -2380,6 +2681,34 @@ rspamd_symcache_resort_cb (EV_P_ ev_timer *w, int revents)
 	cbdata->resort_ev.repeat = tm;
 	ev_timer_again (EV_A_ w);
 
+	if (cache->cfg->symcache_conditional_skip) {
+		/*
+		 * Recompute the per segment skip decisions from the shared
+		 * counters: a symbol that has been executed often enough in a
+		 * segment without a single hit carries no information there and
+		 * is skipped (except for the re-probe sample) until it fires
+		 */
+		for (i = 0; i < cache->filters->len; i ++) {
+			guint b;
+
+			item = g_ptr_array_index (cache->filters, i);
+
+			for (b = 0; b < RSPAMD_SYMCACHE_COND_BUCKETS; b ++) {
+				guint ex = item->st->cond_exec[b],
+					fired = item->st->cond_fired[b];
+
+				item->cond_skip[b] = (ex >= RSPAMD_SYMCACHE_COND_MIN_EXEC &&
+						fired == 0);
+
+				if (ex > RSPAMD_SYMCACHE_COND_MIN_EXEC * 100) {
+					/* Age the counters, so behaviour drift is tracked */
+					item->st->cond_exec[b] = ex / 2;
+					item->st->cond_fired[b] = fired / 2;
+				}
+			}
+		}
+	}
+
 	if (rspamd_worker_is_primary_controller (cbdata->w)) {
 		/* Gather stats from shared execution times */
 		for (i = 0; i < cache->filters->len; i ++) {
@@ -2393,7 +2722,7 @@ rspamd_symcache_resort_cb (EV_P_ ev_timer *w, int revents)
 
 				cur_value = (item->st->total_hits - item->last_count) /
 							(cur_ticks - cbdata->last_resort);
-				rspamd_set_counter_ema (&item->st->frequency_counter,
+				rspamd_set_counter_ema_shared (&item->st->frequency_counter,
 						cur_value, decay_rate);
 				item->st->avg_frequency = item->st->frequency_counter.mean;
 				item->st->stddev_frequency = item->st->frequency_counter.stddev;
@@ -2430,14 +2759,10 @@ rspamd_symcache_resort_cb (EV_P_ ev_timer *w, int revents)
 
 			item->last_count = item->st->total_hits;
 
-			if (item->cd->number > 0) {
-				if (item->type & (SYMBOL_TYPE_CALLBACK|SYMBOL_TYPE_NORMAL)) {
-					item->st->avg_time = item->cd->mean;
-					rspamd_set_counter_ema (&item->st->time_counter,
-							item->st->avg_time, decay_rate);
-					item->st->avg_time = item->st->time_counter.mean;
-					memset (item->cd, 0, sizeof (*item->cd));
-				}
+			if (item->st->time_counter.number > 0 &&
+				(item->type & (SYMBOL_TYPE_CALLBACK|SYMBOL_TYPE_NORMAL))) {
+				/* Scanners feed the shared EMA directly, just publish it */
+				item->st->avg_time = item->st->time_counter.mean;
 			}
 		}
 
@@ -2480,10 +2805,16 @@ rspamd_symcache_start_refresh (struct rspamd_symcache *cache,
 
 void
 rspamd_symcache_inc_frequency (struct rspamd_symcache *cache,
-							   struct rspamd_symcache_item *item)
+							   struct rspamd_symcache_item *item,
+							   struct rspamd_task *task)
 {
 	if (item != NULL) {
 		g_atomic_int_inc (&item->st->hits);
+
+		if (task != NULL && task->cfg->symcache_conditional_skip) {
+			g_atomic_int_inc (
+					&item->st->cond_fired[rspamd_symcache_task_bucket (task)]);
+		}
 	}
 }
 
@@ -2945,6 +3276,12 @@ rspamd_symcache_foreach (struct rspamd_symcache *cache,
 	}
 }
 
+struct rspamd_symbol *
+rspamd_symcache_item_sdef (struct rspamd_symcache_item *item)
+{
+	return item ? item->sdef : NULL;
+}
+
 struct rspamd_symcache_item *
 rspamd_symcache_get_cur_item (struct rspamd_task *task)
 {
@@ -3018,7 +3355,7 @@ rspamd_symcache_finalize_item (struct rspamd_task *task,
 	checkpoint->cur_item = NULL;
 
 	if (checkpoint->profile) {
-		diff = ((rspamd_get_virtual_ticks () - checkpoint->profile_start) * 1e3 -
+		diff = ((rspamd_get_ticks_fast () - checkpoint->profile_start) * 1e3 -
 				dyn_item->start_msec);
 		if (diff > slow_diff_limit) {
 			msg_info_task ("slow rule: %s(%d): %.2f ms", item->symbol, item->id,
@@ -3030,7 +3367,13 @@ rspamd_symcache_finalize_item (struct rspamd_task *task,
 		}
 
 		if (rspamd_worker_is_scanner (task->worker)) {
-			rspamd_set_counter (item->cd, diff);
+			/*
+			 * Update the shared counter in place: CAS based updates are
+			 * lock-free, so all workers converge on a single average
+			 * instead of per-process counters merged on resort
+			 */
+			rspamd_set_counter_ema_shared (&item->st->time_counter,
+					diff, symcache_ema_alpha);
 		}
 	}
 
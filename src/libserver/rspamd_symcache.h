@@ -214,7 +214,8 @@ void rspamd_symcache_start_refresh (struct rspamd_symcache *cache,
  * @param symbol
  */
 void rspamd_symcache_inc_frequency (struct rspamd_symcache *cache,
-									struct rspamd_symcache_item *item);
+									struct rspamd_symcache_item *item,
+									struct rspamd_task *task);
 
 /**
  * Add dependency relation between two symbols identified by id (source) and
@@ -360,6 +361,14 @@ void rspamd_symcache_foreach (struct rspamd_symcache *cache,
 											gint /* flags */, gpointer /* userdata */),
 							  gpointer ud);
 
+/**
+ * Returns the metric symbol definition linked to a cache item at
+ * validation time (NULL for items without a score)
+ * @param item
+ * @return
+ */
+struct rspamd_symbol *rspamd_symcache_item_sdef (struct rspamd_symcache_item *item);
+
 /**
  * Returns the current item being processed (if any)
  * @param task
@@ -282,12 +282,20 @@ rspamd_flatten_record_dtor (struct spf_resolved *r)
 
 static void
 rspamd_spf_process_reference (struct spf_resolved *target,
-		struct spf_addr *addr, struct spf_record *rec, gboolean top)
+		struct spf_addr *addr, struct spf_record *rec, gboolean top,
+		guint depth)
 {
 	struct spf_resolved_element *elt, *relt;
 	struct spf_addr *cur = NULL, taddr, *cur_addr;
 	guint i;
 
+	if (depth > SPF_MAX_NESTING) {
+		/* Cycle of references (e.g. deduplicated self-includes) */
+		msg_info_spf ("spf error for domain %s: references cycle found",
+				rec->sender_domain);
+		return;
+	}
+
 	if (addr) {
 		g_assert (addr->m.idx < rec->resolved->len);
 
@@ -355,11 +363,13 @@ rspamd_spf_process_reference (struct spf_resolved *target,
 			/* Process reference */
 			if (cur->flags & RSPAMD_SPF_FLAG_REDIRECT) {
 				/* Stop on redirected domain */
-				rspamd_spf_process_reference (target, cur, rec, top);
+				rspamd_spf_process_reference (target, cur, rec, top,
+						depth + 1);
 				break;
 			}
 			else {
-				rspamd_spf_process_reference (target, cur, rec, FALSE);
+				rspamd_spf_process_reference (target, cur, rec, FALSE,
+						depth + 1);
 			}
 		}
 		else {
@@ -397,7 +407,7 @@ rspamd_spf_record_flatten (struct spf_record *rec)
 		REF_INIT_RETAIN (res, rspamd_flatten_record_dtor);
 
 		if (rec->resolved->len > 0) {
-			rspamd_spf_process_reference (res, NULL, rec, TRUE);
+			rspamd_spf_process_reference (res, NULL, rec, TRUE, 0);
 		}
 	}
 	else {
@@ -1374,6 +1384,26 @@ parse_spf_include (struct spf_record *rec, struct spf_addr *addr)
 
 	domain++;
 
+	/*
+	 * Deduplicate identical includes within one record: they are common
+	 * in the wild and would otherwise double both the DNS round trips
+	 * and the RFC lookups budget. All mechanisms of a record are resolved
+	 * concurrently, so referencing an element that is still in-flight is
+	 * fine: flattening happens only when no requests remain.
+	 */
+	for (guint i = 0; i < rec->resolved->len; i++) {
+		struct spf_resolved_element *er = g_ptr_array_index (rec->resolved, i);
+
+		if (g_ascii_strcasecmp (er->cur_domain, domain) == 0) {
+			addr->m.idx = i;
+			addr->flags |= RSPAMD_SPF_FLAG_REFERENCE;
+			msg_debug_spf ("duplicate include %s, reuse element %d",
+					domain, (gint)i);
+
+			return TRUE;
+		}
+	}
+
 	rec->dns_requests++;
 
 	cb = rspamd_mempool_alloc (task->task_pool, sizeof (struct spf_dns_cb));
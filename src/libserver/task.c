@@ -15,6 +15,7 @@
  */
 #include "task.h"
 #include "rspamd.h"
+#include "libserver/worker_util.h"
 #include "scan_result.h"
 #include "libserver/protocol.h"
 #include "libserver/protocol_internal.h"
@@ -27,6 +28,10 @@
 #include "utlist.h"
 #include "contrib/zstd/zstd.h"
 #include "libserver/mempool_vars_internal.h"
+#include "libserver/url.h"
+#include "libserver/dkim.h"
+#include "libcryptobox/cryptobox.h"
+#include "ottery.h"
 #include "libserver/cfg_file_private.h"
 #include "libmime/lang_detection.h"
 #include "libmime/scan_result_private.h"
@@ -81,6 +86,7 @@ rspamd_task_new (struct rspamd_worker *worker, struct rspamd_config *cfg,
 	new_task->task_pool = task_pool;
 	new_task->flags = flags;
 	new_task->worker = worker;
+	rspamd_worker_load_add (worker, 1);
 	new_task->lang_det = lang_det;
 
 	if (cfg) {
@@ -99,13 +105,19 @@ rspamd_task_new (struct rspamd_worker *worker, struct rspamd_config *cfg,
 		if (new_task->lang_det == NULL && cfg->lang_det != NULL) {
 			new_task->lang_det = cfg->lang_det;
 		}
+
+		if (cfg->profile_probability > 0 &&
+			rspamd_random_double_fast () < cfg->profile_probability) {
+			/* Sampled always-on profiling: no client header is needed */
+			new_task->flags |= RSPAMD_TASK_FLAG_PROFILE;
+		}
 	}
 
 	new_task->event_loop = event_loop;
 	new_task->task_timestamp = ev_time ();
 	new_task->time_real_finish = NAN;
 
-	new_task->request_headers = kh_init (rspamd_req_headers_hash);
+	/* request_headers is embedded and zeroed with the task itself */
 	new_task->sock = -1;
 	new_task->flags |= (RSPAMD_TASK_FLAG_MIME);
 	new_task->result = rspamd_create_metric_result (new_task);
@@ -290,8 +302,12 @@ rspamd_task_free (struct rspamd_task *task)
 			REF_RELEASE (task->cfg);
 		}
 
-		kh_destroy (rspamd_req_headers_hash, task->request_headers);
+		/* Embedded table: only the internals are to be freed */
+		kfree (task->request_headers.keys);
+		kfree (task->request_headers.vals);
+		kfree (task->request_headers.flags);
 		rspamd_message_unref (task->message);
+		rspamd_worker_load_add (task->worker, -1);
 
 		if (task->flags & RSPAMD_TASK_FLAG_OWN_POOL) {
 			rspamd_mempool_delete (task->task_pool);
@@ -314,6 +330,51 @@ rspamd_task_unmapper (gpointer ud)
 	close (m->fd);
 }
 
+/* Processing profile boundaries: tails get their own tuning */
+#define RSPAMD_TASK_SMALL_SIZE (16 * 1024UL)
+#define RSPAMD_TASK_HUGE_SIZE (1024 * 1024UL)
+
+/*
+ * A lightweight size/shape classifier: picks a processing profile from
+ * the message length and MIME hints in the head of the message, then
+ * adapts the task pool chunk size accordingly. One size fits all chunks
+ * are tuned for the median message and lose on both tails: tiny texts
+ * overallocate, huge multiparts walk long chain lists
+ */
+static void
+rspamd_task_classify_profile (struct rspamd_task *task)
+{
+	gsize len = task->msg.len;
+
+	if (len > 0 && len <= RSPAMD_TASK_SMALL_SIZE) {
+		task->size_class = RSPAMD_TASK_SIZE_SMALL;
+		/* Tiny texts never need the suggested chunk size */
+		task->task_pool->elt_len = MAX (len * 2, 4096);
+	}
+	else if (len >= RSPAMD_TASK_HUGE_SIZE) {
+		gsize hlen = MIN (len, 4096);
+
+		task->size_class = RSPAMD_TASK_SIZE_HUGE;
+		/*
+		 * Huge messages allocate a lot (decoded parts, text copies),
+		 * so grow chunks to keep the chain list short; multiparts
+		 * spotted in the head are decoded into the pool as well, hence
+		 * the larger step for them
+		 */
+		if (rspamd_substring_search_caseless (task->msg.begin, hlen,
+				"multipart/", sizeof ("multipart/") - 1) != -1) {
+			task->task_pool->elt_len = 256 * 1024;
+		}
+		else {
+			task->task_pool->elt_len = 128 * 1024;
+		}
+	}
+
+	msg_debug_task ("classified message of %z bytes as %s profile", len,
+			task->size_class == RSPAMD_TASK_SIZE_SMALL ? "small" :
+			task->size_class == RSPAMD_TASK_SIZE_HUGE ? "huge" : "normal");
+}
+
 gboolean
 rspamd_task_load_message (struct rspamd_task *task,
 						  struct rspamd_http_message *msg, const gchar *start, gsize len)
@@ -429,6 +490,7 @@ rspamd_task_load_message (struct rspamd_task *task,
 				fp, shmem_size, offset, fd);
 
 		rspamd_mempool_add_destructor (task->task_pool, rspamd_task_unmapper, m);
+		rspamd_task_classify_profile (task);
 
 		return TRUE;
 	}
@@ -492,6 +554,19 @@ rspamd_task_load_message (struct rspamd_task *task,
 
 			task->msg.begin = map;
 			task->msg.len = st.st_size;
+
+#ifdef MADV_SEQUENTIAL
+			if (st.st_size > 10 * 1024 * 1024) {
+				/*
+				 * Scanning passes are mostly linear: telling the kernel
+				 * so bounds the resident size of huge outliers, since
+				 * pages behind the scan position are reclaimed first
+				 * instead of evicting the common working set
+				 */
+				(void)madvise (map, st.st_size, MADV_SEQUENTIAL);
+			}
+#endif
+
 			m = rspamd_mempool_alloc (task->task_pool, sizeof (*m));
 			m->begin = map;
 			m->len = st.st_size;
@@ -504,6 +579,7 @@ rspamd_task_load_message (struct rspamd_task *task,
 		task->flags |= RSPAMD_TASK_FLAG_FILE;
 
 		msg_info_task ("loaded message from file %s", fp);
+		rspamd_task_classify_profile (task);
 
 		return TRUE;
 	}
@@ -656,6 +732,8 @@ rspamd_task_load_message (struct rspamd_task *task,
 		}
 	}
 
+	rspamd_task_classify_profile (task);
+
 	return TRUE;
 }
 
@@ -690,6 +768,356 @@ rspamd_task_select_processing_stage (struct rspamd_task *task, guint stages)
 	return RSPAMD_TASK_STAGE_DONE;
 }
 
+/*
+ * Verdict memoization for byte identical duplicates: mirrored MX
+ * deliveries and forwarding loops rescan the very same bytes within
+ * seconds. The memo is keyed by the task digest plus the envelope
+ * identities, so only true duplicates (same body, same sender and
+ * recipients) replay; recipient specific symbols therefore need no
+ * fixups since differing envelopes never share a memo slot.
+ */
+struct rspamd_verdict_memo_sym {
+	gchar *name;
+	gdouble score;
+	GPtrArray *opts; /* gchar * elements */
+};
+
+struct rspamd_verdict_memo {
+	struct rspamd_verdict_memo_sym *syms;
+	guint nsyms;
+	guint cap;
+	gdouble score;
+};
+
+static rspamd_lru_hash_t *verdict_memo_hash = NULL; /* Per worker */
+/* Random per process secret keying the memo digests */
+static guchar verdict_memo_secret[rspamd_cryptobox_HASHBYTES];
+
+static guint
+rspamd_verdict_memo_key_hash (gconstpointer p)
+{
+	guint h;
+
+	/* The key is a blake2 digest, any slice of it is well distributed */
+	memcpy (&h, p, sizeof (h));
+
+	return h;
+}
+
+static gboolean
+rspamd_verdict_memo_key_equal (gconstpointer a, gconstpointer b)
+{
+	return memcmp (a, b, rspamd_cryptobox_HASHBYTES) == 0;
+}
+
+static void
+rspamd_verdict_memo_dtor (gpointer p)
+{
+	struct rspamd_verdict_memo *memo = p;
+	guint i, j;
+
+	for (i = 0; i < memo->nsyms; i ++) {
+		g_free (memo->syms[i].name);
+
+		if (memo->syms[i].opts) {
+			for (j = 0; j < memo->syms[i].opts->len; j ++) {
+				g_free (g_ptr_array_index (memo->syms[i].opts, j));
+			}
+
+			g_ptr_array_free (memo->syms[i].opts, TRUE);
+		}
+	}
+
+	g_free (memo->syms);
+	g_free (memo);
+}
+
+static void
+rspamd_task_verdict_memo_add_sym (gpointer k, gpointer v, gpointer ud)
+{
+	const gchar *name = k;
+	struct rspamd_symbol_result *res = v;
+	struct rspamd_verdict_memo *memo = ud;
+	struct rspamd_verdict_memo_sym *ms;
+	struct rspamd_symbol_option *opt;
+
+	if (memo->nsyms >= memo->cap) {
+		memo->cap *= 2;
+		memo->syms = g_realloc (memo->syms,
+				sizeof (*memo->syms) * memo->cap);
+		memset (memo->syms + memo->nsyms, 0,
+				sizeof (*memo->syms) * (memo->cap - memo->nsyms));
+	}
+
+	ms = &memo->syms[memo->nsyms];
+	ms->name = g_strdup (name);
+
+	/*
+	 * Inserting replays through the ordinary weighting, so store the
+	 * multiplier rather than the final score where the symbol has a
+	 * configured weight
+	 */
+	if (res->sym != NULL && res->sym->weight_ptr != NULL &&
+			*res->sym->weight_ptr != 0) {
+		ms->score = res->score / *res->sym->weight_ptr;
+	}
+	else {
+		ms->score = res->score;
+	}
+
+	if (res->opts_head != NULL) {
+		ms->opts = g_ptr_array_new ();
+
+		DL_FOREACH (res->opts_head, opt) {
+			g_ptr_array_add (ms->opts, g_strdup (opt->option));
+		}
+	}
+
+	memo->nsyms ++;
+}
+
+/*
+ * The memo key guards a full verdict replay, so it must be collision
+ * resistant against adversarial (digest, envelope) pairs: it is the
+ * blake2 digest of the task digest and the envelope identities, keyed
+ * with a random per process secret, and lookups compare the whole
+ * digest, so offline collision search is not possible
+ */
+static void
+rspamd_task_verdict_memo_key (struct rspamd_task *task,
+		guchar out[rspamd_cryptobox_HASHBYTES])
+{
+	rspamd_cryptobox_hash_state_t st;
+	struct rspamd_email_address *addr;
+	guint i;
+
+	rspamd_cryptobox_hash_init (&st, verdict_memo_secret,
+			sizeof (verdict_memo_secret));
+	rspamd_cryptobox_hash_update (&st,
+			MESSAGE_FIELD (task, digest),
+			sizeof (MESSAGE_FIELD (task, digest)));
+
+	if (task->from_envelope) {
+		rspamd_cryptobox_hash_update (&st,
+				(const guchar *)task->from_envelope->addr,
+				task->from_envelope->addr_len);
+	}
+
+	if (task->rcpt_envelope) {
+		PTR_ARRAY_FOREACH (task->rcpt_envelope, i, addr) {
+			rspamd_cryptobox_hash_update (&st, (const guchar *)addr->addr,
+					addr->addr_len);
+		}
+	}
+
+	rspamd_cryptobox_hash_final (&st, out);
+}
+
+static gboolean
+rspamd_task_verdict_memo_usable (struct rspamd_task *task)
+{
+	return task->cfg != NULL && task->cfg->verdict_memo_ttl > 0 &&
+			task->message != NULL && task->msg.len > 0 &&
+			task->settings == NULL && task->settings_elt == NULL &&
+			task->err == NULL &&
+			!(task->flags & (RSPAMD_TASK_FLAG_LEARN_SPAM |
+					RSPAMD_TASK_FLAG_LEARN_HAM | RSPAMD_TASK_FLAG_SKIP));
+}
+
+static gboolean
+rspamd_task_try_verdict_memo (struct rspamd_task *task)
+{
+	struct rspamd_verdict_memo *memo;
+	struct rspamd_verdict_memo_sym *ms;
+	struct rspamd_symbol_result *s;
+	guchar key[rspamd_cryptobox_HASHBYTES];
+	guint i, j;
+
+	if (verdict_memo_hash == NULL || !rspamd_task_verdict_memo_usable (task)) {
+		return FALSE;
+	}
+
+	rspamd_task_verdict_memo_key (task, key);
+	memo = rspamd_lru_hash_lookup (verdict_memo_hash, key,
+			task->task_timestamp);
+
+	if (memo == NULL) {
+		return FALSE;
+	}
+
+	for (i = 0; i < memo->nsyms; i ++) {
+		ms = &memo->syms[i];
+
+		if (rspamd_task_find_symbol_result (task, ms->name) != NULL) {
+			/* Already inserted by a prefilter on this very task */
+			continue;
+		}
+
+		s = rspamd_task_insert_result_full (task, ms->name, ms->score,
+				NULL, RSPAMD_SYMBOL_INSERT_SINGLE);
+
+		if (s != NULL && ms->opts != NULL) {
+			for (j = 0; j < ms->opts->len; j ++) {
+				rspamd_task_add_result_option (task, s,
+						g_ptr_array_index (ms->opts, j));
+			}
+		}
+	}
+
+	if (task->result != NULL) {
+		/* The saved total is authoritative for the duplicate */
+		task->result->score = memo->score;
+	}
+
+	rspamd_mempool_set_variable (task->task_pool, "verdict_memo_replayed",
+			GINT_TO_POINTER (1), NULL);
+	msg_info_task ("replayed %ud symbols (score %.2f) from the verdict memo "
+			"for a byte identical duplicate", memo->nsyms, memo->score);
+
+	return TRUE;
+}
+
+static void
+rspamd_task_save_verdict_memo (struct rspamd_task *task)
+{
+	struct rspamd_verdict_memo *memo;
+	guchar key[rspamd_cryptobox_HASHBYTES];
+	guchar *pkey;
+
+	if (!rspamd_task_verdict_memo_usable (task) || task->result == NULL ||
+			task->result->symbols == NULL ||
+			RSPAMD_TASK_IS_SKIPPED (task)) {
+		return;
+	}
+
+	if (rspamd_mempool_get_variable (task->task_pool,
+			"verdict_memo_replayed") != NULL) {
+		/* Do not re-memoize replays */
+		return;
+	}
+
+	if (verdict_memo_hash == NULL) {
+		verdict_memo_hash = rspamd_lru_hash_new_full (1024,
+				g_free, rspamd_verdict_memo_dtor,
+				rspamd_verdict_memo_key_hash, rspamd_verdict_memo_key_equal);
+		ottery_rand_bytes (verdict_memo_secret,
+				sizeof (verdict_memo_secret));
+	}
+
+	memo = g_malloc0 (sizeof (*memo));
+	memo->score = task->result->score;
+	memo->cap = 16;
+	memo->syms = g_malloc0 (sizeof (*memo->syms) * memo->cap);
+
+	rspamd_task_symbol_result_foreach (task, rspamd_task_verdict_memo_add_sym,
+			memo);
+
+	rspamd_task_verdict_memo_key (task, key);
+	pkey = g_malloc (sizeof (key));
+	memcpy (pkey, key, sizeof (key));
+	rspamd_lru_hash_insert (verdict_memo_hash, pkey, memo,
+			task->task_timestamp, task->cfg->verdict_memo_ttl);
+}
+
+/* Maps the fine grained stage bits into the 8 coarse watermark slots */
+static gint
+rspamd_task_stage_wm_slot (gint st)
+{
+	switch (st) {
+	case RSPAMD_TASK_STAGE_READ_MESSAGE:
+		return 0;
+	case RSPAMD_TASK_STAGE_PROCESS_MESSAGE:
+		return 1;
+	case RSPAMD_TASK_STAGE_PRE_FILTERS_EMPTY:
+	case RSPAMD_TASK_STAGE_PRE_FILTERS:
+		return 2;
+	case RSPAMD_TASK_STAGE_FILTERS:
+		return 3;
+	case RSPAMD_TASK_STAGE_CLASSIFIERS_PRE:
+	case RSPAMD_TASK_STAGE_CLASSIFIERS:
+	case RSPAMD_TASK_STAGE_CLASSIFIERS_POST:
+		return 4;
+	case RSPAMD_TASK_STAGE_COMPOSITES:
+	case RSPAMD_TASK_STAGE_COMPOSITES_POST:
+		return 5;
+	case RSPAMD_TASK_STAGE_POST_FILTERS:
+		return 6;
+	case RSPAMD_TASK_STAGE_IDEMPOTENT:
+		return 7;
+	default:
+		return -1;
+	}
+}
+
+const gchar *rspamd_stage_wm_names[RSPAMD_STAGE_HIST_STAGES] = {
+	"read_message", "process_message", "prefilters", "filters",
+	"classifiers", "composites", "postfilters", "idempotent",
+};
+
+/* Histogram upper bounds in seconds, must match the exporter */
+const gdouble rspamd_stage_hist_bounds[RSPAMD_STAGE_HIST_BUCKETS - 1] = {
+	0.001, 0.002, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+	0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0,
+};
+
+/*
+ * Folds the recorded watermarks into the shared per stage histograms:
+ * a stage's wall time spans from its first entry to the entry of the
+ * next recorded stage (or now for the last one), so asynchronous waits
+ * are attributed to the stage that issued them
+ */
+static void
+rspamd_task_update_stage_hist (struct rspamd_task *task)
+{
+	struct rspamd_stage_histogram *hist;
+	gdouble start, end, d, now;
+	gint i, j, b;
+
+	if (task->worker == NULL || task->worker->srv == NULL ||
+			task->worker->srv->stat == NULL) {
+		return;
+	}
+
+	now = rspamd_get_ticks_fast ();
+
+	for (i = 0; i < RSPAMD_STAGE_HIST_STAGES; i ++) {
+		start = task->stage_watermarks[i];
+
+		if (start == 0) {
+			continue;
+		}
+
+		end = now;
+
+		for (j = i + 1; j < RSPAMD_STAGE_HIST_STAGES; j ++) {
+			if (task->stage_watermarks[j] != 0) {
+				end = task->stage_watermarks[j];
+				break;
+			}
+		}
+
+		d = MAX (end - start, 0);
+
+		for (b = 0; b < RSPAMD_STAGE_HIST_BUCKETS - 1; b ++) {
+			if (d <= rspamd_stage_hist_bounds[b]) {
+				break;
+			}
+		}
+
+		hist = &task->worker->srv->stat->stage_hist[i];
+#ifndef HAVE_ATOMIC_BUILTINS
+		hist->buckets[b] ++;
+		hist->count ++;
+		hist->sum_usec += (guint64)(d * 1e6);
+#else
+		__atomic_add_fetch (&hist->buckets[b], 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch (&hist->count, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch (&hist->sum_usec, (guint64)(d * 1e6),
+				__ATOMIC_RELAXED);
+#endif
+	}
+}
+
 gboolean
 rspamd_task_process (struct rspamd_task *task, guint stages)
 {
@@ -710,6 +1138,15 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 
 	st = rspamd_task_select_processing_stage (task, stages);
 
+	{
+		/* Stage watermark: the first entry into a coarse slot is recorded */
+		gint wm_slot = rspamd_task_stage_wm_slot (st);
+
+		if (wm_slot >= 0 && task->stage_watermarks[wm_slot] == 0) {
+			task->stage_watermarks[wm_slot] = rspamd_get_ticks_fast ();
+		}
+	}
+
 	switch (st) {
 	case RSPAMD_TASK_STAGE_READ_MESSAGE:
 		if (!rspamd_message_parse (task)) {
@@ -721,6 +1158,20 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 	case RSPAMD_TASK_STAGE_PRE_FILTERS:
 	case RSPAMD_TASK_STAGE_FILTERS:
 	case RSPAMD_TASK_STAGE_IDEMPOTENT:
+		if (st == RSPAMD_TASK_STAGE_FILTERS &&
+				rspamd_task_try_verdict_memo (task)) {
+			/*
+			 * Filters, classifiers and composites are replayed from the
+			 * memo; postfilters still run on the replayed result
+			 */
+			task->processed_stages |= RSPAMD_TASK_STAGE_CLASSIFIERS_PRE |
+					RSPAMD_TASK_STAGE_CLASSIFIERS |
+					RSPAMD_TASK_STAGE_CLASSIFIERS_POST |
+					RSPAMD_TASK_STAGE_COMPOSITES |
+					RSPAMD_TASK_STAGE_COMPOSITES_POST;
+			break;
+		}
+
 		all_done = rspamd_symcache_process_symbols (task, task->cfg->cache, st);
 		break;
 
@@ -806,6 +1257,8 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 		break;
 
 	case RSPAMD_TASK_STAGE_DONE:
+		rspamd_task_save_verdict_memo (task);
+		rspamd_task_update_stage_hist (task);
 		task->processed_stages |= RSPAMD_TASK_STAGE_DONE;
 		break;
 
@@ -1664,11 +2117,11 @@ rspamd_task_get_request_header_multiple (struct rspamd_task *task,
 	srch.begin = (gchar *)name;
 	srch.len = strlen (name);
 
-	k = kh_get (rspamd_req_headers_hash, task->request_headers,
+	k = kh_get (rspamd_req_headers_hash, &task->request_headers,
 			&srch);
 
-	if (k != kh_end (task->request_headers)) {
-		ret = kh_value (task->request_headers, k);
+	if (k != kh_end (&task->request_headers)) {
+		ret = kh_value (&task->request_headers, k);
 	}
 
 	return ret;
@@ -1684,7 +2137,7 @@ rspamd_task_add_request_header (struct rspamd_task *task,
 	gint res;
 	struct rspamd_request_header_chain *chain, *nchain;
 
-	k = kh_put (rspamd_req_headers_hash, task->request_headers,
+	k = kh_put (rspamd_req_headers_hash, &task->request_headers,
 		name, &res);
 
 	if (res == 0) {
@@ -1692,7 +2145,7 @@ rspamd_task_add_request_header (struct rspamd_task *task,
 		nchain = rspamd_mempool_alloc (task->task_pool, sizeof (*nchain));
 		nchain->hdr = value;
 		nchain->next = NULL;
-		chain = kh_value (task->request_headers, k);
+		chain = kh_value (&task->request_headers, k);
 
 		/* Slow but OK here */
 		LL_APPEND (chain, nchain);
@@ -1702,7 +2155,7 @@ rspamd_task_add_request_header (struct rspamd_task *task,
 		nchain->hdr = value;
 		nchain->next = NULL;
 
-		kh_value (task->request_headers, k) = nchain;
+		kh_value (&task->request_headers, k) = nchain;
 	}
 }
 
@@ -1831,4 +2284,107 @@ rspamd_task_stage_name (enum rspamd_task_stage stg)
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
+
+static void
+rspamd_task_auth_fill_esld (rspamd_mempool_t *pool, const gchar *domain,
+		const gchar **pesld)
+{
+	rspamd_ftok_t tld;
+	gchar *esld;
+	gsize dlen = strlen (domain);
+
+	if (rspamd_url_find_tld (domain, dlen, &tld)) {
+		esld = rspamd_mempool_alloc (pool, tld.len + 1);
+		rspamd_strlcpy (esld, tld.begin, tld.len + 1);
+	}
+	else {
+		/* No suffix known, align on the whole domain */
+		esld = rspamd_mempool_alloc (pool, dlen + 1);
+		rspamd_strlcpy (esld, domain, dlen + 1);
+	}
+
+	rspamd_str_lc (esld, strlen (esld));
+	*pesld = esld;
+}
+
+struct rspamd_task_auth_results *
+rspamd_task_get_auth_results (struct rspamd_task *task)
+{
+	struct rspamd_task_auth_results *ar;
+	struct rspamd_dkim_check_result **dres, **cur;
+	struct rspamd_email_address *addr;
+	gchar *dom;
+	guint nelt = 0, i;
+
+	ar = rspamd_mempool_get_variable (task->task_pool,
+			RSPAMD_MEMPOOL_AUTH_RESULTS);
+
+	if (ar != NULL) {
+		return ar;
+	}
+
+	ar = rspamd_mempool_alloc0 (task->task_pool, sizeof (*ar));
+
+	/* Header From domain is the alignment reference for DMARC */
+	if (MESSAGE_FIELD_CHECK (task, from_mime) &&
+			MESSAGE_FIELD (task, from_mime)->len > 0) {
+		addr = g_ptr_array_index (MESSAGE_FIELD (task, from_mime), 0);
+
+		if (addr->domain && addr->domain_len > 0) {
+			dom = rspamd_mempool_alloc (task->task_pool, addr->domain_len + 1);
+			rspamd_strlcpy (dom, addr->domain, addr->domain_len + 1);
+			ar->from_domain = dom;
+			rspamd_task_auth_fill_esld (task->task_pool, dom,
+					&ar->from_esld);
+		}
+	}
+
+	/* SPF checked identity: envelope from domain or helo */
+	if (task->from_envelope && task->from_envelope->domain_len > 0) {
+		dom = rspamd_mempool_alloc (task->task_pool,
+				task->from_envelope->domain_len + 1);
+		rspamd_strlcpy (dom, task->from_envelope->domain,
+				task->from_envelope->domain_len + 1);
+		ar->spf_domain = dom;
+	}
+	else if (task->helo && *task->helo) {
+		ar->spf_domain = rspamd_mempool_strdup (task->task_pool, task->helo);
+	}
+
+	if (ar->spf_domain) {
+		rspamd_task_auth_fill_esld (task->task_pool, ar->spf_domain,
+				&ar->spf_esld);
+	}
+
+	dres = rspamd_mempool_get_variable (task->task_pool,
+			RSPAMD_MEMPOOL_DKIM_CHECK_RESULTS);
+
+	if (dres != NULL) {
+		for (cur = dres; *cur != NULL; cur ++) {
+			nelt ++;
+		}
+
+		if (nelt > 0) {
+			ar->dkim = rspamd_mempool_alloc0 (task->task_pool,
+					nelt * sizeof (*ar->dkim));
+
+			for (i = 0; i < nelt; i ++) {
+				if (dres[i]->domain) {
+					ar->dkim[ar->ndkim].domain = dres[i]->domain;
+					ar->dkim[ar->ndkim].success =
+							(dres[i]->rcode == DKIM_CONTINUE);
+					rspamd_task_auth_fill_esld (task->task_pool,
+							dres[i]->domain,
+							&ar->dkim[ar->ndkim].esld);
+					ar->ndkim ++;
+				}
+			}
+		}
+	}
+
+	rspamd_mempool_set_variable (task->task_pool,
+			RSPAMD_MEMPOOL_AUTH_RESULTS, ar, NULL);
+
+	return ar;
+}
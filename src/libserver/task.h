@@ -115,7 +115,8 @@ enum rspamd_task_stage {
 #define RSPAMD_TASK_FLAG_SSL (1u << 22u)
 #define RSPAMD_TASK_FLAG_BAD_UNICODE (1u << 23u)
 #define RSPAMD_TASK_FLAG_MESSAGE_REWRITE (1u << 24u)
-#define RSPAMD_TASK_FLAG_MAX_SHIFT (24u)
+#define RSPAMD_TASK_FLAG_HEADERS_ONLY (1u << 25u)
+#define RSPAMD_TASK_FLAG_MAX_SHIFT (25u)
 
 
 /* Request has a JSON control block */
@@ -132,7 +133,11 @@ enum rspamd_task_stage {
 #define RSPAMD_TASK_PROTOCOL_FLAG_BODY_BLOCK (1u << 5u)
 /* Emit groups information */
 #define RSPAMD_TASK_PROTOCOL_FLAG_GROUPS (1u << 6u)
-#define RSPAMD_TASK_PROTOCOL_FLAG_MAX_SHIFT (6u)
+/* Reply with msgpack instead of json (for the internal proxy hop) */
+#define RSPAMD_TASK_PROTOCOL_FLAG_MSGPACK (1u << 7u)
+/* Client asked to keep the connection open for the next request */
+#define RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE (1u << 8u)
+#define RSPAMD_TASK_PROTOCOL_FLAG_MAX_SHIFT (8u)
 
 #define RSPAMD_TASK_IS_SKIPPED(task) (((task)->flags & RSPAMD_TASK_FLAG_SKIP))
 #define RSPAMD_TASK_IS_SPAMC(task) (((task)->cmd == CMD_CHECK_SPAMC))
@@ -140,6 +145,7 @@ enum rspamd_task_stage {
 #define RSPAMD_TASK_IS_CLASSIFIED(task) (((task)->processed_stages & RSPAMD_TASK_STAGE_CLASSIFIERS))
 #define RSPAMD_TASK_IS_EMPTY(task) (((task)->flags & RSPAMD_TASK_FLAG_EMPTY))
 #define RSPAMD_TASK_IS_PROFILING(task) (((task)->flags & RSPAMD_TASK_FLAG_PROFILE))
+#define RSPAMD_TASK_IS_HEADERS_ONLY(task) (((task)->flags & RSPAMD_TASK_FLAG_HEADERS_ONLY))
 #define RSPAMD_TASK_IS_MIME(task) (((task)->flags & RSPAMD_TASK_FLAG_MIME))
 
 struct rspamd_email_address;
@@ -169,6 +175,11 @@ struct rspamd_task {
 	gint sock;                                      /**< socket descriptor								*/
 	guint32 dns_requests;                           /**< number of DNS requests per this task			*/
 	guint32 flags;                                  /**< Bit flags										*/
+	enum rspamd_task_size_class {
+		RSPAMD_TASK_SIZE_NORMAL = 0,
+		RSPAMD_TASK_SIZE_SMALL,
+		RSPAMD_TASK_SIZE_HUGE,
+	} size_class;                                   /**< processing profile chosen at load time		*/
 	guint32 protocol_flags;
 	guint32 processed_stages;                            /**< bits of stages that are processed			*/
 	gchar *helo;                                    /**< helo header value								*/
@@ -178,7 +189,8 @@ struct rspamd_task {
 	gchar *deliver_to;                                /**< address to deliver								*/
 	gchar *user;                                    /**< user to deliver								*/
 	const gchar *hostname;                            /**< hostname reported by MTA						*/
-	khash_t(rspamd_req_headers_hash) *request_headers; /**< HTTP headers in a request						*/
+	khash_t(rspamd_req_headers_hash) request_headers; /**< HTTP headers in a request, embedded to avoid
+														 * an extra allocation per task						*/
 	struct rspamd_task_data_storage msg;            /**< message buffer									*/
 	struct rspamd_http_connection *http_conn;        /**< HTTP server connection							*/
 	struct rspamd_async_session *s;                /**< async session object							*/
@@ -199,6 +211,7 @@ struct rspamd_task {
 	rspamd_mempool_t *task_pool;                    /**< memory pool for task							*/
 	double time_real_finish;
 	ev_tstamp task_timestamp;
+	ev_tstamp stage_watermarks[8];                  /**< entry timestamps of coarse processing stages	*/
 
 	gboolean (*fin_callback) (struct rspamd_task *task, void *arg);
 	/**< callback for filters finalizing					*/
@@ -374,6 +387,36 @@ gboolean rspamd_task_set_finish_time (struct rspamd_task *task);
  */
 const gchar *rspamd_task_stage_name (enum rspamd_task_stage stg);
 
+struct rspamd_task_auth_dkim_entry {
+	const gchar *domain;
+	const gchar *esld;
+	gboolean success;
+};
+
+/**
+ * Authentication results shared between dkim/spf checks and the DMARC
+ * policy evaluation: domains are resolved to their (lowercased) eSLD
+ * exactly once, so relaxed alignment compares the cached strings
+ * instead of deriving tlds per policy check
+ */
+struct rspamd_task_auth_results {
+	const gchar *from_domain;               /**< header From domain			*/
+	const gchar *from_esld;
+	const gchar *spf_domain;                /**< envelope from or helo		*/
+	const gchar *spf_esld;
+	struct rspamd_task_auth_dkim_entry *dkim;
+	guint ndkim;
+};
+
+/**
+ * Builds (lazily, on the first call) and returns the per task authentication
+ * results; dkim and spf checks must have been finished before calling
+ * @param task
+ * @return cached structure allocated from the task pool
+ */
+struct rspamd_task_auth_results *rspamd_task_get_auth_results (
+		struct rspamd_task *task);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -45,6 +45,7 @@
 #include "rspamd.h"
 #include "message.h"
 #include "multipattern.h"
+#include "libutil/hash.h"
 #include "contrib/uthash/utlist.h"
 #include "contrib/http-parser/http_parser.h"
 #include <unicode/utf8.h>
@@ -235,8 +236,17 @@ struct url_callback_data {
 struct url_match_scanner {
 	GArray *matchers;
 	struct rspamd_multipattern *search_trie;
+	/* Memoized tld resolution results: hostnames repeat across messages */
+	rspamd_lru_hash_t *tld_cache;
 };
 
+struct rspamd_url_tld_cache_res {
+	guint off;
+	guint len;
+};
+
+#define RSPAMD_URL_TLD_CACHE_SIZE 4096
+
 struct url_match_scanner *url_scanner = NULL;
 
 enum {
@@ -505,6 +515,7 @@ rspamd_url_deinit (void)
 	if (url_scanner != NULL) {
 		rspamd_multipattern_destroy (url_scanner->search_trie);
 		g_array_free (url_scanner->matchers, TRUE);
+		rspamd_lru_hash_destroy (url_scanner->tld_cache);
 		g_free (url_scanner);
 
 		url_scanner = NULL;
@@ -537,6 +548,8 @@ rspamd_url_init (const gchar *tld_file)
 				RSPAMD_MULTIPATTERN_TLD|RSPAMD_MULTIPATTERN_ICASE|RSPAMD_MULTIPATTERN_UTF8);
 	}
 
+	url_scanner->tld_cache = rspamd_lru_hash_new (RSPAMD_URL_TLD_CACHE_SIZE,
+			g_free, g_free);
 	rspamd_url_add_static_matchers (url_scanner);
 
 	if (tld_file != NULL) {
@@ -2201,11 +2214,38 @@ gboolean
 rspamd_url_find_tld (const gchar *in, gsize inlen, rspamd_ftok_t *out)
 {
 	struct tld_trie_cbdata cbdata;
+	struct rspamd_url_tld_cache_res *cached;
+	gchar *hkey;
 
 	g_assert (in != NULL);
 	g_assert (out != NULL);
 	g_assert (url_scanner != NULL);
 
+	/*
+	 * Hostnames repeat heavily between messages, so the suffixes trie
+	 * scan is memoized; the cache stores offsets relative to the host
+	 * start with len == 0 standing for a negative result. Inputs longer
+	 * than any valid hostname bypass the cache entirely: the key is
+	 * copied onto the stack, and attacker supplied multi-megabyte
+	 * "hostnames" must not turn that into a stack overflow
+	 */
+	if (url_scanner->tld_cache && inlen <= 255) {
+		hkey = g_alloca (inlen + 1);
+		rspamd_strlcpy (hkey, in, inlen + 1);
+		cached = rspamd_lru_hash_lookup (url_scanner->tld_cache, hkey, 0);
+
+		if (cached != NULL) {
+			if (cached->len == 0) {
+				return FALSE;
+			}
+
+			out->begin = in + cached->off;
+			out->len = cached->len;
+
+			return TRUE;
+		}
+	}
+
 	cbdata.begin = in;
 	cbdata.len = inlen;
 	cbdata.out = out;
@@ -2214,6 +2254,18 @@ rspamd_url_find_tld (const gchar *in, gsize inlen, rspamd_ftok_t *out)
 	rspamd_multipattern_lookup (url_scanner->search_trie, in, inlen,
 			rspamd_tld_trie_find_callback, &cbdata, NULL);
 
+	if (url_scanner->tld_cache && inlen <= 255) {
+		cached = g_malloc0 (sizeof (*cached));
+
+		if (out->len > 0) {
+			cached->off = out->begin - in;
+			cached->len = out->len;
+		}
+
+		rspamd_lru_hash_insert (url_scanner->tld_cache,
+				g_strndup (in, inlen), cached, 0, 0);
+	}
+
 	if (out->len > 0) {
 		return TRUE;
 	}
@@ -3085,6 +3137,16 @@ rspamd_url_find_multiple (rspamd_mempool_t *pool,
 	cb.func = func;
 	cb.newlines = nlines;
 
+	/*
+	 * Any url candidate contains either a dot (hostnames, www anchors,
+	 * tld suffixes) or a scheme separator (mailto:, tel: and so on), so
+	 * spans with neither cannot produce a match and the multipattern
+	 * prefilter scan is skipped entirely
+	 */
+	if (memchr (in, '.', inlen) == NULL && memchr (in, ':', inlen) == NULL) {
+		return;
+	}
+
 	rspamd_multipattern_lookup (url_scanner->search_trie, in,
 			inlen,
 			rspamd_url_trie_generic_callback_multiple, &cb, NULL);
@@ -3115,6 +3177,16 @@ rspamd_url_find_single (rspamd_mempool_t *pool,
 	cb.funcd = ud;
 	cb.func = func;
 
+	/*
+	 * Any url candidate contains either a dot (hostnames, www anchors,
+	 * tld suffixes) or a scheme separator (mailto:, tel: and so on), so
+	 * spans with neither cannot produce a match and the multipattern
+	 * prefilter scan is skipped entirely
+	 */
+	if (memchr (in, '.', inlen) == NULL && memchr (in, ':', inlen) == NULL) {
+		return;
+	}
+
 	rspamd_multipattern_lookup (url_scanner->search_trie, in,
 			inlen,
 			rspamd_url_trie_generic_callback_single, &cb, NULL);
@@ -3620,3 +3692,114 @@ rspamd_url_protocol_from_string (const gchar *str)
 
 	return ret;
 }
+
+/*
+ * Shared (pre-fork) cache of redirector resolutions: whichever worker
+ * resolves a shortener first publishes the final url here, so campaigns
+ * full of the same shortened link do not multiply outbound HTTP by the
+ * worker count. Entries are fixed size slots guarded by a per slot
+ * seqlock (odd while a writer is inside); collisions overwrite.
+ */
+struct rspamd_redirector_cache_elt {
+	guint32 seq;
+	guint32 expire;
+	guint64 key;
+	guint16 target_len;
+	gchar target[494];
+};
+
+#define RSPAMD_REDIRECTOR_CACHE_ELTS 2048
+
+static struct rspamd_redirector_cache_elt *redirector_cache = NULL;
+
+void
+rspamd_url_redirector_cache_init (gpointer shm)
+{
+	redirector_cache = shm;
+}
+
+gsize
+rspamd_url_redirector_cache_size (void)
+{
+	return sizeof (struct rspamd_redirector_cache_elt) *
+			RSPAMD_REDIRECTOR_CACHE_ELTS;
+}
+
+gsize
+rspamd_url_redirector_cache_lookup (const gchar *url, gsize len,
+		gchar *out, gsize outlen)
+{
+	struct rspamd_redirector_cache_elt *elt;
+	guint64 h;
+	guint32 seq;
+	guint16 tlen;
+
+	if (redirector_cache == NULL || len == 0) {
+		return 0;
+	}
+
+	h = rspamd_cryptobox_fast_hash (url, len, rspamd_hash_seed ());
+	elt = &redirector_cache[h % RSPAMD_REDIRECTOR_CACHE_ELTS];
+	seq = g_atomic_int_get (&elt->seq);
+
+	if (seq == 0 || (seq & 1)) {
+		return 0;
+	}
+
+	if (elt->key != h || elt->expire < (guint32)time (NULL)) {
+		return 0;
+	}
+
+	tlen = elt->target_len;
+
+	if (tlen == 0 || tlen >= sizeof (elt->target) || tlen + 1 > outlen) {
+		return 0;
+	}
+
+	memcpy (out, elt->target, tlen);
+	out[tlen] = '\0';
+
+	/* Recheck the sequence to detect a concurrent overwrite */
+	if (g_atomic_int_get (&elt->seq) != seq) {
+		return 0;
+	}
+
+	return tlen;
+}
+
+void
+rspamd_url_redirector_cache_store (const gchar *url, gsize len,
+		const gchar *target, gsize tlen, guint ttl)
+{
+	struct rspamd_redirector_cache_elt *elt;
+	guint64 h;
+
+	if (redirector_cache == NULL || len == 0 ||
+		tlen == 0 || tlen >= sizeof (((struct rspamd_redirector_cache_elt *)0)->target)) {
+		return;
+	}
+
+	h = rspamd_cryptobox_fast_hash (url, len, rspamd_hash_seed ());
+	elt = &redirector_cache[h % RSPAMD_REDIRECTOR_CACHE_ELTS];
+
+	/*
+	 * Claim the slot by moving seq from even to odd with a CAS: without
+	 * writer exclusion two workers could interleave their copies with
+	 * seq left even, and a reader would take a torn target as the
+	 * resolved redirect. On contention the publish is skipped - the
+	 * cache is advisory
+	 */
+	guint32 seq = g_atomic_int_get (&elt->seq);
+
+	if ((seq & 1) ||
+			!g_atomic_int_compare_and_exchange ((gint *)&elt->seq,
+					seq, seq + 1)) {
+		return;
+	}
+
+	elt->key = h;
+	elt->expire = (guint32)time (NULL) + ttl;
+	elt->target_len = tlen;
+	memcpy (elt->target, target, tlen);
+	g_atomic_int_inc ((gint *)&elt->seq);
+}
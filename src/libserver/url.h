@@ -269,6 +269,40 @@ const gchar *rspamd_url_protocol_name (enum rspamd_url_protocol proto);
  */
 enum rspamd_url_protocol rspamd_url_protocol_from_string (const gchar *str);
 
+/**
+ * Attach the shared (pre-fork) redirector resolutions cache
+ * @param shm zeroed shared memory of rspamd_url_redirector_cache_size() bytes
+ */
+void rspamd_url_redirector_cache_init (gpointer shm);
+
+/**
+ * Size of the shared redirector cache
+ */
+gsize rspamd_url_redirector_cache_size (void);
+
+/**
+ * Look up a previously resolved redirector target
+ * @param url source url
+ * @param len source url length
+ * @param out buffer for the target url
+ * @param outlen buffer size
+ * @return target length or 0 if not cached
+ */
+gsize rspamd_url_redirector_cache_lookup (const gchar *url, gsize len,
+										  gchar *out, gsize outlen);
+
+/**
+ * Publish a resolved redirector target for all workers
+ * @param url source url
+ * @param len source url length
+ * @param target final url
+ * @param tlen final url length
+ * @param ttl seconds to keep the entry
+ */
+void rspamd_url_redirector_cache_store (const gchar *url, gsize len,
+										const gchar *target, gsize tlen,
+										guint ttl);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -45,6 +45,10 @@
 #endif
 #include "zlib.h"
 
+#ifdef HAVE_SCHED_YIELD
+#include <sched.h>
+#endif
+
 #ifdef WITH_LIBUNWIND
 #define UNW_LOCAL_ONLY 1
 #include <libunwind.h>
@@ -62,10 +66,13 @@
 #endif
 
 #include "contrib/libev/ev.h"
+#include <pthread.h>
 
 /* Forward declaration */
 static void rspamd_worker_heartbeat_start (struct rspamd_worker *,
 		struct ev_loop *);
+static void rspamd_worker_start_loop_watchdog (struct ev_loop *,
+		rspamd_logger_t *);
 
 static void rspamd_worker_ignore_signal (struct rspamd_worker_signal_handler *);
 /**
@@ -342,6 +349,91 @@ rspamd_worker_init_signals (struct rspamd_worker *worker,
 			rspamd_worker_usr2_handler, NULL);
 }
 
+/*
+ * Copy-on-write audit mode, enabled with the RSPAMD_COW_AUDIT environment
+ * variable: each worker periodically samples /proc/self/smaps_rollup and
+ * logs how much of its address space is still shared with the siblings
+ * versus privately dirtied after fork. With `freeze' in the variable's
+ * value, the configuration pool is additionally mprotected read-only, so
+ * whatever dirties supposedly immutable config data faults loudly with a
+ * backtrace pointing at the culprit.
+ */
+static ev_timer cow_audit_ev;
+
+static void
+rspamd_worker_cow_audit_cb (EV_P_ ev_timer *w, int revents)
+{
+	static const gchar *keys[] = {
+		"Rss:", "Shared_Clean:", "Shared_Dirty:",
+		"Private_Clean:", "Private_Dirty:"
+	};
+	gulong vals[G_N_ELEMENTS (keys)];
+	struct rspamd_worker *worker = (struct rspamd_worker *)w->data;
+	gchar buf[8192], *line;
+	gssize r;
+	guint i;
+	gint fd;
+
+	fd = open ("/proc/self/smaps_rollup", O_RDONLY);
+
+	if (fd == -1) {
+		msg_info ("cannot open smaps_rollup, cow audit disabled: %s",
+				strerror (errno));
+		ev_timer_stop (EV_A_ w);
+
+		return;
+	}
+
+	r = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+
+	if (r <= 0) {
+		return;
+	}
+
+	buf[r] = '\0';
+	memset (vals, 0, sizeof (vals));
+
+	for (line = buf; line != NULL && *line != '\0';) {
+		for (i = 0; i < G_N_ELEMENTS (keys); i ++) {
+			if (g_str_has_prefix (line, keys[i])) {
+				vals[i] = strtoul (line + strlen (keys[i]), NULL, 10);
+				break;
+			}
+		}
+
+		line = strchr (line, '\n');
+
+		if (line != NULL) {
+			line ++;
+		}
+	}
+
+	msg_info ("cow audit (%s, pid %P): rss: %ul kb, shared clean: %ul kb, "
+			"shared dirty: %ul kb, private clean: %ul kb, private dirty: %ul kb",
+			g_quark_to_string (worker->type), worker->pid,
+			vals[0], vals[1], vals[2], vals[3], vals[4]);
+}
+
+static void
+rspamd_worker_cow_audit_maybe_start (struct rspamd_worker *worker)
+{
+	const gchar *mode = getenv ("RSPAMD_COW_AUDIT");
+
+	if (mode == NULL) {
+		return;
+	}
+
+	ev_timer_init (&cow_audit_ev, rspamd_worker_cow_audit_cb, 10., 60.);
+	cow_audit_ev.data = worker;
+	ev_timer_start (worker->srv->event_loop, &cow_audit_ev);
+
+	if (strstr (mode, "freeze") != NULL && worker->srv->cfg) {
+		rspamd_mempool_protect (worker->srv->cfg->cfg_pool, TRUE);
+		msg_info ("cow audit: config pool frozen read-only");
+	}
+}
+
 struct ev_loop *
 rspamd_prepare_worker (struct rspamd_worker *worker, const char *name,
 					   rspamd_accept_handler hdl)
@@ -363,11 +455,25 @@ rspamd_prepare_worker (struct rspamd_worker *worker, const char *name,
 
 	event_loop = ev_loop_new (EVFLAG_SIGNALFD);
 
+	if (worker->srv->cfg->io_collect_interval > 0) {
+		/*
+		 * Trade a bit of latency for fewer epoll_wait and read syscalls:
+		 * the loop then collects io events for the configured interval
+		 * instead of dispatching every single readiness notification
+		 */
+		ev_set_io_collect_interval (event_loop,
+				worker->srv->cfg->io_collect_interval);
+	}
+
 	worker->srv->event_loop = event_loop;
+	rspamd_worker_start_loop_watchdog (event_loop, worker->srv->logger);
+	/* Helper threads for CPU heavy jobs that must not stall the loop */
+	rspamd_offload_pool_start (event_loop, RSPAMD_OFFLOAD_THREADS_DEFAULT);
 
 	rspamd_worker_init_signals (worker, event_loop);
 	rspamd_control_worker_add_default_cmd_handlers (worker, event_loop);
 	rspamd_worker_heartbeat_start (worker, event_loop);
+	rspamd_worker_cow_audit_maybe_start (worker);
 #ifdef WITH_HIREDIS
 	rspamd_redis_pool_config (worker->srv->cfg->redis_pool,
 			worker->srv->cfg, event_loop);
@@ -856,6 +962,22 @@ rspamd_fork_worker (struct rspamd_main *rspamd_main,
 	wrk->flags = cf->worker->flags;
 	REF_RETAIN (cf);
 	wrk->index = index;
+	wrk->load_slot = -1;
+
+	if (rspamd_main->workers_load) {
+		/* Grab a free slot in the shared load board (managed by main) */
+		gint slot;
+
+		for (slot = 0; slot < RSPAMD_WORKERS_LOAD_MAX; slot ++) {
+			if (rspamd_main->workers_load[slot].type == 0) {
+				rspamd_main->workers_load[slot].type = cf->type;
+				rspamd_main->workers_load[slot].inflight = 0;
+				wrk->load_slot = slot;
+				break;
+			}
+		}
+	}
+
 	wrk->ctx = cf->ctx;
 	wrk->finish_actions = g_ptr_array_new ();
 	wrk->ppid = getpid ();
@@ -865,6 +987,25 @@ rspamd_fork_worker (struct rspamd_main *rspamd_main,
 
 	switch (wrk->pid) {
 	case 0:
+#ifdef HAVE_SCHED_YIELD
+		if (cf->pin_cpu_base >= 0) {
+			/*
+			 * Pin the worker to (base + index): combined with NIC RSS
+			 * steering this keeps packet, worker and cpu locality
+			 */
+			cpu_set_t cs;
+
+			CPU_ZERO (&cs);
+			CPU_SET ((cf->pin_cpu_base + index) %
+					MAX (1, sysconf (_SC_NPROCESSORS_ONLN)), &cs);
+
+			if (sched_setaffinity (0, sizeof (cs), &cs) == -1) {
+				msg_warn_main ("cannot pin worker %s(%d) to cpu %d: %s",
+						cf->worker->name, index,
+						cf->pin_cpu_base + index, strerror (errno));
+			}
+		}
+#endif
 		/* Update pid for logging */
 		rspamd_log_update_pid (cf->type, rspamd_main->logger);
 		/* To avoid atomic writes issue */
@@ -1345,6 +1486,273 @@ rspamd_enable_accept_event (EV_P_ ev_timer *w, int revents)
 	ev_io_start (EV_A_ &ac_ev->accept_ev);
 }
 
+/*
+ * Event loop stall watchdog: measures the time spent in callbacks between
+ * a loop wakeup (ev_check) and the next return to the poll (ev_prepare);
+ * blocking calls inside plugins then produce an explicit log line instead
+ * of silent multi-second latency spikes
+ */
+struct rspamd_worker_loop_watchdog {
+	ev_prepare prep;
+	ev_check check;
+	rspamd_logger_t *logger;
+	gdouble wakeup;
+};
+
+/* Log everything that blocks the loop for longer than this */
+static const gdouble loop_stall_limit = 1.0;
+
+static void
+rspamd_worker_loop_check_cb (EV_P_ ev_check *w, int revents)
+{
+	struct rspamd_worker_loop_watchdog *wd =
+			(struct rspamd_worker_loop_watchdog *)w->data;
+
+	wd->wakeup = rspamd_get_ticks (FALSE);
+}
+
+static void
+rspamd_worker_loop_prepare_cb (EV_P_ ev_prepare *w, int revents)
+{
+	struct rspamd_worker_loop_watchdog *wd =
+			(struct rspamd_worker_loop_watchdog *)w->data;
+	gdouble elapsed;
+
+	if (wd->wakeup > 0) {
+		elapsed = rspamd_get_ticks (FALSE) - wd->wakeup;
+
+		if (elapsed > loop_stall_limit) {
+			msg_warn ("event loop stall detected: %.2f seconds spent in "
+					"callbacks without returning to the loop "
+					"(blocking code in some plugin?)", elapsed);
+		}
+	}
+
+	/*
+	 * Flush buffered log lines at the point where the loop is about to
+	 * sleep: with log_buffered enabled the write syscalls then happen
+	 * outside of the latency critical callback processing
+	 */
+	if (wd->logger) {
+		rspamd_log_flush (wd->logger);
+	}
+}
+
+static void
+rspamd_worker_start_loop_watchdog (struct ev_loop *event_loop,
+		rspamd_logger_t *logger)
+{
+	struct rspamd_worker_loop_watchdog *wd;
+
+	wd = g_malloc0 (sizeof (*wd));
+	wd->logger = logger;
+	wd->prep.data = wd;
+	wd->check.data = wd;
+	ev_prepare_init (&wd->prep, rspamd_worker_loop_prepare_cb);
+	ev_check_init (&wd->check, rspamd_worker_loop_check_cb);
+	ev_prepare_start (event_loop, &wd->prep);
+	ev_check_start (event_loop, &wd->check);
+	/* The watchers must not keep the loop alive */
+	ev_unref (event_loop);
+	ev_unref (event_loop);
+}
+
+/*
+ * Generic offload pool: a couple of parked helper threads that run CPU
+ * heavy jobs (e.g. zstd map decompression) off the event loop; completion
+ * callbacks are delivered back to the loop thread via ev_async, so the
+ * callers never observe any concurrency. The pool is per process and must
+ * be started after fork, hence it lives in rspamd_prepare_worker
+ */
+struct rspamd_offload_job {
+	rspamd_offload_work_fn work;
+	rspamd_offload_done_fn done;
+	gpointer ud;
+};
+
+struct rspamd_offload_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	GQueue pending;
+	GQueue completed;
+	pthread_t *threads;
+	guint nthreads;
+	gboolean term;
+	struct ev_loop *event_loop;
+	ev_async wakeup;
+};
+
+static struct rspamd_offload_pool *offload_pool = NULL;
+
+static void *
+rspamd_offload_thread (void *arg)
+{
+	struct rspamd_offload_pool *p = (struct rspamd_offload_pool *)arg;
+	struct rspamd_offload_job *job;
+
+	pthread_mutex_lock (&p->lock);
+
+	for (;;) {
+		while (!p->term && g_queue_is_empty (&p->pending)) {
+			pthread_cond_wait (&p->cond, &p->lock);
+		}
+
+		if (p->term) {
+			break;
+		}
+
+		job = (struct rspamd_offload_job *)g_queue_pop_head (&p->pending);
+		pthread_mutex_unlock (&p->lock);
+
+		job->work (job->ud);
+
+		pthread_mutex_lock (&p->lock);
+		g_queue_push_tail (&p->completed, job);
+		ev_async_send (p->event_loop, &p->wakeup);
+	}
+
+	pthread_mutex_unlock (&p->lock);
+
+	return NULL;
+}
+
+static void
+rspamd_offload_async_cb (EV_P_ ev_async *w, int revents)
+{
+	struct rspamd_offload_pool *p = (struct rspamd_offload_pool *)w->data;
+	struct rspamd_offload_job *job;
+
+	for (;;) {
+		pthread_mutex_lock (&p->lock);
+		job = (struct rspamd_offload_job *)g_queue_pop_head (&p->completed);
+		pthread_mutex_unlock (&p->lock);
+
+		if (job == NULL) {
+			break;
+		}
+
+		job->done (job->ud);
+		g_free (job);
+	}
+}
+
+void
+rspamd_offload_pool_start (struct ev_loop *event_loop, guint nthreads)
+{
+	struct rspamd_offload_pool *p;
+	guint i;
+
+	g_assert (offload_pool == NULL);
+	g_assert (nthreads > 0);
+
+	p = g_malloc0 (sizeof (*p));
+	pthread_mutex_init (&p->lock, NULL);
+	pthread_cond_init (&p->cond, NULL);
+	g_queue_init (&p->pending);
+	g_queue_init (&p->completed);
+	p->event_loop = event_loop;
+	p->nthreads = nthreads;
+	p->threads = g_malloc0 (sizeof (pthread_t) * nthreads);
+
+	p->wakeup.data = p;
+	ev_async_init (&p->wakeup, rspamd_offload_async_cb);
+	ev_async_start (event_loop, &p->wakeup);
+	/* The watcher must not keep the loop alive */
+	ev_unref (event_loop);
+
+	for (i = 0; i < nthreads; i ++) {
+		if (pthread_create (&p->threads[i], NULL, rspamd_offload_thread, p) != 0) {
+			msg_err ("cannot start offload thread: %s", strerror (errno));
+			p->nthreads = i;
+			break;
+		}
+	}
+
+	if (p->nthreads == 0) {
+		ev_ref (event_loop);
+		ev_async_stop (event_loop, &p->wakeup);
+		g_free (p->threads);
+		g_free (p);
+
+		return;
+	}
+
+	offload_pool = p;
+}
+
+struct rspamd_offload_pool *
+rspamd_offload_pool_get (void)
+{
+	return offload_pool;
+}
+
+gboolean
+rspamd_offload_pool_push (struct rspamd_offload_pool *pool,
+		rspamd_offload_work_fn work,
+		rspamd_offload_done_fn done,
+		gpointer ud)
+{
+	struct rspamd_offload_job *job;
+
+	if (pool == NULL || pool->term) {
+		return FALSE;
+	}
+
+	job = g_malloc0 (sizeof (*job));
+	job->work = work;
+	job->done = done;
+	job->ud = ud;
+
+	pthread_mutex_lock (&pool->lock);
+	g_queue_push_tail (&pool->pending, job);
+	pthread_cond_signal (&pool->cond);
+	pthread_mutex_unlock (&pool->lock);
+
+	return TRUE;
+}
+
+void
+rspamd_worker_load_add (struct rspamd_worker *worker, gint delta)
+{
+	if (worker && worker->load_slot >= 0 && worker->srv &&
+		worker->srv->workers_load) {
+		__atomic_add_fetch (
+				&worker->srv->workers_load[worker->load_slot].inflight,
+				delta, __ATOMIC_RELAXED);
+	}
+}
+
+gboolean
+rspamd_worker_load_is_overloaded (struct rspamd_worker *worker)
+{
+	struct rspamd_worker_load_elt *board, *mine;
+	guint my_load, i;
+	/* Significant imbalance is required to pause accepting */
+	static const guint load_shed_threshold = 4;
+
+	if (worker == NULL || worker->load_slot < 0 || worker->srv == NULL ||
+		(board = worker->srv->workers_load) == NULL) {
+		return FALSE;
+	}
+
+	mine = &board[worker->load_slot];
+	my_load = __atomic_load_n (&mine->inflight, __ATOMIC_RELAXED);
+
+	if (my_load < load_shed_threshold) {
+		return FALSE;
+	}
+
+	for (i = 0; i < RSPAMD_WORKERS_LOAD_MAX; i ++) {
+		if (board[i].type == mine->type && i != (guint)worker->load_slot &&
+			__atomic_load_n (&board[i].inflight, __ATOMIC_RELAXED) +
+					load_shed_threshold <= my_load) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 void
 rspamd_worker_throttle_accept_events (gint sock, void *data)
 {
@@ -65,6 +65,39 @@ rspamd_prepare_worker (struct rspamd_worker *worker, const char *name,
  */
 gboolean rspamd_worker_check_context (gpointer ctx, guint64 magic);
 
+/*
+ * Offload pool: parked helper threads for CPU heavy jobs; `work` runs in
+ * a pool thread, `done` is then invoked on the event loop thread
+ */
+struct rspamd_offload_pool;
+
+typedef void (*rspamd_offload_work_fn) (gpointer ud);
+typedef void (*rspamd_offload_done_fn) (gpointer ud);
+
+#define RSPAMD_OFFLOAD_THREADS_DEFAULT 2
+
+/**
+ * Start the per process offload pool; called by rspamd_prepare_worker
+ * (after fork), so only worker processes have a pool
+ * @param event_loop loop that receives completions
+ * @param nthreads number of helper threads
+ */
+void rspamd_offload_pool_start (struct ev_loop *event_loop, guint nthreads);
+
+/**
+ * Get the process wide offload pool or NULL if none has been started
+ */
+struct rspamd_offload_pool *rspamd_offload_pool_get (void);
+
+/**
+ * Enqueue a job; returns FALSE if the pool is unavailable and the caller
+ * should run the work inline instead
+ */
+gboolean rspamd_offload_pool_push (struct rspamd_offload_pool *pool,
+								   rspamd_offload_work_fn work,
+								   rspamd_offload_done_fn done,
+								   gpointer ud);
+
 /**
  * Set special signal handler for a worker
  */
@@ -226,6 +259,17 @@ void rspamd_worker_init_monitored (struct rspamd_worker *worker,
  */
 void rspamd_worker_throttle_accept_events (gint sock, void *data);
 
+/**
+ * Adjusts the shared inflight tasks counter of the worker
+ */
+void rspamd_worker_load_add (struct rspamd_worker *worker, gint delta);
+
+/**
+ * Returns TRUE if the worker processes substantially more tasks than some
+ * idle sibling of the same type, so new accepts are better left to others
+ */
+gboolean rspamd_worker_load_is_overloaded (struct rspamd_worker *worker);
+
 /**
  * Checks (and logs) the worker's termination status. Returns TRUE if a worker
  * should be restarted.
@@ -56,8 +56,31 @@ struct redis_stat_ctx {
 	gboolean enable_signatures;
 	guint expiry;
 	gint cbref_user;
+	gint64 learns_hint; /* last seen learns count, used for pipelining */
+	/*
+	 * Read-through cache of token values: valid for a single revision
+	 * (the learns count) and flushed wholesale when it changes
+	 */
+	rspamd_lru_hash_t *tok_cache;
+	gint64 tok_cache_rev;
 };
 
+#define REDIS_STAT_TOKEN_CACHE_SIZE 32768
+/* Mixes the statfile id into the cache key */
+static const guint64 idx_hash_mult = 0x9e3779b97f4a7c15ULL;
+
+static guint
+rspamd_redis_tok_hash (gconstpointer p)
+{
+	return (guint)*(const guint64 *)p;
+}
+
+static gboolean
+rspamd_redis_tok_equal (gconstpointer a, gconstpointer b)
+{
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
 enum rspamd_redis_connection_state {
 	RSPAMD_REDIS_DISCONNECTED = 0,
 	RSPAMD_REDIS_CONNECTED,
@@ -77,8 +100,11 @@ struct redis_stat_runtime {
 	gchar *redis_object_expanded;
 	redisAsyncContext *redis;
 	guint64 learned;
+	gdouble request_ts;
 	gint id;
+	GArray *query_idx; /* indexes of the tokens actually queried */
 	gboolean has_event;
+	gboolean tokens_pipelined;
 	GError *err;
 };
 
@@ -581,6 +607,33 @@ rspamd_redis_tokens_to_query (struct rspamd_task *task,
 			out->len = 0;
 		}
 		else {
+			/*
+			 * Only the per-command new schema can skip tokens: the old
+			 * schema pre-computes the HMGET argument count upfront
+			 */
+			if (rt->ctx->tok_cache && rt->ctx->new_schema) {
+				gdouble *cached;
+				guint64 ckey = tok->data ^ (idx_hash_mult * (guint64)rt->id);
+
+				if (rt->query_idx == NULL) {
+					/* Allocated even if it stays empty: its presence
+					 * tells the reply handler how many tokens were
+					 * really queried */
+					rt->query_idx = g_array_sized_new (FALSE, FALSE,
+							sizeof (guint), tokens->len);
+				}
+
+				cached = rspamd_lru_hash_lookup (rt->ctx->tok_cache, &ckey, 0);
+
+				if (cached != NULL) {
+					/* Serve the hot token locally, do not query it */
+					tok->values[rt->id] = *cached;
+					continue;
+				}
+
+				g_array_append_val (rt->query_idx, i);
+			}
+
 			if (rt->ctx->new_schema) {
 				l0 = rspamd_snprintf (n0, sizeof (n0), "%*s_%uL",
 						prefix_len, prefix,
@@ -1113,13 +1166,30 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 
 	task = rt->task;
 
+	if (rt->err) {
+		/*
+		 * The learns check has failed after the tokens request had been
+		 * speculatively pipelined; just ignore the reply
+		 */
+		if (rt->has_event) {
+			rspamd_session_remove_event (task->s, rspamd_redis_fin, rt);
+		}
+
+		return;
+	}
+
 	if (c->err == 0 && rt->has_event) {
 		if (r != NULL) {
 			if (reply->type == REDIS_REPLY_ARRAY) {
+				guint expected = rt->query_idx ?
+						rt->query_idx->len : task->tokens->len;
 
-				if (reply->elements == task->tokens->len) {
+				if (reply->elements == expected) {
 					for (i = 0; i < reply->elements; i ++) {
-						tok = g_ptr_array_index (task->tokens, i);
+						guint tidx = rt->query_idx ?
+								g_array_index (rt->query_idx, guint, i) : i;
+
+						tok = g_ptr_array_index (task->tokens, tidx);
 						elt = reply->element[i];
 
 						if (G_UNLIKELY (elt->type == REDIS_REPLY_INTEGER)) {
@@ -1143,6 +1213,20 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 							tok->values[rt->id] = 0;
 						}
 
+						if (rt->ctx->tok_cache && rt->ctx->new_schema) {
+							/* Feed the read-through cache */
+							guint64 *ckey;
+							gdouble *cval;
+
+							ckey = g_malloc (sizeof (*ckey));
+							*ckey = tok->data ^
+									(idx_hash_mult * (guint64)rt->id);
+							cval = g_malloc (sizeof (*cval));
+							*cval = tok->values[rt->id];
+							rspamd_lru_hash_insert (rt->ctx->tok_cache,
+									ckey, cval, 0, 0);
+						}
+
 						processed ++;
 					}
 
@@ -1157,7 +1241,7 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 					msg_err_task_check ("got invalid length of reply vector from redis: "
 										"%d, expected: %d",
 							(gint)reply->elements,
-							(gint)task->tokens->len);
+							(gint)expected);
 				}
 			}
 			else {
@@ -1227,6 +1311,34 @@ rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
 			}
 
 			rt->learned = val;
+			rt->ctx->learns_hint = val;
+
+			if (rt->ctx->new_schema) {
+				if (rt->ctx->tok_cache == NULL) {
+					rt->ctx->tok_cache = rspamd_lru_hash_new_full (
+							REDIS_STAT_TOKEN_CACHE_SIZE,
+							g_free, g_free,
+							rspamd_redis_tok_hash, rspamd_redis_tok_equal);
+					rt->ctx->tok_cache_rev = val;
+				}
+				else if (rt->ctx->tok_cache_rev != (gint64)val) {
+					/* Learns have happened, flush the cached values */
+					rspamd_lru_hash_destroy (rt->ctx->tok_cache);
+					rt->ctx->tok_cache = rspamd_lru_hash_new_full (
+							REDIS_STAT_TOKEN_CACHE_SIZE,
+							g_free, g_free,
+							rspamd_redis_tok_hash, rspamd_redis_tok_equal);
+					rt->ctx->tok_cache_rev = val;
+				}
+			}
+
+			if (rt->request_ts > 0) {
+				/* Feed the latency EWMA used by the least-loaded rotation */
+				rspamd_upstream_update_latency (rt->selected,
+						rspamd_get_ticks (FALSE) - rt->request_ts);
+				rt->request_ts = 0;
+			}
+
 			msg_debug_stat_redis ("connected to redis server, tokens learned for %s: %uL",
 					rt->redis_object_expanded, rt->learned);
 			rspamd_upstream_ok (rt->selected);
@@ -1258,20 +1370,24 @@ rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
 			}
 
 			if (rt->learned >= rt->stcf->clcf->min_learns && rt->learned > 0) {
-				rspamd_fstring_t *query = rspamd_redis_tokens_to_query (
-						task,
-						rt,
-						rt->tokens,
-						rt->ctx->new_schema ? "HGET" : "HMGET",
-						rt->redis_object_expanded, FALSE, -1,
-						rt->stcf->clcf->flags & RSPAMD_FLAG_CLASSIFIER_INTEGER);
-				g_assert (query != NULL);
-				rspamd_mempool_add_destructor (task->task_pool,
-						(rspamd_mempool_destruct_t)rspamd_fstring_free, query);
-
-				int ret = redisAsyncFormattedCommand (rt->redis,
-						rspamd_redis_processed, rt,
-						query->str, query->len);
+				gint ret = REDIS_OK;
+
+				if (!rt->tokens_pipelined) {
+					rspamd_fstring_t *query = rspamd_redis_tokens_to_query (
+							task,
+							rt,
+							rt->tokens,
+							rt->ctx->new_schema ? "HGET" : "HMGET",
+							rt->redis_object_expanded, FALSE, -1,
+							rt->stcf->clcf->flags & RSPAMD_FLAG_CLASSIFIER_INTEGER);
+					g_assert (query != NULL);
+					rspamd_mempool_add_destructor (task->task_pool,
+							(rspamd_mempool_destruct_t)rspamd_fstring_free, query);
+
+					ret = redisAsyncFormattedCommand (rt->redis,
+							rspamd_redis_processed, rt,
+							query->str, query->len);
+				}
 
 				if (ret != REDIS_OK) {
 					msg_err_task ("call to redis failed: %s", rt->redis->errstr);
@@ -1677,6 +1793,8 @@ rspamd_redis_process_tokens (struct rspamd_task *task,
 		}
 	}
 
+	rt->request_ts = rspamd_get_ticks (FALSE);
+
 	if (redisAsyncCommand (rt->redis, rspamd_redis_connected, rt, "HGET %s %s",
 			rt->redis_object_expanded, learned_key) == REDIS_OK) {
 
@@ -1684,6 +1802,35 @@ rspamd_redis_process_tokens (struct rspamd_task *task,
 		rt->has_event = TRUE;
 		rt->tokens = g_ptr_array_ref (tokens);
 
+		/*
+		 * Speculative pipelining: if this statfile had enough learns the
+		 * last time we checked, pack the tokens request into the same
+		 * pipeline as the learns request cutting one round trip per
+		 * classification. If the learns check fails afterwards, the
+		 * tokens reply is simply discarded.
+		 */
+		if (rt->ctx->learns_hint > 0 &&
+			rt->ctx->learns_hint >= rt->stcf->clcf->min_learns) {
+			rspamd_fstring_t *query = rspamd_redis_tokens_to_query (
+					task,
+					rt,
+					tokens,
+					rt->ctx->new_schema ? "HGET" : "HMGET",
+					rt->redis_object_expanded, FALSE, -1,
+					rt->stcf->clcf->flags & RSPAMD_FLAG_CLASSIFIER_INTEGER);
+
+			if (query != NULL) {
+				rspamd_mempool_add_destructor (task->task_pool,
+						(rspamd_mempool_destruct_t)rspamd_fstring_free, query);
+
+				if (redisAsyncFormattedCommand (rt->redis,
+						rspamd_redis_processed, rt,
+						query->str, query->len) == REDIS_OK) {
+					rt->tokens_pipelined = TRUE;
+				}
+			}
+		}
+
 		if (ev_can_stop (&rt->timeout_event)) {
 			rt->timeout_event.repeat = rt->ctx->timeout;
 			ev_timer_again (task->event_loop, &rt->timeout_event);
@@ -1721,6 +1868,11 @@ rspamd_redis_finalize_process (struct rspamd_task *task, gpointer runtime,
 		rt->tokens = NULL;
 	}
 
+	if (rt->query_idx) {
+		g_array_free (rt->query_idx, TRUE);
+		rt->query_idx = NULL;
+	}
+
 	if (rt->err) {
 		msg_info_task ("cannot retreive stat tokens from Redis: %e", rt->err);
 		g_error_free (rt->err);
@@ -104,6 +104,10 @@ struct bayes_task_closure {
 	guint64 processed_tokens;
 	guint64 total_hits;
 	guint64 text_tokens;
+	/* Flat layout of the statfiles to accumulate counts branch-free */
+	const gint *sf_ids;
+	const guchar *sf_spam;
+	guint nstat;
 	struct rspamd_task *task;
 };
 
@@ -122,9 +126,7 @@ bayes_classify_token (struct rspamd_classifier *ctx,
 		rspamd_token_t *tok, struct bayes_task_closure *cl)
 {
 	guint i;
-	gint id;
 	guint spam_count = 0, ham_count = 0, total_count = 0;
-	struct rspamd_statfile *st;
 	struct rspamd_task *task;
 	const gchar *token_type = "txt";
 	double spam_prob, spam_freq, ham_freq, bayes_spam_prob, bayes_ham_prob,
@@ -155,14 +157,11 @@ bayes_classify_token (struct rspamd_classifier *ctx,
 		}
 	}
 
-	for (i = 0; i < ctx->statfiles_ids->len; i++) {
-		id = g_array_index (ctx->statfiles_ids, gint, i);
-		st = g_ptr_array_index (ctx->ctx->statfiles, id);
-		g_assert (st != NULL);
-		val = tok->values[id];
+	for (i = 0; i < cl->nstat; i++) {
+		val = tok->values[cl->sf_ids[i]];
 
 		if (val > 0) {
-			if (st->stcf->is_spam) {
+			if (cl->sf_spam[i]) {
 				spam_count += val;
 			}
 			else {
@@ -331,10 +330,43 @@ bayes_classify (struct rspamd_classifier * ctx,
 		cl.meta_skip_prob = 1.0 - text_tokens / tokens->len;
 	}
 
+	/* Flatten the statfiles layout for the per-token accumulation */
+	gint sf_ids[32];
+	guchar sf_spam[32];
+	guint nstat = MIN (ctx->statfiles_ids->len, G_N_ELEMENTS (sf_ids));
+	/* Early exit thresholds: stop once the posterior is beyond doubt */
+	static const gdouble early_exit_log_prob = 300.0;
+	static const guint64 early_exit_min_tokens = 200;
+
+	for (i = 0; i < nstat; i ++) {
+		id = g_array_index (ctx->statfiles_ids, gint, i);
+		st = g_ptr_array_index (ctx->ctx->statfiles, id);
+		g_assert (st != NULL);
+		sf_ids[i] = id;
+		sf_spam[i] = !!st->stcf->is_spam;
+	}
+
+	cl.sf_ids = sf_ids;
+	cl.sf_spam = sf_spam;
+	cl.nstat = nstat;
+
 	for (i = 0; i < tokens->len; i ++) {
 		tok = g_ptr_array_index (tokens, i);
 
 		bayes_classify_token (ctx, tok, &cl);
+
+		if (cl.processed_tokens >= early_exit_min_tokens &&
+			fabs (cl.spam_prob - cl.ham_prob) > early_exit_log_prob) {
+			/*
+			 * The decision cannot be realistically turned around by the
+			 * remaining tokens, long messages then cost constant time
+			 */
+			msg_debug_bayes ("early exit after %uL tokens of %ud: "
+					"spam probability: %.1f, ham probability: %.1f",
+					cl.processed_tokens, tokens->len,
+					cl.spam_prob, cl.ham_prob);
+			break;
+		}
 	}
 
 	if (cl.processed_tokens == 0) {
@@ -106,9 +106,15 @@ static struct rspamd_sqlite3_prstmt prepared_stmts[RSPAMD_STAT_CACHE_MAX] =
 	}
 };
 
+/* Checkpoint the wal after this many learns or this long, whatever first */
+#define SQLITE_CACHE_SYNC_LEARNS 32
+#define SQLITE_CACHE_SYNC_INTERVAL 5.0
+
 struct rspamd_stat_sqlite3_ctx {
 	sqlite3 *db;
 	GArray *prstmt;
+	guint dirty_learns;
+	gdouble last_sync;
 };
 
 gpointer
@@ -274,7 +280,21 @@ rspamd_stat_cache_sqlite3_learn (struct rspamd_task *task,
 				RSPAMD_STAT_CACHE_TRANSACTION_COMMIT);
 	}
 
-	rspamd_sqlite3_sync (ctx->db, NULL, NULL);
+	/*
+	 * Write behind: the wal checkpoint stalls on fsync, so it is only
+	 * performed after a batch of learns or periodically. The learn cache
+	 * is a dedup helper, hence losing the last seconds of it on a crash
+	 * is acceptable while stalling the controller on every learn is not.
+	 */
+	ctx->dirty_learns ++;
+
+	if (ctx->dirty_learns >= SQLITE_CACHE_SYNC_LEARNS ||
+		rspamd_get_calendar_ticks () - ctx->last_sync >
+				SQLITE_CACHE_SYNC_INTERVAL) {
+		rspamd_sqlite3_sync (ctx->db, NULL, NULL);
+		ctx->dirty_learns = 0;
+		ctx->last_sync = rspamd_get_calendar_ticks ();
+	}
 
 	return RSPAMD_LEARN_OK;
 }
@@ -285,6 +305,10 @@ rspamd_stat_cache_sqlite3_close (gpointer c)
 	struct rspamd_stat_sqlite3_ctx *ctx = (struct rspamd_stat_sqlite3_ctx *)c;
 
 	if (ctx != NULL) {
+		if (ctx->dirty_learns > 0) {
+			rspamd_sqlite3_sync (ctx->db, NULL, NULL);
+		}
+
 		rspamd_sqlite3_close_prstmt (ctx->db, ctx->prstmt);
 		sqlite3_close (ctx->db);
 		g_free (ctx);
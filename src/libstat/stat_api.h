@@ -127,6 +127,16 @@ rspamd_stat_result_t rspamd_stat_learn (struct rspamd_task *task,
 										guint stage,
 										GError **err);
 
+/**
+ * Append the task tokens, score and operation to the features export log
+ * (no-op unless `stat_export_file` is configured)
+ * @param task task with computed tokens
+ * @param is_learn TRUE for learn operations, FALSE for classification
+ * @param is_spam learn direction, ignored when is_learn is FALSE
+ */
+void rspamd_stat_export_task (struct rspamd_task *task, gboolean is_learn,
+							  gboolean is_spam);
+
 /**
  * Get the overall statistics for all statfile backends
  * @param cfg configuration
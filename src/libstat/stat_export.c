@@ -0,0 +1,204 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Opt-in feature export: when `stat_export_file` is set in the options
+ * section, every classified or learned task appends one zstd compressed
+ * record with its token hashes (tokenizer output, including metadata
+ * tokens), the score and the operation to a per worker append only log.
+ * External models can then be trained from already computed features
+ * instead of re-parsing the corpus.
+ */
+
+#include "config.h"
+#include "stat_api.h"
+#include "rspamd.h"
+#include "stat_internal.h"
+#include "libserver/cfg_file.h"
+#include "libmime/scan_result.h"
+#include "unix-std.h"
+#include "contrib/zstd/zstd.h"
+
+static const guchar rspamd_stat_export_magic[8] = {'r', 's', 'e', 'x', 'p', 0, 0, 1};
+
+/* Fixed part of a record, followed by ntokens token entries */
+struct rspamd_stat_export_rec {
+	gdouble timestamp;
+	gdouble score;
+	guchar op; /* 0 = classify, 1 = learn spam, 2 = learn ham */
+	guchar pad[3];
+	guint32 ntokens;
+};
+
+struct rspamd_stat_export_token {
+	guint64 data;
+	guint32 flags;
+	guint32 window_idx;
+};
+
+/* On disk framing of a single compressed record */
+struct rspamd_stat_export_frame {
+	guint32 comp_len;
+	guint32 raw_len;
+};
+
+/* Per process writer state, opened lazily on the first export */
+static struct rspamd_stat_export_writer {
+	gchar *path;
+	gint fd;
+	guint64 written;
+	ZSTD_CCtx *zctx;
+} stat_export_writer = {
+	.path = NULL,
+	.fd = -1,
+	.written = 0,
+	.zctx = NULL,
+};
+
+#define STAT_EXPORT_DEFAULT_SIZE (100ULL * 1024 * 1024)
+
+static gboolean
+rspamd_stat_export_open (struct rspamd_config *cfg)
+{
+	struct rspamd_stat_export_writer *w = &stat_export_writer;
+	struct stat st;
+
+	if (w->path == NULL) {
+		w->path = g_strdup_printf ("%s.%d", cfg->stat_export_file,
+				(gint)getpid ());
+	}
+
+	w->fd = open (w->path, O_WRONLY | O_CREAT | O_APPEND, 00600);
+
+	if (w->fd == -1) {
+		msg_err_config ("cannot open stat export file %s: %s", w->path,
+				strerror (errno));
+
+		return FALSE;
+	}
+
+	if (fstat (w->fd, &st) == 0 && st.st_size == 0) {
+		(void)write (w->fd, rspamd_stat_export_magic,
+				sizeof (rspamd_stat_export_magic));
+	}
+
+	w->written = st.st_size;
+
+	if (w->zctx == NULL) {
+		w->zctx = ZSTD_createCCtx ();
+	}
+
+	return TRUE;
+}
+
+static void
+rspamd_stat_export_rotate (struct rspamd_config *cfg)
+{
+	struct rspamd_stat_export_writer *w = &stat_export_writer;
+	gchar *rotated;
+
+	close (w->fd);
+	w->fd = -1;
+
+	rotated = g_strdup_printf ("%s.%.0f", w->path,
+			rspamd_get_calendar_ticks ());
+
+	if (rename (w->path, rotated) == -1) {
+		msg_err_config ("cannot rotate stat export file %s -> %s: %s",
+				w->path, rotated, strerror (errno));
+	}
+
+	g_free (rotated);
+}
+
+void
+rspamd_stat_export_task (struct rspamd_task *task, gboolean is_learn,
+		gboolean is_spam)
+{
+	struct rspamd_stat_export_writer *w = &stat_export_writer;
+	struct rspamd_config *cfg = task->cfg;
+	struct rspamd_stat_export_rec rec;
+	struct rspamd_stat_export_frame frame;
+	struct rspamd_stat_export_token *toks;
+	rspamd_token_t *tok;
+	guchar *raw, *comp;
+	gsize raw_len, comp_bound, comp_len;
+	guint64 max_size;
+	guint i;
+
+	if (cfg->stat_export_file == NULL || task->tokens == NULL ||
+		task->tokens->len == 0) {
+		return;
+	}
+
+	if (w->fd == -1 && !rspamd_stat_export_open (cfg)) {
+		return;
+	}
+
+	memset (&rec, 0, sizeof (rec));
+	rec.timestamp = task->task_timestamp;
+	rec.score = task->result ? task->result->score : NAN;
+	rec.op = is_learn ? (is_spam ? 1 : 2) : 0;
+	rec.ntokens = task->tokens->len;
+
+	raw_len = sizeof (rec) +
+			  sizeof (struct rspamd_stat_export_token) * task->tokens->len;
+	raw = g_malloc (raw_len);
+	memcpy (raw, &rec, sizeof (rec));
+	toks = (struct rspamd_stat_export_token *)(raw + sizeof (rec));
+
+	PTR_ARRAY_FOREACH (task->tokens, i, tok) {
+		toks[i].data = tok->data;
+		toks[i].flags = tok->flags;
+		toks[i].window_idx = tok->window_idx;
+	}
+
+	comp_bound = ZSTD_compressBound (raw_len);
+	comp = g_malloc (sizeof (frame) + comp_bound);
+	comp_len = ZSTD_compressCCtx (w->zctx, comp + sizeof (frame), comp_bound,
+			raw, raw_len, 1);
+
+	if (ZSTD_isError (comp_len)) {
+		msg_err_task ("cannot compress stat export record: %s",
+				ZSTD_getErrorName (comp_len));
+		g_free (raw);
+		g_free (comp);
+
+		return;
+	}
+
+	frame.comp_len = comp_len;
+	frame.raw_len = raw_len;
+	memcpy (comp, &frame, sizeof (frame));
+
+	if (write (w->fd, comp, sizeof (frame) + comp_len) == -1) {
+		msg_err_task ("cannot write stat export record to %s: %s",
+				w->path, strerror (errno));
+	}
+	else {
+		w->written += sizeof (frame) + comp_len;
+	}
+
+	g_free (raw);
+	g_free (comp);
+
+	max_size = cfg->stat_export_size > 0 ? cfg->stat_export_size :
+			STAT_EXPORT_DEFAULT_SIZE;
+
+	if (w->written > max_size) {
+		rspamd_stat_export_rotate (cfg);
+	}
+}
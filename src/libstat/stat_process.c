@@ -19,6 +19,7 @@
 #include "stat_internal.h"
 #include "libmime/message.h"
 #include "libmime/images.h"
+#include "libmime/scan_result.h"
 #include "libserver/html.h"
 #include "lua/lua_common.h"
 #include "libserver/mempool_vars_internal.h"
@@ -31,6 +32,226 @@
 
 static const gdouble similarity_treshold = 80.0;
 
+/*
+ * Sliding memo of recent classifications for near identical bulk mail:
+ * the token set is summarised by a bottom-k sketch of its 64 bit token
+ * hashes, and when a new task's sketch overlaps a recent one above the
+ * threshold the cached verdict is inserted directly, skipping the
+ * backend token fetch and the posterior computation. Campaign messages
+ * that differ only in personalisation tokens then classify at hash
+ * speed. Opt-in via `options.stat_sketch_memo`.
+ */
+#define RSPAMD_STAT_MEMO_SKETCH_SIZE 32
+#define RSPAMD_STAT_MEMO_SIZE 128
+#define RSPAMD_STAT_MEMO_SIM_THRESHOLD 0.9
+#define RSPAMD_STAT_MEMO_VAR "stat_memo_hit"
+
+struct rspamd_stat_memo_elt {
+	guint64 sketch[RSPAMD_STAT_MEMO_SKETCH_SIZE];
+	guint nsketch;
+	const gchar *symbol; /* Interned statfile symbol */
+	gdouble score;
+	gchar option[32];
+};
+
+static rspamd_lru_hash_t *stat_memo_hash = NULL;
+
+static guint
+rspamd_stat_memo_khash (gconstpointer p)
+{
+	return *(const guint64 *)p;
+}
+
+static gboolean
+rspamd_stat_memo_kequal (gconstpointer a, gconstpointer b)
+{
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+/* Bottom-k distinct token hashes in ascending order */
+static guint
+rspamd_stat_memo_sketch (struct rspamd_task *task, guint64 *out)
+{
+	rspamd_token_t *tok;
+	guint i, n = 0;
+
+	PTR_ARRAY_FOREACH (task->tokens, i, tok) {
+		guint64 v = tok->data;
+		guint lo = 0, hi = n, mid;
+
+		if (n == RSPAMD_STAT_MEMO_SKETCH_SIZE && v >= out[n - 1]) {
+			continue;
+		}
+
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+
+			if (out[mid] < v) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+
+		if (lo < n && out[lo] == v) {
+			/* Duplicate */
+			continue;
+		}
+
+		if (n == RSPAMD_STAT_MEMO_SKETCH_SIZE) {
+			memmove (&out[lo + 1], &out[lo],
+					(RSPAMD_STAT_MEMO_SKETCH_SIZE - 1 - lo) * sizeof (*out));
+		}
+		else {
+			memmove (&out[lo + 1], &out[lo], (n - lo) * sizeof (*out));
+			n ++;
+		}
+
+		out[lo] = v;
+	}
+
+	return n;
+}
+
+/* Bucket key from the smallest few minima, the most set stable part */
+static guint64
+rspamd_stat_memo_key (const guint64 *sk, guint n)
+{
+	return rspamd_cryptobox_fast_hash (sk,
+			MIN (n, 4) * sizeof (guint64), rspamd_hash_seed ());
+}
+
+static gdouble
+rspamd_stat_memo_similarity (const guint64 *s1, guint n1,
+		const guint64 *s2, guint n2)
+{
+	guint i = 0, j = 0, common = 0, denom = MIN (n1, n2);
+
+	if (denom == 0) {
+		return 0.0;
+	}
+
+	while (i < n1 && j < n2) {
+		if (s1[i] == s2[j]) {
+			common ++;
+			i ++;
+			j ++;
+		}
+		else if (s1[i] < s2[j]) {
+			i ++;
+		}
+		else {
+			j ++;
+		}
+	}
+
+	return (gdouble)common / (gdouble)denom;
+}
+
+static gboolean
+rspamd_stat_memo_lookup (struct rspamd_stat_ctx *st_ctx,
+		struct rspamd_task *task)
+{
+	guint64 sketch[RSPAMD_STAT_MEMO_SKETCH_SIZE], key;
+	struct rspamd_stat_memo_elt *elt;
+	gdouble sim;
+	guint n;
+
+	if (!task->cfg->stat_sketch_memo || stat_memo_hash == NULL ||
+		task->tokens == NULL || task->tokens->len == 0) {
+		return FALSE;
+	}
+
+	n = rspamd_stat_memo_sketch (task, sketch);
+	key = rspamd_stat_memo_key (sketch, n);
+	elt = rspamd_lru_hash_lookup (stat_memo_hash, &key,
+			task->task_timestamp);
+
+	if (elt) {
+		sim = rspamd_stat_memo_similarity (sketch, n,
+				elt->sketch, elt->nsketch);
+
+		if (sim >= RSPAMD_STAT_MEMO_SIM_THRESHOLD) {
+			msg_debug_bayes ("reuse classification of a similar message "
+					"(%.2f of the sketch shared): %s (%.2f)",
+					sim, elt->symbol, elt->score);
+			rspamd_mempool_set_variable (task->task_pool,
+					RSPAMD_STAT_MEMO_VAR, elt, NULL);
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+rspamd_stat_memo_store (struct rspamd_stat_ctx *st_ctx,
+		struct rspamd_task *task)
+{
+	guint64 *key;
+	struct rspamd_stat_memo_elt *elt;
+	struct rspamd_statfile *st;
+	struct rspamd_symbol_result *sres = NULL;
+	guint i;
+
+	if (!task->cfg->stat_sketch_memo || task->tokens == NULL ||
+		task->tokens->len == 0) {
+		return;
+	}
+
+	/* Find what the classifier has just inserted */
+	for (i = 0; i < st_ctx->statfiles->len; i++) {
+		st = g_ptr_array_index (st_ctx->statfiles, i);
+		sres = rspamd_task_find_symbol_result (task, st->stcf->symbol);
+
+		if (sres != NULL) {
+			break;
+		}
+	}
+
+	if (sres == NULL) {
+		/* Nothing conclusive to remember */
+		return;
+	}
+
+	if (stat_memo_hash == NULL) {
+		stat_memo_hash = rspamd_lru_hash_new_full (RSPAMD_STAT_MEMO_SIZE,
+				g_free, g_free,
+				rspamd_stat_memo_khash, rspamd_stat_memo_kequal);
+	}
+
+	elt = g_malloc0 (sizeof (*elt));
+	elt->nsketch = rspamd_stat_memo_sketch (task, elt->sketch);
+	elt->symbol = sres->name;
+	elt->score = sres->score;
+
+	if (sres->opts_head && sres->opts_head->option) {
+		rspamd_strlcpy (elt->option, sres->opts_head->option,
+				sizeof (elt->option));
+	}
+
+	key = g_malloc (sizeof (*key));
+	*key = rspamd_stat_memo_key (elt->sketch, elt->nsketch);
+	rspamd_lru_hash_insert (stat_memo_hash, key, elt,
+			task->task_timestamp, 0);
+}
+
+static void
+rspamd_stat_memo_apply (struct rspamd_task *task)
+{
+	struct rspamd_stat_memo_elt *elt;
+
+	elt = rspamd_mempool_get_variable (task->task_pool,
+			RSPAMD_STAT_MEMO_VAR);
+
+	if (elt) {
+		rspamd_task_insert_result (task, elt->symbol, elt->score,
+				elt->option[0] != '\0' ? elt->option : NULL);
+	}
+}
+
 static void
 rspamd_stat_tokenize_parts_metadata (struct rspamd_stat_ctx *st_ctx,
 		struct rspamd_task *task)
@@ -420,13 +641,26 @@ rspamd_stat_classify (struct rspamd_task *task, lua_State *L, guint stage,
 		rspamd_stat_preprocess (st_ctx, task, FALSE);
 	}
 	else if (stage == RSPAMD_TASK_STAGE_CLASSIFIERS) {
-		/* Process backends */
-		rspamd_stat_backends_process (st_ctx, task);
+		if (rspamd_stat_memo_lookup (st_ctx, task)) {
+			/* A similar message has just been classified: skip backends */
+		}
+		else {
+			/* Process backends */
+			rspamd_stat_backends_process (st_ctx, task);
+		}
 	}
 	else if (stage == RSPAMD_TASK_STAGE_CLASSIFIERS_POST) {
+		if (rspamd_mempool_get_variable (task->task_pool,
+				RSPAMD_STAT_MEMO_VAR) != NULL) {
+			/* Reuse the memoized verdict */
+			rspamd_stat_memo_apply (task);
+			rspamd_stat_export_task (task, FALSE, FALSE);
+		}
 		/* Process classifiers */
-		if (rspamd_stat_backends_post_process (st_ctx, task)) {
+		else if (rspamd_stat_backends_post_process (st_ctx, task)) {
 			rspamd_stat_classifiers_process (st_ctx, task);
+			rspamd_stat_memo_store (st_ctx, task);
+			rspamd_stat_export_task (task, FALSE, FALSE);
 		}
 		/* Do not process classifiers on backend failures */
 	}
@@ -859,6 +1093,8 @@ rspamd_stat_learn (struct rspamd_task *task,
 			}
 			return RSPAMD_STAT_PROCESS_ERROR;
 		}
+
+		rspamd_stat_export_task (task, TRUE, spam);
 	}
 	else if (stage == RSPAMD_TASK_STAGE_LEARN_POST) {
 		if (!rspamd_stat_backends_post_learn (st_ctx, task, classifier, spam, err)) {
@@ -274,7 +274,7 @@ rspamd_tokenizer_osb (struct rspamd_stat_ctx *ctx,
 	struct token_pipe_entry *hashpipe;
 	guint32 h1, h2;
 	gsize token_size;
-	guint processed = 0, i, w, window_size, token_flags = 0;
+	guint processed = 0, i, w, window_size, token_flags = 0, head = 0;
 
 	if (words == NULL) {
 		return FALSE;
@@ -357,21 +357,27 @@ rspamd_tokenizer_osb (struct rspamd_stat_ctx *ctx,
 			continue;
 		}
 
+/*
+ * The pipe is circular: HPIPE(0) is the newest element and HPIPE(i) is
+ * the i-th preceding one, so no per-word data shifting is needed while
+ * the produced tokens are bit identical to the shifting variant
+ */
+#define HPIPE(n) hashpipe[(head + (n)) % window_size]
 #define ADD_TOKEN do {\
     new_tok = rspamd_mempool_alloc0 (task->task_pool, token_size); \
     new_tok->flags = token_flags; \
-    new_tok->t1 = hashpipe[0].t; \
-    new_tok->t2 = hashpipe[i].t; \
+    new_tok->t1 = HPIPE(0).t; \
+    new_tok->t2 = HPIPE(i).t; \
     if (osb_cf->ht == RSPAMD_OSB_HASH_COMPAT) { \
-        h1 = ((guint32)hashpipe[0].h) * primes[0] + \
-            ((guint32)hashpipe[i].h) * primes[i << 1]; \
-        h2 = ((guint32)hashpipe[0].h) * primes[1] + \
-            ((guint32)hashpipe[i].h) * primes[(i << 1) - 1]; \
+        h1 = ((guint32)HPIPE(0).h) * primes[0] + \
+            ((guint32)HPIPE(i).h) * primes[i << 1]; \
+        h2 = ((guint32)HPIPE(0).h) * primes[1] + \
+            ((guint32)HPIPE(i).h) * primes[(i << 1) - 1]; \
         memcpy((guchar *)&new_tok->data, &h1, sizeof (h1)); \
         memcpy(((guchar *)&new_tok->data) + sizeof (h1), &h2, sizeof (h2)); \
     } \
     else { \
-        new_tok->data = hashpipe[0].h * primes[0] + hashpipe[i].h * primes[i << 1]; \
+        new_tok->data = HPIPE(0).h * primes[0] + HPIPE(i).h * primes[i << 1]; \
     } \
     new_tok->window_idx = i; \
     g_ptr_array_add (result, new_tok); \
@@ -384,17 +390,15 @@ rspamd_tokenizer_osb (struct rspamd_stat_ctx *ctx,
 			hashpipe[window_size - processed].t = token;
 		}
 		else {
-			/* Shift hashpipe */
-			for (i = window_size - 1; i > 0; i--) {
-				hashpipe[i] = hashpipe[i - 1];
-			}
-			hashpipe[0].h = cur;
-			hashpipe[0].t = token;
+			/* Rotate the circular hashpipe */
+			head = (head + window_size - 1) % window_size;
+			hashpipe[head].h = cur;
+			hashpipe[head].t = token;
 
 			processed++;
 
 			for (i = 1; i < window_size; i++) {
-				if (!(hashpipe[i].t->flags & RSPAMD_STAT_TOKEN_FLAG_EXCEPTION)) {
+				if (!(HPIPE(i).t->flags & RSPAMD_STAT_TOKEN_FLAG_EXCEPTION)) {
 					ADD_TOKEN;
 				}
 			}
@@ -402,6 +406,7 @@ rspamd_tokenizer_osb (struct rspamd_stat_ctx *ctx,
 	}
 
 	if (processed > 1 && processed <= window_size) {
+		/* The pipe has never been rotated in the fill phase, head == 0 */
 		processed --;
 		memmove (hashpipe, &hashpipe[window_size - processed],
 				processed * sizeof (hashpipe[0]));
@@ -412,6 +417,7 @@ rspamd_tokenizer_osb (struct rspamd_stat_ctx *ctx,
 	}
 
 #undef ADD_TOKEN
+#undef HPIPE
 
 	return TRUE;
 }
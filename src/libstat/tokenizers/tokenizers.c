@@ -327,6 +327,12 @@ rspamd_tokenize_text (const gchar *text, gsize len,
 	}
 
 	if (!cur_words) {
+		/*
+		 * Estimate the words count from the text length (six bytes per
+		 * word on average): growing the tokens array through multiple
+		 * reallocs re-copies the whole stream for every large part
+		 */
+		initial_size = MAX (initial_size, MIN (len / 6, 64 * 1024));
 		res = g_array_sized_new (FALSE, FALSE, sizeof (rspamd_stat_token_t),
 				initial_size);
 	}
@@ -835,12 +841,34 @@ rspamd_normalize_words (GArray *words, rspamd_mempool_t *pool)
 	}
 }
 
+/*
+ * Direct mapped per-language memo of stem results: natural language
+ * repeats words heavily, so each distinct word should hit the snowball
+ * stemmer once per worker rather than once per occurrence; collisions
+ * simply overwrite the slot
+ */
+#define RSPAMD_STEM_MEMO_SIZE 8192
+
+struct rspamd_stem_memo_slot {
+	guint64 h;
+	gchar *word; /* Owned, the normalized input the slot was filled from */
+	guint wlen;
+	gchar *data; /* Owned, NUL terminated */
+	guint len;
+};
+
+struct rspamd_stemmer_elt {
+	struct sb_stemmer *stem;
+	struct rspamd_stem_memo_slot *memo;
+};
+
 void
 rspamd_stem_words (GArray *words, rspamd_mempool_t *pool,
 				   const gchar *language,
 				   struct rspamd_lang_detector *d)
 {
 	static GHashTable *stemmers = NULL;
+	struct rspamd_stemmer_elt *elt = NULL;
 	struct sb_stemmer *stem = NULL;
 	guint i;
 	rspamd_stat_token_t *tok;
@@ -853,9 +881,9 @@ rspamd_stem_words (GArray *words, rspamd_mempool_t *pool,
 	}
 
 	if (language && language[0] != '\0') {
-		stem = g_hash_table_lookup (stemmers, language);
+		elt = g_hash_table_lookup (stemmers, language);
 
-		if (stem == NULL) {
+		if (elt == NULL) {
 
 			stem = sb_stemmer_new (language, "UTF_8");
 
@@ -867,13 +895,20 @@ rspamd_stem_words (GArray *words, rspamd_mempool_t *pool,
 						GINT_TO_POINTER (-1));
 			}
 			else {
+				elt = g_malloc0 (sizeof (*elt));
+				elt->stem = stem;
+				elt->memo = g_malloc0 (sizeof (*elt->memo) *
+						RSPAMD_STEM_MEMO_SIZE);
 				g_hash_table_insert (stemmers, g_strdup (language),
-						stem);
+						elt);
 			}
 		}
-		else if (stem == GINT_TO_POINTER (-1)) {
+		else if (elt == GINT_TO_POINTER (-1)) {
 			/* Negative cache */
-			stem = NULL;
+			elt = NULL;
+		}
+		else {
+			stem = elt->stem;
 		}
 	}
 	for (i = 0; i < words->len; i++) {
@@ -882,11 +917,50 @@ rspamd_stem_words (GArray *words, rspamd_mempool_t *pool,
 		if (tok->flags & RSPAMD_STAT_TOKEN_FLAG_UTF) {
 			if (stem) {
 				const gchar *stemmed = NULL;
+				struct rspamd_stem_memo_slot *slot;
+				guint64 wh;
+
+				wh = rspamd_cryptobox_fast_hash (tok->normalized.begin,
+						tok->normalized.len, rspamd_hash_seed ());
+				slot = &elt->memo[wh & (RSPAMD_STEM_MEMO_SIZE - 1)];
+
+				/*
+				 * The hash alone is not enough: a collision would
+				 * silently substitute another word's stem into the
+				 * statistics tokens, so verify the stored word
+				 */
+				if (slot->data != NULL && slot->h == wh &&
+						slot->wlen == tok->normalized.len &&
+						memcmp (slot->word, tok->normalized.begin,
+								slot->wlen) == 0) {
+					/* Stemmed this word before */
+					stemmed = slot->data;
+					dlen = slot->len;
+				}
+				else {
+					stemmed = sb_stemmer_stem (stem,
+							tok->normalized.begin, tok->normalized.len);
+
+					dlen = stemmed ? strlen (stemmed) : 0;
 
-				stemmed = sb_stemmer_stem (stem,
-						tok->normalized.begin, tok->normalized.len);
+					if (dlen > 0) {
+						if (slot->data) {
+							g_free (slot->data);
+						}
+						if (slot->word) {
+							g_free (slot->word);
+						}
 
-				dlen = stemmed ? strlen (stemmed) : 0;
+						slot->data = g_malloc (dlen + 1);
+						memcpy (slot->data, stemmed, dlen + 1);
+						slot->len = dlen;
+						slot->word = g_malloc (tok->normalized.len);
+						memcpy (slot->word, tok->normalized.begin,
+								tok->normalized.len);
+						slot->wlen = tok->normalized.len;
+						slot->h = wh;
+					}
+				}
 
 				if (dlen > 0) {
 					dest = rspamd_mempool_alloc (pool, dlen + 1);
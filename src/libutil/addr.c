@@ -1832,6 +1832,12 @@ rspamd_inet_address_equal (gconstpointer a, gconstpointer b)
 {
 	const rspamd_inet_addr_t *a1 = a, *a2 = b;
 
+	if (a1->af == AF_INET && a2->af == AF_INET) {
+		/* Branchless fast path for the dominant case */
+		return a1->u.in.addr.s4.sin_addr.s_addr ==
+				a2->u.in.addr.s4.sin_addr.s_addr;
+	}
+
 	return rspamd_inet_address_compare (a1, a2, FALSE) == 0;
 }
 
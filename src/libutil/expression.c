@@ -23,7 +23,6 @@
 #include <math.h>
 
 #define RSPAMD_EXPR_FLAG_NEGATE (1 << 0)
-#define RSPAMD_EXPR_FLAG_PROCESSED (1 << 1)
 
 #define MIN_RESORT_EVALS 50
 #define MAX_RESORT_EVALS 150
@@ -45,6 +44,7 @@ struct rspamd_expression_elt {
 
 	gint flags;
 	gint priority;
+	guint eval_gen; /* evaluation the cached value belongs to */
 	gdouble value;
 };
 
@@ -498,8 +498,14 @@ rspamd_ast_priority_traverse (GNode *node, gpointer d)
 				elt->priority = RSPAMD_EXPRESSION_MAX_PRIORITY -
 						expr->subr->priority (elt->p.atom);
 			}
-			elt->p.atom->hits = 0;
-			elt->p.atom->avg_ticks = 0.0;
+
+			/*
+			 * Decay the learned counters instead of resetting them:
+			 * zeroing here used to wipe the measured hit rates and
+			 * timings right before the resort read them, so the learned
+			 * order was never actually applied
+			 */
+			elt->p.atom->hits /= 2;
 		}
 	}
 
@@ -528,9 +534,6 @@ rspamd_ast_priority_cmp (GNode *a, GNode *b)
 		w1 = ATOM_PRIORITY (ea);
 		w2 = ATOM_PRIORITY (eb);
 
-		ea->p.atom->hits = 0;
-		ea->p.atom->avg_ticks = 0.0;
-
 		return w1 - w2;
 	}
 	else {
@@ -1016,7 +1019,7 @@ rspamd_ast_process_node (struct rspamd_expression *expr, GNode *node,
 
 	switch (elt->type) {
 	case ELT_ATOM:
-		if (!(elt->flags & RSPAMD_EXPR_FLAG_PROCESSED)) {
+		if (elt->eval_gen != expr->evals) {
 
 			/*
 			 * Sometimes get ticks for this expression. 'Sometimes' here means
@@ -1045,7 +1048,7 @@ rspamd_ast_process_node (struct rspamd_expression *expr, GNode *node,
 						(expr->evals);
 			}
 
-			elt->flags |= RSPAMD_EXPR_FLAG_PROCESSED;
+			elt->eval_gen = expr->evals;
 		}
 
 		acc = elt->value;
@@ -1097,17 +1100,6 @@ rspamd_ast_process_node (struct rspamd_expression *expr, GNode *node,
 	return acc;
 }
 
-static gboolean
-rspamd_ast_cleanup_traverse (GNode *n, gpointer d)
-{
-	struct rspamd_expression_elt *elt = n->data;
-
-	elt->value = 0;
-	elt->flags = 0;
-
-	return FALSE;
-}
-
 gdouble
 rspamd_process_expression_closure (struct rspamd_expression *expr,
 								   rspamd_expression_process_cb cb,
@@ -1136,9 +1128,10 @@ rspamd_process_expression_closure (struct rspamd_expression *expr,
 
 	ret = rspamd_ast_process_node (expr, expr->ast, &pd);
 
-	/* Cleanup */
-	g_node_traverse (expr->ast, G_IN_ORDER, G_TRAVERSE_ALL, -1,
-			rspamd_ast_cleanup_traverse, NULL);
+	/*
+	 * No per-node cleanup pass is needed: cached atom values are
+	 * invalidated by the evaluation generation stored in each element
+	 */
 
 	/* Check if we need to resort */
 	if (expr->evals % expr->next_resort == 0) {
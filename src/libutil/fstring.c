@@ -126,6 +126,15 @@ rspamd_fstring_suggest_size (gsize len, gsize allocated, gsize needed_len)
 
 	newlen = MAX (len + needed_len, 1 + allocated * 3 / 2);
 
+	if (newlen > 1024 * 1024) {
+		/*
+		 * Large strings are served from mmapped chunks by the allocator;
+		 * rounding to page multiples lets realloc grow them with mremap
+		 * instead of copying megabytes around
+		 */
+		newlen = (newlen + 4095) & ~((gsize)4095);
+	}
+
 #ifdef HAVE_MALLOC_SIZE
 	optlen = sys_alloc_size (newlen + sizeof (rspamd_fstring_t));
 #endif
@@ -293,7 +302,8 @@ rspamd_fstrhash_lc (const rspamd_ftok_t * str, gboolean is_utf)
 	}
 	else {
 		for (i = 0; i < str->len; i++, p++) {
-			hval = fstrhash_c (g_ascii_tolower (*p), hval);
+			/* The table lookup produces identical hashes branch-free */
+			hval = fstrhash_c (lc_map[(guchar)*p], hval);
 		}
 	}
 
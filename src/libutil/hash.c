@@ -32,6 +32,8 @@ struct rspamd_lru_hash_s {
 	guint maxsize;
 	guint eviction_min_prio;
 	guint eviction_used;
+	guint64 hits;
+	guint64 misses;
 	struct rspamd_lru_element_s **eviction_pool;
 
 	GDestroyNotify value_destroy;
@@ -557,6 +559,7 @@ rspamd_lru_hash_lookup (rspamd_lru_hash_t *hash, gconstpointer key, time_t now)
 
 			if (now - vnode->creation_time > vnode->ttl) {
 				rspamd_lru_hash_remove_node (hash, res);
+				hash->misses ++;
 
 				return NULL;
 			}
@@ -566,13 +569,31 @@ rspamd_lru_hash_lookup (rspamd_lru_hash_t *hash, gconstpointer key, time_t now)
 		res->last = MAX (res->last, now);
 		rspamd_lru_hash_update_counter (res);
 		rspamd_lru_hash_maybe_evict (hash, res);
+		hash->hits ++;
 
 		return res->data;
 	}
 
+	hash->misses ++;
+
 	return NULL;
 }
 
+void
+rspamd_lru_hash_counters (rspamd_lru_hash_t *hash,
+		guint64 *hits, guint64 *misses)
+{
+	if (hash) {
+		if (hits) {
+			*hits = hash->hits;
+		}
+
+		if (misses) {
+			*misses = hash->misses;
+		}
+	}
+}
+
 gboolean
 rspamd_lru_hash_remove (rspamd_lru_hash_t *hash,
 		gconstpointer key)
@@ -701,7 +722,8 @@ rspamd_lru_hash_foreach (rspamd_lru_hash_t *h, int it, gpointer *k,
 		return -1;
 	}
 
-	return i;
+	/* Next slot to continue from, so the iteration makes progress */
+	return i + 1;
 }
 
 
@@ -84,6 +84,12 @@ void rspamd_lru_hash_insert (rspamd_lru_hash_t *hash,
 
 void rspamd_lru_hash_destroy (rspamd_lru_hash_t *hash);
 
+/**
+ * Returns the cumulative hit and miss counters of the hash
+ */
+void rspamd_lru_hash_counters (rspamd_lru_hash_t *hash,
+							   guint64 *hits, guint64 *misses);
+
 /**
  * Iterate over lru hash. Iterations must start from it=0 and are done when it==-1
  * @param hash
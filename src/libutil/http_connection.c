@@ -33,6 +33,10 @@
 #include "contrib/http-parser/http_parser.h"
 #include "unix-std.h"
 
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
 #include <openssl/err.h>
 
 #define ENCRYPTED_VERSION " HTTP/1.0"
@@ -53,6 +57,7 @@ enum rspamd_http_priv_flags {
 	RSPAMD_HTTP_CONN_FLAG_PROXY = 1u << 5u,
 	RSPAMD_HTTP_CONN_FLAG_PROXY_REQUEST = 1u << 6u,
 	RSPAMD_HTTP_CONN_OWN_SOCKET = 1u << 7u,
+	RSPAMD_HTTP_CONN_FLAG_TUNED = 1u << 8u,
 };
 
 #define IS_CONN_ENCRYPTED(c) ((c)->flags & RSPAMD_HTTP_CONN_FLAG_ENCRYPTED)
@@ -100,11 +105,38 @@ http_error_quark (void)
 	return g_quark_from_static_string ("http-error-quark");
 }
 
+/*
+ * Bounded freelist of connection read buffers: every message read used
+ * to allocate a privbuf with a fresh fstring and free both at reset,
+ * which is pure allocator churn at connection rate; recycle them
+ * instead, dropping oversized buffers so the cache stays small
+ */
+#define RSPAMD_HTTP_PRIVBUF_CACHE_MAX 64
+#define RSPAMD_HTTP_PRIVBUF_KEEP_SIZE (64 * 1024)
+
+static struct _rspamd_http_privbuf *
+		http_privbuf_cache[RSPAMD_HTTP_PRIVBUF_CACHE_MAX];
+static guint http_privbuf_cache_cnt = 0;
+
+static struct _rspamd_http_privbuf *
+rspamd_http_privbuf_new (gsize initial_size);
+
 static void
 rspamd_http_privbuf_dtor (gpointer ud)
 {
 	struct _rspamd_http_privbuf *p = (struct _rspamd_http_privbuf *)ud;
 
+	if (http_privbuf_cache_cnt < RSPAMD_HTTP_PRIVBUF_CACHE_MAX) {
+		if (p->data && p->data->allocated > RSPAMD_HTTP_PRIVBUF_KEEP_SIZE) {
+			rspamd_fstring_free (p->data);
+			p->data = NULL;
+		}
+
+		http_privbuf_cache[http_privbuf_cache_cnt ++] = p;
+
+		return;
+	}
+
 	if (p->data) {
 		rspamd_fstring_free (p->data);
 	}
@@ -112,6 +144,35 @@ rspamd_http_privbuf_dtor (gpointer ud)
 	g_free (p);
 }
 
+static struct _rspamd_http_privbuf *
+rspamd_http_privbuf_new (gsize initial_size)
+{
+	struct _rspamd_http_privbuf *p;
+
+	if (http_privbuf_cache_cnt > 0) {
+		p = http_privbuf_cache[--http_privbuf_cache_cnt];
+
+		if (p->data != NULL) {
+			p->data->len = 0;
+		}
+		else {
+			p->data = rspamd_fstring_sized_new (initial_size);
+		}
+
+		p->zc_buf = NULL;
+		p->zc_remain = 0;
+		REF_INIT_RETAIN (p, rspamd_http_privbuf_dtor);
+
+		return p;
+	}
+
+	p = g_malloc0 (sizeof (*p));
+	REF_INIT_RETAIN (p, rspamd_http_privbuf_dtor);
+	p->data = rspamd_fstring_sized_new (initial_size);
+
+	return p;
+}
+
 static const gchar *
 rspamd_http_code_to_str (gint code)
 {
@@ -1387,6 +1448,16 @@ rspamd_http_connection_copy_msg (struct rspamd_http_message *msg, GError **err)
 			new_msg->body_buf.begin = new_msg->body_buf.str +
 					(msg->body_buf.begin - msg->body_buf.str);
 		}
+		else if (msg->flags & RSPAMD_HTTP_FLAG_BODY_SHARED) {
+			/* Reference the refcounted buffer instead of copying */
+			if (!rspamd_http_message_share_body (msg, new_msg)) {
+				g_set_error (err, http_error_quark (), EINVAL,
+						"cannot share body of the message");
+				rspamd_http_message_unref (new_msg);
+
+				return NULL;
+			}
+		}
 		else {
 			old_body = rspamd_http_message_get_body (msg, &old_len);
 
@@ -1504,9 +1575,7 @@ rspamd_http_connection_read_message_common (struct rspamd_http_connection *conn,
 
 	priv->timeout = timeout;
 	priv->header = NULL;
-	priv->buf = g_malloc0 (sizeof (*priv->buf));
-	REF_INIT_RETAIN (priv->buf, rspamd_http_privbuf_dtor);
-	priv->buf->data = rspamd_fstring_sized_new (8192);
+	priv->buf = rspamd_http_privbuf_new (8192);
 	priv->flags |= RSPAMD_HTTP_CONN_FLAG_NEW_HEADER;
 
 	rspamd_ev_watcher_init (&priv->ev, conn->fd, EV_READ,
@@ -1691,6 +1760,10 @@ rspamd_http_message_write_header (const gchar* mime_type, gboolean encrypted,
 				status.len = msg->status->len;
 			}
 
+			if (msg->flags & RSPAMD_HTTP_FLAG_KEEPALIVE) {
+				conn_type = "keep-alive";
+			}
+
 			if (encrypted) {
 				/* Internal reply (encrypted) */
 				if (mime_type) {
@@ -1734,12 +1807,13 @@ rspamd_http_message_write_header (const gchar* mime_type, gboolean encrypted,
 					meth_len =
 							rspamd_printf_fstring (buf,
 									"HTTP/1.1 %d %T\r\n"
-											"Connection: close\r\n"
+											"Connection: %s\r\n"
 											"Server: %s\r\n"
 											"Date: %s\r\n"
 											"Content-Length: %z\r\n"
 											"Content-Type: %s\r\n",
-									msg->code, &status, "rspamd/" RVERSION,
+									msg->code, &status, conn_type,
+									"rspamd/" RVERSION,
 									datebuf,
 									bodylen, mime_type);
 				}
@@ -1747,11 +1821,12 @@ rspamd_http_message_write_header (const gchar* mime_type, gboolean encrypted,
 					meth_len =
 							rspamd_printf_fstring (buf,
 									"HTTP/1.1 %d %T\r\n"
-											"Connection: close\r\n"
+											"Connection: %s\r\n"
 											"Server: %s\r\n"
 											"Date: %s\r\n"
 											"Content-Length: %z\r\n",
-									msg->code, &status, "rspamd/" RVERSION,
+									msg->code, &status, conn_type,
+									"rspamd/" RVERSION,
 									datebuf,
 									bodylen);
 				}
@@ -1906,6 +1981,51 @@ rspamd_http_message_write_header (const gchar* mime_type, gboolean encrypted,
 	return meth_len;
 }
 
+/*
+ * Adjusts the reply socket for latency fairness: an adaptive SO_SNDBUF
+ * keeps big replies (history, symbol dumps) from sinking deep into the
+ * kernel queue on slow links, and TCP_NOTSENT_LOWAT makes the write
+ * watcher fire when the unsent backlog drains below the watermark
+ * rather than when the whole buffer empties
+ */
+static void
+rspamd_http_connection_tune_reply_socket (struct rspamd_http_connection *conn,
+		struct rspamd_http_connection_private *priv)
+{
+	struct rspamd_http_context *ctx = priv->ctx;
+
+	if (ctx->config.adaptive_sndbuf) {
+		gint sndbuf;
+
+		/* Track the typical reply size */
+		if (ctx->reply_size_ema <= 0) {
+			ctx->reply_size_ema = priv->wr_total;
+		}
+		else {
+			ctx->reply_size_ema +=
+					((gdouble)priv->wr_total - ctx->reply_size_ema) * 0.125;
+		}
+
+		sndbuf = CLAMP ((gint)(ctx->reply_size_ema * 2.0),
+				16 * 1024, 1024 * 1024);
+
+		(void)setsockopt (conn->fd, SOL_SOCKET, SO_SNDBUF,
+				(const void *)&sndbuf, sizeof (sndbuf));
+	}
+
+#ifdef TCP_NOTSENT_LOWAT
+	if (ctx->config.notsent_lowat > 0 &&
+			!(priv->flags & RSPAMD_HTTP_CONN_FLAG_TUNED)) {
+		gint lowat = ctx->config.notsent_lowat;
+
+		if (setsockopt (conn->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+				(const void *)&lowat, sizeof (lowat)) == 0) {
+			priv->flags |= RSPAMD_HTTP_CONN_FLAG_TUNED;
+		}
+	}
+#endif
+}
+
 static void
 rspamd_http_connection_write_message_common (struct rspamd_http_connection *conn,
 											 struct rspamd_http_message *msg,
@@ -1933,9 +2053,7 @@ rspamd_http_connection_write_message_common (struct rspamd_http_connection *conn
 	priv->timeout = timeout;
 
 	priv->header = NULL;
-	priv->buf = g_malloc0 (sizeof (*priv->buf));
-	REF_INIT_RETAIN (priv->buf, rspamd_http_privbuf_dtor);
-	priv->buf->data = rspamd_fstring_sized_new (512);
+	priv->buf = rspamd_http_privbuf_new (512);
 	buf = priv->buf->data;
 
 	if (priv->peer_key && priv->local_key) {
@@ -2219,6 +2337,10 @@ rspamd_http_connection_write_message_common (struct rspamd_http_connection *conn
 
 	priv->flags &= ~RSPAMD_HTTP_CONN_FLAG_RESETED;
 
+	if (conn->type == RSPAMD_HTTP_SERVER && priv->ctx) {
+		rspamd_http_connection_tune_reply_socket (conn, priv);
+	}
+
 	if (priv->flags & RSPAMD_HTTP_CONN_FLAG_PROXY) {
 		/* We need to disable SSL flag! */
 		msg->flags &=~ RSPAMD_HTTP_FLAG_SSL;
@@ -2366,7 +2488,13 @@ rspamd_http_message_parse_query (struct rspamd_http_message *msg)
 			rspamd_fstring_mapped_ftok_free);
 
 	if (msg->url && msg->url->len > 0) {
-		http_parser_parse_url (msg->url->str, msg->url->len, TRUE, &u);
+		if (!msg->url_parsed) {
+			http_parser_parse_url (msg->url->str, msg->url->len, TRUE,
+					&msg->parsed_url);
+			msg->url_parsed = TRUE;
+		}
+
+		u = msg->parsed_url;
 
 		if (u.field_set & (1 << UF_QUERY)) {
 			p = msg->url->str + u.field_data[UF_QUERY].off;
@@ -79,6 +79,15 @@ struct rspamd_storage_shmem {
  * Do not verify server's certificate
  */
 #define RSPAMD_HTTP_FLAG_SSL_NOVERIFY (1 << 6)
+/**
+ * Body is a refcounted buffer shared with other messages
+ */
+#define RSPAMD_HTTP_FLAG_BODY_SHARED (1 << 7)
+/**
+ * Reply with `Connection: keep-alive` leaving the connection usable for
+ * the next request
+ */
+#define RSPAMD_HTTP_FLAG_KEEPALIVE (1 << 8)
 /**
  * Options for HTTP connection
  */
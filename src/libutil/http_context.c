@@ -91,6 +91,7 @@ rspamd_http_context_new_default (struct rspamd_config *cfg,
 	static const int default_kp_size = 1024;
 	static const gdouble default_rotate_time = 120;
 	static const gdouble default_keepalive_interval = 65;
+	static const guint default_keepalive_max_per_host = 16;
 	static const gchar *default_user_agent = "rspamd-" RSPAMD_VERSION_FULL;
 
 	ctx = g_malloc0 (sizeof (*ctx));
@@ -99,7 +100,9 @@ rspamd_http_context_new_default (struct rspamd_config *cfg,
 	ctx->config.client_key_rotate_time = default_rotate_time;
 	ctx->config.user_agent = default_user_agent;
 	ctx->config.keepalive_interval = default_keepalive_interval;
+	ctx->config.keepalive_max_per_host = default_keepalive_max_per_host;
 	ctx->ups_ctx = ups_ctx;
+	ctx->cfg = cfg;
 
 	if (cfg) {
 		ctx->ssl_ctx = cfg->libs_ctx->ssl_ctx;
@@ -174,10 +177,22 @@ rspamd_http_context_init (struct rspamd_http_context *ctx)
 {
 	if (ctx->config.kp_cache_size_client > 0) {
 		ctx->client_kp_cache = rspamd_keypair_cache_new (ctx->config.kp_cache_size_client);
+
+		if (ctx->cfg && ctx->cfg->shared_keypairs_table) {
+			rspamd_keypair_cache_set_shared (ctx->client_kp_cache,
+					ctx->cfg->shared_keypairs_table,
+					ctx->cfg->shared_keypairs_nelts);
+		}
 	}
 
 	if (ctx->config.kp_cache_size_server > 0) {
 		ctx->server_kp_cache = rspamd_keypair_cache_new (ctx->config.kp_cache_size_server);
+
+		if (ctx->cfg && ctx->cfg->shared_keypairs_table) {
+			rspamd_keypair_cache_set_shared (ctx->server_kp_cache,
+					ctx->cfg->shared_keypairs_table,
+					ctx->cfg->shared_keypairs_nelts);
+		}
 	}
 
 	if (ctx->config.client_key_rotate_time > 0 && ctx->event_loop) {
@@ -251,6 +266,16 @@ rspamd_http_context_create (struct rspamd_config *cfg,
 				ctx->config.keepalive_interval = ucl_object_todouble (keepalive_interval);
 			}
 
+			const ucl_object_t *keepalive_max;
+
+			keepalive_max = ucl_object_lookup (client_obj,
+					"keepalive_max_per_host");
+
+			if (keepalive_max) {
+				ctx->config.keepalive_max_per_host =
+						ucl_object_toint (keepalive_max);
+			}
+
 			const ucl_object_t *http_proxy;
 			http_proxy = ucl_object_lookup (client_obj, "http_proxy");
 
@@ -269,6 +294,24 @@ rspamd_http_context_create (struct rspamd_config *cfg,
 			if (kp_size) {
 				ctx->config.kp_cache_size_server = ucl_object_toint (kp_size);
 			}
+
+			const ucl_object_t *notsent_lowat;
+
+			notsent_lowat = ucl_object_lookup (server_obj, "notsent_lowat");
+
+			if (notsent_lowat) {
+				ctx->config.notsent_lowat = ucl_object_toint (notsent_lowat);
+			}
+
+			const ucl_object_t *adaptive_sndbuf;
+
+			adaptive_sndbuf = ucl_object_lookup (server_obj,
+					"adaptive_sndbuf");
+
+			if (adaptive_sndbuf) {
+				ctx->config.adaptive_sndbuf =
+						ucl_object_toboolean (adaptive_sndbuf);
+			}
 		}
 	}
 
@@ -552,6 +595,19 @@ rspamd_http_context_push_keepalive (struct rspamd_http_context *ctx,
 		}
 	}
 
+	if (ctx->config.keepalive_max_per_host > 0 &&
+		g_queue_get_length (&conn->keepalive_hash_key->conns) >=
+				ctx->config.keepalive_max_per_host) {
+		/* Cap idle connections per host, just close the extra one */
+		conn->finished = TRUE;
+		msg_debug_http_context ("too many keepalive connections for %s, "
+				"drop the connection",
+				rspamd_inet_address_to_string (
+						conn->keepalive_hash_key->addr));
+
+		return;
+	}
+
 	/* Move connection to the keepalive pool */
 	cbdata = g_malloc0 (sizeof (*cbdata));
 
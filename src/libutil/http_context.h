@@ -37,9 +37,12 @@ struct rspamd_http_context_cfg {
 	guint kp_cache_size_server;
 	guint ssl_cache_size;
 	gdouble keepalive_interval;
+	guint keepalive_max_per_host;
 	gdouble client_key_rotate_time;
 	const gchar *user_agent;
 	const gchar *http_proxy;
+	guint notsent_lowat;
+	gboolean adaptive_sndbuf;
 };
 
 /**
@@ -302,6 +302,85 @@ rspamd_http_message_set_body_from_fd (struct rspamd_http_message *msg,
 	return TRUE;
 }
 
+gboolean
+rspamd_http_message_set_body_external (struct rspamd_http_message *msg,
+									   const gchar *data, gsize len)
+{
+	rspamd_http_message_storage_cleanup (msg);
+
+	/*
+	 * Zero-copy mode: the message merely references the caller owned
+	 * region (e.g. the mmapped task input), so no storage is attached
+	 */
+	msg->flags &= ~(RSPAMD_HTTP_FLAG_SHMEM|RSPAMD_HTTP_FLAG_SHMEM_IMMUTABLE);
+	msg->body_buf.str = NULL;
+	msg->body_buf.begin = data;
+	msg->body_buf.len = len;
+	msg->body_buf.allocated_len = 0;
+
+	return TRUE;
+}
+
+static void
+rspamd_http_message_body_dtor (gpointer p)
+{
+	struct rspamd_http_message_body *body =
+			(struct rspamd_http_message_body *)p;
+
+	rspamd_fstring_free (body->buf);
+	g_free (body);
+}
+
+gboolean
+rspamd_http_message_body_to_shared (struct rspamd_http_message *msg)
+{
+	struct rspamd_http_message_body *body;
+	union _rspamd_storage_u *storage = &msg->body_buf.c;
+
+	if (msg->flags & RSPAMD_HTTP_FLAG_BODY_SHARED) {
+		return TRUE;
+	}
+
+	if ((msg->flags & RSPAMD_HTTP_FLAG_SHMEM) || storage->normal == NULL) {
+		/* No owned fstring to wrap */
+		return FALSE;
+	}
+
+	body = g_malloc0 (sizeof (*body));
+	body->buf = storage->normal;
+	REF_INIT_RETAIN (body, rspamd_http_message_body_dtor);
+	storage->shared_body = body;
+	msg->flags |= RSPAMD_HTTP_FLAG_BODY_SHARED;
+
+	return TRUE;
+}
+
+gboolean
+rspamd_http_message_share_body (struct rspamd_http_message *src,
+								struct rspamd_http_message *dst)
+{
+	struct rspamd_http_message_body *body;
+
+	if (!(src->flags & RSPAMD_HTTP_FLAG_BODY_SHARED) ||
+			src->body_buf.c.shared_body == NULL) {
+		return FALSE;
+	}
+
+	rspamd_http_message_storage_cleanup (dst);
+
+	body = src->body_buf.c.shared_body;
+	REF_RETAIN (body);
+	dst->body_buf.c.shared_body = body;
+	dst->body_buf.str = body->buf->str;
+	dst->body_buf.begin = src->body_buf.begin;
+	dst->body_buf.len = src->body_buf.len;
+	/* The buffer is shared, so it must never be grown in place */
+	dst->body_buf.allocated_len = 0;
+	dst->flags |= RSPAMD_HTTP_FLAG_BODY_SHARED|RSPAMD_HTTP_FLAG_HAS_BODY;
+
+	return TRUE;
+}
+
 gboolean
 rspamd_http_message_set_body_from_fstring_steal (struct rspamd_http_message *msg,
 												 rspamd_fstring_t *fstr)
@@ -350,6 +429,9 @@ rspamd_http_message_grow_body (struct rspamd_http_message *msg, gsize len)
 	union _rspamd_storage_u *storage;
 	gsize newlen;
 
+	/* Shared bodies are immutable */
+	g_assert (!(msg->flags & RSPAMD_HTTP_FLAG_BODY_SHARED));
+
 	storage = &msg->body_buf.c;
 
 	if (msg->flags & RSPAMD_HTTP_FLAG_SHMEM) {
@@ -405,6 +487,9 @@ rspamd_http_message_append_body (struct rspamd_http_message *msg,
 {
 	union _rspamd_storage_u *storage;
 
+	/* Shared bodies are immutable */
+	g_assert (!(msg->flags & RSPAMD_HTTP_FLAG_BODY_SHARED));
+
 	storage = &msg->body_buf.c;
 
 	if (msg->flags & RSPAMD_HTTP_FLAG_SHMEM) {
@@ -454,6 +539,14 @@ rspamd_http_message_storage_cleanup (struct rspamd_http_message *msg)
 		storage->shared.shm_fd = -1;
 		msg->body_buf.str = MAP_FAILED;
 	}
+	else if (msg->flags & RSPAMD_HTTP_FLAG_BODY_SHARED) {
+		if (msg->body_buf.c.shared_body) {
+			REF_RELEASE (msg->body_buf.c.shared_body);
+		}
+
+		msg->body_buf.c.shared_body = NULL;
+		msg->flags &= ~RSPAMD_HTTP_FLAG_BODY_SHARED;
+	}
 	else {
 		if (msg->body_buf.c.normal) {
 			rspamd_fstring_free (msg->body_buf.c.normal);
@@ -117,9 +117,38 @@ void rspamd_http_message_set_method (struct rspamd_http_message *msg,
  * @param fd
  * @return TRUE if a message's body has been set
  */
+/**
+ * Sets body of a message from a caller owned memory region without copying;
+ * the region must remain valid until the message is destroyed
+ * @param msg
+ * @param data
+ * @param len
+ * @return TRUE if a message body has been set
+ */
+gboolean rspamd_http_message_set_body_external (struct rspamd_http_message *msg,
+												const gchar *data, gsize len);
+
 gboolean rspamd_http_message_set_body_from_fd (struct rspamd_http_message *msg,
 											   gint fd);
 
+/**
+ * Converts a plain fstring body into a refcounted buffer that can be
+ * shared between messages without copying
+ * @param msg
+ * @return TRUE if the body is (now) refcounted
+ */
+gboolean rspamd_http_message_body_to_shared (struct rspamd_http_message *msg);
+
+/**
+ * References the refcounted body of `src` from `dst` without copying;
+ * `src` must have been converted with rspamd_http_message_body_to_shared
+ * @param src
+ * @param dst
+ * @return TRUE if the body has been shared
+ */
+gboolean rspamd_http_message_share_body (struct rspamd_http_message *src,
+										 struct rspamd_http_message *dst);
+
 /**
  * Uses rspamd_fstring_t as message's body, string is consumed by this operation
  * @param msg
@@ -45,6 +45,15 @@ struct rspamd_http_header {
 /**
  * HTTP message structure, used for requests and replies
  */
+/*
+ * Refcounted body buffer shared between several messages, e.g. the
+ * master connection and its mirror copies in the proxy
+ */
+struct rspamd_http_message_body {
+	rspamd_fstring_t *buf;
+	ref_entry_t ref;
+};
+
 struct rspamd_http_message {
 	rspamd_fstring_t *url;
 	GString *host;
@@ -64,6 +73,7 @@ struct rspamd_http_message {
 		/* Internal storage */
 		union _rspamd_storage_u {
 			rspamd_fstring_t *normal;
+			struct rspamd_http_message_body *shared_body;
 			struct _rspamd_storage_shared_s {
 				struct rspamd_storage_shmem *name;
 				gint shm_fd;
@@ -72,6 +82,9 @@ struct rspamd_http_message {
 	} body_buf;
 
 	struct rspamd_cryptobox_pubkey *peer_key;
+	/* Cached parsed url offsets, valid when url_parsed is set */
+	struct http_parser_url parsed_url;
+	gboolean url_parsed;
 	time_t date;
 	time_t last_modified;
 	unsigned port;
@@ -98,6 +111,7 @@ KHASH_INIT (rspamd_keep_alive_hash, struct rspamd_keepalive_hash_key *,
 
 struct rspamd_http_context {
 	struct rspamd_http_context_cfg config;
+	struct rspamd_config *cfg;
 	struct rspamd_keypair_cache *client_kp_cache;
 	struct rspamd_cryptobox_keypair *client_kp;
 	struct rspamd_keypair_cache *server_kp_cache;
@@ -107,6 +121,7 @@ struct rspamd_http_context {
 	gpointer ssl_ctx_noverify;
 	struct ev_loop *event_loop;
 	ev_timer client_rotate_ev;
+	gdouble reply_size_ema;  /* EMA of server reply sizes for sndbuf tuning */
 	khash_t (rspamd_keep_alive_hash) *keep_alive_hash;
 };
 
@@ -287,7 +287,13 @@ rspamd_http_router_finish_handler (struct rspamd_http_connection *conn,
 		/* Search for path */
 		if (msg->url != NULL && msg->url->len != 0) {
 
-			http_parser_parse_url (msg->url->str, msg->url->len, TRUE, &u);
+			if (!msg->url_parsed) {
+				http_parser_parse_url (msg->url->str, msg->url->len, TRUE,
+						&msg->parsed_url);
+				msg->url_parsed = TRUE;
+			}
+
+			u = msg->parsed_url;
 
 			if (u.field_set & (1 << UF_PATH)) {
 				guint unnorm_len;
@@ -97,9 +97,12 @@ rspamd_ev_watcher_reschedule (struct ev_loop *loop,
 	g_assert (ev->cb != NULL);
 
 	if (ev_can_stop (&ev->io)) {
-		ev_io_stop (EV_A_ &ev->io);
-		ev_io_set (&ev->io, ev->io.fd, what);
-		ev_io_start (EV_A_ &ev->io);
+		if ((ev->io.events & (EV_READ|EV_WRITE)) != what) {
+			ev_io_stop (EV_A_ &ev->io);
+			ev_io_set (&ev->io, ev->io.fd, what);
+			ev_io_start (EV_A_ &ev->io);
+		}
+		/* Events are unchanged: avoid the epoll churn entirely */
 	}
 	else {
 		ev->io.data = ev;
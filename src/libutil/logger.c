@@ -76,6 +76,8 @@ struct rspamd_logger_s {
 	gboolean log_buffered;
 	gboolean log_silent_workers;
 	guint32 log_buf_size;
+	guint debug_sample;                 /* emit every Nth debug line */
+	guint debug_cnt;
 
 	struct rspamd_logger_error_log *errlog;
 	struct rspamd_cryptobox_pubkey *pk;
@@ -540,6 +542,7 @@ rspamd_set_logger (struct rspamd_config *cfg,
 	}
 
 	logger->log_buffered = cfg->log_buffered;
+	logger->debug_sample = cfg->log_debug_sample;
 	logger->log_silent_workers = cfg->log_silent_workers;
 	logger->log_buf_size = cfg->log_buf_size;
 
@@ -1350,6 +1353,12 @@ rspamd_conditional_debug_fast (rspamd_logger_t *rspamd_log,
 			}
 		}
 
+		if (rspamd_log->debug_sample > 1 &&
+			(rspamd_log->debug_cnt ++ % rspamd_log->debug_sample) != 0) {
+			/* Sampled debugging: bound the logging rate in production */
+			return;
+		}
+
 		va_start (vp, fmt);
 		end = rspamd_vsnprintf (logbuf, sizeof (logbuf), fmt, vp);
 		*end = '\0';
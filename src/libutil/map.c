@@ -23,6 +23,7 @@
 #include "http_connection.h"
 #include "http_private.h"
 #include "rspamd.h"
+#include "libserver/worker_util.h"
 #include "contrib/zstd/zstd.h"
 #include "contrib/libev/ev.h"
 #include "contrib/uthash/utlist.h"
@@ -274,6 +275,161 @@ rspamd_map_cache_cb (struct ev_loop *loop, ev_timer *w, int revents)
 	}
 }
 
+/*
+ * Streaming zstd decompression into a freshly allocated buffer; shared
+ * between the http and file backends, and also run from the offload pool
+ */
+static gboolean
+rspamd_map_zstd_inflate (const guchar *in, gsize inlen, guchar **outp,
+		gsize *outlenp)
+{
+	ZSTD_DStream *zstream;
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+	guchar *out;
+	gsize outlen, r;
+
+	zstream = ZSTD_createDStream ();
+	ZSTD_initDStream (zstream);
+
+	zin.pos = 0;
+	zin.src = in;
+	zin.size = inlen;
+
+	if ((outlen = ZSTD_getDecompressedSize (zin.src, zin.size)) == 0) {
+		outlen = ZSTD_DStreamOutSize ();
+	}
+
+	out = g_malloc (outlen);
+
+	zout.dst = out;
+	zout.pos = 0;
+	zout.size = outlen;
+
+	while (zin.pos < zin.size) {
+		r = ZSTD_decompressStream (zstream, &zout, &zin);
+
+		if (ZSTD_isError (r)) {
+			ZSTD_freeDStream (zstream);
+			g_free (out);
+			*outp = NULL;
+
+			return FALSE;
+		}
+
+		if (zout.pos == zout.size) {
+			/* We need to extend output buffer */
+			zout.size = zout.size * 1.5 + 1.0;
+			out = g_realloc (zout.dst, zout.size);
+			zout.dst = out;
+		}
+	}
+
+	ZSTD_freeDStream (zstream);
+	*outp = out;
+	*outlenp = zout.pos;
+
+	return TRUE;
+}
+
+static gboolean
+rspamd_map_http_unchanged (struct http_callback_data *cbd,
+		const guchar *data, gsize len)
+{
+	struct rspamd_map *map = cbd->map;
+	guint64 cksum;
+
+	cksum = rspamd_cryptobox_fast_hash (data, len, rspamd_hash_seed ());
+
+	if (cbd->map->backends->len == 1 &&
+		cbd->data->last_cksum != 0 &&
+		cbd->data->last_cksum == cksum) {
+		/*
+		 * Modification signals (etag or last modified) have fired, but the
+		 * content is bit identical: keep the current data and skip the
+		 * whole reparse and rebuild cycle
+		 */
+		msg_info_map ("%s(%s): content is not changed (checksum %xL) despite "
+				"modification signals, skip reloading",
+				cbd->bk->uri,
+				rspamd_inet_address_to_string_pretty (cbd->addr),
+				cksum);
+		cbd->periodic->need_modify = FALSE;
+
+		return TRUE;
+	}
+
+	cbd->data->last_cksum = cksum;
+
+	return FALSE;
+}
+
+/*
+ * Compressed http maps are inflated in the offload pool when one is
+ * available (worker processes), so a multi-megabyte zstd payload does not
+ * stall the event loop; the finish callback transfers its cbd reference
+ * to this job and the delivery continues on the loop thread
+ */
+struct rspamd_map_zstd_cbd {
+	struct http_callback_data *cbd;
+	const guchar *in;
+	gsize dlen;
+	guchar *out;
+	gsize outlen;
+	gboolean success;
+	gchar next_check_date[128];
+};
+
+static void
+rspamd_map_http_zstd_work (gpointer ud)
+{
+	struct rspamd_map_zstd_cbd *zcbd = (struct rspamd_map_zstd_cbd *)ud;
+
+	zcbd->success = rspamd_map_zstd_inflate (zcbd->in, zcbd->dlen,
+			&zcbd->out, &zcbd->outlen);
+}
+
+static void
+rspamd_map_http_zstd_done (gpointer ud)
+{
+	struct rspamd_map_zstd_cbd *zcbd = (struct rspamd_map_zstd_cbd *)ud;
+	struct http_callback_data *cbd = zcbd->cbd;
+	struct rspamd_map *map = cbd->map;
+	struct rspamd_map_backend *bk = cbd->bk;
+
+	if (!zcbd->success) {
+		msg_err_map ("%s(%s): cannot decompress data",
+				bk->uri,
+				rspamd_inet_address_to_string_pretty (cbd->addr));
+		MAP_RELEASE (cbd->shmem_data, "shmem_data");
+		cbd->periodic->errored = 1;
+	}
+	else if (rspamd_map_http_unchanged (cbd, zcbd->out, zcbd->outlen)) {
+		g_free (zcbd->out);
+		MAP_RELEASE (cbd->shmem_data, "shmem_data");
+		cbd->periodic->cur_backend ++;
+	}
+	else {
+		msg_info_map ("%s(%s): read map data %z bytes compressed, "
+				"%z uncompressed, next check at %s",
+				bk->uri,
+				rspamd_inet_address_to_string_pretty (cbd->addr),
+				zcbd->dlen, zcbd->outlen, zcbd->next_check_date);
+		map->read_callback (zcbd->out, zcbd->outlen, &cbd->periodic->cbdata,
+				TRUE);
+		rspamd_map_save_http_cached_file (map, bk, cbd->data, zcbd->out,
+				zcbd->outlen);
+		g_free (zcbd->out);
+		MAP_RELEASE (cbd->shmem_data, "shmem_data");
+		cbd->periodic->cur_backend ++;
+	}
+
+	munmap ((gpointer)zcbd->in, zcbd->dlen);
+	rspamd_map_process_periodic (cbd->periodic);
+	MAP_RELEASE (cbd, "http_callback_data");
+	g_free (zcbd);
+}
+
 static int
 http_map_finish (struct rspamd_http_connection *conn,
 		struct rspamd_http_message *msg)
@@ -419,62 +575,57 @@ http_map_finish (struct rspamd_http_connection *conn,
 
 
 		if (cbd->bk->is_compressed) {
-			ZSTD_DStream *zstream;
-			ZSTD_inBuffer zin;
-			ZSTD_outBuffer zout;
+			struct rspamd_offload_pool *opool = rspamd_offload_pool_get ();
 			guchar *out;
-			gsize outlen, r;
-
-			zstream = ZSTD_createDStream ();
-			ZSTD_initDStream (zstream);
-
-			zin.pos = 0;
-			zin.src = in;
-			zin.size = dlen;
+			gsize outlen;
+
+			if (opool) {
+				struct rspamd_map_zstd_cbd *zcbd;
+
+				zcbd = g_malloc0 (sizeof (*zcbd));
+				zcbd->cbd = cbd;
+				zcbd->in = in;
+				zcbd->dlen = dlen;
+				rspamd_strlcpy (zcbd->next_check_date, next_check_date,
+						sizeof (zcbd->next_check_date));
+
+				if (rspamd_offload_pool_push (opool,
+						rspamd_map_http_zstd_work,
+						rspamd_map_http_zstd_done, zcbd)) {
+					/* Our cbd reference is transferred to the job */
+					return 0;
+				}
 
-			if ((outlen = ZSTD_getDecompressedSize (zin.src, zin.size)) == 0) {
-				outlen = ZSTD_DStreamOutSize ();
+				g_free (zcbd);
 			}
 
-			out = g_malloc (outlen);
-
-			zout.dst = out;
-			zout.pos = 0;
-			zout.size = outlen;
-
-			while (zin.pos < zin.size) {
-				r = ZSTD_decompressStream (zstream, &zout, &zin);
-
-				if (ZSTD_isError (r)) {
-					msg_err_map ("%s(%s): cannot decompress data: %s",
-							cbd->bk->uri,
-							rspamd_inet_address_to_string_pretty (cbd->addr),
-							ZSTD_getErrorName (r));
-					ZSTD_freeDStream (zstream);
-					g_free (out);
-					MAP_RELEASE (cbd->shmem_data, "shmem_data");
-					goto err;
-				}
+			if (!rspamd_map_zstd_inflate (in, dlen, &out, &outlen)) {
+				msg_err_map ("%s(%s): cannot decompress data",
+						cbd->bk->uri,
+						rspamd_inet_address_to_string_pretty (cbd->addr));
+				MAP_RELEASE (cbd->shmem_data, "shmem_data");
+				goto err;
+			}
 
-				if (zout.pos == zout.size) {
-					/* We need to extend output buffer */
-					zout.size = zout.size * 1.5 + 1.0;
-					out = g_realloc (zout.dst, zout.size);
-					zout.dst = out;
-				}
+			if (rspamd_map_http_unchanged (cbd, out, outlen)) {
+				g_free (out);
+				goto unchanged;
 			}
 
-			ZSTD_freeDStream (zstream);
 			msg_info_map ("%s(%s): read map data %z bytes compressed, "
 					"%z uncompressed, next check at %s",
 					cbd->bk->uri,
 					rspamd_inet_address_to_string_pretty (cbd->addr),
-					dlen, zout.pos, next_check_date);
-			map->read_callback (out, zout.pos, &cbd->periodic->cbdata, TRUE);
-			rspamd_map_save_http_cached_file (map, bk, cbd->data, out, zout.pos);
+					dlen, outlen, next_check_date);
+			map->read_callback (out, outlen, &cbd->periodic->cbdata, TRUE);
+			rspamd_map_save_http_cached_file (map, bk, cbd->data, out, outlen);
 			g_free (out);
 		}
 		else {
+			if (rspamd_map_http_unchanged (cbd, in, cbd->data_len)) {
+				goto unchanged;
+			}
+
 			msg_info_map ("%s(%s): read map data %z bytes, next check at %s",
 					cbd->bk->uri,
 					rspamd_inet_address_to_string_pretty (cbd->addr),
@@ -483,6 +634,8 @@ http_map_finish (struct rspamd_http_connection *conn,
 			map->read_callback (in, cbd->data_len, &cbd->periodic->cbdata, TRUE);
 		}
 
+unchanged:
+
 		MAP_RELEASE (cbd->shmem_data, "shmem_data");
 
 		cbd->periodic->cur_backend ++;
@@ -799,55 +952,20 @@ read_map_file (struct rspamd_map *map, struct file_map_data *data,
 				return FALSE;
 			}
 
-			ZSTD_DStream *zstream;
-			ZSTD_inBuffer zin;
-			ZSTD_outBuffer zout;
 			guchar *out;
-			gsize outlen, r;
-
-			zstream = ZSTD_createDStream ();
-			ZSTD_initDStream (zstream);
-
-			zin.pos = 0;
-			zin.src = bytes;
-			zin.size = len;
-
-			if ((outlen = ZSTD_getDecompressedSize (zin.src, zin.size)) == 0) {
-				outlen = ZSTD_DStreamOutSize ();
-			}
-
-			out = g_malloc (outlen);
-
-			zout.dst = out;
-			zout.pos = 0;
-			zout.size = outlen;
-
-			while (zin.pos < zin.size) {
-				r = ZSTD_decompressStream (zstream, &zout, &zin);
+			gsize outlen;
 
-				if (ZSTD_isError (r)) {
-					msg_err_map ("%s: cannot decompress data: %s",
-							data->filename,
-							ZSTD_getErrorName (r));
-					ZSTD_freeDStream (zstream);
-					g_free (out);
-					munmap (bytes, len);
-					return FALSE;
-				}
-
-				if (zout.pos == zout.size) {
-					/* We need to extend output buffer */
-					zout.size = zout.size * 1.5 + 1.0;
-					out = g_realloc (zout.dst, zout.size);
-					zout.dst = out;
-				}
+			if (!rspamd_map_zstd_inflate (bytes, len, &out, &outlen)) {
+				msg_err_map ("%s: cannot decompress data",
+						data->filename);
+				munmap (bytes, len);
+				return FALSE;
 			}
 
-			ZSTD_freeDStream (zstream);
 			msg_info_map ("%s: read map data, %z bytes compressed, "
 					"%z uncompressed)", data->filename,
-					len, zout.pos);
-			map->read_callback (out, zout.pos, &periodic->cbdata, TRUE);
+					len, outlen);
+			map->read_callback (out, outlen, &periodic->cbdata, TRUE);
 			g_free (out);
 
 			munmap (bytes, len);
@@ -1866,6 +1984,7 @@ rspamd_map_preload (struct rspamd_config *cfg)
 		if (map_ok) {
 			struct map_periodic_cbdata fake_cbd;
 			gboolean succeed = TRUE;
+			gdouble map_ts = rspamd_get_ticks (FALSE);
 
 			memset (&fake_cbd, 0, sizeof (fake_cbd));
 			fake_cbd.cbdata.state = 0;
@@ -1918,6 +2037,8 @@ rspamd_map_preload (struct rspamd_config *cfg)
 
 			if (succeed) {
 				map->fin_callback (&fake_cbd.cbdata, map->user_data);
+				msg_debug_map ("preloaded %s in %.3f seconds", map->name,
+						rspamd_get_ticks (FALSE) - map_ts);
 			}
 			else {
 				msg_info_map ("preload of %s failed", map->name);
@@ -504,12 +504,14 @@ rspamd_map_helper_insert_hash (gpointer st, gconstpointer key, gconstpointer val
 	gsize vlen;
 	gint r;
 
-	k = kh_get (rspamd_map_hash, ht->htb, key);
+	/* A single probe for both the lookup and the insertion */
+	k = kh_put (rspamd_map_hash, ht->htb, (gchar *)key, &r);
 	vlen = strlen (value);
 
-	if (k == kh_end (ht->htb)) {
+	if (r != 0) {
+		/* A new key: replace the temporary pointer with an owned copy */
 		nk = rspamd_mempool_strdup (ht->pool, key);
-		k = kh_put (rspamd_map_hash, ht->htb, nk, &r);
+		kh_key (ht->htb, k) = (gchar *)nk;
 	}
 	else {
 		val = kh_value (ht->htb, k);
@@ -639,6 +641,14 @@ rspamd_map_helper_new_hash (struct rspamd_map *map)
 
 	htb = rspamd_mempool_alloc0 (pool, sizeof (*htb));
 	htb->htb = kh_init (rspamd_map_hash);
+
+	if (map && map->nelts > 0) {
+		/*
+		 * Presize the new generation from the previous one: reloads of
+		 * large lists then insert without any intermediate rehashing
+		 */
+		kh_resize (rspamd_map_hash, htb->htb, map->nelts * 1.3 + 64);
+	}
 	htb->pool = pool;
 	rspamd_cryptobox_fast_hash_init (&htb->hst, map_hash_seed);
 
@@ -1331,6 +1341,55 @@ rspamd_match_hash_map (struct rspamd_hash_map_helper *map, const gchar *in)
 	return NULL;
 }
 
+guint
+rspamd_match_hash_map_batch (struct rspamd_hash_map_helper *map,
+		const gchar **keys, guint nkeys, gconstpointer *results)
+{
+	khash_t(rspamd_map_hash) *h;
+	struct rspamd_map_helper_value *val;
+	khiter_t k;
+	khint_t mask, bucket;
+	guint i, nmatched = 0;
+
+	if (map == NULL || map->htb == NULL || nkeys == 0) {
+		if (results) {
+			memset (results, 0, sizeof (*results) * nkeys);
+		}
+
+		return 0;
+	}
+
+	h = map->htb;
+	mask = kh_n_buckets (h) - 1;
+
+	/*
+	 * First pass: hash all keys and prefetch the home buckets, so by the
+	 * time the probe loop needs a bucket its cache lines are (likely)
+	 * already in flight instead of being demand loaded one by one
+	 */
+	for (i = 0; i < nkeys; i ++) {
+		bucket = rspamd_strcase_hash (keys[i]) & mask;
+		__builtin_prefetch (&h->flags[bucket >> 4], 0, 1);
+		__builtin_prefetch (&h->keys[bucket], 0, 1);
+	}
+
+	for (i = 0; i < nkeys; i ++) {
+		k = kh_get (rspamd_map_hash, h, keys[i]);
+
+		if (k != kh_end (h)) {
+			val = kh_value (h, k);
+			val->hits ++;
+			results[i] = val->value;
+			nmatched ++;
+		}
+		else {
+			results[i] = NULL;
+		}
+	}
+
+	return nmatched;
+}
+
 gconstpointer
 rspamd_match_radix_map (struct rspamd_radix_map_helper *map,
 		const guchar *in, gsize inlen)
@@ -1372,4 +1431,34 @@ rspamd_match_radix_map_addr (struct rspamd_radix_map_helper *map,
 	}
 
 	return NULL;
+}
+
+guint
+rspamd_match_radix_map_addr_batch (struct rspamd_radix_map_helper *map,
+		const rspamd_inet_addr_t **addrs, guint naddrs, gconstpointer *results)
+{
+	guint i, nmatched = 0;
+
+	if (map == NULL || map->trie == NULL || naddrs == 0) {
+		if (results) {
+			memset (results, 0, sizeof (*results) * naddrs);
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < naddrs; i ++) {
+		/* Keep the next key warm while the trie chases this one */
+		if (i + 1 < naddrs) {
+			__builtin_prefetch (addrs[i + 1], 0, 1);
+		}
+
+		results[i] = rspamd_match_radix_map_addr (map, addrs[i]);
+
+		if (results[i] != NULL) {
+			nmatched ++;
+		}
+	}
+
+	return nmatched;
 }
\ No newline at end of file
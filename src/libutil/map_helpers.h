@@ -151,6 +151,20 @@ GPtrArray *rspamd_match_regexp_map_all (struct rspamd_regexp_map_helper *map,
 gconstpointer rspamd_match_hash_map (struct rspamd_hash_map_helper *map,
 									 const gchar *in);
 
+/**
+ * Look up a batch of keys in one go: the home buckets of all keys are
+ * prefetched before probing, which hides most of the memory latency of
+ * long dependent lookup chains
+ * @param map
+ * @param keys array of NUL terminated keys
+ * @param nkeys number of keys
+ * @param results per key matched values (NULL for misses), nkeys elements
+ * @return number of matched keys
+ */
+guint rspamd_match_hash_map_batch (struct rspamd_hash_map_helper *map,
+								   const gchar **keys, guint nkeys,
+								   gconstpointer *results);
+
 /**
  * Find value matching specific key in a hash map
  * @param map
@@ -164,6 +178,19 @@ gconstpointer rspamd_match_radix_map (struct rspamd_radix_map_helper *map,
 gconstpointer rspamd_match_radix_map_addr (struct rspamd_radix_map_helper *map,
 										   const rspamd_inet_addr_t *addr);
 
+/**
+ * Batched variant of rspamd_match_radix_map_addr
+ * @param map
+ * @param addrs array of addresses
+ * @param naddrs number of addresses
+ * @param results per address matched values (NULL for misses)
+ * @return number of matched addresses
+ */
+guint rspamd_match_radix_map_addr_batch (struct rspamd_radix_map_helper *map,
+										 const rspamd_inet_addr_t **addrs,
+										 guint naddrs,
+										 gconstpointer *results);
+
 /**
  * Creates radix map helper
  * @param map
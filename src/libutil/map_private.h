@@ -100,6 +100,7 @@ struct http_map_data {
 	time_t last_checked;
 	gboolean request_sent;
 	guint64 gen;
+	guint64 last_cksum;
 	guint16 port;
 };
 
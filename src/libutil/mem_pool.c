@@ -21,6 +21,7 @@
 #include "unix-std.h"
 #include "khash.h"
 #include "cryptobox.h"
+#include "ucl.h"
 #include "contrib/uthash/utlist.h"
 
 #ifdef WITH_JEMALLOC
@@ -29,6 +30,9 @@
 #define HAVE_MALLOC_SIZE 1
 #define sys_alloc_size(sz) nallocx(sz, 0)
 #endif
+#if (JEMALLOC_VERSION_MAJOR >= 4)
+#define HAVE_JEMALLOC_ARENAS 1
+#endif
 #elif defined(__APPLE__)
 #include <malloc/malloc.h>
 #define HAVE_MALLOC_SIZE 1
@@ -76,7 +80,8 @@ struct rspamd_mempool_entry_point {
 static inline uint32_t
 rspamd_entry_hash (const char *str)
 {
-	return (guint)rspamd_cryptobox_fast_hash (str, strlen (str), rspamd_hash_seed ());
+	return (guint)rspamd_cryptobox_fast_hash_short (str, strlen (str),
+			rspamd_hash_seed ());
 }
 
 static inline int
@@ -114,6 +119,164 @@ pool_chain_free (struct _pool_chain *chain)
 /* By default allocate 8Kb chunks of memory */
 #define FIXED_POOL_SIZE 4096
 
+/*
+ * Process-wide cache of recycled chunks: task pools are created and
+ * destroyed thousands of times per second with the very same suggested
+ * sizes, so warm chunks are reused instead of hitting the allocator
+ * every time. Guarded by a tiny spin lock: contention is negligible in
+ * the one thread per worker model.
+ *
+ * NUMA note: pages of a chunk are placed by the kernel's first-touch
+ * policy on the node of the worker that faulted them in; since the cache
+ * is per process and workers can be pinned with the pin_cpu_base option,
+ * recycled chunks stay node-local for pinned workers without any
+ * explicit mbind and hence without a libnuma dependency.
+ */
+#define RSPAMD_MEMPOOL_CHUNK_CACHE_SIZE 64
+
+static struct {
+	gpointer chunks[RSPAMD_MEMPOOL_CHUNK_CACHE_SIZE];
+	gsize sizes[RSPAMD_MEMPOOL_CHUNK_CACHE_SIZE];
+	guint cnt;
+	volatile gint lock;
+} mempool_chunk_cache;
+
+#ifdef HAVE_JEMALLOC_ARENAS
+/*
+ * Per subsystem arenas: pool chunks are allocated from a dedicated arena
+ * selected by the pool tag, so that jemalloc statistics attribute memory
+ * to a subsystem instead of requiring full heap profiling
+ */
+static const gchar *mempool_subsys_names[RSPAMD_MEMPOOL_SUBSYS_MAX] = {
+	"other", "parse", "lua", "http", "stat"
+};
+static unsigned int mempool_subsys_arenas[RSPAMD_MEMPOOL_SUBSYS_MAX];
+static gint mempool_subsys_flags[RSPAMD_MEMPOOL_SUBSYS_MAX];
+static gboolean mempool_arenas_ready = FALSE;
+
+static void
+rspamd_mempool_init_arenas (void)
+{
+	unsigned int arena;
+	size_t sz = sizeof (arena);
+	guint i;
+
+	for (i = 0; i < RSPAMD_MEMPOOL_SUBSYS_MAX; i ++) {
+		/* jemalloc 4 spells it `arenas.extend', 5 - `arenas.create' */
+		if (mallctl ("arenas.create", &arena, &sz, NULL, 0) == 0 ||
+				mallctl ("arenas.extend", &arena, &sz, NULL, 0) == 0) {
+			mempool_subsys_arenas[i] = arena;
+			mempool_subsys_flags[i] = MALLOCX_ARENA (arena);
+		}
+		else {
+			mempool_subsys_arenas[i] = 0;
+			mempool_subsys_flags[i] = 0;
+		}
+	}
+
+	mempool_arenas_ready = TRUE;
+}
+
+static gint
+rspamd_mempool_subsys_flags (const gchar *tag)
+{
+	enum rspamd_mempool_subsys subsys = RSPAMD_MEMPOOL_SUBSYS_OTHER;
+
+	if (!mempool_arenas_ready) {
+		rspamd_mempool_init_arenas ();
+	}
+
+	if (tag != NULL) {
+		if (g_ascii_strncasecmp (tag, "task", 4) == 0 ||
+				g_ascii_strncasecmp (tag, "mime", 4) == 0) {
+			subsys = RSPAMD_MEMPOOL_SUBSYS_PARSE;
+		}
+		else if (g_ascii_strncasecmp (tag, "lua", 3) == 0) {
+			subsys = RSPAMD_MEMPOOL_SUBSYS_LUA;
+		}
+		else if (g_ascii_strncasecmp (tag, "http", 4) == 0 ||
+				g_ascii_strncasecmp (tag, "proxy", 5) == 0 ||
+				g_ascii_strncasecmp (tag, "milter", 6) == 0 ||
+				g_ascii_strncasecmp (tag, "controller", 10) == 0) {
+			subsys = RSPAMD_MEMPOOL_SUBSYS_HTTP;
+		}
+		else if (g_ascii_strncasecmp (tag, "stat", 4) == 0 ||
+				g_ascii_strncasecmp (tag, "classifier", 10) == 0 ||
+				g_ascii_strncasecmp (tag, "fuzzy", 5) == 0) {
+			subsys = RSPAMD_MEMPOOL_SUBSYS_STAT;
+		}
+	}
+
+	return mempool_subsys_flags[subsys];
+}
+#endif
+
+static inline void
+rspamd_mempool_chunk_cache_lock (void)
+{
+	while (!g_atomic_int_compare_and_exchange (&mempool_chunk_cache.lock,
+			0, 1));
+}
+
+static inline void
+rspamd_mempool_chunk_cache_unlock (void)
+{
+	g_atomic_int_set (&mempool_chunk_cache.lock, 0);
+}
+
+static gpointer
+rspamd_mempool_chunk_cache_get (gsize total_size)
+{
+	gpointer res = NULL;
+	guint i;
+
+	rspamd_mempool_chunk_cache_lock ();
+
+	for (i = 0; i < mempool_chunk_cache.cnt; i ++) {
+		if (mempool_chunk_cache.sizes[i] == total_size) {
+			res = mempool_chunk_cache.chunks[i];
+			mempool_chunk_cache.cnt --;
+			mempool_chunk_cache.chunks[i] =
+					mempool_chunk_cache.chunks[mempool_chunk_cache.cnt];
+			mempool_chunk_cache.sizes[i] =
+					mempool_chunk_cache.sizes[mempool_chunk_cache.cnt];
+			break;
+		}
+	}
+
+	rspamd_mempool_chunk_cache_unlock ();
+
+	if (res) {
+		g_atomic_int_inc (&mem_pool_stat->chunks_reused);
+		g_atomic_int_add (&mem_pool_stat->chunks_cached, -1);
+	}
+
+	return res;
+}
+
+static gboolean
+rspamd_mempool_chunk_cache_put (gpointer p, gsize total_size)
+{
+	gboolean res = FALSE;
+
+	rspamd_mempool_chunk_cache_lock ();
+
+	if (mempool_chunk_cache.cnt < RSPAMD_MEMPOOL_CHUNK_CACHE_SIZE) {
+		mempool_chunk_cache.chunks[mempool_chunk_cache.cnt] = p;
+		mempool_chunk_cache.sizes[mempool_chunk_cache.cnt] = total_size;
+		mempool_chunk_cache.cnt ++;
+		res = TRUE;
+	}
+
+	rspamd_mempool_chunk_cache_unlock ();
+
+	if (res) {
+		g_atomic_int_inc (&mem_pool_stat->chunks_cached);
+	}
+
+	return res;
+}
+
 static inline struct rspamd_mempool_entry_point *
 rspamd_mempool_entry_new (const gchar *loc)
 {
@@ -177,7 +340,8 @@ rspamd_mempool_get_entry (const gchar *loc)
 
 
 static struct _pool_chain *
-rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type)
+rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type,
+		gint mx_flags)
 {
 	struct _pool_chain *chain;
 	gsize total_size = size + sizeof (struct _pool_chain) + MIN_MEM_ALIGNMENT,
@@ -232,7 +396,26 @@ rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type)
 		optimal_size = sys_alloc_size (total_size);
 #endif
 		total_size = MAX (total_size, optimal_size);
-		map = malloc (total_size);
+		map = NULL;
+
+#ifdef HAVE_JEMALLOC_ARENAS
+		if (mx_flags != 0) {
+			/*
+			 * Subsystem tagged chunks come from a dedicated arena and bypass
+			 * the recycle cache to keep the attribution exact
+			 */
+			map = mallocx (total_size, mx_flags);
+		}
+#endif
+
+		if (map == NULL) {
+			/* Try to reuse a warm chunk of the same size class first */
+			map = rspamd_mempool_chunk_cache_get (total_size);
+		}
+
+		if (map == NULL) {
+			map = malloc (total_size);
+		}
 
 		if (map == NULL) {
 			g_error ("%s: failed to allocate %"G_GSIZE_FORMAT" bytes",
@@ -364,6 +547,10 @@ rspamd_mempool_new_ (gsize size, const gchar *tag, const gchar *loc)
 		new_pool->tag.tagname[0] = '\0';
 	}
 
+#ifdef HAVE_JEMALLOC_ARENAS
+	new_pool->mx_flags = rspamd_mempool_subsys_flags (tag);
+#endif
+
 	/* Generate new uid */
 	ottery_rand_bytes (uidbuf, sizeof (uidbuf));
 	for (i = 0; i < G_N_ELEMENTS (uidbuf); i ++) {
@@ -392,6 +579,8 @@ memory_pool_alloc_common (rspamd_mempool_t * pool, gsize size,
 
 	if (pool) {
 		POOL_MTX_LOCK ();
+		pool->used_size += size;
+
 		if (always_malloc && pool_type != RSPAMD_MEMPOOL_SHARED) {
 			void *ptr;
 
@@ -419,14 +608,15 @@ memory_pool_alloc_common (rspamd_mempool_t * pool, gsize size,
 			if (pool->elt_len >= size + MIN_MEM_ALIGNMENT) {
 				pool->entry->elts[pool->entry->cur_elts].fragmentation += size;
 				new = rspamd_mempool_chain_new (pool->elt_len,
-						pool_type);
+						pool_type, pool->mx_flags);
 			}
 			else {
 				mem_pool_stat->oversized_chunks++;
 				g_atomic_int_add (&mem_pool_stat->fragmented_size,
 						free);
 				pool->entry->elts[pool->entry->cur_elts].fragmentation += free;
-				new = rspamd_mempool_chain_new (size + pool->elt_len, pool_type);
+				new = rspamd_mempool_chain_new (size + pool->elt_len,
+						pool_type, pool->mx_flags);
 			}
 
 			/* Connect to pool subsystem */
@@ -670,6 +860,11 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 
 	POOL_MTX_LOCK ();
 
+	if (pool->protected_ro) {
+		/* Thaw frozen chunks so destructors and free can proceed */
+		rspamd_mempool_protect (pool, FALSE);
+	}
+
 	cur = NULL;
 
 	if (pool->pools[RSPAMD_MEMPOOL_NORMAL] != NULL) {
@@ -712,7 +907,11 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 					munmap ((void *)cur, len);
 				}
 				else {
-					free (cur); /* Not g_free as we use system allocator */
+					/* Arena tagged chunks are never recycled across subsystems */
+					if (pool->mx_flags != 0 ||
+							!rspamd_mempool_chunk_cache_put (cur, len)) {
+						free (cur); /* Not g_free as we use system allocator */
+					}
 				}
 			}
 		}
@@ -749,7 +948,11 @@ rspamd_mempool_cleanup_tmp (rspamd_mempool_t * pool)
 					-((gint)cur->slice_size));
 			g_atomic_int_add (&mem_pool_stat->chunks_allocated, -1);
 
-			free (cur);
+			if (pool->mx_flags != 0 ||
+					!rspamd_mempool_chunk_cache_put (cur,
+							cur->slice_size + sizeof (struct _pool_chain))) {
+				free (cur);
+			}
 		}
 
 		pool->pools[RSPAMD_MEMPOOL_TMP] = NULL;
@@ -759,6 +962,96 @@ rspamd_mempool_cleanup_tmp (rspamd_mempool_t * pool)
 	POOL_MTX_UNLOCK ();
 }
 
+gsize
+rspamd_mempool_used_size (rspamd_mempool_t *pool)
+{
+	return pool ? pool->used_size : 0;
+}
+
+void
+rspamd_mempool_protect (rspamd_mempool_t *pool, gboolean readonly)
+{
+	struct _pool_chain *cur;
+	gsize pgsz = sysconf (_SC_PAGESIZE);
+	guchar *pstart, *pend;
+
+	if (pool == NULL || pool->pools[RSPAMD_MEMPOOL_NORMAL] == NULL) {
+		return;
+	}
+
+	LL_FOREACH (pool->pools[RSPAMD_MEMPOOL_NORMAL], cur) {
+		/*
+		 * Only whole pages strictly inside the chunk payload are
+		 * protected: the chain header stays writable, so the pool can
+		 * still be walked and freed
+		 */
+		pstart = (guchar *)align_ptr (cur->begin, pgsz);
+		pend = (guchar *)(((uintptr_t)(cur->begin + cur->slice_size)) &
+				~(pgsz - 1));
+
+		if (pend > pstart) {
+			if (mprotect (pstart, pend - pstart,
+					readonly ? PROT_READ : (PROT_READ | PROT_WRITE)) == -1) {
+				msg_warn ("cannot mprotect pool chunk: %s", strerror (errno));
+			}
+		}
+	}
+
+	pool->protected_ro = readonly;
+}
+
+struct ucl_object_s *
+rspamd_mempool_get_arena_stats (void)
+{
+#ifdef HAVE_JEMALLOC_ARENAS
+	static const gchar *counters[] = {
+		"small.allocated", "large.allocated", "mapped", "resident"
+	};
+	ucl_object_t *top, *sub;
+	guint64 epoch = 1;
+	size_t epoch_sz = sizeof (epoch), val_sz;
+	size_t val;
+	gchar namebuf[128];
+	guint i, j;
+
+	if (!mempool_arenas_ready) {
+		rspamd_mempool_init_arenas ();
+	}
+
+	/* Stats are refreshed on epoch advance merely */
+	mallctl ("epoch", &epoch, &epoch_sz, &epoch, epoch_sz);
+
+	top = ucl_object_typed_new (UCL_OBJECT);
+
+	for (i = 0; i < RSPAMD_MEMPOOL_SUBSYS_MAX; i ++) {
+		if (mempool_subsys_flags[i] == 0) {
+			continue;
+		}
+
+		sub = ucl_object_typed_new (UCL_OBJECT);
+
+		for (j = 0; j < G_N_ELEMENTS (counters); j ++) {
+			rspamd_snprintf (namebuf, sizeof (namebuf), "stats.arenas.%d.%s",
+					mempool_subsys_arenas[i], counters[j]);
+			val = 0;
+			val_sz = sizeof (val);
+
+			/* Not all counters exist in all jemalloc versions */
+			if (mallctl (namebuf, &val, &val_sz, NULL, 0) == 0) {
+				ucl_object_insert_key (sub,
+						ucl_object_fromint (val), counters[j], 0, true);
+			}
+		}
+
+		ucl_object_insert_key (top, sub, mempool_subsys_names[i], 0, false);
+	}
+
+	return top;
+#else
+	return NULL;
+#endif
+}
+
 void
 rspamd_mempool_stat (rspamd_mempool_stat_t * st)
 {
@@ -770,6 +1063,8 @@ rspamd_mempool_stat (rspamd_mempool_stat_t * st)
 		st->chunks_allocated = mem_pool_stat->chunks_allocated;
 		st->chunks_freed = mem_pool_stat->chunks_freed;
 		st->oversized_chunks = mem_pool_stat->oversized_chunks;
+		st->chunks_cached = mem_pool_stat->chunks_cached;
+		st->chunks_reused = mem_pool_stat->chunks_reused;
 	}
 }
 
@@ -54,6 +54,20 @@ struct f_str_s;
 #define align_ptr(p, a)                                                   \
     (guint8 *) (((uintptr_t) (p) + ((uintptr_t) a - 1)) & ~((uintptr_t) a - 1))
 
+/**
+ * Subsystem attribution for pool chunks: with jemalloc integration each
+ * subsystem allocates its chunks from a dedicated arena, so memory usage
+ * can be attributed in production without full heap dumps
+ */
+enum rspamd_mempool_subsys {
+	RSPAMD_MEMPOOL_SUBSYS_OTHER = 0,
+	RSPAMD_MEMPOOL_SUBSYS_PARSE,
+	RSPAMD_MEMPOOL_SUBSYS_LUA,
+	RSPAMD_MEMPOOL_SUBSYS_HTTP,
+	RSPAMD_MEMPOOL_SUBSYS_STAT,
+	RSPAMD_MEMPOOL_SUBSYS_MAX
+};
+
 enum rspamd_mempool_chain_type {
 	RSPAMD_MEMPOOL_NORMAL = 0,
 	RSPAMD_MEMPOOL_TMP,
@@ -127,10 +141,36 @@ typedef struct memory_pool_s {
 	GPtrArray *trash_stack;
 	GHashTable *variables;                  /**< private memory pool variables			*/
 	gsize elt_len;                            /**< size of an element						*/
+	gsize used_size;                          /**< total bytes requested from this pool	*/
 	struct rspamd_mempool_entry_point *entry;
 	struct rspamd_mempool_tag tag;          /**< memory pool tag						*/
+	gint mx_flags;                          /**< jemalloc arena flags for chunks		*/
+	gboolean protected_ro;                  /**< chunks are frozen read-only			*/
 } rspamd_mempool_t;
 
+/**
+ * Returns the total number of bytes requested from the pool so far; with
+ * task pools this gives per-task memory accounting
+ */
+gsize rspamd_mempool_used_size (rspamd_mempool_t *pool);
+
+struct ucl_object_s;
+/**
+ * Exports per subsystem jemalloc arena statistics as an ucl object, or
+ * NULL if the allocator integration is not compiled in
+ */
+struct ucl_object_s *rspamd_mempool_get_arena_stats (void);
+
+/**
+ * Changes the protection of the interior pages of all normal chunks of
+ * the pool; used by the copy-on-write audit mode to freeze read-only
+ * configuration data after fork, so any write to it faults loudly.
+ * The pool is unfrozen automatically before deletion.
+ * @param pool pool to protect
+ * @param readonly TRUE to freeze, FALSE to thaw
+ */
+void rspamd_mempool_protect (rspamd_mempool_t *pool, gboolean readonly);
+
 /**
  * Statistics structure
  */
@@ -143,6 +183,8 @@ typedef struct memory_pool_stat_s {
 	guint chunks_freed;                 /**< chunks freed										*/
 	guint oversized_chunks;             /**< oversized chunks									*/
 	guint fragmented_size;                /**< fragmentation size								*/
+	guint chunks_cached;                /**< chunks currently in the recycle cache				*/
+	guint chunks_reused;                /**< chunks served from the recycle cache				*/
 } rspamd_mempool_stat_t;
 
 
@@ -500,9 +500,10 @@ rspamd_multipattern_compile (struct rspamd_multipattern *mp, GError **err)
 
 					return FALSE;
 				}
-			}
 
-			rspamd_multipattern_try_save_hs (mp, hash);
+				/* Save only freshly compiled automata */
+				rspamd_multipattern_try_save_hs (mp, hash);
+			}
 
 			for (i = 0; i < MAX_SCRATCH; i ++) {
 				g_assert (hs_alloc_scratch (mp->db, &mp->scratch[i]) == HS_SUCCESS);
@@ -50,6 +50,18 @@ radix_insert_compressed (radix_compressed_t *tree,
  * @param keylen length of a key
  * @return opaque pointer or `RADIX_NO_VALUE` if no value has been found
  */
+/**
+ * Insert new key to the radix trie without looking up the previous value:
+ * this halves tree traversals and is intended for bulk loading of large
+ * lists where the old value is not needed
+ * @return TRUE if a key was inserted, FALSE on duplicate
+ */
+gboolean
+radix_insert_compressed_bulk (radix_compressed_t *tree,
+	guint8 *key, gsize keylen,
+	gsize masklen,
+	uintptr_t value);
+
 uintptr_t radix_find_compressed (radix_compressed_t *tree, const guint8 *key,
 								 gsize keylen);
 
@@ -61,6 +61,9 @@ struct rspamd_regexp_s {
 	pcre2_match_context *raw_mcontext;
 #endif
 	regexp_id_t id;
+	/* Literal fast path: set when the pattern contains no metacharacters */
+	const gchar *literal;
+	gsize literal_len;
 	ref_entry_t ref;
 	gpointer ud;
 	gpointer re_class;
@@ -467,6 +470,27 @@ fin:
 	res->max_hits = 0;
 	res->re = r;
 
+	/*
+	 * Pure literal patterns are matched with a substring search instead
+	 * of pcre: a surprisingly large share of rules are literal
+	 * alternation leftovers reduced to a single literal. Extended mode
+	 * patterns are excluded: /x strips unescaped whitespace and comments,
+	 * so their bytes are not the literal they appear to be
+	 */
+	if (!(rspamd_flags & RSPAMD_REGEXP_FLAG_FULL_MATCH) &&
+		!(regexp_flags & PCRE_FLAG(EXTENDED)) &&
+		real_pattern[0] != '\0' &&
+		strpbrk (real_pattern, "\\^$.[]|()?*+{}") == NULL) {
+		gboolean icase = !!(regexp_flags & PCRE_FLAG(CASELESS));
+
+		if (!icase || !rspamd_str_has_8bit (real_pattern,
+				strlen (real_pattern))) {
+			/* Caseless search is ascii only */
+			res->literal = real_pattern;
+			res->literal_len = strlen (real_pattern);
+		}
+	}
+
 	if (rspamd_flags & RSPAMD_REGEXP_FLAG_RAW) {
 		res->raw_re = r;
 	}
@@ -523,6 +547,58 @@ fin:
 	return res;
 }
 
+static gboolean
+rspamd_regexp_search_literal (rspamd_regexp_t *re, const gchar *text,
+		gsize len, const gchar **start, const gchar **end)
+{
+	const gchar *mt;
+	gsize remain;
+	goffset pos;
+
+	if (end != NULL && *end != NULL) {
+		/* Incremental search */
+		mt = (*end);
+
+		if ((gint)len > (mt - text)) {
+			remain = len - (mt - text);
+		}
+		else {
+			return FALSE;
+		}
+	}
+	else {
+		mt = text;
+		remain = len;
+	}
+
+	if (remain < re->literal_len) {
+		return FALSE;
+	}
+
+	if (re->pcre_flags & PCRE_FLAG(CASELESS)) {
+		pos = rspamd_substring_search_caseless (mt, remain,
+				re->literal, re->literal_len);
+	}
+	else {
+		pos = rspamd_substring_search (mt, remain,
+				re->literal, re->literal_len);
+	}
+
+	if (pos == -1) {
+		return FALSE;
+	}
+
+	if (start) {
+		*start = mt + pos;
+	}
+
+	if (end) {
+		*end = mt + pos + re->literal_len;
+	}
+
+	return TRUE;
+}
+
 #ifndef WITH_PCRE2
 gboolean
 rspamd_regexp_search (rspamd_regexp_t *re, const gchar *text, gsize len,
@@ -545,6 +621,10 @@ rspamd_regexp_search (rspamd_regexp_t *re, const gchar *text, gsize len,
 		len = strlen (text);
 	}
 
+	if (re->literal != NULL && captures == NULL) {
+		return rspamd_regexp_search_literal (re, text, len, start, end);
+	}
+
 	if (end != NULL && *end != NULL) {
 		/* Incremental search */
 		mt = (*end);
@@ -590,6 +670,16 @@ rspamd_regexp_search (rspamd_regexp_t *re, const gchar *text, gsize len,
 		return FALSE;
 	}
 
+	if (ext != NULL) {
+		/*
+		 * Scale the backtracking budget with the input size; workers are
+		 * single threaded, so mutating the shared extra block is safe
+		 */
+		ext->flags |= PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+		ext->match_limit = CLAMP ((guint64)remain * 100, 10000, 1000000);
+		ext->match_limit_recursion = CLAMP ((guint64)remain * 10, 10000, 100000);
+	}
+
 	ncaptures = (re->ncaptures + 1) * 3;
 	ovec = g_alloca (sizeof (gint) * ncaptures);
 
@@ -679,6 +769,10 @@ rspamd_regexp_search (rspamd_regexp_t *re, const gchar *text, gsize len,
 		len = strlen (text);
 	}
 
+	if (re->literal != NULL && captures == NULL) {
+		return rspamd_regexp_search_literal (re, text, len, start, end);
+	}
+
 	if (end != NULL && *end != NULL) {
 		/* Incremental search */
 		mt = (*end);
@@ -707,6 +801,17 @@ rspamd_regexp_search (rspamd_regexp_t *re, const gchar *text, gsize len,
 		mcontext = re->mcontext;
 	}
 
+	/*
+	 * Scale the backtracking budget with the input size: a short header
+	 * never deserves a million steps, while a large body legitimately
+	 * needs more than a tiny floor. The contexts are per regexp and the
+	 * workers are single threaded, so mutating them in place is safe
+	 */
+	if (mcontext != NULL) {
+		pcre2_set_match_limit (mcontext,
+				CLAMP ((guint64)remain * 100, 10000, 1000000));
+	}
+
 	match_data = pcre2_match_data_create (re->ncaptures + 1, NULL);
 
 #ifdef HAVE_PCRE_JIT
@@ -778,6 +883,14 @@ rspamd_regexp_get_pattern (rspamd_regexp_t *re)
 	return re->pattern;
 }
 
+gboolean
+rspamd_regexp_is_literal (rspamd_regexp_t *re)
+{
+	g_assert (re != NULL);
+
+	return re->literal != NULL;
+}
+
 guint
 rspamd_regexp_set_flags (rspamd_regexp_t *re, guint new_flags)
 {
@@ -125,6 +125,13 @@ gpointer rspamd_regexp_get_id (rspamd_regexp_t *re);
  */
 const char *rspamd_regexp_get_pattern (rspamd_regexp_t *re);
 
+/**
+ * Returns TRUE if the regexp is matched via the literal substring fast
+ * path and hence can never backtrack
+ * @param re regexp object
+ */
+gboolean rspamd_regexp_is_literal (rspamd_regexp_t *re);
+
 /**
  * Get PCRE flags for the regexp
  */
@@ -1100,15 +1100,11 @@ rspamd_rrd_write_rra (struct rspamd_rrd_file *file, gulong *rra_steps)
 	}
 }
 
-/**
- * Add record to rrd file
- * @param file rrd file object
- * @param points points (must be row suitable for this RRA, depending on ds count)
- * @param err error pointer
- * @return TRUE if a row has been added
+/*
+ * Update the mmapped file with a single record without syncing the map
  */
-gboolean
-rspamd_rrd_add_record (struct rspamd_rrd_file *file,
+static gboolean
+rspamd_rrd_add_record_nosync (struct rspamd_rrd_file *file,
 		GArray *points,
 		gdouble ticks,
 		GError **err)
@@ -1230,9 +1226,6 @@ rspamd_rrd_add_record (struct rspamd_rrd_file *file,
 	file->live_head->last_up = seconds;
 	file->live_head->last_up_usec = microseconds;
 
-	/* Sync and invalidate */
-	msync (file->map, file->size, MS_ASYNC | MS_INVALIDATE);
-
 	g_free (pdp_new);
 	g_free (pdp_temp);
 	g_free (rra_steps);
@@ -1240,6 +1233,107 @@ rspamd_rrd_add_record (struct rspamd_rrd_file *file,
 	return TRUE;
 }
 
+/**
+ * Add record to rrd file
+ * @param file rrd file object
+ * @param points points (must be row suitable for this RRA, depending on ds count)
+ * @param err error pointer
+ * @return TRUE if a row has been added
+ */
+gboolean
+rspamd_rrd_add_record (struct rspamd_rrd_file *file,
+		GArray *points,
+		gdouble ticks,
+		GError **err)
+{
+	if (!rspamd_rrd_add_record_nosync (file, points, ticks, err)) {
+		return FALSE;
+	}
+
+	/* Sync and invalidate */
+	msync (file->map, file->size, MS_ASYNC | MS_INVALIDATE);
+
+	return TRUE;
+}
+
+gboolean
+rspamd_rrd_add_record_deferred (struct rspamd_rrd_file *file,
+		GArray *points,
+		gdouble ticks,
+		GError **err)
+{
+	guint nelts;
+
+	if (file == NULL || file->stat_head->ds_cnt * sizeof (gdouble) !=
+			points->len) {
+		g_set_error (err,
+				rrd_error_quark (), EINVAL,
+				"rrd defer points failed: wrong arguments");
+		return FALSE;
+	}
+
+	/* Each batched record is the timestamp followed by the row values */
+	nelts = file->stat_head->ds_cnt + 1;
+
+	if (file->deferred == NULL) {
+		file->deferred = g_array_sized_new (FALSE, FALSE, sizeof (gdouble),
+				nelts * 16);
+	}
+
+	g_array_append_val (file->deferred, ticks);
+	g_array_append_vals (file->deferred, points->data,
+			file->stat_head->ds_cnt);
+
+	return TRUE;
+}
+
+gboolean
+rspamd_rrd_flush_deferred (struct rspamd_rrd_file *file,
+		GError **err)
+{
+	GArray cur;
+	gdouble *elts;
+	guint nelts, i;
+	gboolean ret = TRUE;
+
+	if (file == NULL) {
+		g_set_error (err,
+				rrd_error_quark (), EINVAL,
+				"rrd flush failed: wrong arguments");
+		return FALSE;
+	}
+
+	if (file->deferred == NULL || file->deferred->len == 0) {
+		return TRUE;
+	}
+
+	nelts = file->stat_head->ds_cnt + 1;
+	elts = (gdouble *)file->deferred->data;
+
+	/*
+	 * Replay the batch through the ordinary update path: the pdp/cdp
+	 * math is driven by the stored timestamps, so the result is the
+	 * same as if every point had been written at its tick, but the
+	 * file pages are touched and synced once per batch
+	 */
+	for (i = 0; i + nelts <= file->deferred->len; i += nelts) {
+		cur.data = (gchar *)(elts + i + 1);
+		cur.len = file->stat_head->ds_cnt * sizeof (gdouble);
+
+		if (!rspamd_rrd_add_record_nosync (file, &cur, elts[i], err)) {
+			ret = FALSE;
+			err = NULL; /* Report the first error merely */
+		}
+	}
+
+	g_array_set_size (file->deferred, 0);
+
+	/* Sync and invalidate */
+	msync (file->map, file->size, MS_ASYNC | MS_INVALIDATE);
+
+	return ret;
+}
+
 /**
  * Close rrd file
  * @param file
@@ -1253,11 +1347,17 @@ rspamd_rrd_close (struct rspamd_rrd_file * file)
 		return -1;
 	}
 
+	rspamd_rrd_flush_deferred (file, NULL);
+
 	munmap (file->map, file->size);
 	close (file->fd);
 	g_free (file->filename);
 	g_free (file->id);
 
+	if (file->deferred) {
+		g_array_free (file->deferred, TRUE);
+	}
+
 	g_free (file);
 
 	return 0;
@@ -209,6 +209,7 @@ struct rspamd_rrd_file {
 	gboolean finalized;
 	gchar *id;
 	gint fd;
+	GArray *deferred; /* datapoints accumulated for a batched flush */
 };
 
 
@@ -280,6 +281,29 @@ gboolean rspamd_rrd_add_record (struct rspamd_rrd_file *file,
 								gdouble ticks,
 								GError **err);
 
+/**
+ * Append a datapoint to the in memory batch without touching the file;
+ * the batch is applied by rspamd_rrd_flush_deferred
+ * @param file rrd file
+ * @param points vector of points (must be row size)
+ * @param ticks timestamp of the datapoint
+ * @param err error pointer
+ * @return TRUE if a point has been batched
+ */
+gboolean rspamd_rrd_add_record_deferred (struct rspamd_rrd_file *file,
+		GArray *points,
+		gdouble ticks,
+		GError **err);
+
+/**
+ * Apply all batched datapoints to the file and sync it once
+ * @param file rrd file
+ * @param err error pointer
+ * @return TRUE if all points have been written
+ */
+gboolean rspamd_rrd_flush_deferred (struct rspamd_rrd_file *file,
+		GError **err);
+
 /**
  * Close rrd file
  * @param file
@@ -211,7 +211,9 @@ rspamd_shingles_from_text (GArray *input,
 		}
 	}
 	else {
-		guint64 window[SHINGLES_WINDOW * RSPAMD_SHINGLE_SIZE], seed;
+		guint64 seeds[RSPAMD_SHINGLE_SIZE];
+		guint64 *word_hashes;
+		gsize nw = 0;
 
 		switch (alg) {
 		case RSPAMD_SHINGLES_XXHASH:
@@ -225,62 +227,72 @@ rspamd_shingles_from_text (GArray *input,
 			break;
 		}
 
-		memset (window, 0, sizeof (window));
-		for (i = 0; i <= ilen; i ++) {
-			if (i - beg >= SHINGLES_WINDOW || i == ilen) {
-
-				for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
-					/* Shift hashes window to right */
-					for (k = 0; k < SHINGLES_WINDOW - 1; k ++) {
-						window[j * SHINGLES_WINDOW + k] =
-								window[j * SHINGLES_WINDOW + k + 1];
-					}
-
-					word = NULL;
+		for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+			memcpy (&seeds[j], keys[j], sizeof (seeds[j]));
+		}
 
-					while (widx < input->len) {
-						word = &g_array_index (input, rspamd_stat_token_t, widx);
+		/*
+		 * Phase 1: hash every consumed word once per lane into a
+		 * contiguous block; lanes of a single word are adjacent, so the
+		 * inner loop runs over hot words data and a register-cached seed
+		 * array instead of re-reading keys per lane per position
+		 */
+		word_hashes = g_malloc0 (hlen * RSPAMD_SHINGLE_SIZE *
+				sizeof (guint64));
+
+		for (widx = 0; widx < input->len && nw < hlen; widx ++) {
+			word = &g_array_index (input, rspamd_stat_token_t, widx);
+
+			if ((word->flags & RSPAMD_STAT_TOKEN_FLAG_SKIPPED)
+				 || word->stemmed.len == 0) {
+				continue;
+			}
 
-						if ((word->flags & RSPAMD_STAT_TOKEN_FLAG_SKIPPED)
-							 || word->stemmed.len == 0) {
-							widx++;
-						}
-						else {
-							break;
-						}
-					}
+			for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+				word_hashes[nw * RSPAMD_SHINGLE_SIZE + j] =
+						rspamd_cryptobox_fast_hash_specific (ht,
+								word->stemmed.begin, word->stemmed.len,
+								seeds[j]);
+			}
 
-					if (word == NULL) {
-						/* Nothing but exceptions */
-						for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
-							g_free (hashes[i]);
-						}
+			nw ++;
+		}
 
-						g_free (hashes);
+		if (nw == 0) {
+			/* Nothing but exceptions */
+			for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
+				g_free (hashes[i]);
+			}
 
-						return NULL;
-					}
+			g_free (hashes);
+			g_free (word_hashes);
 
-					/* Insert the last element to the pipe */
-					memcpy (&seed, keys[j], sizeof (seed));
-					window[j * SHINGLES_WINDOW + SHINGLES_WINDOW - 1] =
-							rspamd_cryptobox_fast_hash_specific (ht,
-									word->stemmed.begin, word->stemmed.len,
-									seed);
-					val = 0;
-					for (k = 0; k < SHINGLES_WINDOW; k ++) {
-						val ^= window[j * SHINGLES_WINDOW + k] >>
-								(8 * (SHINGLES_WINDOW - k - 1));
-					}
+			return NULL;
+		}
 
-					g_assert (hlen > beg);
-					hashes[j][beg] = val;
+		/*
+		 * Phase 2: rolling combination over the precomputed hashes; the
+		 * positions before the start of the input are zeroes, matching
+		 * the historical window behaviour, so the produced values are
+		 * exactly the same as with the in-place window shifting
+		 */
+		for (beg = 0; beg < hlen; beg ++) {
+			for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+				val = 0;
+
+				for (k = 0; k < SHINGLES_WINDOW; k ++) {
+					gint hidx = (gint)beg + k - (SHINGLES_WINDOW - 1);
+					guint64 h = hidx >= 0 ?
+							word_hashes[hidx * RSPAMD_SHINGLE_SIZE + j] : 0;
+
+					val ^= h >> (8 * (SHINGLES_WINDOW - k - 1));
 				}
 
-				beg ++;
-				widx ++;
+				hashes[j][beg] = val;
 			}
 		}
+
+		g_free (word_hashes);
 	}
 
 	/* Now we need to filter all hashes and make a shingles result */
@@ -287,10 +287,17 @@ rspamd_sqlite3_open_or_create (rspamd_mempool_t *pool, const gchar *path, const
 	sqlite3 *sqlite;
 	gint rc, flags, lock_fd;
 	gchar lock_path[PATH_MAX], dbdir[PATH_MAX], *pdir;
+	/*
+	 * Checkpoints are driven explicitly via rspamd_sqlite3_sync by the
+	 * owners (fuzzy periodic sync, batched learn cache), so the automatic
+	 * checkpoint only acts as a safety net: the previous value of 16
+	 * pages forced a checkpoint with fsync inside nearly every write
+	 * transaction, stalling concurrent readers during learn bursts
+	 */
 	static const char sqlite_wal[] =
 									"PRAGMA journal_mode=\"wal\";"
-									"PRAGMA wal_autocheckpoint = 16;"
-									"PRAGMA journal_size_limit = 1536;",
+									"PRAGMA wal_autocheckpoint = 1024;"
+									"PRAGMA journal_size_limit = 16777216;",
 			exclusive_lock_sql[] =	"PRAGMA locking_mode=\"exclusive\";",
 
 			fsync_sql[] = 			"PRAGMA synchronous=\"NORMAL\";",
@@ -16,6 +16,8 @@
 #include "config.h"
 #include "util.h"
 #include "cryptobox.h"
+#include "libcryptobox/qp/qp.h"
+#include "libcryptobox/base32/base32.h"
 #include "url.h"
 #include "str_util.h"
 #include "logger.h"
@@ -257,7 +259,7 @@ rspamd_str_hash (gconstpointer key)
 
 	len = strlen ((const gchar *)key);
 
-	return (guint)rspamd_cryptobox_fast_hash (key, len, rspamd_hash_seed ());
+	return (guint)rspamd_cryptobox_fast_hash_short (key, len, rspamd_hash_seed ());
 }
 
 gboolean
@@ -306,7 +308,8 @@ rspamd_ftok_hash (gconstpointer key)
 {
 	const rspamd_ftok_t *f = key;
 
-	return (guint)rspamd_cryptobox_fast_hash (f->begin, f->len, rspamd_hash_seed ());
+	return (guint)rspamd_cryptobox_fast_hash_short (f->begin, f->len,
+			rspamd_hash_seed ());
 }
 
 gboolean
@@ -540,64 +543,8 @@ gint
 rspamd_encode_base32_buf (const guchar *in, gsize inlen, gchar *out,
 		gsize outlen)
 {
-	static const char b32[]="ybndrfg8ejkmcpqxot1uwisza345h769";
-	gchar *o, *end;
-	gsize i;
-	gint remain = -1, x;
-
-	end = out + outlen;
-	o = out;
-
-	for (i = 0; i < inlen && o < end - 1; i++) {
-		switch (i % 5) {
-		case 0:
-			/* 8 bits of input and 3 to remain */
-			x = in[i];
-			remain = in[i] >> 5;
-			*o++ = b32[x & 0x1F];
-			break;
-		case 1:
-			/* 11 bits of input, 1 to remain */
-			x = remain | in[i] << 3;
-			*o++ = b32[x & 0x1F];
-			*o++ = b32[x >> 5 & 0x1F];
-			remain = x >> 10;
-			break;
-		case 2:
-			/* 9 bits of input, 4 to remain */
-			x = remain | in[i] << 1;
-			*o++ = b32[x & 0x1F];
-			remain = x >> 5;
-			break;
-		case 3:
-			/* 12 bits of input, 2 to remain */
-			x = remain | in[i] << 4;
-			*o++ = b32[x & 0x1F];
-			*o++ = b32[x >> 5 & 0x1F];
-			remain = x >> 10 & 0x3;
-			break;
-		case 4:
-			/* 10 bits of output, nothing to remain */
-			x = remain | in[i] << 2;
-			*o++ = b32[x & 0x1F];
-			*o++ = b32[x >> 5 & 0x1F];
-			remain = -1;
-			break;
-		default:
-			/* Not to be happen */
-			break;
-		}
-
-	}
-	if (remain >= 0 && o < end) {
-		*o++ = b32[remain];
-	}
-
-	if (o <= end) {
-		return (o - out);
-	}
-
-	return -1;
+	/* The kernels live in libcryptobox to share the cpu dispatch logic */
+	return base32_encode (in, inlen, out, outlen);
 }
 
 gchar *
@@ -1951,25 +1898,7 @@ gint
 rspamd_encode_hex_buf (const guchar *in, gsize inlen, gchar *out,
 		gsize outlen)
 {
-	gchar *o, *end;
-	const guchar *p;
-	static const gchar hexdigests[16] = "0123456789abcdef";
-
-	end = out + outlen;
-	o = out;
-	p = in;
-
-	while (inlen > 0 && o < end - 1) {
-		*o++ = hexdigests[((*p >> 4) & 0xF)];
-		*o++ = hexdigests[((*p++) & 0xF)];
-		inlen --;
-	}
-
-	if (o <= end) {
-		return (o - out);
-	}
-
-	return -1;
+	return hex_encode (in, inlen, out, outlen);
 }
 
 gchar *
@@ -2069,123 +1998,8 @@ gssize
 rspamd_decode_qp_buf (const gchar *in, gsize inlen,
 		gchar *out, gsize outlen)
 {
-	gchar *o, *end, *pos, c;
-	const gchar *p;
-	guchar ret;
-	gssize remain, processed;
-
-	p = in;
-	o = out;
-	end = out + outlen;
-	remain = inlen;
-
-	while (remain > 0 && o < end) {
-		if (*p == '=') {
-			remain --;
-
-			if (remain == 0) {
-				/* Last '=' character, bugon */
-				if (end - o > 0) {
-					*o++ = *p;
-				}
-				else {
-					/* Buffer overflow */
-					return (-1);
-				}
-
-				break;
-			}
-
-			p ++;
-decode:
-			/* Decode character after '=' */
-			c = *p++;
-			remain --;
-			ret = 0;
-
-			if      (c >= '0' && c <= '9') { ret = c - '0'; }
-			else if (c >= 'A' && c <= 'F') { ret = c - 'A' + 10; }
-			else if (c >= 'a' && c <= 'f') { ret = c - 'a' + 10; }
-			else if (c == '\r' || c == '\n') {
-				/* Soft line break */
-				while (remain > 0 && (*p == '\r' || *p == '\n')) {
-					remain --;
-					p ++;
-				}
-
-				continue;
-			}
-			else {
-				/* Hack, hack, hack, treat =<garbadge> as =<garbadge> */
-				if (remain > 0) {
-					*o++ = *(p - 1);
-				}
-
-				continue;
-			}
-
-			if (remain > 0) {
-				c = *p++;
-				ret *= 16;
-
-				if      (c >= '0' && c <= '9') { ret += c - '0'; }
-				else if (c >= 'A' && c <= 'F') { ret += c - 'A' + 10; }
-				else if (c >= 'a' && c <= 'f') { ret += c - 'a' + 10; }
-
-				if (end - o > 0) {
-					*o++ = (gchar)ret;
-				}
-				else {
-					return (-1);
-				}
-
-				remain --;
-			}
-		}
-		else {
-			if (end - o >= remain) {
-				if ((pos = memccpy (o, p, '=', remain)) == NULL) {
-					/* All copied */
-					o += remain;
-					break;
-				}
-				else {
-					processed = pos - o;
-					remain -= processed;
-					p += processed;
-
-					if (remain > 0) {
-						o = pos - 1;
-						/*
-						 * Skip comparison and jump inside decode branch,
-						 * as we know that we have found match
-						 */
-						goto decode;
-					}
-					else {
-						/* Last '=' character, bugon */
-						o = pos;
-
-						if (end - o > 0) {
-							*o = '=';
-						}
-						else {
-							/* Buffer overflow */
-							return (-1);
-						}
-
-						break;
-					}
-				}
-			}
-			else {
-				/* Buffer overflow */
-				return (-1);
-			}
-		}
-	}
-
-	return (o - out);
+	/* Vectorized when the CPU supports it, see libcryptobox/qp */
+	return qp_decode (in, inlen, out, outlen);
 }
 
 #define BITOP(a,b,op) \
@@ -0,0 +1,119 @@
+/*-
+ * Copyright 2019 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RSPAMD_STRIPED_COUNTER_H
+#define RSPAMD_STRIPED_COUNTER_H
+
+#include "config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Striped counters for shared memory statistics: every worker updates its
+ * own cacheline padded slot, so hot increments never bounce a line between
+ * cores, and readers aggregate all slots on demand. Slots are picked by
+ * the worker's load slot; with more workers than slots some of them share
+ * a line, which merely degrades towards the old behaviour.
+ */
+
+#define RSPAMD_STRIPED_COUNTER_SLOTS 64
+#define RSPAMD_STRIPED_COUNTER_CACHELINE 64
+
+struct rspamd_striped_counter_slot {
+	guint64 value;
+	guchar pad[RSPAMD_STRIPED_COUNTER_CACHELINE - sizeof (guint64)];
+};
+
+struct rspamd_striped_counter {
+	struct rspamd_striped_counter_slot slots[RSPAMD_STRIPED_COUNTER_SLOTS];
+};
+
+/**
+ * Adds a value to the slot owned by the specified worker (negative slots
+ * fall back to slot 0)
+ */
+static inline void
+rspamd_striped_counter_add (struct rspamd_striped_counter *cnt,
+		gint slot, guint64 val)
+{
+	guint idx = (slot > 0 ? (guint)slot : 0) % RSPAMD_STRIPED_COUNTER_SLOTS;
+
+#ifndef HAVE_ATOMIC_BUILTINS
+	cnt->slots[idx].value += val;
+#else
+	__atomic_add_fetch (&cnt->slots[idx].value, val, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * Aggregates all slots; the result is a consistent snapshot in the same
+ * weak sense the old shared counters provided
+ */
+static inline guint64
+rspamd_striped_counter_read (const struct rspamd_striped_counter *cnt)
+{
+	guint64 sum = 0;
+	guint i;
+
+	for (i = 0; i < RSPAMD_STRIPED_COUNTER_SLOTS; i ++) {
+#ifndef HAVE_ATOMIC_BUILTINS
+		sum += cnt->slots[i].value;
+#else
+		sum += __atomic_load_n (&cnt->slots[i].value, __ATOMIC_RELAXED);
+#endif
+	}
+
+	return sum;
+}
+
+/**
+ * Resets the counter to zero (all slots)
+ */
+static inline void
+rspamd_striped_counter_reset (struct rspamd_striped_counter *cnt)
+{
+	guint i;
+
+	for (i = 0; i < RSPAMD_STRIPED_COUNTER_SLOTS; i ++) {
+#ifndef HAVE_ATOMIC_BUILTINS
+		cnt->slots[i].value = 0;
+#else
+		__atomic_store_n (&cnt->slots[i].value, 0, __ATOMIC_RELAXED);
+#endif
+	}
+}
+
+/**
+ * Sets the aggregate value: slot 0 receives it, the others are zeroed
+ * (used when restoring persisted statistics)
+ */
+static inline void
+rspamd_striped_counter_set (struct rspamd_striped_counter *cnt, guint64 val)
+{
+	rspamd_striped_counter_reset (cnt);
+#ifndef HAVE_ATOMIC_BUILTINS
+	cnt->slots[0].value = val;
+#else
+	__atomic_store_n (&cnt->slots[0].value, val, __ATOMIC_RELAXED);
+#endif
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* RSPAMD_STRIPED_COUNTER_H */
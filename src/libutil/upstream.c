@@ -69,6 +69,7 @@ struct upstream {
 	} addrs;
 
 	struct upstream_inet_addr_entry *new_addrs;
+	struct rspamd_counter_data lat_counter; /* response times EWMA */
 	rspamd_mutex_t *lock;
 	gpointer data;
 	gchar uid[8];
@@ -132,6 +133,8 @@ static gdouble default_dns_timeout = 1.0;
 static guint default_dns_retransmits = 2;
 /* TODO: make it configurable */
 static gdouble default_lazy_resolve_time = 3600.0;
+/* Floor for DNS TTL driven re-resolution to avoid hammering resolvers */
+static guint min_resolve_ttl = 60;
 
 static void rspamd_upstream_lazy_resolve_cb (struct ev_loop *, ev_timer *, int );
 
@@ -151,7 +154,7 @@ rspamd_upstreams_library_config (struct rspamd_config *cfg,
 		ctx->limits.max_errors = cfg->upstream_max_errors;
 	}
 	if (cfg->upstream_revive_time) {
-		ctx->limits.revive_time = cfg->upstream_max_errors;
+		ctx->limits.revive_time = cfg->upstream_revive_time;
 	}
 	if (cfg->upstream_lazy_resolve_time) {
 		ctx->limits.lazy_resolve_time = cfg->upstream_lazy_resolve_time;
@@ -432,6 +435,8 @@ rspamd_upstream_dns_cb (struct rdns_reply *reply, void *arg)
 	struct upstream_inet_addr_entry *up_ent;
 
 	if (reply->code == RDNS_RC_NOERROR) {
+		guint min_ttl = 0;
+
 		entry = reply->entries;
 
 		RSPAMD_UPSTREAM_LOCK (up->lock);
@@ -449,9 +454,26 @@ rspamd_upstream_dns_cb (struct rdns_reply *reply, void *arg)
 						&entry->content.aaa.addr);
 				LL_PREPEND (up->new_addrs, up_ent);
 			}
+
+			if (entry->type == RDNS_REQUEST_A ||
+				entry->type == RDNS_REQUEST_AAAA) {
+				if (min_ttl == 0 || entry->ttl < min_ttl) {
+					min_ttl = entry->ttl;
+				}
+			}
+
 			entry = entry->next;
 		}
 
+		if (min_ttl > 0) {
+			/*
+			 * Let the background lazy resolve timer follow the record TTL
+			 * (with a floor), so address changes propagate without ever
+			 * resolving on the scan path
+			 */
+			up->ttl = MAX (min_ttl, min_resolve_ttl);
+		}
+
 		RSPAMD_UPSTREAM_UNLOCK (up->lock);
 	}
 
@@ -1145,6 +1167,10 @@ rspamd_upstreams_parse_line_len (struct upstream_list *ups,
 		ups->rot_alg = RSPAMD_UPSTREAM_SEQUENTIAL;
 		p += sizeof ("sequential:") - 1;
 	}
+	else if (RSPAMD_LEN_CHECK_STARTS_WITH(p, len, "least-loaded:")) {
+		ups->rot_alg = RSPAMD_UPSTREAM_LEAST_LOADED;
+		p += sizeof ("least-loaded:") - 1;
+	}
 
 	while (p < end) {
 		span_len = rspamd_memcspn (p, separators, end - p);
@@ -1261,6 +1287,25 @@ rspamd_upstream_restore_cb (gpointer elt, gpointer ls)
 	REF_RELEASE (up);
 }
 
+void
+rspamd_upstream_update_latency (struct upstream *up, gdouble lat)
+{
+	/* Decay rather fast: slow replicas should be retried eventually */
+	static const gdouble decay_rate = 0.1;
+
+	if (up && lat >= 0) {
+		RSPAMD_UPSTREAM_LOCK (up->lock);
+		rspamd_set_counter_ema (&up->lat_counter, lat, decay_rate);
+		RSPAMD_UPSTREAM_UNLOCK (up->lock);
+	}
+}
+
+gdouble
+rspamd_upstream_get_latency (struct upstream *up)
+{
+	return up ? up->lat_counter.mean : 0.0;
+}
+
 static struct upstream*
 rspamd_upstream_get_random (struct upstream_list *ups)
 {
@@ -1347,6 +1392,34 @@ rspamd_consistent_hash (guint64 key, guint32 nbuckets)
 	return b;
 }
 
+/*
+ * Power of two choices: pick two distinct random candidates and select
+ * the one with the lower response time EWMA. Upstreams with no samples
+ * yet have a zero average and hence are probed first.
+ */
+static struct upstream*
+rspamd_upstream_get_least_loaded (struct upstream_list *ups)
+{
+	struct upstream *u1, *u2;
+	guint i1, i2;
+
+	if (ups->alive->len == 1) {
+		return g_ptr_array_index (ups->alive, 0);
+	}
+
+	i1 = ottery_rand_range (ups->alive->len - 1);
+	i2 = ottery_rand_range (ups->alive->len - 2);
+
+	if (i2 >= i1) {
+		i2 ++;
+	}
+
+	u1 = g_ptr_array_index (ups->alive, i1);
+	u2 = g_ptr_array_index (ups->alive, i2);
+
+	return u1->lat_counter.mean <= u2->lat_counter.mean ? u1 : u2;
+}
+
 static struct upstream*
 rspamd_upstream_get_hashed (struct upstream_list *ups, const guint8 *key, guint keylen)
 {
@@ -1413,6 +1486,9 @@ rspamd_upstream_get_common (struct upstream_list *ups,
 
 		up = g_ptr_array_index (ups->alive, ups->cur_elt ++);
 		break;
+	case RSPAMD_UPSTREAM_LEAST_LOADED:
+		up = rspamd_upstream_get_least_loaded (ups);
+		break;
 	}
 
 	if (up) {
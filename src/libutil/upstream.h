@@ -16,6 +16,7 @@ enum rspamd_upstream_rotation {
 	RSPAMD_UPSTREAM_ROUND_ROBIN,
 	RSPAMD_UPSTREAM_MASTER_SLAVE,
 	RSPAMD_UPSTREAM_SEQUENTIAL,
+	RSPAMD_UPSTREAM_LEAST_LOADED,
 	RSPAMD_UPSTREAM_UNDEF
 };
 
@@ -67,6 +68,17 @@ void rspamd_upstream_fail (struct upstream *up, gboolean addr_failure);
  */
 void rspamd_upstream_ok (struct upstream *up);
 
+/**
+ * Feeds a response time sample (in seconds) to the latency EWMA of the
+ * upstream; used by the least-loaded rotation
+ */
+void rspamd_upstream_update_latency (struct upstream *up, gdouble lat);
+
+/**
+ * Returns the current latency EWMA of the upstream (in seconds)
+ */
+gdouble rspamd_upstream_get_latency (struct upstream *up);
+
 /**
  * Set weight for an upstream
  * @param up
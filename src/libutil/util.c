@@ -2051,6 +2051,63 @@ rspamd_get_ticks (gboolean rdtsc_ok)
 	return res;
 }
 
+static inline gdouble
+rspamd_get_monotonic_seconds (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (gdouble)ts.tv_sec + ts.tv_nsec / 1000000000.;
+#else
+	return rspamd_get_ticks (FALSE);
+#endif
+}
+
+gdouble
+rspamd_get_ticks_fast (void)
+{
+#if defined(HAVE_RDTSC) && defined(__x86_64__)
+	static guint64 base_tsc = 0;
+	static gdouble base_time = 0.0, tsc_freq = 0.0;
+	guint64 tsc;
+
+	__builtin_ia32_lfence ();
+	tsc = __rdtsc ();
+
+	if (G_UNLIKELY (base_tsc == 0)) {
+		base_tsc = tsc;
+		base_time = rspamd_get_monotonic_seconds ();
+
+		return base_time;
+	}
+
+	if (G_UNLIKELY (tsc_freq == 0.0)) {
+		/*
+		 * Calibrate lazily once enough cycles have passed (roughly ten
+		 * milliseconds on modern CPUs); until then fall back to the
+		 * monotonic clock
+		 */
+		if (tsc - base_tsc > (1ULL << 24)) {
+			gdouble now = rspamd_get_monotonic_seconds ();
+
+			if (now > base_time) {
+				tsc_freq = (gdouble)(tsc - base_tsc) / (now - base_time);
+			}
+
+			return now;
+		}
+
+		return rspamd_get_monotonic_seconds ();
+	}
+
+	return base_time + (gdouble)(tsc - base_tsc) / tsc_freq;
+#else
+	return rspamd_get_monotonic_seconds ();
+#endif
+}
+
 gdouble
 rspamd_get_virtual_ticks (void)
 {
@@ -3266,3 +3323,125 @@ rspamd_set_counter_ema (struct rspamd_counter_data *cd,
 
 	return cd->mean;
 }
+
+/*
+ * Sliding window counters shared between all workers: a fixed table of
+ * cache line sized buckets, each tracking the current and the previous
+ * window counts of one key. All updates are plain atomics, so checks
+ * cost memory speed; collisions simply merge keys into one bucket which
+ * is acceptable for ratelimiting purposes.
+ */
+struct rspamd_shm_rl_bucket {
+	guint64 key;
+	guint32 ts;
+	guint32 cur;
+	guint32 prev;
+	guchar pad[44];
+};
+
+#define RSPAMD_SHM_RL_BUCKETS 16384
+
+static struct rspamd_shm_rl_bucket *shm_rl_buckets = NULL;
+
+void
+rspamd_shm_ratelimit_init (gpointer tbl)
+{
+	shm_rl_buckets = tbl;
+}
+
+gsize
+rspamd_shm_ratelimit_size (void)
+{
+	return sizeof (struct rspamd_shm_rl_bucket) * RSPAMD_SHM_RL_BUCKETS;
+}
+
+gdouble
+rspamd_shm_ratelimit_add (const guchar *key, gsize keylen,
+		guint window, time_t now)
+{
+	struct rspamd_shm_rl_bucket *b;
+	guint64 h;
+	guint32 ts, cur, prev, nprev;
+	gdouble elapsed;
+
+	if (shm_rl_buckets == NULL || window == 0) {
+		return -1;
+	}
+
+	h = rspamd_cryptobox_fast_hash (key, keylen, rspamd_hash_seed ());
+	b = &shm_rl_buckets[h % RSPAMD_SHM_RL_BUCKETS];
+
+	if (__atomic_load_n (&b->key, __ATOMIC_RELAXED) != h) {
+		/* Take over the bucket */
+		__atomic_store_n (&b->cur, 0, __ATOMIC_RELAXED);
+		__atomic_store_n (&b->prev, 0, __ATOMIC_RELAXED);
+		__atomic_store_n (&b->ts, (guint32)now, __ATOMIC_RELAXED);
+		__atomic_store_n (&b->key, h, __ATOMIC_RELEASE);
+	}
+
+	ts = __atomic_load_n (&b->ts, __ATOMIC_ACQUIRE);
+
+	if ((guint32)now - ts >= window) {
+		/* Rotate the window; a single process wins the race */
+		nprev = ((guint32)now - ts >= 2 * window) ? 0 :
+				__atomic_load_n (&b->cur, __ATOMIC_RELAXED);
+
+		if (__atomic_compare_exchange_n (&b->ts, &ts, (guint32)now, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			__atomic_store_n (&b->prev, nprev, __ATOMIC_RELAXED);
+			__atomic_store_n (&b->cur, 0, __ATOMIC_RELAXED);
+			ts = (guint32)now;
+		}
+	}
+
+	cur = __atomic_add_fetch (&b->cur, 1, __ATOMIC_RELAXED);
+	prev = __atomic_load_n (&b->prev, __ATOMIC_RELAXED);
+	elapsed = (gdouble)((guint32)now - ts) / (gdouble)window;
+
+	if (elapsed > 1.0) {
+		elapsed = 1.0;
+	}
+	else if (elapsed < 0) {
+		elapsed = 0;
+	}
+
+	return (gdouble)cur + (gdouble)prev * (1.0 - elapsed);
+}
+
+double
+rspamd_set_counter_ema_shared (struct rspamd_counter_data *cd,
+		gdouble value,
+		gdouble alpha)
+{
+	union {
+		gdouble d;
+		guint64 i;
+	} old_mean, new_mean, old_std, new_std;
+	gdouble diff, incr;
+
+	/*
+	 * Shared memory variant: `cd` is updated concurrently by multiple
+	 * worker processes, so each field is set with a CAS loop over its
+	 * bit pattern. Fields are not updated transactionally, but a transient
+	 * skew between mean and stddev is tolerable for statistics.
+	 */
+	do {
+		old_mean.i = __atomic_load_n ((guint64 *)&cd->mean, __ATOMIC_ACQUIRE);
+		diff = value - old_mean.d;
+		incr = diff * alpha;
+		new_mean.d = old_mean.d + incr;
+	} while (!__atomic_compare_exchange_n ((guint64 *)&cd->mean,
+			&old_mean.i, new_mean.i, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	do {
+		old_std.i = __atomic_load_n ((guint64 *)&cd->stddev, __ATOMIC_ACQUIRE);
+		new_std.d = (1 - alpha) * (old_std.d + diff * incr);
+	} while (!__atomic_compare_exchange_n ((guint64 *)&cd->stddev,
+			&old_std.i, new_std.i, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	__atomic_add_fetch (&cd->number, 1, __ATOMIC_RELAXED);
+
+	return new_mean.d;
+}
@@ -312,6 +312,14 @@ gint rspamd_read_passphrase (gchar *buf, gint size, gint rwflag, gpointer key);
  */
 gdouble rspamd_get_ticks (gboolean rdtsc_ok);
 
+/**
+ * Return monotonic seconds with high resolution but minimal cost: rdtsc
+ * lazily calibrated against the monotonic clock where available, a plain
+ * monotonic clock read elsewhere; intended for hot profiling paths
+ * @return
+ */
+gdouble rspamd_get_ticks_fast (void);
+
 /**
  * Portably return the current virtual clock ticks as seconds
  * @return
@@ -536,6 +544,40 @@ double rspamd_set_counter_ema (struct rspamd_counter_data *cd,
 							   gdouble value,
 							   gdouble alpha);
 
+/**
+ * Sets counter's data using exponential moving average; safe to use when
+ * `cd` lives in shared memory and is updated by several processes at once.
+ * Each field is updated with a lock-free CAS loop; fields might be
+ * transiently skewed relative to each other which is fine for statistics.
+ * @param cd counter (normally allocated via rspamd_mempool_alloc_shared)
+ * @param value new counter value
+ * @param alpha decay coefficient (0..1)
+ * @return new counter value
+ */
+double rspamd_set_counter_ema_shared (struct rspamd_counter_data *cd,
+									  gdouble value,
+									  gdouble alpha);
+
+/**
+ * Attaches the shared memory region used by the sliding window ratelimit
+ * counters; the region must be of rspamd_shm_ratelimit_size () bytes and
+ * allocated from a shared pool before forking
+ */
+void rspamd_shm_ratelimit_init (gpointer tbl);
+
+/**
+ * Size of the shared ratelimit counters region
+ */
+gsize rspamd_shm_ratelimit_size (void);
+
+/**
+ * Accounts a hit for `key` and returns the estimated number of hits within
+ * the sliding window of `window` seconds (including this one), shared
+ * between all workers; returns -1 when the shared region is not attached
+ */
+gdouble rspamd_shm_ratelimit_add (const guchar *key, gsize keylen,
+								  guint window, time_t now);
+
 /**
  * Sets counter's data using flat moving average
  * @param cd counter
@@ -1083,6 +1083,14 @@ rspamd_plugins_table_push_elt (lua_State *L, const gchar *field_name,
 	lua_pop (L, 2); /* Global + element */
 }
 
+static int
+rspamd_lua_bytecode_writer (lua_State *L, const void *p, size_t sz, void *ud)
+{
+	FILE *f = (FILE *)ud;
+
+	return fwrite (p, 1, sz, f) == sz ? 0 : -1;
+}
+
 gboolean
 rspamd_init_lua_filters (struct rspamd_config *cfg, gboolean force_load)
 {
@@ -1137,18 +1145,69 @@ rspamd_init_lua_filters (struct rspamd_config *cfg, gboolean force_load)
 			rspamd_snprintf (lua_fname, strlen (module->path) + 2, "@%s",
 				module->path);
 
-			if (luaL_loadbuffer (L, data, fsize, lua_fname) != 0) {
-				msg_err_config ("load of %s failed: %s", module->path,
-					lua_tostring (L, -1));
-				lua_settop (L, err_idx - 1); /*  Error function */
+			/*
+			 * Try the precompiled bytecode snapshot first: reloads then
+			 * skip parsing the sources entirely. Snapshots are keyed by
+			 * the source digest, so a changed file or an incompatible
+			 * lua VM simply falls back to the source below.
+			 */
+			gboolean bc_loaded = FALSE;
+			gchar bc_path[PATH_MAX];
+
+			if (cfg->hs_cache_dir) {
+				gsize bc_len;
+				guint8 *bc_data;
+
+				rspamd_snprintf (bc_path, sizeof (bc_path), "%s%c%s.luac",
+						cfg->hs_cache_dir, G_DIR_SEPARATOR, module->digest);
+				bc_data = rspamd_file_xmap (bc_path, PROT_READ, &bc_len, TRUE);
+
+				if (bc_data) {
+					if (luaL_loadbuffer (L, bc_data, bc_len, lua_fname) == 0) {
+						bc_loaded = TRUE;
+					}
+					else {
+						lua_pop (L, 1);
+						(void)unlink (bc_path);
+					}
 
-				rspamd_plugins_table_push_elt (L, "disabled_failed",
-						module->name);
-				munmap (data, fsize);
-				g_free (lua_fname);
+					munmap (bc_data, bc_len);
+				}
+			}
 
-				cur = g_list_next (cur);
-				continue;
+			if (!bc_loaded) {
+				if (luaL_loadbuffer (L, data, fsize, lua_fname) != 0) {
+					msg_err_config ("load of %s failed: %s", module->path,
+						lua_tostring (L, -1));
+					lua_settop (L, err_idx - 1); /*  Error function */
+
+					rspamd_plugins_table_push_elt (L, "disabled_failed",
+							module->name);
+					munmap (data, fsize);
+					g_free (lua_fname);
+
+					cur = g_list_next (cur);
+					continue;
+				}
+
+				if (cfg->hs_cache_dir) {
+					/* Save the bytecode snapshot for the next load */
+					gchar bc_tmp[PATH_MAX];
+					FILE *f;
+
+					rspamd_snprintf (bc_tmp, sizeof (bc_tmp), "%s.new",
+							bc_path);
+					f = fopen (bc_tmp, "wx");
+
+					if (f != NULL) {
+						gint rc = lua_dump (L, rspamd_lua_bytecode_writer, f);
+
+						if (fclose (f) != 0 || rc != 0 ||
+							rename (bc_tmp, bc_path) == -1) {
+							(void)unlink (bc_tmp);
+						}
+					}
+				}
 			}
 
 			munmap (data, fsize);
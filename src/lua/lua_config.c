@@ -59,6 +59,21 @@ LUA_FUNCTION_DEF (config, get_module_opt);
  */
 LUA_FUNCTION_DEF (config, get_all_opt);
 
+/***
+ * @method rspamd_config:compile_opts(mname, schema)
+ * Compiles the options of a module against a declared schema once at
+ * configuration time. `schema` maps option names to type names
+ * ('string', 'number' or 'boolean'); the options are read, validated
+ * and coerced a single time and the result is a read only userdata
+ * whose field reads are plain typed loads - no table traversal and no
+ * per call type checks in hot task callbacks. Mistyped options are
+ * reported here and read back as nil.
+ * @param {string} mname name of module
+ * @param {table} schema option name -> type name
+ * @return {compiled_opts} userdata with field access via indexing
+ */
+LUA_FUNCTION_DEF (config, compile_opts);
+
 /***
  * @method rspamd_config:get_ucl()
  * Returns full configuration as a native Lua object (ucl to lua conversion).
@@ -815,6 +830,7 @@ static const struct luaL_reg configlib_m[] = {
 	LUA_INTERFACE_DEF (config, get_mempool),
 	LUA_INTERFACE_DEF (config, get_resolver),
 	LUA_INTERFACE_DEF (config, get_all_opt),
+	LUA_INTERFACE_DEF (config, compile_opts),
 	LUA_INTERFACE_DEF (config, get_ucl),
 	LUA_INTERFACE_DEF (config, add_radix_map),
 	LUA_INTERFACE_DEF (config, radix_from_config),
@@ -1044,6 +1060,197 @@ lua_config_get_all_opt (lua_State * L)
 	return 1;
 }
 
+
+/* Typed compiled options: schema validated once, fields are plain loads */
+#define COMPILED_OPTS_CLASS "rspamd{compiled_opts}"
+
+enum rspamd_compiled_opt_type {
+	RSPAMD_COMPILED_OPT_STRING = 0,
+	RSPAMD_COMPILED_OPT_NUMBER,
+	RSPAMD_COMPILED_OPT_BOOLEAN,
+};
+
+struct rspamd_compiled_opt {
+	gchar *name;
+	guint64 name_hash;
+	enum rspamd_compiled_opt_type type;
+	union {
+		gchar *s;
+		gdouble d;
+		gboolean b;
+	} v;
+	gboolean has_value;
+};
+
+struct rspamd_compiled_opts {
+	guint nopts;
+	struct rspamd_compiled_opt opts[];
+};
+
+static gint
+lua_compiled_opts_index (lua_State *L)
+{
+	struct rspamd_compiled_opts *co = luaL_checkudata (L, 1,
+			COMPILED_OPTS_CLASS);
+	gsize keylen;
+	const gchar *key = luaL_checklstring (L, 2, &keylen);
+	guint64 h = rspamd_cryptobox_fast_hash (key, keylen, rspamd_hash_seed ());
+	struct rspamd_compiled_opt *opt;
+	guint i;
+
+	for (i = 0; i < co->nopts; i ++) {
+		opt = &co->opts[i];
+
+		if (opt->name_hash == h && strcmp (opt->name, key) == 0) {
+			if (!opt->has_value) {
+				lua_pushnil (L);
+			}
+			else {
+				switch (opt->type) {
+				case RSPAMD_COMPILED_OPT_STRING:
+					lua_pushstring (L, opt->v.s);
+					break;
+				case RSPAMD_COMPILED_OPT_NUMBER:
+					lua_pushnumber (L, opt->v.d);
+					break;
+				case RSPAMD_COMPILED_OPT_BOOLEAN:
+					lua_pushboolean (L, opt->v.b);
+					break;
+				}
+			}
+
+			return 1;
+		}
+	}
+
+	lua_pushnil (L);
+
+	return 1;
+}
+
+static gint
+lua_compiled_opts_gc (lua_State *L)
+{
+	struct rspamd_compiled_opts *co = luaL_checkudata (L, 1,
+			COMPILED_OPTS_CLASS);
+	guint i;
+
+	for (i = 0; i < co->nopts; i ++) {
+		g_free (co->opts[i].name);
+
+		if (co->opts[i].type == RSPAMD_COMPILED_OPT_STRING &&
+				co->opts[i].has_value) {
+			g_free (co->opts[i].v.s);
+		}
+	}
+
+	return 0;
+}
+
+static gint
+lua_config_compile_opts (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct rspamd_config *cfg = lua_check_config (L, 1);
+	const gchar *mname = luaL_checkstring (L, 2);
+	const ucl_object_t *mobj, *elt;
+	struct rspamd_compiled_opts *co;
+	struct rspamd_compiled_opt *opt;
+	guint nopts = 0;
+
+	if (cfg == NULL || mname == NULL) {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	luaL_checktype (L, 3, LUA_TTABLE);
+
+	/* Count schema entries */
+	lua_pushnil (L);
+	while (lua_next (L, 3)) {
+		nopts ++;
+		lua_pop (L, 1);
+	}
+
+	mobj = ucl_obj_get_key (cfg->rcl_obj, mname);
+
+	co = lua_newuserdata (L, sizeof (*co) +
+			nopts * sizeof (struct rspamd_compiled_opt));
+	memset (co, 0, sizeof (*co) + nopts * sizeof (struct rspamd_compiled_opt));
+	luaL_getmetatable (L, COMPILED_OPTS_CLASS);
+	lua_setmetatable (L, -2);
+
+	lua_pushnil (L);
+	while (lua_next (L, 3)) {
+		const gchar *name, *type;
+
+		/* Converting a non string key in place would break lua_next */
+		if (lua_type (L, -2) != LUA_TSTRING ||
+				lua_type (L, -1) != LUA_TSTRING) {
+			lua_pop (L, 1);
+			continue;
+		}
+
+		name = lua_tostring (L, -2);
+		type = lua_tostring (L, -1);
+
+		opt = &co->opts[co->nopts];
+		opt->name = g_strdup (name);
+		opt->name_hash = rspamd_cryptobox_fast_hash (name, strlen (name),
+				rspamd_hash_seed ());
+		opt->has_value = FALSE;
+
+		if (strcmp (type, "number") == 0) {
+			opt->type = RSPAMD_COMPILED_OPT_NUMBER;
+		}
+		else if (strcmp (type, "boolean") == 0) {
+			opt->type = RSPAMD_COMPILED_OPT_BOOLEAN;
+		}
+		else {
+			opt->type = RSPAMD_COMPILED_OPT_STRING;
+		}
+
+		elt = mobj ? ucl_obj_get_key (mobj, name) : NULL;
+
+		if (elt != NULL) {
+			switch (opt->type) {
+			case RSPAMD_COMPILED_OPT_STRING:
+				if (ucl_object_type (elt) == UCL_STRING) {
+					opt->v.s = g_strdup (ucl_object_tostring (elt));
+					opt->has_value = TRUE;
+				}
+				break;
+			case RSPAMD_COMPILED_OPT_NUMBER:
+				if (ucl_object_type (elt) == UCL_INT ||
+						ucl_object_type (elt) == UCL_FLOAT ||
+						ucl_object_type (elt) == UCL_TIME) {
+					opt->v.d = ucl_object_todouble (elt);
+					opt->has_value = TRUE;
+				}
+				break;
+			case RSPAMD_COMPILED_OPT_BOOLEAN:
+				if (ucl_object_type (elt) == UCL_BOOLEAN) {
+					opt->v.b = ucl_object_toboolean (elt);
+					opt->has_value = TRUE;
+				}
+				break;
+			}
+
+			if (!opt->has_value) {
+				msg_warn_config ("option %s.%s has invalid type %s, "
+						"expected %s; it will read as nil",
+						mname, name,
+						ucl_object_type_to_string (ucl_object_type (elt)),
+						type);
+			}
+		}
+
+		co->nopts ++;
+		lua_pop (L, 1);
+	}
+
+	return 1;
+}
+
 struct rspamd_lua_cached_config {
 	lua_State *L;
 	gint ref;
@@ -1175,7 +1382,6 @@ lua_metric_symbol_callback (struct rspamd_task *task,
 							gpointer ud)
 {
 	struct lua_callback_data *cd = ud;
-	struct rspamd_task **ptask;
 	gint level = lua_gettop (cd->L), nresults, err_idx, ret;
 	lua_State *L = cd->L;
 	struct rspamd_symbol_result *s;
@@ -1194,9 +1400,7 @@ lua_metric_symbol_callback (struct rspamd_task *task,
 		lua_getglobal (L, cd->callback.name);
 	}
 
-	ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
-	*ptask = task;
+	rspamd_lua_task_push (L, task);
 
 	if ((ret = lua_pcall (L, 1, LUA_MULTRET, err_idx)) != 0) {
 		msg_err_task ("call to (%s) failed (%d): %s", cd->symbol, ret,
@@ -1290,7 +1494,6 @@ lua_metric_symbol_callback_coro (struct rspamd_task *task,
 							gpointer ud)
 {
 	struct lua_callback_data *cd = ud;
-	struct rspamd_task **ptask;
 	struct thread_entry *thread_entry;
 
 	rspamd_symcache_item_async_inc (task, item, "lua coro symbol");
@@ -1310,9 +1513,7 @@ lua_metric_symbol_callback_coro (struct rspamd_task *task,
 		lua_getglobal (thread, cd->callback.name);
 	}
 
-	ptask = lua_newuserdata (thread, sizeof (struct rspamd_task *));
-	rspamd_lua_setclass (thread, "rspamd{task}", -1);
-	*ptask = task;
+	rspamd_lua_task_push (thread, task);
 
 	thread_entry->finish_callback = lua_metric_symbol_callback_return;
 	thread_entry->error_callback = lua_metric_symbol_callback_error;
@@ -4375,6 +4576,13 @@ luaopen_config (lua_State * L)
 	rspamd_lua_new_class (L, "rspamd{monitored}", monitoredlib_m);
 
 	lua_pop (L, 1);
+
+	luaL_newmetatable (L, COMPILED_OPTS_CLASS);
+	lua_pushcfunction (L, lua_compiled_opts_index);
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, lua_compiled_opts_gc);
+	lua_setfield (L, -2, "__gc");
+	lua_pop (L, 1);
 }
 
 void
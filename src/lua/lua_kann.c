@@ -145,11 +145,13 @@ LUA_FUNCTION_DEF (kann, destroy);
 LUA_FUNCTION_DEF (kann, save);
 LUA_FUNCTION_DEF (kann, train1);
 LUA_FUNCTION_DEF (kann, apply1);
+LUA_FUNCTION_DEF (kann, apply_batch);
 
 static luaL_reg rspamd_kann_m[] = {
 		LUA_INTERFACE_DEF (kann, save),
 		LUA_INTERFACE_DEF (kann, train1),
 		LUA_INTERFACE_DEF (kann, apply1),
+		LUA_INTERFACE_DEF (kann, apply_batch),
 		{"__gc", lua_kann_destroy},
 		{NULL, NULL},
 };
@@ -1200,5 +1202,93 @@ lua_kann_apply1 (lua_State *L)
 		return luaL_error (L, "invalid arguments: rspamd{kann} expected");
 	}
 
+	return 1;
+}
+
+/*
+ * Batched forward pass: takes an array of input vectors and evaluates
+ * them in one graph traversal, so the underlying matrix kernels work on
+ * whole batches instead of single rows; returns an array of output
+ * vectors in the same order
+ */
+static int
+lua_kann_apply_batch (lua_State *L)
+{
+	kann_t *k = lua_check_kann (L, 1);
+
+	if (k && lua_istable (L, 2)) {
+		gsize nsamples = rspamd_lua_table_size (L, 2);
+		int n_in = kann_dim_in (k);
+		int i_out;
+		float *vec;
+
+		if (n_in <= 0) {
+			return luaL_error (L, "invalid inputs count: %d", n_in);
+		}
+
+		if (nsamples == 0) {
+			lua_createtable (L, 0, 0);
+
+			return 1;
+		}
+
+		vec = (float *)g_malloc (sizeof (float) * n_in * nsamples);
+
+		for (gsize s = 0; s < nsamples; s ++) {
+			lua_rawgeti (L, 2, s + 1);
+
+			if (!lua_istable (L, -1) ||
+				rspamd_lua_table_size (L, -1) != (gsize)n_in) {
+				g_free (vec);
+				return luaL_error (L, "invalid sample %d: "
+						"table of %d numbers expected", (int)s + 1, n_in);
+			}
+
+			for (int i = 0; i < n_in; i ++) {
+				lua_rawgeti (L, -1, i + 1);
+				vec[s * n_in + i] = lua_tonumber (L, -1);
+				lua_pop (L, 1);
+			}
+
+			lua_pop (L, 1);
+		}
+
+		i_out = kann_find (k, KANN_F_OUT, 0);
+
+		if (i_out <= 0) {
+			g_free (vec);
+			return luaL_error (L, "invalid ANN: output layer is missing or is "
+					"at the input pos");
+		}
+
+		kann_set_batch_size (k, nsamples);
+		kann_feed_bind (k, KANN_F_IN, 0, &vec);
+		kad_eval_at (k->n, k->v, i_out);
+
+		gsize outlen = kad_len (k->v[i_out]);
+		gsize n_out = outlen / nsamples;
+
+		lua_createtable (L, nsamples, 0);
+
+		for (gsize s = 0; s < nsamples; s ++) {
+			lua_createtable (L, n_out, 0);
+
+			for (gsize i = 0; i < n_out; i ++) {
+				lua_pushnumber (L, k->v[i_out]->x[s * n_out + i]);
+				lua_rawseti (L, -2, i + 1);
+			}
+
+			lua_rawseti (L, -2, s + 1);
+		}
+
+		/* Restore the single sample shape expected by apply1 and save */
+		kann_set_batch_size (k, 1);
+		g_free (vec);
+	}
+	else {
+		return luaL_error (L, "invalid arguments: rspamd{kann} and "
+				"an array of input vectors expected");
+	}
+
 	return 1;
 }
\ No newline at end of file
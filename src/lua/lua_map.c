@@ -42,6 +42,17 @@
  */
 LUA_FUNCTION_DEF (map, get_key);
 
+/***
+ * @method map:get_keys(keys)
+ * Batched lookup for hash and set maps: checks all keys from the array in
+ * one call (the underlying buckets are prefetched together, which is much
+ * cheaper than a chain of dependent get_key calls)
+ *
+ * @param {table} keys array of string keys
+ * @return {table} array of the same length: matched value (or `true` for sets) per key, `false` for misses
+ */
+LUA_FUNCTION_DEF (map, get_keys);
+
 
 /***
  * @method map:is_signed()
@@ -113,6 +124,7 @@ LUA_FUNCTION_DEF (map, get_nelts);
 
 static const struct luaL_reg maplib_m[] = {
 	LUA_INTERFACE_DEF (map, get_key),
+	LUA_INTERFACE_DEF (map, get_keys),
 	LUA_INTERFACE_DEF (map, is_signed),
 	LUA_INTERFACE_DEF (map, get_proto),
 	LUA_INTERFACE_DEF (map, get_sign_key),
@@ -912,6 +924,72 @@ lua_map_get_key (lua_State * L)
 	return 1;
 }
 
+static gint
+lua_map_get_keys (lua_State * L)
+{
+	LUA_TRACE_POINT;
+	struct rspamd_lua_map *map = lua_check_map (L, 1);
+	const gchar **keys;
+	gconstpointer *results;
+	gsize nkeys, i;
+
+	if (map == NULL || lua_type (L, 2) != LUA_TTABLE) {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	if (map->type != RSPAMD_LUA_MAP_SET &&
+		map->type != RSPAMD_LUA_MAP_HASH) {
+		return luaL_error (L, "batched lookup requires a hash or set map");
+	}
+
+	nkeys = rspamd_lua_table_size (L, 2);
+	lua_createtable (L, nkeys, 0);
+
+	if (nkeys == 0 || map->data.hash == NULL) {
+		for (i = 0; i < nkeys; i ++) {
+			lua_pushboolean (L, false);
+			lua_rawseti (L, -2, i + 1);
+		}
+
+		return 1;
+	}
+
+	keys = g_alloca (sizeof (*keys) * nkeys);
+	results = g_alloca (sizeof (*results) * nkeys);
+
+	for (i = 0; i < nkeys; i ++) {
+		lua_rawgeti (L, 2, i + 1);
+		/* Keys must be NUL terminated for the hash, so strings only */
+		keys[i] = lua_tostring (L, -1);
+
+		if (keys[i] == NULL) {
+			keys[i] = "";
+		}
+
+		lua_pop (L, 1);
+	}
+
+	rspamd_match_hash_map_batch (map->data.hash, keys, nkeys, results);
+
+	for (i = 0; i < nkeys; i ++) {
+		if (results[i]) {
+			if (map->type == RSPAMD_LUA_MAP_HASH) {
+				lua_pushstring (L, results[i]);
+			}
+			else {
+				lua_pushboolean (L, true);
+			}
+		}
+		else {
+			lua_pushboolean (L, false);
+		}
+
+		lua_rawseti (L, -2, i + 1);
+	}
+
+	return 1;
+}
+
 static gboolean
 lua_map_traverse_cb (gconstpointer key,
 		gconstpointer value, gsize hits, gpointer ud)
@@ -55,6 +55,13 @@ LUA_FUNCTION_DEF (mempool, add_destructor);
 LUA_FUNCTION_DEF (mempool, delete);
 LUA_FUNCTION_DEF (mempool, stat);
 LUA_FUNCTION_DEF (mempool, suggest_size);
+/***
+ * @method mempool:get_size()
+ * Returns the total number of bytes requested from this pool so far; on a
+ * task pool this is the per-task memory footprint
+ * @return {number} bytes allocated
+ */
+LUA_FUNCTION_DEF (mempool, get_size);
 /***
  * @method mempool:set_variable(name, [value1[, value2 ...]])
  * Sets a variable that's valid during memory pool lifetime. This function allows
@@ -114,6 +121,7 @@ static const struct luaL_reg mempoollib_m[] = {
 	LUA_INTERFACE_DEF (mempool, add_destructor),
 	LUA_INTERFACE_DEF (mempool, stat),
 	LUA_INTERFACE_DEF (mempool, suggest_size),
+	LUA_INTERFACE_DEF (mempool, get_size),
 	LUA_INTERFACE_DEF (mempool, set_variable),
 	LUA_INTERFACE_DEF (mempool, set_bucket),
 	LUA_INTERFACE_DEF (mempool, get_variable),
@@ -245,6 +253,22 @@ lua_mempool_stat (lua_State *L)
 	return 1;
 }
 
+static int
+lua_mempool_get_size (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct memory_pool_s *mempool = rspamd_lua_check_mempool (L, 1);
+
+	if (mempool) {
+		lua_pushinteger (L, rspamd_mempool_used_size (mempool));
+	}
+	else {
+		lua_pushnil (L);
+	}
+
+	return 1;
+}
+
 static int
 lua_mempool_suggest_size (lua_State *L)
 {
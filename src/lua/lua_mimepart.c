@@ -349,6 +349,13 @@ LUA_FUNCTION_DEF (mimepart, get_raw_content);
  * @return {integer} length of part in **bytes**
  */
 LUA_FUNCTION_DEF (mimepart, get_length);
+/***
+ * @method mime_part:get_raw_span()
+ * Returns the byte offset and length of the raw part data within the
+ * original message, so consumers can slice the input without reparsing
+ * @return {number,number} offset and length of the raw part
+ */
+LUA_FUNCTION_DEF (mimepart, get_raw_span);
 /***
  * @method mime_part:get_type()
  * Extract content-type string of the mime part
@@ -527,6 +534,7 @@ static const struct luaL_reg mimepartlib_m[] = {
 	LUA_INTERFACE_DEF (mimepart, get_content),
 	LUA_INTERFACE_DEF (mimepart, get_raw_content),
 	LUA_INTERFACE_DEF (mimepart, get_length),
+	LUA_INTERFACE_DEF (mimepart, get_raw_span),
 	LUA_INTERFACE_DEF (mimepart, get_type),
 	LUA_INTERFACE_DEF (mimepart, get_type_full),
 	LUA_INTERFACE_DEF (mimepart, get_detected_type),
@@ -955,7 +963,8 @@ lua_textpart_filter_words (lua_State *L)
 
 		guint cnt, i;
 
-		lua_createtable (L, 8, 0);
+		/* Presize the table to fit all words without rehashing */
+		lua_createtable (L, part->utf_words->len, 0);
 
 		for (i = 0, cnt = 1; i < part->utf_words->len; i ++) {
 			rspamd_stat_token_t *w = &g_array_index (part->utf_words,
@@ -1379,6 +1388,34 @@ lua_mimepart_get_raw_content (lua_State * L)
 	return 1;
 }
 
+static gint
+lua_mimepart_get_raw_span (lua_State * L)
+{
+	LUA_TRACE_POINT;
+	struct rspamd_mime_part *part = lua_check_mimepart (L);
+	struct rspamd_task *task;
+
+	if (part == NULL) {
+		lua_pushnil (L);
+		return 1;
+	}
+
+	/* The raw data always points inside the message of the owning task */
+	task = lua_check_task_maybe (L, 2);
+
+	if (task && task->msg.begin && part->raw_data.begin >= task->msg.begin &&
+		part->raw_data.begin <= task->msg.begin + task->msg.len) {
+		lua_pushinteger (L, part->raw_data.begin - task->msg.begin);
+		lua_pushinteger (L, part->raw_data.len);
+
+		return 2;
+	}
+
+	lua_pushnil (L);
+
+	return 1;
+}
+
 static gint
 lua_mimepart_get_length (lua_State * L)
 {
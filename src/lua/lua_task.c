@@ -617,6 +617,20 @@ LUA_FUNCTION_DEF (task, get_archives);
  * @return {list of maps} dkim check results
  */
 LUA_FUNCTION_DEF (task, get_dkim_results);
+/***
+ * @method task:get_auth_results()
+ * Returns the per task authentication results structure shared between
+ * dkim/spf checks and the dmarc plugin. Domains are resolved to their
+ * lowercased eSLD once, so relaxed alignment can compare the cached
+ * strings instead of deriving tlds again. Callee must ensure that dkim
+ * and spf checks have been completed. Fields in map:
+ *
+ * * `from_domain`, `from_esld` - header From identity
+ * * `spf_domain`, `spf_esld` - envelope from (or helo) identity
+ * * `dkim` - list of maps with `domain`, `esld` and `success`
+ * @return {table} authentication results
+ */
+LUA_FUNCTION_DEF (task, get_auth_results);
 /***
  * @method task:get_symbol(name)
  * Searches for a symbol `name` in all metrics results and returns a list of tables
@@ -1153,6 +1167,7 @@ static const struct luaL_reg tasklib_m[] = {
 	LUA_INTERFACE_DEF (task, get_images),
 	LUA_INTERFACE_DEF (task, get_archives),
 	LUA_INTERFACE_DEF (task, get_dkim_results),
+	LUA_INTERFACE_DEF (task, get_auth_results),
 	LUA_INTERFACE_DEF (task, get_symbol),
 	LUA_INTERFACE_DEF (task, get_symbols),
 	LUA_INTERFACE_DEF (task, get_symbols_all),
@@ -4187,6 +4202,57 @@ lua_task_get_dkim_results (lua_State *L)
 	return 1;
 }
 
+static gint
+lua_task_get_auth_results (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct rspamd_task *task = lua_check_task (L, 1);
+	struct rspamd_task_auth_results *ar;
+	guint i;
+
+	if (task) {
+		if (!lua_task_get_cached (L, task, "auth_results")) {
+			ar = rspamd_task_get_auth_results (task);
+
+			lua_createtable (L, 0, 7);
+
+			if (ar->from_domain) {
+				rspamd_lua_table_set (L, "from_domain", ar->from_domain);
+				rspamd_lua_table_set (L, "from_esld", ar->from_esld);
+			}
+
+			if (ar->spf_domain) {
+				rspamd_lua_table_set (L, "spf_domain", ar->spf_domain);
+				rspamd_lua_table_set (L, "spf_esld", ar->spf_esld);
+			}
+
+			if (ar->ndkim > 0) {
+				lua_pushstring (L, "dkim");
+				lua_createtable (L, ar->ndkim, 0);
+
+				for (i = 0; i < ar->ndkim; i ++) {
+					lua_createtable (L, 0, 3);
+					rspamd_lua_table_set (L, "domain", ar->dkim[i].domain);
+					rspamd_lua_table_set (L, "esld", ar->dkim[i].esld);
+					lua_pushstring (L, "success");
+					lua_pushboolean (L, ar->dkim[i].success);
+					lua_settable (L, -3);
+					lua_rawseti (L, -2, i + 1);
+				}
+
+				lua_settable (L, -3);
+			}
+
+			lua_task_set_cached (L, task, "auth_results", -1);
+		}
+	}
+	else {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	return 1;
+}
+
 static inline gboolean
 lua_push_symbol_result (lua_State *L,
 		struct rspamd_task *task,
@@ -5020,6 +5086,14 @@ lua_task_get_flags (lua_State *L)
 					lua_pushstring (L, "message_rewrite");
 					lua_rawseti (L, -2, idx++);
 					break;
+				case RSPAMD_TASK_FLAG_PROFILE:
+					lua_pushstring (L, "profile");
+					lua_rawseti (L, -2, idx++);
+					break;
+				case RSPAMD_TASK_FLAG_HEADERS_ONLY:
+					lua_pushstring (L, "headers_only");
+					lua_rawseti (L, -2, idx++);
+					break;
 				default:
 					break;
 				}
@@ -5162,6 +5236,7 @@ lua_task_set_settings (lua_State *L)
 						if (g_ascii_strcasecmp (act_name, act_res->action->name) == 0) {
 							old_score = act_res->cur_limit;
 							act_res->cur_limit = act_score;
+							mres->actions_order_valid = FALSE;
 							found = TRUE;
 							break;
 						}
@@ -5170,6 +5245,7 @@ lua_task_set_settings (lua_State *L)
 						if (act_res->action->action_type == act_type) {
 							old_score = act_res->cur_limit;
 							act_res->cur_limit = act_score;
+							mres->actions_order_valid = FALSE;
 							found = TRUE;
 							break;
 						}
@@ -5214,6 +5290,7 @@ lua_task_set_settings (lua_State *L)
 						mres->actions_limits[mres->nactions].action = new_act;
 						mres->actions_limits[mres->nactions].cur_limit = act_score;
 						mres->nactions ++;
+						mres->actions_order_valid = FALSE;
 					}
 					/* Disabled/missing action is disabled one more time, not an error */
 				}
@@ -5775,6 +5852,7 @@ lua_task_disable_action (lua_State *L)
 				}
 				else {
 					action_res->cur_limit = NAN;
+					task->result->actions_order_valid = FALSE;
 					lua_pushboolean (L, true);
 				}
 
@@ -6538,8 +6616,32 @@ void
 rspamd_lua_task_push (lua_State *L, struct rspamd_task *task)
 {
 	struct rspamd_task **ptask;
+	struct rspamd_lua_cached_entry *entry;
+	static const gchar *cache_key = "task_ud";
+
+	/*
+	 * All symbols observe the very same task object, so a single userdata
+	 * per task is shared between all of them instead of allocating a new
+	 * one per push: symbol callbacks are the hottest C to Lua transition
+	 */
+	if (task->lua_cache) {
+		entry = g_hash_table_lookup (task->lua_cache, cache_key);
+
+		if (entry) {
+			lua_rawgeti (L, LUA_REGISTRYINDEX, entry->ref);
+
+			return;
+		}
+	}
 
 	ptask = lua_newuserdata (L, sizeof (gpointer));
 	rspamd_lua_setclass (L, "rspamd{task}", -1);
 	*ptask = task;
+
+	if (task->lua_cache) {
+		entry = rspamd_mempool_alloc0 (task->task_pool, sizeof (*entry));
+		lua_pushvalue (L, -1);
+		entry->ref = luaL_ref (L, LUA_REGISTRYINDEX);
+		g_hash_table_insert (task->lua_cache, (gpointer)cache_key, entry);
+	}
 }
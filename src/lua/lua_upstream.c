@@ -78,11 +78,13 @@ static const struct luaL_reg upstream_list_f[] = {
 LUA_FUNCTION_DEF (upstream, ok);
 LUA_FUNCTION_DEF (upstream, fail);
 LUA_FUNCTION_DEF (upstream, get_addr);
+LUA_FUNCTION_DEF (upstream, get_latency);
 
 static const struct luaL_reg upstream_m[] = {
 	LUA_INTERFACE_DEF (upstream, ok),
 	LUA_INTERFACE_DEF (upstream, fail),
 	LUA_INTERFACE_DEF (upstream, get_addr),
+	LUA_INTERFACE_DEF (upstream, get_latency),
 	{"__tostring", rspamd_lua_class_tostring},
 	{NULL, NULL}
 };
@@ -119,6 +121,27 @@ lua_upstream_get_addr (lua_State *L)
 	return 1;
 }
 
+/***
+ * @method upstream:get_latency()
+ * Get the response time EWMA of upstream (in seconds)
+ * @return {number} smoothed response time
+ */
+static gint
+lua_upstream_get_latency (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct upstream *up = lua_check_upstream (L);
+
+	if (up) {
+		lua_pushnumber (L, rspamd_upstream_get_latency (up));
+	}
+	else {
+		lua_pushnil (L);
+	}
+
+	return 1;
+}
+
 /***
  * @method upstream:fail()
  * Indicate upstream failure. After certain amount of failures during specified time frame, an upstream is marked as down and does not participate in rotations.
@@ -65,6 +65,8 @@ LUA_FUNCTION_DEF (url, get_visible);
 LUA_FUNCTION_DEF (url, create);
 LUA_FUNCTION_DEF (url, init);
 LUA_FUNCTION_DEF (url, all);
+LUA_FUNCTION_DEF (url, redirector_cache_get);
+LUA_FUNCTION_DEF (url, redirector_cache_set);
 
 static const struct luaL_reg urllib_m[] = {
 	LUA_INTERFACE_DEF (url, get_length),
@@ -99,6 +101,8 @@ static const struct luaL_reg urllib_f[] = {
 	LUA_INTERFACE_DEF (url, init),
 	LUA_INTERFACE_DEF (url, create),
 	LUA_INTERFACE_DEF (url, all),
+	LUA_INTERFACE_DEF (url, redirector_cache_get),
+	LUA_INTERFACE_DEF (url, redirector_cache_set),
 	{NULL, NULL}
 };
 
@@ -817,6 +821,74 @@ lua_url_all (lua_State *L)
 	return 1;
 }
 
+/***
+ * @function url.redirector_cache_get(url)
+ * Returns the final url of a previously resolved redirector from the
+ * cache shared by all workers, or nil
+ * @param {string} url source url
+ * @return {string|nil} resolved target
+ */
+static gint
+lua_url_redirector_cache_get (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	const gchar *url;
+	gsize len, tlen;
+	gchar target[512];
+
+	url = luaL_checklstring (L, 1, &len);
+
+	if (url != NULL) {
+		tlen = rspamd_url_redirector_cache_lookup (url, len,
+				target, sizeof (target));
+
+		if (tlen > 0) {
+			lua_pushlstring (L, target, tlen);
+		}
+		else {
+			lua_pushnil (L);
+		}
+	}
+	else {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	return 1;
+}
+
+/***
+ * @function url.redirector_cache_set(url, target[, ttl])
+ * Publishes a resolved redirector target to the cache shared by all
+ * workers (default ttl is 3600 seconds)
+ * @param {string} url source url
+ * @param {string} target final url
+ * @param {number} ttl seconds to keep the entry
+ */
+static gint
+lua_url_redirector_cache_set (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	const gchar *url, *target;
+	gsize len, tlen;
+	guint ttl = 3600;
+
+	url = luaL_checklstring (L, 1, &len);
+	target = luaL_checklstring (L, 2, &tlen);
+
+	if (url != NULL && target != NULL) {
+		if (lua_type (L, 3) == LUA_TNUMBER) {
+			ttl = lua_tonumber (L, 3);
+		}
+
+		rspamd_url_redirector_cache_store (url, len, target, tlen, ttl);
+	}
+	else {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	return 0;
+}
+
 /***
  * @method url:get_flags()
  * Return flags for a specified URL as map 'flag'->true for all flags set,
@@ -362,6 +362,17 @@ LUA_FUNCTION_DEF (util, close_file);
  * @return {string} string with random hex digests
  */
 LUA_FUNCTION_DEF (util, random_hex);
+/***
+ * @function util.shm_ratelimit(key, window)
+ * Accounts a hit for `key` in the shared (between all workers) sliding
+ * window counters and returns the estimated number of hits within the
+ * last `window` seconds, allowing in-process ratelimit decisions without
+ * a round trip to Redis
+ * @param {string} key bucket key
+ * @param {number} window window length in seconds
+ * @return {number} estimated hits in the window or nil if unavailable
+ */
+LUA_FUNCTION_DEF (util, shm_ratelimit);
 
 /***
  * @function util.zstd_compress(data)
@@ -620,6 +631,81 @@ LUA_FUNCTION_DEF (util, parse_content_type);
 LUA_FUNCTION_DEF (util, mime_header_encode);
 
 
+/***
+ * @function util.str_split(text[, delimiters])
+ * Companion of lua_util.str_split: splits text by a set of delimiter
+ * characters (whitespace when not given), keeping empty fields, so
+ * `a,,b` split by `,` gives 3 elements just like the lpeg grammar did
+ * @param {string} text text to split
+ * @param {string} delimiters set of delimiter characters
+ * @return {table} numeric table of parts
+ */
+LUA_FUNCTION_DEF (util, str_split);
+
+/***
+ * @function util.str_trim(text)
+ * Returns a string with no trailing and leading spaces
+ * @param {string} text input text
+ * @return {string} trimmed text
+ */
+LUA_FUNCTION_DEF (util, str_trim);
+
+/***
+ * @function util.round(num[, ndigits])
+ * Round number to the specified number of decimal digits
+ * @return {number} rounded number
+ */
+LUA_FUNCTION_DEF (util, round);
+
+/***
+ * @function util.list_to_hash(list)
+ * Converts numeric table (or a single string) to a lookup set
+ * @return {table} hash table with elements as keys and true values
+ */
+LUA_FUNCTION_DEF (util, list_to_hash);
+
+/***
+ * @function util.flatten(tbl)
+ * Flattens a numeric table of numeric tables into a single numeric table
+ * @return {table} flattened table
+ */
+LUA_FUNCTION_DEF (util, flatten);
+
+/***
+ * @function util.keys(tbl)
+ * Returns all keys of a table as a numeric table
+ * @return {table} keys
+ */
+LUA_FUNCTION_DEF (util, keys);
+
+/***
+ * @function util.values(tbl)
+ * Returns all values of a table as a numeric table
+ * @return {table} values
+ */
+LUA_FUNCTION_DEF (util, values);
+
+/***
+ * @function util.shallowcopy(tbl)
+ * Performs a shallow copy of a table (other types are returned as is)
+ * @return {table} copy
+ */
+LUA_FUNCTION_DEF (util, shallowcopy);
+
+/***
+ * @function util.deepcopy(tbl)
+ * Performs a deep copy of a table including metatables
+ * @return {table} copy
+ */
+LUA_FUNCTION_DEF (util, deepcopy);
+
+/***
+ * @function util.toboolean(v)
+ * Converts a string or a number to boolean
+ * @return {boolean[,error]} converted value
+ */
+LUA_FUNCTION_DEF (util, toboolean);
+
 static const struct luaL_reg utillib_f[] = {
 	LUA_INTERFACE_DEF (util, create_event_base),
 	LUA_INTERFACE_DEF (util, load_rspamd_config),
@@ -657,6 +743,7 @@ static const struct luaL_reg utillib_f[] = {
 	LUA_INTERFACE_DEF (util, create_file),
 	LUA_INTERFACE_DEF (util, close_file),
 	LUA_INTERFACE_DEF (util, random_hex),
+	LUA_INTERFACE_DEF (util, shm_ratelimit),
 	LUA_INTERFACE_DEF (util, zstd_compress),
 	LUA_INTERFACE_DEF (util, zstd_decompress),
 	LUA_INTERFACE_DEF (util, gzip_compress),
@@ -682,6 +769,16 @@ static const struct luaL_reg utillib_f[] = {
 	LUA_INTERFACE_DEF (util, pack),
 	LUA_INTERFACE_DEF (util, unpack),
 	LUA_INTERFACE_DEF (util, packsize),
+	LUA_INTERFACE_DEF (util, str_split),
+	LUA_INTERFACE_DEF (util, str_trim),
+	LUA_INTERFACE_DEF (util, round),
+	LUA_INTERFACE_DEF (util, list_to_hash),
+	LUA_INTERFACE_DEF (util, flatten),
+	LUA_INTERFACE_DEF (util, keys),
+	LUA_INTERFACE_DEF (util, values),
+	LUA_INTERFACE_DEF (util, shallowcopy),
+	LUA_INTERFACE_DEF (util, deepcopy),
+	LUA_INTERFACE_DEF (util, toboolean),
 	{NULL, NULL}
 };
 
@@ -2086,6 +2183,35 @@ lua_util_close_file (lua_State *L)
 	return 1;
 }
 
+static gint
+lua_util_shm_ratelimit (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	const gchar *key;
+	gsize keylen;
+	guint window;
+	gdouble res;
+
+	key = lua_tolstring (L, 1, &keylen);
+	window = lua_tointeger (L, 2);
+
+	if (key == NULL || window == 0) {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	res = rspamd_shm_ratelimit_add ((const guchar *)key, keylen, window,
+			time (NULL));
+
+	if (res < 0) {
+		lua_pushnil (L);
+	}
+	else {
+		lua_pushnumber (L, res);
+	}
+
+	return 1;
+}
+
 static gint
 lua_util_random_hex (lua_State *L)
 {
@@ -3842,6 +3968,294 @@ lua_util_unpack (lua_State *L)
 	return n + 1;
 }
 
+
+#define LUA_UTIL_SPACES_SET " \t\n\v\f\r"
+
+static gint
+lua_util_str_split (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gsize len, seplen, i, start = 0;
+	const gchar *s = luaL_checklstring (L, 1, &len);
+	const gchar *sep = luaL_optlstring (L, 2, LUA_UTIL_SPACES_SET, &seplen);
+	guchar set[256];
+	gint n = 1;
+
+	memset (set, 0, sizeof (set));
+
+	for (i = 0; i < seplen; i ++) {
+		set[(guchar)sep[i]] = 1;
+	}
+
+	lua_createtable (L, 8, 0);
+
+	for (i = 0; i <= len; i ++) {
+		if (i == len || set[(guchar)s[i]]) {
+			lua_pushlstring (L, s + start, i - start);
+			lua_rawseti (L, -2, n ++);
+			start = i + 1;
+		}
+	}
+
+	return 1;
+}
+
+static gint
+lua_util_str_trim (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gsize len;
+	const gchar *s = luaL_checklstring (L, 1, &len);
+
+	while (len > 0 && g_ascii_isspace (s[0])) {
+		s ++;
+		len --;
+	}
+
+	while (len > 0 && g_ascii_isspace (s[len - 1])) {
+		len --;
+	}
+
+	lua_pushlstring (L, s, len);
+
+	return 1;
+}
+
+static gint
+lua_util_round (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gdouble num = luaL_checknumber (L, 1);
+	gdouble mult = pow (10.0, luaL_optnumber (L, 2, 0.0));
+
+	lua_pushnumber (L, floor (num * mult) / mult);
+
+	return 1;
+}
+
+static gint
+lua_util_list_to_hash (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gint i;
+
+	if (lua_type (L, 1) == LUA_TTABLE) {
+		lua_rawgeti (L, 1, 1);
+
+		if (!lua_isnil (L, -1)) {
+			lua_pop (L, 1);
+			lua_newtable (L);
+
+			for (i = 1; ; i ++) {
+				lua_rawgeti (L, 1, i);
+
+				if (lua_isnil (L, -1)) {
+					lua_pop (L, 1);
+					break;
+				}
+
+				lua_pushboolean (L, true);
+				lua_settable (L, -3);
+			}
+		}
+		else {
+			/* Assume it is a hash already */
+			lua_pop (L, 1);
+			lua_pushvalue (L, 1);
+		}
+	}
+	else if (lua_type (L, 1) == LUA_TSTRING) {
+		lua_newtable (L);
+		lua_pushvalue (L, 1);
+		lua_pushboolean (L, true);
+		lua_settable (L, -3);
+	}
+	else {
+		lua_pushnil (L);
+	}
+
+	return 1;
+}
+
+static gint
+lua_util_flatten (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gint i, j, n = 1;
+
+	luaL_checktype (L, 1, LUA_TTABLE);
+	lua_newtable (L);
+
+	for (i = 1; ; i ++) {
+		lua_rawgeti (L, 1, i);
+
+		if (lua_isnil (L, -1)) {
+			lua_pop (L, 1);
+			break;
+		}
+
+		if (!lua_istable (L, -1)) {
+			return luaL_error (L, "invalid element %d: table expected", i);
+		}
+
+		for (j = 1; ; j ++) {
+			lua_rawgeti (L, -1, j);
+
+			if (lua_isnil (L, -1)) {
+				lua_pop (L, 1);
+				break;
+			}
+
+			lua_rawseti (L, -3, n ++);
+		}
+
+		lua_pop (L, 1);
+	}
+
+	return 1;
+}
+
+static gint
+lua_util_keys (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gint n = 1;
+
+	luaL_checktype (L, 1, LUA_TTABLE);
+	lua_newtable (L);
+	lua_pushnil (L);
+
+	while (lua_next (L, 1)) {
+		lua_pop (L, 1); /* Value */
+		lua_pushvalue (L, -1); /* Copy of the key */
+		lua_rawseti (L, -3, n ++);
+	}
+
+	return 1;
+}
+
+static gint
+lua_util_values (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	gint n = 1;
+
+	luaL_checktype (L, 1, LUA_TTABLE);
+	lua_newtable (L);
+	lua_pushnil (L);
+
+	while (lua_next (L, 1)) {
+		lua_rawseti (L, -3, n ++);
+	}
+
+	return 1;
+}
+
+static gint
+lua_util_shallowcopy (lua_State *L)
+{
+	LUA_TRACE_POINT;
+
+	if (lua_type (L, 1) == LUA_TTABLE) {
+		lua_newtable (L);
+		lua_pushnil (L);
+
+		while (lua_next (L, 1)) {
+			lua_pushvalue (L, -2);
+			lua_insert (L, -2);
+			lua_rawset (L, -4);
+		}
+	}
+	else {
+		lua_pushvalue (L, 1);
+	}
+
+	return 1;
+}
+
+/* Pushes a deep copy of the value at idx; no cycle detection just like
+ * the lua version it replaces */
+static void
+lua_util_deepcopy_impl (lua_State *L, gint idx)
+{
+	if (idx < 0) {
+		idx = lua_gettop (L) + idx + 1;
+	}
+
+	if (lua_type (L, idx) == LUA_TTABLE) {
+		luaL_checkstack (L, 5, "deepcopy");
+		lua_newtable (L);
+		lua_pushnil (L);
+
+		while (lua_next (L, idx)) {
+			/* Stack: copy, key, value */
+			lua_util_deepcopy_impl (L, -2);
+			lua_util_deepcopy_impl (L, -2);
+			/* Stack: copy, key, value, key copy, value copy */
+			lua_settable (L, -5);
+			lua_pop (L, 1); /* Value, key remains for the next iteration */
+		}
+
+		if (lua_getmetatable (L, idx)) {
+			lua_util_deepcopy_impl (L, -1);
+			lua_remove (L, -2);
+			lua_setmetatable (L, -2);
+		}
+	}
+	else {
+		lua_pushvalue (L, idx);
+	}
+}
+
+static gint
+lua_util_deepcopy (lua_State *L)
+{
+	LUA_TRACE_POINT;
+
+	luaL_checkany (L, 1);
+	lua_util_deepcopy_impl (L, 1);
+
+	return 1;
+}
+
+static gint
+lua_util_toboolean (lua_State *L)
+{
+	LUA_TRACE_POINT;
+
+	if (lua_type (L, 1) == LUA_TSTRING) {
+		const gchar *v = lua_tostring (L, 1);
+
+		if (strcmp (v, "1") == 0 ||
+				g_ascii_strcasecmp (v, "true") == 0) {
+			lua_pushboolean (L, true);
+
+			return 1;
+		}
+		else if (strcmp (v, "0") == 0 ||
+				g_ascii_strcasecmp (v, "false") == 0) {
+			lua_pushboolean (L, false);
+
+			return 1;
+		}
+
+		lua_pushboolean (L, false);
+		lua_pushfstring (L, "cannot convert '%s' to boolean", v);
+
+		return 2;
+	}
+	else if (lua_type (L, 1) == LUA_TNUMBER) {
+		lua_pushboolean (L, lua_tonumber (L, 1) != 0);
+
+		return 1;
+	}
+
+	lua_pushboolean (L, false);
+	lua_pushliteral (L, "cannot convert value to boolean");
+
+	return 2;
+}
+
 static gint
 lua_load_util (lua_State * L)
 {
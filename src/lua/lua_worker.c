@@ -86,20 +86,24 @@ lua_worker_get_stat (lua_State *L)
 		stat = &stat_copy;
 		top = ucl_object_typed_new (UCL_OBJECT);
 		ucl_object_insert_key (top, ucl_object_fromint (
-				stat->messages_scanned), "scanned", 0, false);
+				rspamd_striped_counter_read (&stat->messages_scanned)),
+				"scanned", 0, false);
 		ucl_object_insert_key (top, ucl_object_fromint (
 				stat->messages_learned), "learned", 0, false);
-		if (stat->messages_scanned > 0) {
+		if (rspamd_striped_counter_read (&stat->messages_scanned) > 0) {
+			guint64 cnt;
+
 			sub = ucl_object_typed_new (UCL_OBJECT);
 			for (i = METRIC_ACTION_REJECT; i <= METRIC_ACTION_NOACTION; i++) {
+				cnt = rspamd_striped_counter_read (&stat->actions_stat[i]);
 				ucl_object_insert_key (sub,
-						ucl_object_fromint (stat->actions_stat[i]),
+						ucl_object_fromint (cnt),
 						rspamd_action_to_str (i), 0, false);
 				if (i < METRIC_ACTION_GREYLIST) {
-					spam += stat->actions_stat[i];
+					spam += cnt;
 				}
 				else {
-					ham += stat->actions_stat[i];
+					ham += cnt;
 				}
 			}
 			ucl_object_insert_key (top, sub, "actions", 0, false);
@@ -379,25 +379,39 @@ rspamd_chartable_process_word_utf (struct rspamd_task *task,
 	/* We assume that w is normalized */
 
 	while (p < end) {
+		gboolean is_ascii;
+
 		uc = *p++;
 
 		if (((gint32)uc) < 0) {
 			break;
 		}
 
-		sc = ublock_getCode (uc);
-		cat = u_charType (uc);
-
-		if (cat == U_NON_SPACING_MARK ||
-			(sc == UBLOCK_LATIN_1_SUPPLEMENT) ||
-			(sc == UBLOCK_LATIN_EXTENDED_A) ||
-			(sc == UBLOCK_LATIN_EXTENDED_ADDITIONAL) ||
-			(sc == UBLOCK_LATIN_EXTENDED_B) ||
-			(sc == UBLOCK_COMBINING_DIACRITICAL_MARKS)) {
-			nspecial ++;
+		/*
+		 * Ascii codepoints (the vast majority for typical corpus) need
+		 * no ICU block/category lookups: they are basic latin with no
+		 * special characters by definition
+		 */
+		is_ascii = uc < 0x80;
+
+		if (!is_ascii) {
+			sc = ublock_getCode (uc);
+			cat = u_charType (uc);
+
+			if (cat == U_NON_SPACING_MARK ||
+				(sc == UBLOCK_LATIN_1_SUPPLEMENT) ||
+				(sc == UBLOCK_LATIN_EXTENDED_A) ||
+				(sc == UBLOCK_LATIN_EXTENDED_ADDITIONAL) ||
+				(sc == UBLOCK_LATIN_EXTENDED_B) ||
+				(sc == UBLOCK_COMBINING_DIACRITICAL_MARKS)) {
+				nspecial ++;
+			}
+		}
+		else {
+			sc = UBLOCK_BASIC_LATIN;
 		}
 
-		if (u_isalpha (uc)) {
+		if (is_ascii ? g_ascii_isalpha (uc) : u_isalpha (uc)) {
 
 			if (sc <= UBLOCK_COMBINING_DIACRITICAL_MARKS ||
 					sc == UBLOCK_LATIN_EXTENDED_ADDITIONAL) {
@@ -447,7 +461,7 @@ rspamd_chartable_process_word_utf (struct rspamd_task *task,
 			state = got_alpha;
 
 		}
-		else if (u_isdigit (uc)) {
+		else if (is_ascii ? g_ascii_isdigit (uc) : u_isdigit (uc)) {
 			if (state != got_digit) {
 				prev_state = state;
 			}
@@ -79,10 +79,12 @@ struct dkim_ctx {
 	guint strict_multiplier;
 	guint time_jitter;
 	rspamd_lru_hash_t *dkim_hash;
+	rspamd_lru_hash_t *dkim_neg_hash; /* negative dns results */
 	rspamd_lru_hash_t *dkim_sign_hash;
 	const gchar *sign_headers;
 	const gchar *arc_sign_headers;
 	guint max_sigs;
+	gchar *cache_file;
 	gboolean trusted_only;
 	gboolean check_local;
 	gboolean check_authed;
@@ -140,6 +142,157 @@ dkim_module_key_dtor (gpointer k)
 	rspamd_dkim_key_unref (key);
 }
 
+/*
+ * Cache handoff across restarts: on shutdown the key cache is serialized
+ * to `cache_file` and a freshly started worker imports it, so a deploy
+ * does not begin with a cold DKIM key cache and a multi-minute p95
+ * regression while DNS refills it
+ */
+static void
+dkim_module_save_key_cache (gpointer p)
+{
+	struct dkim_ctx *dkim_module_ctx = p;
+	rspamd_dkim_key_t *key;
+	ucl_object_t *top, *elt;
+	struct ucl_emitter_functions *efuncs;
+	const guchar *raw;
+	gpointer k, v;
+	gchar *tmpname, *b64;
+	gsize rawlen;
+	time_t now = time (NULL);
+	gint it = 0, fd;
+	FILE *f;
+
+	if (dkim_module_ctx->dkim_hash == NULL) {
+		return;
+	}
+
+	top = ucl_object_typed_new (UCL_ARRAY);
+
+	while ((it = rspamd_lru_hash_foreach (dkim_module_ctx->dkim_hash,
+			it, &k, &v)) != -1) {
+		key = v;
+		raw = rspamd_dkim_key_get_raw (key, &rawlen);
+
+		if (raw == NULL || rawlen == 0) {
+			continue;
+		}
+
+		b64 = rspamd_encode_base64 (raw, rawlen, 0, NULL);
+		elt = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (elt,
+				ucl_object_fromstring ((const gchar *)k), "name", 0, true);
+		ucl_object_insert_key (elt,
+				ucl_object_fromstring_common (b64, 0, UCL_STRING_RAW),
+				"data", 0, false);
+		g_free (b64);
+		ucl_object_insert_key (elt,
+				ucl_object_fromint (rspamd_dkim_key_type (key)),
+				"type", 0, false);
+		ucl_object_insert_key (elt,
+				ucl_object_fromint (now + rspamd_dkim_key_get_ttl (key)),
+				"expire", 0, false);
+		ucl_array_append (top, elt);
+	}
+
+	/* Every worker saves on shutdown; pid suffix keeps them from clashing */
+	tmpname = g_strdup_printf ("%s.new.%d", dkim_module_ctx->cache_file,
+			(int)getpid ());
+	fd = open (tmpname, O_CREAT | O_TRUNC | O_WRONLY, 00600);
+	f = fd != -1 ? fdopen (fd, "w") : NULL;
+
+	if (f == NULL) {
+		msg_warn ("cannot save dkim key cache to %s: %s", tmpname,
+				strerror (errno));
+
+		if (fd != -1) {
+			close (fd);
+		}
+	}
+	else {
+		efuncs = ucl_object_emit_file_funcs (f);
+		ucl_object_emit_full (top, UCL_EMIT_JSON_COMPACT, efuncs, NULL);
+		ucl_object_emit_funcs_free (efuncs);
+		fclose (f);
+
+		if (rename (tmpname, dkim_module_ctx->cache_file) == -1) {
+			msg_warn ("cannot rename dkim key cache to %s: %s",
+					dkim_module_ctx->cache_file, strerror (errno));
+			unlink (tmpname);
+		}
+	}
+
+	g_free (tmpname);
+	ucl_object_unref (top);
+}
+
+static void
+dkim_module_load_key_cache (struct dkim_ctx *dkim_module_ctx)
+{
+	struct ucl_parser *parser;
+	ucl_object_t *top;
+	const ucl_object_t *cur, *elt;
+	ucl_object_iter_t uit = NULL;
+	rspamd_dkim_key_t *key;
+	GError *err = NULL;
+	time_t now = time (NULL);
+	gint64 expire;
+	guint loaded = 0;
+
+	if (access (dkim_module_ctx->cache_file, R_OK) == -1) {
+		return;
+	}
+
+	parser = ucl_parser_new (UCL_PARSER_DEFAULT);
+
+	if (!ucl_parser_add_file (parser, dkim_module_ctx->cache_file)) {
+		msg_warn ("cannot load dkim key cache from %s: %s",
+				dkim_module_ctx->cache_file, ucl_parser_get_error (parser));
+		ucl_parser_free (parser);
+
+		return;
+	}
+
+	top = ucl_parser_get_object (parser);
+	ucl_parser_free (parser);
+
+	while ((cur = ucl_object_iterate (top, &uit, true)) != NULL) {
+		const gchar *name, *data;
+
+		elt = ucl_object_lookup (cur, "name");
+		name = elt ? ucl_object_tostring (elt) : NULL;
+		elt = ucl_object_lookup (cur, "data");
+		data = elt ? ucl_object_tostring (elt) : NULL;
+		elt = ucl_object_lookup (cur, "expire");
+		expire = elt ? ucl_object_toint (elt) : 0;
+
+		if (name == NULL || data == NULL || expire <= now) {
+			continue;
+		}
+
+		elt = ucl_object_lookup (cur, "type");
+		key = rspamd_dkim_make_key (data, strlen (data),
+				elt ? ucl_object_toint (elt) : RSPAMD_DKIM_KEY_RSA, &err);
+
+		if (key == NULL) {
+			msg_info ("cannot import dkim key for %s: %e", name, err);
+			g_clear_error (&err);
+			continue;
+		}
+
+		rspamd_lru_hash_insert (dkim_module_ctx->dkim_hash,
+				g_strdup (name), key, now, expire - now);
+		loaded ++;
+	}
+
+	if (loaded > 0) {
+		msg_info ("imported %d dkim keys from the cache handoff file %s",
+				loaded, dkim_module_ctx->cache_file);
+	}
+
+	ucl_object_unref (top);
+}
+
 static void
 dkim_module_free_list (gpointer k)
 {
@@ -502,9 +655,33 @@ dkim_module_config (struct rspamd_config *cfg)
 				cache_size,
 				g_free,
 				dkim_module_key_dtor);
+
+		if ((value = rspamd_config_get_module_opt (cfg, "dkim",
+				"cache_file")) != NULL) {
+			dkim_module_ctx->cache_file = rspamd_mempool_strdup (
+					cfg->cfg_pool, ucl_object_tostring (value));
+			/*
+			 * The save destructor must be registered before the hash
+			 * destroy one below, since pool destructors run in order
+			 */
+			rspamd_mempool_add_destructor (cfg->cfg_pool,
+					dkim_module_save_key_cache, dkim_module_ctx);
+		}
+
 		rspamd_mempool_add_destructor (cfg->cfg_pool,
 				(rspamd_mempool_destruct_t)rspamd_lru_hash_destroy,
 				dkim_module_ctx->dkim_hash);
+		dkim_module_ctx->dkim_neg_hash = rspamd_lru_hash_new (
+				cache_size,
+				g_free,
+				NULL);
+		rspamd_mempool_add_destructor (cfg->cfg_pool,
+				(rspamd_mempool_destruct_t)rspamd_lru_hash_destroy,
+				dkim_module_ctx->dkim_neg_hash);
+
+		if (dkim_module_ctx->cache_file != NULL) {
+			dkim_module_load_key_cache (dkim_module_ctx);
+		}
 	}
 
 	if (sign_cache_size > 0) {
@@ -1093,6 +1270,14 @@ dkim_module_key_handler (rspamd_dkim_key_t *key,
 			if (err->code == DKIM_SIGERROR_NOKEY) {
 				res->res = rspamd_dkim_create_result (ctx, DKIM_TRYAGAIN, task);
 				res->res->fail_reason = "DNS error when getting key";
+
+				if (dkim_module_ctx->dkim_neg_hash) {
+					/* Negative cache: avoid re-querying missing keys */
+					rspamd_lru_hash_insert (dkim_module_ctx->dkim_neg_hash,
+							g_strdup (rspamd_dkim_get_dns_key (ctx)),
+							GINT_TO_POINTER (1),
+							res->task->task_timestamp, 60);
+				}
 			}
 			else {
 				res->res = rspamd_dkim_create_result (ctx, DKIM_PERM_ERROR, task);
@@ -1118,6 +1303,7 @@ dkim_symbol_callback (struct rspamd_task *task,
 	GError *err = NULL;
 	struct rspamd_mime_header *rh, *rh_cur;
 	struct dkim_check_result *res = NULL, *cur;
+	GPtrArray *used_ctxs = NULL;
 	guint checked = 0, *dmarc_checks;
 	struct dkim_ctx *dkim_module_ctx = dkim_get_context (task->cfg);
 
@@ -1219,6 +1405,18 @@ dkim_symbol_callback (struct rspamd_task *task,
 					continue;
 				}
 
+				if (dkim_module_ctx->dkim_neg_hash &&
+					rspamd_lru_hash_lookup (dkim_module_ctx->dkim_neg_hash,
+							rspamd_dkim_get_dns_key (ctx),
+							task->task_timestamp) != NULL) {
+					/* The key is known to be missing, do not query DNS */
+					msg_debug_task ("skip dkim check for %s: "
+							"the key is negatively cached",
+							rspamd_dkim_get_dns_key (ctx));
+
+					continue;
+				}
+
 				if (dkim_module_ctx->dkim_hash) {
 					key = rspamd_lru_hash_lookup (dkim_module_ctx->dkim_hash,
 							rspamd_dkim_get_dns_key (ctx),
@@ -1244,6 +1442,12 @@ dkim_symbol_callback (struct rspamd_task *task,
 				}
 			}
 
+			if (used_ctxs == NULL) {
+				used_ctxs = g_ptr_array_sized_new (
+						dkim_module_ctx->max_sigs);
+			}
+
+			g_ptr_array_add (used_ctxs, ctx);
 			checked ++;
 
 			if (checked > dkim_module_ctx->max_sigs) {
@@ -1253,6 +1457,12 @@ dkim_symbol_callback (struct rspamd_task *task,
 				break;
 			}
 		}
+
+		if (used_ctxs != NULL) {
+			/* Hash the body once for all pending signatures */
+			rspamd_dkim_precompute_body_hashes (task, used_ctxs);
+			g_ptr_array_free (used_ctxs, TRUE);
+		}
 	}
 	else {
 		rspamd_task_insert_result (task,
@@ -34,6 +34,7 @@
 #include "libmime/message.h"
 #include "libutil/map.h"
 #include "libutil/map_helpers.h"
+#include "libutil/hash.h"
 #include "libmime/images.h"
 #include "libserver/worker_util.h"
 #include "libserver/mempool_vars_internal.h"
@@ -87,6 +88,7 @@ struct fuzzy_rule {
 	gboolean skip_unknown;
 	gint learn_condition_cb;
 	struct rspamd_hash_map_helper *skip_map;
+	rspamd_lru_hash_t *neg_cache;
 	struct fuzzy_ctx *ctx;
 	gint lua_id;
 };
@@ -156,6 +158,14 @@ struct fuzzy_learn_session {
 #define FUZZY_CMD_FLAG_SENT (1 << 1)
 #define FUZZY_CMD_FLAG_IMAGE (1 << 2)
 
+/*
+ * Per rule cache of digests recently reported as not found by the storage;
+ * entries expire quickly so that fresh learns on the server become visible,
+ * and local learn/delete commands drop the affected digests eagerly
+ */
+#define FUZZY_NEG_CACHE_SIZE 2048
+#define FUZZY_NEG_CACHE_TTL 120
+
 #define FUZZY_CHECK_FLAG_NOIMAGES (1 << 0)
 #define FUZZY_CHECK_FLAG_NOATTACHMENTS (1 << 1)
 #define FUZZY_CHECK_FLAG_NOTEXT (1 << 2)
@@ -296,6 +306,19 @@ fuzzy_normalize (gint32 in, double weight)
 #endif
 }
 
+static guint
+fuzzy_neg_cache_hash (gconstpointer ptr)
+{
+	return rspamd_cryptobox_fast_hash (ptr, rspamd_cryptobox_HASHBYTES,
+			rspamd_hash_seed ());
+}
+
+static gboolean
+fuzzy_neg_cache_equal (gconstpointer p1, gconstpointer p2)
+{
+	return memcmp (p1, p2, rspamd_cryptobox_HASHBYTES) == 0;
+}
+
 static struct fuzzy_rule *
 fuzzy_rule_new (const char *default_symbol, rspamd_mempool_t *pool)
 {
@@ -309,6 +332,9 @@ fuzzy_rule_new (const char *default_symbol, rspamd_mempool_t *pool)
 		(rspamd_mempool_destruct_t)g_hash_table_unref,
 		rule->mappings);
 	rule->read_only = FALSE;
+	rule->neg_cache = rspamd_lru_hash_new_full (FUZZY_NEG_CACHE_SIZE,
+			g_free, NULL,
+			fuzzy_neg_cache_hash, fuzzy_neg_cache_equal);
 
 	return rule;
 }
@@ -328,6 +354,10 @@ fuzzy_free_rule (gpointer r)
 	if (rule->peer_key) {
 		rspamd_pubkey_unref (rule->peer_key);
 	}
+
+	if (rule->neg_cache) {
+		rspamd_lru_hash_destroy (rule->neg_cache);
+	}
 }
 
 static gint
@@ -1338,35 +1368,131 @@ struct rspamd_cached_shingles {
 	guchar digest[rspamd_cryptobox_HASHBYTES];
 };
 
+/*
+ * Cross task worker level cache of computed shingles keyed by the part
+ * digest and the rule keys: rescans of the same content (MTA retries
+ * after soft reject, retransmit storms during storage failover) then
+ * reuse the hash work instead of recomputing it for every new task
+ */
+#define FUZZY_SHINGLES_CACHE_SIZE 512
+
+struct fuzzy_shingles_lru_elt {
+	struct rspamd_cached_shingles cached; /* sh points at the field below */
+	struct rspamd_shingle sh;
+};
+
+static rspamd_lru_hash_t *fuzzy_shingles_cache = NULL;
+
+static guint
+fuzzy_shingles_cache_hash (gconstpointer p)
+{
+	return *(const guint64 *)p;
+}
+
+static gboolean
+fuzzy_shingles_cache_equal (gconstpointer a, gconstpointer b)
+{
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+static guint64
+fuzzy_shingles_cache_key (struct fuzzy_rule *rule,
+		struct rspamd_mime_part *mp)
+{
+	rspamd_cryptobox_fast_hash_state_t st;
+	gint key_part;
+
+	memcpy (&key_part, rule->shingles_key->str, sizeof (key_part));
+	rspamd_cryptobox_fast_hash_init (&st, rspamd_hash_seed ());
+	rspamd_cryptobox_fast_hash_update (&st, mp->digest, sizeof (mp->digest));
+	rspamd_cryptobox_fast_hash_update (&st, &rule->alg, sizeof (rule->alg));
+	rspamd_cryptobox_fast_hash_update (&st, &key_part, sizeof (key_part));
+
+	return rspamd_cryptobox_fast_hash_final (&st);
+}
+
 static struct rspamd_cached_shingles *
 fuzzy_cmd_get_cached (struct fuzzy_rule *rule,
 		rspamd_mempool_t *pool,
-		gpointer p)
+		struct rspamd_mime_part *mp)
 {
 	gchar key[32];
 	gint key_part;
+	struct rspamd_cached_shingles *res;
 
 	memcpy (&key_part, rule->shingles_key->str, sizeof (key_part));
-	rspamd_snprintf (key, sizeof (key), "%p%s%d", p, rule->algorithm_str,
+	rspamd_snprintf (key, sizeof (key), "%p%s%d", mp, rule->algorithm_str,
 			key_part);
 
-	return rspamd_mempool_get_variable (pool, key);
+	res = rspamd_mempool_get_variable (pool, key);
+
+	if (res == NULL && fuzzy_shingles_cache != NULL && mp != NULL) {
+		/* Check the cross task cache */
+		struct fuzzy_shingles_lru_elt *elt;
+		guint64 lru_key = fuzzy_shingles_cache_key (rule, mp);
+
+		elt = rspamd_lru_hash_lookup (fuzzy_shingles_cache, &lru_key,
+				time (NULL));
+
+		if (elt) {
+			/* Copy into the task pool to get the usual lifetime */
+			res = rspamd_mempool_alloc (pool, sizeof (*res));
+			memcpy (res->digest, elt->cached.digest, sizeof (res->digest));
+
+			if (elt->cached.sh) {
+				res->sh = rspamd_mempool_alloc (pool, sizeof (*res->sh));
+				memcpy (res->sh, &elt->sh, sizeof (elt->sh));
+			}
+			else {
+				res->sh = NULL;
+			}
+
+			rspamd_mempool_set_variable (pool, key, res, NULL);
+		}
+	}
+
+	return res;
 }
 
 static void
 fuzzy_cmd_set_cached (struct fuzzy_rule *rule,
 		rspamd_mempool_t *pool,
-		gpointer p,
+		struct rspamd_mime_part *mp,
 		struct rspamd_cached_shingles *data)
 {
 	gchar key[32];
 	gint key_part;
 
 	memcpy (&key_part, rule->shingles_key->str, sizeof (key_part));
-	rspamd_snprintf (key, sizeof (key), "%p%s%d", p, rule->algorithm_str,
+	rspamd_snprintf (key, sizeof (key), "%p%s%d", mp, rule->algorithm_str,
 			key_part);
 	/* Key is copied */
 	rspamd_mempool_set_variable (pool, key, data, NULL);
+
+	if (mp != NULL) {
+		struct fuzzy_shingles_lru_elt *elt;
+		guint64 *lru_key;
+
+		if (fuzzy_shingles_cache == NULL) {
+			fuzzy_shingles_cache = rspamd_lru_hash_new_full (
+					FUZZY_SHINGLES_CACHE_SIZE,
+					g_free, g_free,
+					fuzzy_shingles_cache_hash, fuzzy_shingles_cache_equal);
+		}
+
+		lru_key = g_malloc (sizeof (*lru_key));
+		*lru_key = fuzzy_shingles_cache_key (rule, mp);
+		elt = g_malloc0 (sizeof (*elt));
+		memcpy (elt->cached.digest, data->digest, sizeof (elt->cached.digest));
+
+		if (data->sh) {
+			memcpy (&elt->sh, data->sh, sizeof (elt->sh));
+			elt->cached.sh = &elt->sh;
+		}
+
+		rspamd_lru_hash_insert (fuzzy_shingles_cache, lru_key, elt,
+				time (NULL), -1);
+	}
 }
 
 static gboolean
@@ -1771,6 +1897,66 @@ fuzzy_cmd_vector_to_wire (gint fd, GPtrArray *v)
 	struct fuzzy_cmd_io *io;
 	gboolean processed = FALSE;
 
+#ifdef HAVE_SENDMMSG
+	/*
+	 * Commands remain one per datagram (the storage dispatches by the
+	 * exact packet size), but all unsent datagrams of a session are
+	 * pushed with a single syscall and demultiplexed by tag on reply
+	 */
+	struct mmsghdr *msgvec;
+	struct fuzzy_cmd_io **pending;
+	guint npending = 0;
+	gint sent;
+
+	msgvec = g_alloca (sizeof (*msgvec) * v->len);
+	pending = g_alloca (sizeof (*pending) * v->len);
+	memset (msgvec, 0, sizeof (*msgvec) * v->len);
+
+	for (i = 0; i < v->len; i ++) {
+		io = g_ptr_array_index (v, i);
+
+		if (io->flags & FUZZY_CMD_FLAG_REPLIED) {
+			continue;
+		}
+
+		all_replied = FALSE;
+
+		if (!(io->flags & FUZZY_CMD_FLAG_SENT)) {
+			msgvec[npending].msg_hdr.msg_iov = &io->io;
+			msgvec[npending].msg_hdr.msg_iovlen = 1;
+			pending[npending] = io;
+			npending ++;
+			all_sent = FALSE;
+		}
+	}
+
+	if (npending > 0) {
+		for (;;) {
+			sent = sendmmsg (fd, msgvec, npending, 0);
+
+			if (sent == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				return FALSE;
+			}
+
+			break;
+		}
+
+		for (i = 0; i < (guint)sent; i ++) {
+			pending[i]->flags |= FUZZY_CMD_FLAG_SENT;
+		}
+
+		if ((guint)sent < npending) {
+			/* Partial send: the rest is retried by the caller */
+			return TRUE;
+		}
+
+		processed = TRUE;
+	}
+#else
 	/* First try to resend unsent commands */
 	for (i = 0; i < v->len; i ++) {
 		io = g_ptr_array_index (v, i);
@@ -1790,6 +1976,7 @@ fuzzy_cmd_vector_to_wire (gint fd, GPtrArray *v)
 			all_sent = FALSE;
 		}
 	}
+#endif
 
 	if (all_sent && !all_replied) {
 		/* Now try to resend each command in the vector */
@@ -2110,6 +2297,17 @@ fuzzy_check_try_read (struct fuzzy_client_session *session)
 						rep->v1.flag,
 						rep->v1.value);
 			}
+			else if (cmd->cmd == FUZZY_CHECK) {
+				/*
+				 * Confirmed absent: remember the digest for a short while
+				 * to avoid asking the storage again for the same content
+				 */
+				rspamd_lru_hash_insert (session->rule->neg_cache,
+						g_memdup (cmd->digest, sizeof (cmd->digest)),
+						GINT_TO_POINTER (1),
+						task->task_timestamp,
+						FUZZY_NEG_CACHE_TTL);
+			}
 
 			ret = 1;
 		}
@@ -2754,6 +2952,22 @@ fuzzy_generate_commands (struct rspamd_task *task, struct fuzzy_rule *rule,
 						}
 					}
 
+					if (!skip_existing && c == FUZZY_CHECK &&
+						rspamd_lru_hash_lookup (rule->neg_cache,
+								io->cmd.digest, task->task_timestamp) != NULL) {
+						/* Storage has recently reported this digest as absent */
+						msg_debug_task ("skip fuzzy check for %*xs: "
+								"recently not found",
+								(gint) sizeof (io->cmd.digest) / 2,
+								io->cmd.digest);
+						skip_existing = TRUE;
+					}
+					else if (c == FUZZY_WRITE || c == FUZZY_DEL) {
+						/* Learning changes the server state for this digest */
+						rspamd_lru_hash_remove (rule->neg_cache,
+								io->cmd.digest);
+					}
+
 					if (!skip_existing) {
 						g_ptr_array_add (res, io);
 					}
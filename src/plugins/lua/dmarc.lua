@@ -300,6 +300,17 @@ local function dmarc_validate_policy(task, policy, hdrfromdom, dmarc_esld)
   local spf_tmpfail = false
   local dkim_tmpfail = false
 
+  -- Cached per task eslds (lowercased), populated once on the C side
+  local auth_res = task:get_auth_results() or E
+  local from_esld = auth_res.from_esld
+  local dkim_eslds
+  if auth_res.dkim then
+    dkim_eslds = {}
+    for _,d in ipairs(auth_res.dkim) do
+      dkim_eslds[d.domain] = d.esld
+    end
+  end
+
   local spf_domain = ((task:get_from(1) or E)[1] or E).domain
 
   if not spf_domain or spf_domain == '' then
@@ -314,10 +325,13 @@ local function dmarc_validate_policy(task, policy, hdrfromdom, dmarc_esld)
         table.insert(reason, "SPF not aligned (strict)")
       end
     else
-      local spf_tld = rspamd_util.get_tld(spf_domain)
-      if rspamd_util.strequal_caseless(spf_tld, dmarc_esld) then
-        spf_ok = true
+      if auth_res.spf_esld and from_esld then
+        spf_ok = rspamd_util.strequal_caseless(auth_res.spf_esld, from_esld)
       else
+        local spf_tld = rspamd_util.get_tld(spf_domain)
+        spf_ok = rspamd_util.strequal_caseless(spf_tld, dmarc_esld)
+      end
+      if not spf_ok then
         table.insert(reason, "SPF not aligned (relaxed)")
       end
     end
@@ -328,9 +342,12 @@ local function dmarc_validate_policy(task, policy, hdrfromdom, dmarc_esld)
           spf_tmpfail = true
         end
       else
-        local spf_tld = rspamd_util.get_tld(spf_domain)
-        if rspamd_util.strequal_caseless(spf_tld, dmarc_esld) then
-          spf_tmpfail = true
+        if auth_res.spf_esld and from_esld then
+          spf_tmpfail = rspamd_util.strequal_caseless(auth_res.spf_esld,
+              from_esld)
+        else
+          local spf_tld = rspamd_util.get_tld(spf_domain)
+          spf_tmpfail = rspamd_util.strequal_caseless(spf_tld, dmarc_esld)
         end
       end
     end
@@ -366,9 +383,17 @@ local function dmarc_validate_policy(task, policy, hdrfromdom, dmarc_esld)
             dkim_violated = "DKIM not aligned (strict)"
           end
         else
-          local dkim_tld = rspamd_util.get_tld(domain)
+          local aligned
+          local dkim_esld = dkim_eslds and dkim_eslds[domain]
+
+          if dkim_esld and from_esld then
+            aligned = rspamd_util.strequal_caseless(dkim_esld, from_esld)
+          else
+            local dkim_tld = rspamd_util.get_tld(domain)
+            aligned = rspamd_util.strequal_caseless(dkim_tld, dmarc_esld)
+          end
 
-          if rspamd_util.strequal_caseless(dkim_tld, dmarc_esld) then
+          if aligned then
             dkim_ok = true
           else
             dkim_violated = "DKIM not aligned (relaxed)"
@@ -382,9 +407,16 @@ local function dmarc_validate_policy(task, policy, hdrfromdom, dmarc_esld)
               dkim_tmpfail = true
             end
           else
-            local dkim_tld = rspamd_util.get_tld(domain)
+            local dkim_esld = dkim_eslds and dkim_eslds[domain]
 
-            if rspamd_util.strequal_caseless(dkim_tld, dmarc_esld) then
+            local aligned
+            if dkim_esld and from_esld then
+              aligned = rspamd_util.strequal_caseless(dkim_esld, from_esld)
+            else
+              local dkim_tld = rspamd_util.get_tld(domain)
+              aligned = rspamd_util.strequal_caseless(dkim_tld, dmarc_esld)
+            end
+            if aligned then
               dkim_tmpfail = true
             end
           end
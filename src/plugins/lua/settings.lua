@@ -97,20 +97,44 @@ end
 
 -- Checks for overridden settings within query params and returns 'true' if
 -- settings are overridden
+-- Memoized parsed settings headers (bounded)
+local query_settings_cache = {}
+local query_settings_cache_size = 0
+
 local function check_query_settings(task)
   -- Try 'settings' attribute
   local settings_id = task:get_settings_id()
   local query_set = task:get_request_header('settings')
   if query_set then
+    local raw_set = tostring(query_set)
+    -- Identical settings are passed on every scan call by API users, so
+    -- memoize the parsed objects to avoid a ucl parse per message
+    local cached = query_settings_cache[raw_set]
+
+    if cached then
+      if settings_id then
+        rspamd_logger.warnx(task, "both settings-id '%s' and settings headers are presented, ignore settings-id; ",
+            tostring(settings_id))
+      end
+      apply_settings(task, cached, nil)
+
+      return true
+    end
 
     local parser = ucl.parser()
-    local res,err = parser:parse_string(tostring(query_set))
+    local res,err = parser:parse_string(raw_set)
     if res then
       if settings_id then
         rspamd_logger.warnx(task, "both settings-id '%s' and settings headers are presented, ignore settings-id; ",
             tostring(settings_id))
       end
       local settings_obj = parser:get_object()
+
+      if query_settings_cache_size < 100 then
+        query_settings_cache[raw_set] = settings_obj
+        query_settings_cache_size = query_settings_cache_size + 1
+      end
+
       apply_settings(task, settings_obj, nil)
 
       return true
@@ -84,6 +84,9 @@ local function cache_url(task, orig_url, url, key, param)
     adjust_url(task, orig_url, url)
   end
 
+  -- Publish to the in-memory cache shared by all workers
+  rspamd_url.redirector_cache_set(str_orig_url, str_url, settings.expire)
+
   local function redis_trim_cb(err, _)
     if err then
       rspamd_logger.errx(task, 'got error while getting top urls count: %s', err)
@@ -160,6 +163,18 @@ end
 -- Orig url is the original url object
 -- url should be a new url object...
 local function resolve_cached(task, orig_url, url, key, ntries)
+  -- Shared memory cache first: no redis round trip if any worker has
+  -- already resolved this url
+  local shm_cached = rspamd_url.redirector_cache_get(tostring(orig_url))
+  if shm_cached then
+    lua_util.debugm(N, task, 'found shm cached redirect from %s to %s',
+      orig_url, shm_cached)
+    if shm_cached ~= tostring(orig_url) then
+      adjust_url(task, orig_url, shm_cached)
+    end
+    return
+  end
+
   local function resolve_url()
     if ntries > settings.nested_limit then
       -- We cannot resolve more, stop
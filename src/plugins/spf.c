@@ -663,11 +663,20 @@ spf_symbol_callback (struct rspamd_task *task,
 		if (spf_module_ctx->spf_hash &&
 				(l = rspamd_lru_hash_lookup (spf_module_ctx->spf_hash, domain,
 					task->task_timestamp)) != NULL) {
+			if (task->worker) {
+				__atomic_add_fetch (&task->worker->srv->stat->spf_cache_hits,
+						1, __ATOMIC_RELAXED);
+			}
+
 			spf_record_ref (l);
 			spf_check_list (l, task, TRUE);
 			spf_record_unref (l);
 		}
 		else {
+			if (task->worker) {
+				__atomic_add_fetch (&task->worker->srv->stat->spf_cache_misses,
+						1, __ATOMIC_RELAXED);
+			}
 
 			if (!rspamd_spf_resolve (task, spf_plugin_callback, item)) {
 				msg_info_task ("cannot make spf request for %s", domain);
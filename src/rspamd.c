@@ -970,6 +970,10 @@ rspamd_term_handler (struct ev_loop *loop, ev_signal *w, int revents)
 			/* Special case if we are likely running with valgrind */
 			term_attempts = TERMINATION_ATTEMPTS * 10;
 		}
+		else if (rspamd_main->cfg && rspamd_main->cfg->soft_shutdown_time > 0) {
+			/* The finale timer ticks five times per second */
+			term_attempts = rspamd_main->cfg->soft_shutdown_time * 5;
+		}
 		else {
 			term_attempts = TERMINATION_ATTEMPTS;
 		}
@@ -1004,18 +1008,28 @@ rspamd_stat_update_handler (struct ev_loop *loop, ev_timer *w, int revents)
 
 	memcpy (&cur_stat, rspamd_main->stat, sizeof (cur_stat));
 
-	if (old_stat.messages_scanned > 0 &&
-		cur_stat.messages_scanned > old_stat.messages_scanned) {
-		gdouble rate = (double)(cur_stat.messages_scanned - old_stat.messages_scanned) /
+	guint64 old_scanned = rspamd_striped_counter_read (&old_stat.messages_scanned);
+	guint64 cur_scanned = rspamd_striped_counter_read (&cur_stat.messages_scanned);
+
+	if (old_scanned > 0 && cur_scanned > old_scanned) {
+		gdouble rate = (double)(cur_scanned - old_scanned) /
 				w->repeat;
-		gdouble old_spam = old_stat.actions_stat[METRIC_ACTION_REJECT] +
-				old_stat.actions_stat[METRIC_ACTION_ADD_HEADER] +
-				old_stat.actions_stat[METRIC_ACTION_REWRITE_SUBJECT];
-		gdouble old_ham = old_stat.actions_stat[METRIC_ACTION_NOACTION];
-		gdouble new_spam = cur_stat.actions_stat[METRIC_ACTION_REJECT] +
-				cur_stat.actions_stat[METRIC_ACTION_ADD_HEADER] +
-				cur_stat.actions_stat[METRIC_ACTION_REWRITE_SUBJECT];
-		gdouble new_ham = cur_stat.actions_stat[METRIC_ACTION_NOACTION];
+		gdouble old_spam = rspamd_striped_counter_read (
+				&old_stat.actions_stat[METRIC_ACTION_REJECT]) +
+				rspamd_striped_counter_read (
+				&old_stat.actions_stat[METRIC_ACTION_ADD_HEADER]) +
+				rspamd_striped_counter_read (
+				&old_stat.actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
+		gdouble old_ham = rspamd_striped_counter_read (
+				&old_stat.actions_stat[METRIC_ACTION_NOACTION]);
+		gdouble new_spam = rspamd_striped_counter_read (
+				&cur_stat.actions_stat[METRIC_ACTION_REJECT]) +
+				rspamd_striped_counter_read (
+				&cur_stat.actions_stat[METRIC_ACTION_ADD_HEADER]) +
+				rspamd_striped_counter_read (
+				&cur_stat.actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
+		gdouble new_ham = rspamd_striped_counter_read (
+				&cur_stat.actions_stat[METRIC_ACTION_NOACTION]);
 
 		rspamd_snprintf (proctitle, sizeof (proctitle),
 				"main process; %.1f msg/sec, %.1f msg/sec spam, %.1f msg/sec ham",
@@ -1118,6 +1132,12 @@ rspamd_cld_handler (EV_P_ ev_child *w, struct rspamd_main *rspamd_main,
 				wrk->pid);
 	}
 
+	if (wrk->load_slot >= 0 && rspamd_main->workers_load) {
+		/* Release the shared load slot */
+		memset (&rspamd_main->workers_load[wrk->load_slot], 0,
+				sizeof (rspamd_main->workers_load[0]));
+	}
+
 	REF_RELEASE (wrk->cf);
 	g_free (wrk);
 }
@@ -1196,6 +1216,9 @@ main (gint argc, gchar **argv, gchar **env)
 			"main");
 	rspamd_main->stat = rspamd_mempool_alloc0_shared (rspamd_main->server_pool,
 			sizeof (struct rspamd_stat));
+	rspamd_main->workers_load = rspamd_mempool_alloc0_shared (
+			rspamd_main->server_pool,
+			sizeof (struct rspamd_worker_load_elt) * RSPAMD_WORKERS_LOAD_MAX);
 	rspamd_main->cfg = rspamd_config_new (RSPAMD_CONFIG_INIT_DEFAULT);
 	rspamd_main->spairs = g_hash_table_new_full (rspamd_spair_hash,
 			rspamd_spair_equal, g_free, rspamd_spair_close);
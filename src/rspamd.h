@@ -25,6 +25,7 @@
 #include "libutil/http_connection.h"
 #include "libutil/upstream.h"
 #include "libutil/radix.h"
+#include "libutil/striped_counter.h"
 #include "libserver/cfg_file.h"
 #include "libserver/url.h"
 #include "libserver/protocol.h"
@@ -89,6 +90,7 @@ struct rspamd_worker {
 	pid_t pid;                      /**< pid of worker									*/
 	pid_t ppid;                     /**< pid of parent									*/
 	guint index;                    /**< index number									*/
+	gint load_slot;                 /**< slot in the shared load board or -1			*/
 	guint nconns;                   /**< current connections count						*/
 	gboolean wanna_die;             /**< worker is terminating							*/
 	gboolean cores_throttled;       /**< set to true if cores throttling took place		*/
@@ -276,15 +278,51 @@ struct rspamd_dns_resolver;
 struct rspamd_task;
 struct rspamd_cryptobox_library_ctx;
 
+/*
+ * Stage attributed scan latency histograms: every task records coarse
+ * watermarks on stage transitions and folds the durations in here at
+ * completion; the controller exports them in Prometheus text format
+ */
+#define RSPAMD_STAGE_HIST_STAGES 8
+#define RSPAMD_STAGE_HIST_BUCKETS 16
+
+struct rspamd_stage_histogram {
+	guint64 buckets[RSPAMD_STAGE_HIST_BUCKETS];
+	guint64 count;
+	guint64 sum_usec;
+};
+
+extern const gchar *rspamd_stage_wm_names[RSPAMD_STAGE_HIST_STAGES];
+extern const gdouble rspamd_stage_hist_bounds[RSPAMD_STAGE_HIST_BUCKETS - 1];
+
 /**
  * Server statistics
  */
 struct rspamd_stat {
-	guint messages_scanned;                             /**< total number of messages scanned				*/
-	guint actions_stat[METRIC_ACTION_MAX];              /**< statistic for each action						*/
+	struct rspamd_striped_counter messages_scanned;     /**< total number of messages scanned				*/
+	struct rspamd_striped_counter actions_stat[METRIC_ACTION_MAX]; /**< statistic for each action			*/
 	guint connections_count;                            /**< total connections count						*/
 	guint control_connections_count;                    /**< connections count to control interface			*/
 	guint messages_learned;                             /**< messages learned								*/
+	guint64 dns_cache_hits;                             /**< dns cache hits									*/
+	guint64 dns_cache_misses;                           /**< dns cache misses								*/
+	guint64 spf_cache_hits;                             /**< spf records cache hits							*/
+	guint64 spf_cache_misses;                           /**< spf records cache misses						*/
+	guint64 dns_requests_coalesced;                     /**< dns requests merged with identical in-flight ones	*/
+	struct rspamd_stage_histogram stage_hist[RSPAMD_STAGE_HIST_STAGES]; /**< stage latency histograms	*/
+};
+
+/**
+ * Shared (between all processes) board of per-worker load, used to shed
+ * new connections from overloaded workers to idle siblings listening on
+ * the same sockets. Elements are cache line sized to avoid false sharing.
+ */
+#define RSPAMD_WORKERS_LOAD_MAX 512
+
+struct rspamd_worker_load_elt {
+	guint32 type;                   /**< worker type quark or 0 if the slot is free		*/
+	guint inflight;                 /**< tasks currently processed, updated atomically	*/
+	guchar pad[56];
 };
 
 /**
@@ -297,6 +335,7 @@ struct rspamd_main {
 	rspamd_pidfh_t *pfh;                                        /**< struct pidfh for pidfile						*/
 	GQuark type;                                                /**< process type									*/
 	struct rspamd_stat *stat;                                   /**< pointer to statistics							*/
+	struct rspamd_worker_load_elt *workers_load;                /**< shared per-worker load board					*/
 
 	rspamd_mempool_t *server_pool;                              /**< server's memory pool							*/
 	rspamd_mempool_mutex_t *start_mtx;                          /**< server is starting up							*/
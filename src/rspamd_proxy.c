@@ -1079,20 +1079,25 @@ proxy_request_compress (struct rspamd_http_message *msg)
 			return;
 		}
 
+		/* The context is costly to create, reuse one per process */
+		static ZSTD_CCtx *zctx_cached = NULL;
+
+		if (zctx_cached == NULL) {
+			zctx_cached = ZSTD_createCCtx ();
+		}
+
+		zctx = zctx_cached;
 		body = rspamd_fstring_sized_new (ZSTD_compressBound (inlen));
-		zctx = ZSTD_createCCtx ();
 		body->len = ZSTD_compressCCtx (zctx, body->str, body->allocated,
 				in, inlen, 1);
 
 		if (ZSTD_isError (body->len)) {
 			msg_err ("compression error");
 			rspamd_fstring_free (body);
-			ZSTD_freeCCtx (zctx);
 
 			return;
 		}
 
-		ZSTD_freeCCtx (zctx);
 		rspamd_http_message_set_body_from_fstring_steal (msg, body);
 		rspamd_http_message_add_header (msg, COMPRESSION_HEADER, "zstd");
 	}
@@ -1348,6 +1353,15 @@ proxy_open_mirror_connections (struct rspamd_proxy_session *session)
 
 	coin = rspamd_random_double ();
 
+	if (session->ctx->mirrors->len > 0 && session->client_message) {
+		/*
+		 * Share one refcounted body buffer between the master message and
+		 * all mirror copies instead of duplicating it per mirror; no-op
+		 * for shmem or externally referenced bodies
+		 */
+		rspamd_http_message_body_to_shared (session->client_message);
+	}
+
 	for (i = 0; i < session->ctx->mirrors->len; i ++) {
 		m = g_ptr_array_index (session->ctx->mirrors, i);
 
@@ -1429,8 +1443,9 @@ proxy_open_mirror_connections (struct rspamd_proxy_session *session)
 		}
 		else {
 			if (session->fname) {
-				msg->flags &= ~RSPAMD_HTTP_FLAG_SHMEM;
-				rspamd_http_message_set_body (msg, session->map, session->map_len);
+				/* Reference the mmapped input directly, avoid copying */
+				rspamd_http_message_set_body_external (msg, session->map,
+						session->map_len);
 			}
 
 			msg->method = HTTP_POST;
@@ -1772,6 +1787,12 @@ rspamd_proxy_self_scan (struct rspamd_proxy_session *session)
 				msg_err_task ("cannot load message: %e", task->err);
 				task->flags |= RSPAMD_TASK_FLAG_SKIP;
 			}
+			else if (session->client_milter_conn != NULL &&
+					session->client_milter_conn->body_stream != NULL) {
+				/* Use the prefilter results gathered during receive */
+				rspamd_re_cache_stream_attach (task,
+						session->client_milter_conn->body_stream);
+			}
 		}
 	}
 
@@ -1920,8 +1941,8 @@ retry:
 		}
 		else {
 			if (session->fname) {
-				msg->flags &= ~RSPAMD_HTTP_FLAG_SHMEM;
-				rspamd_http_message_set_body (msg,
+				/* Reference the mmapped input directly, avoid copying */
+				rspamd_http_message_set_body_external (msg,
 						session->map, session->map_len);
 			}
 
@@ -2224,6 +2245,7 @@ start_rspamd_proxy (struct rspamd_worker *worker)
 	ctx->resolver = rspamd_dns_resolver_init (worker->srv->logger,
 			ctx->event_loop,
 			worker->srv->cfg);
+	rspamd_dns_resolver_attach_stat (ctx->resolver, worker->srv->stat);
 	rspamd_map_watch (worker->srv->cfg, ctx->event_loop, ctx->resolver, worker, 0);
 
 	rspamd_upstreams_library_config (worker->srv->cfg, ctx->cfg->ups_ctx,
@@ -2240,6 +2262,8 @@ start_rspamd_proxy (struct rspamd_worker *worker)
 		rspamd_worker_init_scanner (worker, ctx->event_loop, ctx->resolver,
 				&ctx->lang_det);
 
+		/* Prefilter rawbody regexps while milter chunks are received */
+		rspamd_milter_set_re_cache (ctx->cfg->re_cache);
 	}
 
 	if (worker->srv->cfg->enable_sessions_cache) {
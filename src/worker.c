@@ -288,10 +288,17 @@ rspamd_worker_body_handler (struct rspamd_http_connection *conn,
 		ev_timer_start (task->event_loop, &task->timeout_ev);
 	}
 
-	/* Set socket guard */
-	task->guard_ev.data = task;
-	ev_io_init (&task->guard_ev, rspamd_worker_guard_handler, task->sock, EV_READ);
-	ev_io_start (task->event_loop, &task->guard_ev);
+	/*
+	 * Set socket guard; for keep-alive connections the client may
+	 * legitimately pipeline the next request while this one is being
+	 * processed, so the guard (which reads and discards) must stay off
+	 */
+	if (!(task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE)) {
+		task->guard_ev.data = task;
+		ev_io_init (&task->guard_ev, rspamd_worker_guard_handler, task->sock,
+				EV_READ);
+		ev_io_start (task->event_loop, &task->guard_ev);
+	}
 
 	rspamd_task_process (task, RSPAMD_TASK_PROCESS_ALL);
 
@@ -341,6 +348,75 @@ rspamd_worker_error_handler (struct rspamd_http_connection *conn, GError *err)
 	}
 }
 
+static gint rspamd_worker_finish_handler (struct rspamd_http_connection *conn,
+	struct rspamd_http_message *msg);
+
+/*
+ * The client negotiated keep-alive and the reply has been sent: spawn a
+ * fresh task reading the next (possibly already pipelined) request from
+ * a duplicated descriptor, before the finished task closes its own
+ */
+static void
+rspamd_worker_keep_alive_continue (struct rspamd_task *task)
+{
+	struct rspamd_worker *worker = task->worker;
+	struct rspamd_worker_ctx *ctx = (struct rspamd_worker_ctx *)worker->ctx;
+	struct rspamd_task *ntask;
+	rspamd_inet_addr_t *addr;
+	gint nfd;
+
+	nfd = dup (task->sock);
+
+	if (nfd == -1) {
+		msg_warn_task ("cannot continue keep-alive connection: dup failed: %s",
+				strerror (errno));
+
+		return;
+	}
+
+	addr = rspamd_inet_address_copy (task->client_addr);
+	ntask = rspamd_task_new (worker, ctx->cfg, NULL, ctx->lang_det,
+			ctx->event_loop);
+
+	if (ctx->is_mime) {
+		ntask->flags |= RSPAMD_TASK_FLAG_MIME;
+	}
+	else {
+		ntask->flags &= ~RSPAMD_TASK_FLAG_MIME;
+	}
+
+	ntask->sock = nfd;
+	ntask->client_addr = addr;
+	ntask->resolver = ctx->resolver;
+	ntask->flags |= RSPAMD_TASK_FLAG_LEARN_AUTO;
+
+	msg_debug_task ("continue keep-alive connection from %s, task ptr: %p",
+			rspamd_inet_address_to_string (addr), ntask);
+
+	ntask->http_conn = rspamd_http_connection_new_server (
+			ctx->http_ctx,
+			nfd,
+			rspamd_worker_body_handler,
+			rspamd_worker_error_handler,
+			rspamd_worker_finish_handler,
+			0);
+	rspamd_http_connection_set_max_size (ntask->http_conn,
+			ntask->cfg->max_message);
+	worker->nconns++;
+	rspamd_mempool_add_destructor (ntask->task_pool,
+			(rspamd_mempool_destruct_t)reduce_tasks_count, worker);
+
+	ntask->s = rspamd_session_create (ntask->task_pool, rspamd_task_fin,
+			rspamd_task_restore, (event_finalizer_t)rspamd_task_free, ntask);
+
+	if (ctx->key) {
+		rspamd_http_connection_set_key (ntask->http_conn, ctx->key);
+	}
+
+	rspamd_http_connection_read_message (ntask->http_conn, ntask,
+			ctx->timeout);
+}
+
 static gint
 rspamd_worker_finish_handler (struct rspamd_http_connection *conn,
 	struct rspamd_http_message *msg)
@@ -351,6 +427,11 @@ rspamd_worker_finish_handler (struct rspamd_http_connection *conn,
 		/* We are done here */
 		msg_debug_task ("normally closing connection from: %s",
 			rspamd_inet_address_to_string (task->client_addr));
+
+		if (task->protocol_flags & RSPAMD_TASK_PROTOCOL_FLAG_KEEPALIVE) {
+			rspamd_worker_keep_alive_continue (task);
+		}
+
 		rspamd_session_destroy (task->s);
 	}
 	else if (task->processed_stages & RSPAMD_TASK_STAGE_DONE) {
@@ -392,8 +473,47 @@ accept_socket (EV_P_ ev_io *w, int revents)
 		return;
 	}
 
+	if (rspamd_worker_load_is_overloaded (worker)) {
+		/*
+		 * This worker has substantially more tasks inflight than some idle
+		 * sibling: pause accepting for a while, so further accept races on
+		 * the shared sockets are won by less loaded processes
+		 */
+		msg_debug ("shed new connections: worker is overloaded "
+				"compared to its siblings");
+		rspamd_worker_throttle_accept_events (nfd, worker->accept_events);
+	}
+
 	task = rspamd_task_new (worker, ctx->cfg, NULL, ctx->lang_det, ctx->event_loop);
 
+	if (ctx->shed_tasks_watermark > 0 &&
+		worker->nconns > ctx->shed_tasks_watermark) {
+		/*
+		 * Graceful degradation: above the watermark it is better to shed
+		 * new tasks with a soft reject (the MTA retries later) than to
+		 * slow every task down uniformly and miss all deadlines
+		 */
+		struct rspamd_action *soft_reject;
+
+		msg_info_task ("%d tasks are already processed, shed the new task "
+				"with a soft reject", worker->nconns);
+		rspamd_create_metric_result (task);
+		soft_reject = rspamd_config_get_action_by_type (task->cfg,
+				METRIC_ACTION_SOFT_REJECT);
+
+		if (soft_reject) {
+			rspamd_add_passthrough_result (task,
+					soft_reject,
+					RSPAMD_PASSTHROUGH_CRITICAL,
+					NAN,
+					"worker is overloaded",
+					"shed_tasks_watermark",
+					0);
+		}
+
+		task->flags |= RSPAMD_TASK_FLAG_SKIP;
+	}
+
 	msg_info_task ("accepted connection from %s port %d, task ptr: %p",
 		rspamd_inet_address_to_string (addr),
 		rspamd_inet_address_get_port (addr),
@@ -410,7 +530,13 @@ accept_socket (EV_P_ ev_io *w, int revents)
 	task->sock = nfd;
 	task->client_addr = addr;
 
+	/* The counter page is shared between all workers */
+#ifndef HAVE_ATOMIC_BUILTINS
 	worker->srv->stat->connections_count++;
+#else
+	__atomic_add_fetch (&worker->srv->stat->connections_count, 1,
+			__ATOMIC_RELAXED);
+#endif
 	task->resolver = ctx->resolver;
 	/* TODO: allow to disable autolearn in protocol */
 	task->flags |= RSPAMD_TASK_FLAG_LEARN_AUTO;
@@ -583,6 +709,17 @@ init_worker (struct rspamd_config *cfg)
 			RSPAMD_CL_FLAG_INT_32,
 			"Maximum count of parallel tasks processed by a single worker process");
 
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"shed_tasks_watermark",
+			rspamd_rcl_parse_struct_integer,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_worker_ctx,
+						shed_tasks_watermark),
+			RSPAMD_CL_FLAG_INT_32,
+			"Soft reject new tasks above this number of parallel tasks "
+			"instead of slowing everything down uniformly (0 = disabled)");
+
 	rspamd_rcl_register_worker_option (cfg,
 			type,
 			"keypair",
@@ -662,6 +799,7 @@ start_worker (struct rspamd_worker *worker)
 	ctx->resolver = rspamd_dns_resolver_init (worker->srv->logger,
 			ctx->event_loop,
 			worker->srv->cfg);
+	rspamd_dns_resolver_attach_stat (ctx->resolver, worker->srv->stat);
 	rspamd_map_watch (worker->srv->cfg, ctx->event_loop, ctx->resolver, worker, 0);
 	rspamd_upstreams_library_config (worker->srv->cfg, ctx->cfg->ups_ctx,
 			ctx->event_loop, ctx->resolver->r);
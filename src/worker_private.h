@@ -47,6 +47,8 @@ struct rspamd_worker_ctx {
 	gboolean encrypted_only;
 	/* Limit of tasks */
 	guint32 max_tasks;
+	/* Start shedding work above this number of parallel tasks, 0 = off */
+	guint32 shed_tasks_watermark;
 	/* Maximum time for task processing */
 	ev_tstamp task_timeout;
 	/* Encryption key */
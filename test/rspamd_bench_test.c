@@ -0,0 +1,135 @@
+/* Benchmark of the scan hot path components: mime decoding kernels and
+ * shingles computation, runnable in-process without sockets or config.
+ * Timings are printed via the logger, so baselines can be collected from
+ * the test output in CI.
+ */
+
+#include "config.h"
+#include "rspamd.h"
+#include "util.h"
+#include "cryptobox.h"
+#include "shingles.h"
+#include "tests.h"
+#include "contrib/libottery/ottery.h"
+
+static gsize
+rspamd_bench_fill_qp (gchar *buf, gsize len)
+{
+	gsize i, o = 0, line = 0;
+
+	for (i = 0; o + 4 < len && i < len; i++) {
+		guchar c = ottery_rand_uint32 () & 0xff;
+
+		if (c > 0x20 && c < 0x7f && c != '=') {
+			buf[o++] = c;
+		}
+		else {
+			o += rspamd_snprintf (buf + o, len - o, "=%02X", c);
+		}
+
+		if (++line >= 76) {
+			buf[o++] = '\r';
+			buf[o++] = '\n';
+			line = 0;
+		}
+	}
+
+	return o;
+}
+
+void
+rspamd_bench_test_func (void)
+{
+	const gsize buflen = 4 * 1024 * 1024;
+	const guint iters = 20;
+	gchar *in, *out;
+	gsize inlen, outlen, b64len;
+	gdouble t1, t2;
+	guint i;
+
+	in = g_malloc (buflen * 2);
+	out = g_malloc (buflen * 2);
+
+	/* Quoted-printable decoding */
+	inlen = rspamd_bench_fill_qp (in, buflen);
+	t1 = rspamd_get_ticks (FALSE);
+
+	for (i = 0; i < iters; i++) {
+		g_assert (rspamd_decode_qp_buf (in, inlen, out, buflen * 2) != -1);
+	}
+
+	t2 = rspamd_get_ticks (FALSE);
+	msg_info ("qp decode: %.2f MB/sec",
+			(inlen * iters) / (t2 - t1) / (1024.0 * 1024.0));
+
+	/* Base64 decoding with MIME folding */
+	gchar *b64;
+
+	ottery_rand_bytes (out, buflen / 2);
+	b64 = rspamd_encode_base64_fold (out, buflen / 2, 76, &b64len,
+			RSPAMD_TASK_NEWLINES_CRLF);
+	t1 = rspamd_get_ticks (FALSE);
+
+	for (i = 0; i < iters; i++) {
+		outlen = buflen * 2;
+		g_assert (rspamd_cryptobox_base64_decode (b64, b64len,
+				out, &outlen));
+	}
+
+	t2 = rspamd_get_ticks (FALSE);
+	msg_info ("base64 decode (folded): %.2f MB/sec",
+			(b64len * iters) / (t2 - t1) / (1024.0 * 1024.0));
+	g_free (b64);
+
+	/* Shingles over synthetic words */
+	const guint nwords = 10000;
+	GArray *words;
+	rspamd_stat_token_t tok;
+	guchar key[16];
+	struct rspamd_shingle *sgl;
+	rspamd_ftok_t *copies;
+
+	memset (&tok, 0, sizeof (tok));
+	ottery_rand_bytes (key, sizeof (key));
+	words = g_array_sized_new (FALSE, TRUE, sizeof (tok), nwords);
+	copies = g_malloc (sizeof (*copies) * nwords);
+
+	for (i = 0; i < nwords; i++) {
+		gsize wlen = 3 + ottery_rand_range (8);
+		gchar *w = g_malloc (wlen);
+		gsize j;
+
+		for (j = 0; j < wlen; j++) {
+			w[j] = 'a' + ottery_rand_range ('z' - 'a');
+		}
+
+		copies[i].begin = w;
+		copies[i].len = wlen;
+		tok.stemmed.begin = w;
+		tok.stemmed.len = wlen;
+		tok.flags = RSPAMD_STAT_TOKEN_FLAG_TEXT;
+		g_array_append_val (words, tok);
+	}
+
+	t1 = rspamd_get_ticks (FALSE);
+
+	for (i = 0; i < iters; i++) {
+		sgl = rspamd_shingles_from_text (words, key, NULL,
+				rspamd_shingles_default_filter, NULL,
+				RSPAMD_SHINGLES_MUMHASH);
+		g_assert (sgl != NULL);
+		g_free (sgl);
+	}
+
+	t2 = rspamd_get_ticks (FALSE);
+	msg_info ("shingles: %.2f kwords/sec",
+			(nwords * iters) / (t2 - t1) / 1024.0);
+
+	for (i = 0; i < nwords; i++) {
+		g_free ((gpointer)copies[i].begin);
+	}
+
+	g_free (copies);
+	g_array_free (words, TRUE);
+	g_free (out);
+}
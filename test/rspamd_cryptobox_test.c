@@ -19,8 +19,79 @@
 #include "fstring.h"
 #include "ottery.h"
 #include "cryptobox.h"
+#include "libcryptobox/base32/base32.h"
+#include "libserver/dkim.h"
 #include "unix-std.h"
 
+/* Reference kernels exported for equivalence testing */
+gssize base32_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+gssize hex_encode_ref (const guchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+
+/*
+ * Plain transcription of relaxed header canonicalization (lowercase the
+ * name, squeeze whitespace runs in the value), used as the model the
+ * vectorized kernel must match byte for byte
+ */
+static goffset
+test_canon_relaxed_model (const gchar *hname, const gchar *hvalue,
+		gchar *out, gsize outlen)
+{
+	gchar *t = out;
+	const guchar *h = (const guchar *)hname;
+	gboolean got_sp = FALSE;
+
+	while (*h && t - out < outlen) {
+		*t++ = g_ascii_tolower (*h++);
+	}
+
+	if (t - out >= outlen) {
+		return -1;
+	}
+
+	*t++ = ':';
+	h = (const guchar *)hvalue;
+
+	while (g_ascii_isspace (*h)) {
+		h++;
+	}
+
+	while (*h && (t - out < outlen)) {
+		if (g_ascii_isspace (*h)) {
+			if (got_sp) {
+				h++;
+				continue;
+			}
+			else {
+				got_sp = TRUE;
+				*t++ = ' ';
+				h++;
+				continue;
+			}
+		}
+		else {
+			got_sp = FALSE;
+		}
+
+		*t++ = *h++;
+	}
+
+	if (g_ascii_isspace (*(t - 1))) {
+		t--;
+	}
+
+	if (t - out >= outlen - 2) {
+		return -1;
+	}
+
+	*t++ = '\r';
+	*t++ = '\n';
+	*t = '\0';
+
+	return t - out;
+}
+
 static const int mapping_size = 64 * 8192 + 1;
 static const int max_seg = 32;
 static const int random_fuzz_cnt = 10000;
@@ -345,4 +416,107 @@ start:
 		mode = RSPAMD_CRYPTOBOX_MODE_NIST;
 		goto start;
 	}
+
+	/* Short keys hashing microbenchmark: inline path vs generic one */
+	static const gsize short_key_lens[] = {8, 16, 32, 64};
+	const gint hash_iters = 1000000;
+	guchar keybuf[64];
+	guint64 acc = 0;
+
+	ottery_rand_bytes (keybuf, sizeof (keybuf));
+
+	for (i = 0; i < (gint)G_N_ELEMENTS (short_key_lens); i ++) {
+		gsize klen = short_key_lens[i];
+		gint j;
+
+		for (j = 0; j < hash_iters; j ++) {
+			g_assert (rspamd_cryptobox_fast_hash_short (keybuf, klen, j) ==
+					rspamd_cryptobox_fast_hash (keybuf, klen, j));
+		}
+
+		t1 = rspamd_get_ticks (TRUE);
+		for (j = 0; j < hash_iters; j ++) {
+			acc ^= rspamd_cryptobox_fast_hash (keybuf, klen, acc);
+		}
+		t2 = rspamd_get_ticks (TRUE);
+		msg_info ("generic fast hash of %z bytes keys: %.0f", klen, t2 - t1);
+
+		t1 = rspamd_get_ticks (TRUE);
+		for (j = 0; j < hash_iters; j ++) {
+			acc ^= rspamd_cryptobox_fast_hash_short (keybuf, klen, acc);
+		}
+		t2 = rspamd_get_ticks (TRUE);
+		msg_info ("short fast hash of %z bytes keys: %.0f", klen, t2 - t1);
+	}
+
+	g_assert (acc != 0);
+
+	/* Base32/hex encode kernels: reference vs the runtime selected one */
+	{
+		guchar inb[512];
+		gchar o_ref[1024], o_opt[1024];
+		gssize r_ref, r_opt;
+		gsize ilen;
+		gint j;
+
+		for (j = 0; j < random_fuzz_cnt; j ++) {
+			ilen = ottery_rand_range (sizeof (inb) - 1) + 1;
+			ottery_rand_bytes (inb, ilen);
+
+			r_ref = base32_encode_ref (inb, ilen, o_ref, sizeof (o_ref));
+			r_opt = base32_encode (inb, ilen, o_opt, sizeof (o_opt));
+			g_assert (r_ref > 0);
+			g_assert (r_ref == r_opt);
+			g_assert (memcmp (o_ref, o_opt, r_ref) == 0);
+
+			r_ref = hex_encode_ref (inb, ilen, o_ref, sizeof (o_ref));
+			r_opt = hex_encode (inb, ilen, o_opt, sizeof (o_opt));
+			g_assert (r_ref == (gssize)(ilen * 2));
+			g_assert (r_ref == r_opt);
+			g_assert (memcmp (o_ref, o_opt, r_ref) == 0);
+		}
+	}
+
+	/* Relaxed dkim header canonicalization kernel vs the scalar model */
+	{
+		static const gchar name_alpha[] =
+				"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_0123456789";
+		static const gchar val_alpha[] =
+				"aBcDeF Gh\tIj\r\nKl  mN\x80\xff.:=%~0123456789";
+		gchar hname[65], hvalue[257];
+		gchar o_model[512], o_kern[512];
+		goffset r_model, r_kern;
+		gsize nlen, vlen, outlen, k;
+		gint j;
+
+		for (j = 0; j < random_fuzz_cnt; j ++) {
+			nlen = ottery_rand_range (sizeof (hname) - 2) + 1;
+			vlen = ottery_rand_range (sizeof (hvalue) - 1);
+
+			for (k = 0; k < nlen; k ++) {
+				hname[k] = name_alpha[ottery_rand_range (
+						sizeof (name_alpha) - 2)];
+			}
+			hname[nlen] = '\0';
+
+			for (k = 0; k < vlen; k ++) {
+				hvalue[k] = val_alpha[ottery_rand_range (
+						sizeof (val_alpha) - 2)];
+			}
+			hvalue[vlen] = '\0';
+
+			outlen = strlen (hname) + strlen (hvalue) + sizeof (":" CRLF);
+			g_assert (outlen <= sizeof (o_model));
+
+			r_model = test_canon_relaxed_model (hname, hvalue, o_model,
+					outlen);
+			r_kern = rspamd_dkim_canonize_header_relaxed_str (hname, hvalue,
+					o_kern, outlen);
+			g_assert (r_model == r_kern);
+
+			if (r_model > 0) {
+				g_assert (memcmp (o_model, o_kern, r_model) == 0);
+			}
+		}
+	}
 }
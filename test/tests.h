@@ -36,6 +36,8 @@ void rspamd_shingles_test_func (void);
 
 void rspamd_http_test_func (void);
 
+void rspamd_bench_test_func (void);
+
 void rspamd_lua_test_func (void);
 
 void rspamd_cryptobox_test_func (void);